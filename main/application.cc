@@ -5,12 +5,14 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#include "websocket_udp_protocol.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
 #include "assets.h"
 #include "settings.h"
 
 #include <cstring>
+#include <algorithm>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
@@ -59,6 +61,18 @@ Application::Application() {
         .skip_unhandled_events = true
     };
     esp_timer_create(&clock_timer_args, &clock_timer_handle_);
+
+    esp_timer_create_args_t chat_text_timer_args = {
+        .callback = [](void* arg) {
+            Application* app = (Application*)arg;
+            xEventGroupSetBits(app->event_group_, MAIN_EVENT_CHAT_TEXT);
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "chat_text_timer",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&chat_text_timer_args, &chat_text_timer_handle_);
 }
 
 Application::~Application() {
@@ -66,6 +80,10 @@ Application::~Application() {
         esp_timer_stop(clock_timer_handle_);
         esp_timer_delete(clock_timer_handle_);
     }
+    if (chat_text_timer_handle_ != nullptr) {
+        esp_timer_stop(chat_text_timer_handle_);
+        esp_timer_delete(chat_text_timer_handle_);
+    }
     vEventGroupDelete(event_group_);
 }
 
@@ -213,7 +231,7 @@ void Application::ShowActivationCode(const std::string& code, const std::string&
         digit_sound{'9', Lang::Sounds::OGG_9}
     }};
 
-    // This sentence uses 9KB of SRAM, so we need to wait for it to finish
+    // The sounds are queued and played one after another
     Alert(Lang::Strings::ACTIVATION, message.c_str(), "link", Lang::Sounds::OGG_ACTIVATION);
 
     for (const auto& digit : code) {
@@ -266,11 +284,8 @@ void Application::ToggleChatState() {
 
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
+            if (!ConnectAudioChannel()) {
+                return;
             }
 
             SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
@@ -303,11 +318,8 @@ void Application::StartListening() {
     
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
+            if (!ConnectAudioChannel()) {
+                return;
             }
 
             SetListeningMode(kListeningModeManualStop);
@@ -365,6 +377,7 @@ void Application::Start() {
         xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
     };
     callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
+        wake_word_time_us_ = esp_timer_get_time();
         xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
     };
     callbacks.on_vad_change = [this](bool speaking) {
@@ -405,7 +418,11 @@ void Application::Start() {
     if (ota.HasMqttConfig()) {
         protocol_ = std::make_unique<MqttProtocol>();
     } else if (ota.HasWebsocketConfig()) {
+#if CONFIG_WEBSOCKET_UDP_AUDIO
+        protocol_ = std::make_unique<WebsocketUdpProtocol>();
+#else
         protocol_ = std::make_unique<WebsocketProtocol>();
+#endif
     } else {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
@@ -416,16 +433,25 @@ void Application::Start() {
     });
 
     protocol_->OnNetworkError([this](const std::string& message) {
+        if (speculative_connect_) {
+            // Nobody is waiting for the channel yet, the next wake word will try again
+            ESP_LOGW(TAG, "Failed to warm up the audio channel: %s", message.c_str());
+            return;
+        }
         last_error_message_ = message;
         xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
     });
     protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
-        if (device_state_ == kDeviceStateSpeaking) {
-            audio_service_.PushPacketToDecodeQueue(std::move(packet));
+        // The reply audio may arrive before the scheduled switch to the speaking state
+        if (device_state_ == kDeviceStateSpeaking || audio_service_.IsPlaybackTimelineOpen()) {
+            audio_service_.PushPacketToJitterBuffer(std::move(packet));
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
         board.SetPowerSaveMode(false);
+        // The sequence numbers of the new channel start over
+        audio_service_.ResetDecoder();
+        audio_service_.SetUplinkParams(protocol_->uplink_frame_duration(), protocol_->uplink_bitrate());
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
@@ -433,25 +459,36 @@ void Application::Start() {
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
+        // Nobody is waiting for the results of the tool calls any more
+        McpServer::GetInstance().CancelToolCalls();
         Schedule([this]() {
+            RevealChatText(true);
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
+    protocol_->OnIncomingJson([this, display](const JsonMessage& message) {
+        // Dispatch on the hash of the type and confirm the type in the case, only the fields a
+        // handler needs are extracted
+        switch (message.type_hash()) {
+        case JsonTypeHash("tts"): {
+            if (!message.IsType("tts")) {
+                goto unknown_type;
+            }
+            auto state = message.GetStringView("state");
+            if (state == "start") {
+                // Accept the reply audio right away, before the state change below is scheduled
+                audio_service_.OpenPlaybackTimeline();
+                audio_service_.BeginPlaybackSegment();
                 Schedule([this]() {
                     aborted_ = false;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
                         SetDeviceState(kDeviceStateSpeaking);
                     }
                 });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
+            } else if (state == "stop") {
+                audio_service_.EndPlaybackTimeline();
                 Schedule([this]() {
                     if (device_state_ == kDeviceStateSpeaking) {
                         if (listening_mode_ == kListeningModeManualStop) {
@@ -461,71 +498,115 @@ void Application::Start() {
                         }
                     }
                 });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
+            } else if (state == "sentence_start") {
+                uint32_t segment = audio_service_.BeginPlaybackSegment();
+                std::string text;
+                if (message.GetString("text", text)) {
+                    ESP_LOGI(TAG, "<< %s", text.c_str());
+                    Schedule([this, segment, message = std::move(text)]() mutable {
+                        // The text is revealed while the audio of the sentence plays
+                        chat_text_pacer_.Queue(segment, std::move(message), esp_timer_get_time() / 1000);
+                        if (!esp_timer_is_active(chat_text_timer_handle_)) {
+                            esp_timer_start_periodic(chat_text_timer_handle_, CHAT_TEXT_TICK_MS * 1000);
+                        }
                     });
                 }
             }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
+            break;
+        }
+        case JsonTypeHash("stt"): {
+            if (!message.IsType("stt")) {
+                goto unknown_type;
+            }
+            std::string text;
+            if (message.GetString("text", text)) {
+                ESP_LOGI(TAG, ">> %s", text.c_str());
+                Schedule([this, display, message = std::move(text)]() {
+                    RevealChatText(true);
                     display->SetChatMessage("user", message.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
+            break;
+        }
+        case JsonTypeHash("llm"): {
+            if (!message.IsType("llm")) {
+                goto unknown_type;
+            }
+            std::string emotion;
+            if (message.GetString("emotion", emotion)) {
+                Schedule([this, display, emotion_str = std::move(emotion)]() {
                     display->SetEmotion(emotion_str.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
-                McpServer::GetInstance().ParseMessage(payload);
+            break;
+        }
+        case JsonTypeHash("mcp"): {
+            if (!message.IsType("mcp")) {
+                goto unknown_type;
+            }
+            // Only the payload is parsed into a tree, the MCP server reads it directly
+            if (message.IsObject("payload")) {
+                auto payload = message.ParseMember("payload");
+                if (payload != nullptr) {
+                    McpServer::GetInstance().ParseMessage(payload);
+                    cJSON_Delete(payload);
+                }
+            }
+            break;
+        }
+        case JsonTypeHash("system"): {
+            if (!message.IsType("system")) {
+                goto unknown_type;
             }
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (cJSON_IsString(command)) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
+            auto command = message.GetStringView("command");
+            if (!command.empty()) {
+                ESP_LOGI(TAG, "System command: %.*s", (int)command.size(), command.data());
+                if (command == "reboot") {
                     // Do a reboot if user requests a OTA update
                     Schedule([this]() {
                         Reboot();
                     });
                 } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
+                    ESP_LOGW(TAG, "Unknown system command: %.*s", (int)command.size(), command.data());
                 }
             }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::OGG_VIBRATION);
+            break;
+        }
+        case JsonTypeHash("alert"): {
+            if (!message.IsType("alert")) {
+                goto unknown_type;
+            }
+            std::string status, text, emotion;
+            if (message.GetString("status", status) && message.GetString("message", text) && message.GetString("emotion", emotion)) {
+                Alert(status.c_str(), text.c_str(), emotion.c_str(), Lang::Sounds::OGG_VIBRATION);
             } else {
                 ESP_LOGW(TAG, "Alert command requires status, message and emotion");
             }
+            break;
+        }
 #if CONFIG_RECEIVE_CUSTOM_MESSAGE
-        } else if (strcmp(type->valuestring, "custom") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            ESP_LOGI(TAG, "Received custom message: %s", cJSON_PrintUnformatted(root));
-            if (cJSON_IsObject(payload)) {
-                Schedule([this, display, payload_str = std::string(cJSON_PrintUnformatted(payload))]() {
+        case JsonTypeHash("custom"): {
+            if (!message.IsType("custom")) {
+                goto unknown_type;
+            }
+            auto text = message.text();
+            ESP_LOGI(TAG, "Received custom message: %.*s", (int)text.size(), text.data());
+            if (message.IsObject("payload")) {
+                Schedule([this, display, payload_str = std::string(message.GetRaw("payload"))]() {
                     display->SetChatMessage("system", payload_str.c_str());
                 });
             } else {
                 ESP_LOGW(TAG, "Invalid custom message format: missing payload");
             }
+            break;
+        }
 #endif
-        } else {
-            ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+        default:
+        unknown_type: {
+            auto type = message.type();
+            ESP_LOGW(TAG, "Unknown message type: %.*s", (int)type.size(), type.data());
+            break;
+        }
         }
     });
     bool protocol_started = protocol_->Start();
@@ -562,6 +643,7 @@ void Application::MainEventLoop() {
             MAIN_EVENT_WAKE_WORD_DETECTED |
             MAIN_EVENT_VAD_CHANGE |
             MAIN_EVENT_CLOCK_TICK |
+            MAIN_EVENT_CHAT_TEXT |
             MAIN_EVENT_ERROR, pdTRUE, pdFALSE, portMAX_DELAY);
 
         if (bits & MAIN_EVENT_ERROR) {
@@ -571,9 +653,11 @@ void Application::MainEventLoop() {
 
         if (bits & MAIN_EVENT_SEND_AUDIO) {
             while (auto packet = audio_service_.PopPacketFromSendQueue()) {
+                int64_t encoded_time = packet->trace_time;
                 if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
                     break;
                 }
+                audio_service_.GetLatencyTracer().RecordSince(kLatencyStageSend, encoded_time);
             }
         }
 
@@ -597,10 +681,23 @@ void Application::MainEventLoop() {
             }
         }
 
+        if (bits & MAIN_EVENT_CHAT_TEXT) {
+            RevealChatText();
+        }
+
         if (bits & MAIN_EVENT_CLOCK_TICK) {
             clock_ticks_++;
             auto display = Board::GetInstance().GetDisplay();
             display->UpdateStatusBar();
+
+#if CONFIG_AUDIO_CHANNEL_WARM_STANDBY
+            // Give up an idle channel after the standby time, so the device can enter the power save mode
+            if (device_state_ == kDeviceStateIdle && clock_ticks_ >= CONFIG_AUDIO_CHANNEL_STANDBY_SECONDS &&
+                protocol_ && protocol_->IsAudioChannelOpened()) {
+                ESP_LOGI(TAG, "Closing the idle audio channel");
+                protocol_->CloseAudioChannel();
+            }
+#endif
         
             // Print the debug info every 10 seconds
             if (clock_ticks_ % 10 == 0) {
@@ -620,16 +717,36 @@ void Application::OnWakeWordDetected() {
     if (device_state_ == kDeviceStateIdle) {
         audio_service_.EncodeWakeWord();
 
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
+        bool warm = protocol_->IsAudioChannelOpened();
+        if (!warm) {
+#if CONFIG_AUDIO_CHANNEL_WARM_STANDBY
+            // Capture the speech following the wake word while connecting, it is sent once the channel is open
+            audio_service_.EnableVoiceProcessing(true);
+            audio_service_.EnableWakeWordDetection(false);
+            prebuffering_ = true;
+#endif
+            if (!ConnectAudioChannel()) {
+                if (prebuffering_) {
+                    prebuffering_ = false;
+                    audio_service_.EnableVoiceProcessing(false);
+                    audio_service_.ClearSendQueue();
+                }
                 audio_service_.EnableWakeWordDetection(true);
                 return;
             }
         }
 
         auto wake_word = audio_service_.GetLastWakeWord();
-        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+        int64_t wait_us = esp_timer_get_time() - wake_word_time_us_;
+        audio_service_.GetLatencyTracer().Record(kLatencyStageChannelOpen, wait_us);
+        if (warm && connect_time_avg_us_ > 0) {
+            int64_t saved_us = std::max<int64_t>(connect_time_avg_us_ - wait_us, 0);
+            audio_service_.GetLatencyTracer().Record(kLatencyStageChannelSaved, saved_us);
+            ESP_LOGI(TAG, "Wake word detected: %s, channel ready in %lld ms, warm standby saved %lld ms",
+                wake_word.c_str(), wait_us / 1000, saved_us / 1000);
+        } else {
+            ESP_LOGI(TAG, "Wake word detected: %s, channel ready in %lld ms", wake_word.c_str(), wait_us / 1000);
+        }
 #if CONFIG_SEND_WAKE_WORD_DATA
         // Encode and send the wake word data to the server
         while (auto packet = audio_service_.PopWakeWordPacket()) {
@@ -653,11 +770,66 @@ void Application::OnWakeWordDetected() {
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
+    // Drop the audio prefetched for the interrupted reply and close its timeline, so the audio the
+    // server sends before it handles the abort is dropped too, its text is shown at once
+    audio_service_.ResetDecoder();
+    RevealChatText(true);
     if (protocol_) {
         protocol_->SendAbortSpeaking(reason);
     }
 }
 
+// Appends the text the speech has reached, or all of it, the timer stops once everything is shown
+void Application::RevealChatText(bool flush) {
+    auto display = Board::GetInstance().GetDisplay();
+    auto append = [display](const char* chunk, bool start) {
+        display->AppendChatText("assistant", chunk, start);
+    };
+    if (flush) {
+        chat_text_pacer_.Flush(append);
+    } else if (chat_text_pacer_.Tick(audio_service_.GetPlayingSegment(), audio_service_.GetSegmentPlayedMs(),
+            esp_timer_get_time() / 1000, append)) {
+        return;
+    }
+    esp_timer_stop(chat_text_timer_handle_);
+}
+
+// Opens the audio channel if it is not open yet, and keeps the average connect time for the latency report
+bool Application::ConnectAudioChannel(bool speculative) {
+    if (protocol_->IsAudioChannelOpened()) {
+        return true;
+    }
+    if (!speculative) {
+        SetDeviceState(kDeviceStateConnecting);
+    }
+
+    int64_t start_time = esp_timer_get_time();
+    speculative_connect_ = speculative;
+    bool opened = protocol_->OpenAudioChannel();
+    speculative_connect_ = false;
+    if (!opened) {
+        return false;
+    }
+
+    int64_t connect_time = esp_timer_get_time() - start_time;
+    connect_time_avg_us_ = connect_time_avg_us_ == 0 ? connect_time : (connect_time_avg_us_ * 7 + connect_time) / 8;
+    ESP_LOGI(TAG, "Audio channel opened in %lld ms%s", connect_time / 1000, speculative ? " (warm standby)" : "");
+    return true;
+}
+
+void Application::WarmUpAudioChannel() {
+#if CONFIG_AUDIO_CHANNEL_WARM_STANDBY
+    Schedule([this]() {
+        if (device_state_ != kDeviceStateIdle || !protocol_) {
+            return;
+        }
+        // Restart the standby countdown of an open channel
+        clock_ticks_ = 0;
+        ConnectAudioChannel(true);
+    });
+#endif
+}
+
 void Application::SetListeningMode(ListeningMode mode) {
     listening_mode_ = mode;
     SetDeviceState(kDeviceStateListening);
@@ -703,7 +875,11 @@ void Application::SetDeviceState(DeviceState state) {
                 protocol_->SendStartListening(listening_mode_);
                 audio_service_.EnableVoiceProcessing(true);
                 audio_service_.EnableWakeWordDetection(false);
+            } else if (prebuffering_) {
+                // Started while connecting, the buffered audio follows the start listening command
+                protocol_->SendStartListening(listening_mode_);
             }
+            prebuffering_ = false;
             break;
         case kDeviceStateSpeaking:
             display->SetStatus(Lang::Strings::SPEAKING);
@@ -713,7 +889,7 @@ void Application::SetDeviceState(DeviceState state) {
                 // Only AFE wake word can be detected in speaking mode
                 audio_service_.EnableWakeWordDetection(audio_service_.IsAfeWakeWord());
             }
-            audio_service_.ResetDecoder();
+            // Do not reset the decoder here, it would drop the audio prefetched since the tts start
             break;
         default:
             // Do nothing
@@ -761,13 +937,15 @@ bool Application::UpgradeFirmware(Ota& ota, const std::string& url) {
     audio_service_.Stop();
     vTaskDelay(pdMS_TO_TICKS(1000));
 
-    bool upgrade_success = ota.StartUpgradeFromUrl(upgrade_url, [display](int progress, size_t speed) {
+    auto on_progress = [display](int progress, size_t speed) {
         std::thread([display, progress, speed]() {
             char buffer[32];
             snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
             display->SetChatMessage("system", buffer);
         }).detach();
-    });
+    };
+    // The version check may offer a delta patch and a checksum, only for its own firmware URL
+    bool upgrade_success = url.empty() ? ota.StartUpgrade(on_progress) : ota.StartUpgradeFromUrl(upgrade_url, on_progress);
 
     if (!upgrade_success) {
         // Upgrade failed, restart audio service and continue running
@@ -867,6 +1045,13 @@ void Application::SetAecMode(AecMode mode) {
     });
 }
 
-void Application::PlaySound(const std::string_view& sound) {
-    audio_service_.PlaySound(sound);
+std::shared_ptr<SoundPlayback> Application::PlaySound(const std::string_view& sound) {
+    return audio_service_.PlaySound(sound);
+}
+
+cJSON* Application::GetAudioLinkStatisticsJson() {
+    if (protocol_ == nullptr) {
+        return nullptr;
+    }
+    return protocol_->GetLinkStatisticsJson();
 }
\ No newline at end of file
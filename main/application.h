@@ -10,11 +10,13 @@
 #include <mutex>
 #include <deque>
 #include <memory>
+#include <atomic>
 
 #include "protocol.h"
 #include "ota.h"
 #include "audio_service.h"
 #include "device_state_event.h"
+#include "chat_text_pacer.h"
 
 
 #define MAIN_EVENT_SCHEDULE (1 << 0)
@@ -24,6 +26,10 @@
 #define MAIN_EVENT_ERROR (1 << 4)
 #define MAIN_EVENT_CHECK_NEW_VERSION_DONE (1 << 5)
 #define MAIN_EVENT_CLOCK_TICK (1 << 6)
+#define MAIN_EVENT_CHAT_TEXT (1 << 7)
+
+// How often the text of the reply catches up with the speech
+#define CHAT_TEXT_TICK_MS 100
 
 
 enum AecMode {
@@ -61,8 +67,12 @@ public:
     void SendMcpMessage(const std::string& payload);
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
-    void PlaySound(const std::string_view& sound);
+    std::shared_ptr<SoundPlayback> PlaySound(const std::string_view& sound);
     AudioService& GetAudioService() { return audio_service_; }
+    // Link quality of the audio channel, nullptr if unknown, the caller owns the result
+    cJSON* GetAudioLinkStatisticsJson();
+    // Open the audio channel ahead of the next wake word, e.g. when leaving the power save mode
+    void WarmUpAudioChannel();
 
 private:
     Application();
@@ -73,11 +83,13 @@ private:
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
+    esp_timer_handle_t chat_text_timer_handle_ = nullptr;
     volatile DeviceState device_state_ = kDeviceStateUnknown;
     ListeningMode listening_mode_ = kListeningModeAutoStop;
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
     AudioService audio_service_;
+    ChatTextPacer chat_text_pacer_;
 
     bool has_server_time_ = false;
     bool aborted_ = false;
@@ -85,11 +97,20 @@ private:
     TaskHandle_t check_new_version_task_handle_ = nullptr;
     TaskHandle_t main_event_loop_task_handle_ = nullptr;
 
+    // Warm standby: errors of a speculative connect are not shown, the audio after the wake word
+    // is buffered while the channel opens
+    std::atomic<bool> speculative_connect_{false};
+    bool prebuffering_ = false;
+    std::atomic<int64_t> wake_word_time_us_{0};
+    int64_t connect_time_avg_us_ = 0;
+
     void OnWakeWordDetected();
+    bool ConnectAudioChannel(bool speculative = false);
     void CheckNewVersion(Ota& ota);
     void CheckAssetsVersion();
     void ShowActivationCode(const std::string& code, const std::string& message);
     void SetListeningMode(ListeningMode mode);
+    void RevealChatText(bool flush = false);
 };
 
 
@@ -4,11 +4,15 @@
 #include "application.h"
 #include "lvgl_theme.h"
 #include "emote_display.h"
+#include "download_pipeline.h"
 
 #include <esp_log.h>
 #include <spi_flash_mmap.h>
 #include <esp_timer.h>
 #include <cbin_font.h>
+#include <mbedtls/sha256.h>
+#include <algorithm>
+#include <array>
 
 
 #define TAG "Assets"
@@ -41,10 +45,30 @@ uint32_t Assets::CalculateChecksum(const char* data, uint32_t length) {
     return checksum & 0xFFFF;
 }
 
+static bool HashRange(const esp_partition_t* partition, size_t offset, size_t size, std::array<uint8_t, 32>& digest) {
+    std::vector<uint8_t> buffer(4096);
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, 0);
+    bool success = true;
+    for (size_t position = 0; position < size; position += buffer.size()) {
+        size_t n = std::min(buffer.size(), size - position);
+        if (esp_partition_read(partition, offset + position, buffer.data(), n) != ESP_OK) {
+            success = false;
+            break;
+        }
+        mbedtls_sha256_update(&context, buffer.data(), n);
+    }
+    mbedtls_sha256_finish(&context, digest.data());
+    mbedtls_sha256_free(&context);
+    return success;
+}
+
 bool Assets::InitializePartition() {
     partition_valid_ = false;
     checksum_valid_ = false;
     assets_.clear();
+    table_slot_ = -1;
 
     partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, "assets");
     if (partition_ == nullptr) {
@@ -69,6 +93,19 @@ bool Assets::InitializePartition() {
 
     partition_valid_ = true;
 
+    // The chunked container only checks its table at boot, the asset hashes are checked when written
+    if (LoadTable()) {
+        checksum_valid_ = true;
+        for (auto& entry : table_.entries) {
+            assets_[entry.name] = Asset{
+                .size = static_cast<size_t>(entry.size),
+                .offset = static_cast<size_t>(entry.offset)
+            };
+        }
+        ESP_LOGI(TAG, "Loaded %u assets from table slot %d, sequence %lu", table_.entries.size(), table_slot_, table_.sequence);
+        return true;
+    }
+
     uint32_t stored_files = *(uint32_t*)(mmap_root_ + 0);
     uint32_t stored_chksum = *(uint32_t*)(mmap_root_ + 4);
     uint32_t stored_len = *(uint32_t*)(mmap_root_ + 8);
@@ -101,6 +138,29 @@ bool Assets::InitializePartition() {
     return checksum_valid_;
 }
 
+bool Assets::LoadTable() {
+    table_slot_ = -1;
+    if (partition_->size < ASSETS_DATA_OFFSET) {
+        return false;
+    }
+    for (int slot = 0; slot < ASSETS_TABLE_SLOTS; slot++) {
+        AssetsTable table;
+        if (!table.Parse((const uint8_t*)mmap_root_ + slot * ASSETS_TABLE_SLOT_SIZE, ASSETS_TABLE_SLOT_SIZE)) {
+            continue;
+        }
+        if (table.image_size > partition_->size) {
+            ESP_LOGW(TAG, "The table in slot %d is larger than the partition", slot);
+            continue;
+        }
+        // A table whose write was interrupted fails its hash, so the newest valid one is complete
+        if (table_slot_ < 0 || (int32_t)(table.sequence - table_.sequence) > 0) {
+            table_ = std::move(table);
+            table_slot_ = slot;
+        }
+    }
+    return table_slot_ >= 0;
+}
+
 bool Assets::Apply() {
     void* ptr = nullptr;
     size_t size = 0;
@@ -379,6 +439,20 @@ bool Assets::Download(std::string url, std::function<void(int progress, size_t s
     checksum_valid_ = false;
     assets_.clear();
 
+    // 新旧资源都是分块格式时，只下载有变化的资源
+    if (table_slot_ >= 0) {
+        AssetsTable package;
+        if (FetchTable(url, package)) {
+            return DownloadChanged(url, package, progress_callback);
+        }
+    }
+    return DownloadAll(url, progress_callback);
+}
+
+bool Assets::DownloadAll(const std::string& url, std::function<void(int progress, size_t speed)> progress_callback) {
+    // 整个分区会被覆盖，当前的表不再可用
+    table_slot_ = -1;
+
     // 下载新的资源文件
     auto network = Board::GetInstance().GetNetwork();
     auto http = network->CreateHttp(0);
@@ -406,6 +480,8 @@ bool Assets::Download(std::string url, std::function<void(int progress, size_t s
 
     // 定义扇区大小为4KB（ESP32的标准扇区大小）
     const size_t SECTOR_SIZE = esp_partition_get_main_flash_sector_size();
+    // 对齐时按64KB块擦除，比逐个扇区擦除快得多
+    const size_t ERASE_BLOCK_SIZE = 64 * 1024;
     
     // 计算需要擦除的扇区数量
     size_t sectors_to_erase = (content_length + SECTOR_SIZE - 1) / SECTOR_SIZE; // 向上取整
@@ -414,82 +490,86 @@ bool Assets::Download(std::string url, std::function<void(int progress, size_t s
     ESP_LOGI(TAG, "Sector size: %u, content length: %u, sectors to erase: %u, total erase size: %u", 
              SECTOR_SIZE, content_length, sectors_to_erase, total_erase_size);
     
-    // 写入新的资源文件到分区，一边erase一边写入
-    char buffer[512];
+    // 写入新的资源文件到分区，一边erase一边写入，擦写在流水线任务中进行，与下载并行
     size_t total_written = 0;
-    size_t recent_written = 0;
-    size_t current_sector = 0;
-    auto last_calc_time = esp_timer_get_time();
-    
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            return false;
-        }
-
-        if (ret == 0) {
-            break;
-        }
-
-        // 检查是否需要擦除新的扇区
-        size_t write_end_offset = total_written + ret;
-        size_t needed_sectors = (write_end_offset + SECTOR_SIZE - 1) / SECTOR_SIZE;
-        
+    size_t total_erased = 0;
+    DownloadPipeline pipeline([this, &total_written, &total_erased, total_erase_size, SECTOR_SIZE, ERASE_BLOCK_SIZE](const uint8_t* data, size_t size) {
         // 擦除需要的新扇区
-        while (current_sector < needed_sectors) {
-            size_t sector_start = current_sector * SECTOR_SIZE;
-            size_t sector_end = (current_sector + 1) * SECTOR_SIZE;
-            
-            // 确保擦除范围不超过分区大小
-            if (sector_end > partition_->size) {
-                ESP_LOGE(TAG, "Sector end (%u) exceeds partition size (%lu)", sector_end, partition_->size);
-                return false;
+        while (total_erased < total_written + size) {
+            size_t erase_size = SECTOR_SIZE;
+            if (total_erased % ERASE_BLOCK_SIZE == 0 && total_erased + ERASE_BLOCK_SIZE <= total_erase_size) {
+                erase_size = ERASE_BLOCK_SIZE;
             }
-            
-            ESP_LOGD(TAG, "Erasing sector %u (offset: %u, size: %u)", current_sector, sector_start, SECTOR_SIZE);
-            esp_err_t err = esp_partition_erase_range(partition_, sector_start, SECTOR_SIZE);
+            esp_err_t err = esp_partition_erase_range(partition_, total_erased, erase_size);
             if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to erase sector %u at offset %u: %s", current_sector, sector_start, esp_err_to_name(err));
+                ESP_LOGE(TAG, "Failed to erase at offset %u: %s", total_erased, esp_err_to_name(err));
                 return false;
             }
-            
-            current_sector++;
+            total_erased += erase_size;
         }
 
         // 写入数据到分区
-        esp_err_t err = esp_partition_write(partition_, total_written, buffer, ret);
+        esp_err_t err = esp_partition_write(partition_, total_written, data, size);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to write to assets partition at offset %u: %s", total_written, esp_err_to_name(err));
             return false;
         }
+        total_written += size;
+        return true;
+    });
+    if (!pipeline.Start()) {
+        return false;
+    }
+
+    size_t total_read = 0;
+    size_t recent_read = 0;
+    auto last_calc_time = esp_timer_get_time();
+    
+    while (total_read < content_length) {
+        size_t space;
+        auto buffer = pipeline.GetBuffer(space);
+        int ret = http->Read((char*)buffer, std::min(space, content_length - total_read));
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+            return false;
+        }
 
-        total_written += ret;
-        recent_written += ret;
+        if (ret == 0) {
+            break;
+        }
+
+        if (!pipeline.Commit(ret)) {
+            return false;
+        }
+        total_read += ret;
+        recent_read += ret;
 
         // 计算进度和速度
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || total_written == content_length || ret == 0) {
-            size_t progress = total_written * 100 / content_length;
-            size_t speed = recent_written; // 每秒的字节数
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %u B/s, Sectors erased: %u", 
-                     progress, total_written, content_length, speed, current_sector);
+        if (esp_timer_get_time() - last_calc_time >= 1000000 || total_read == content_length) {
+            size_t progress = total_read * 100 / content_length;
+            size_t speed = recent_read; // 每秒的字节数
+            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %u B/s", progress, total_read, content_length, speed);
             if (progress_callback) {
                 progress_callback(progress, speed);
             }
             last_calc_time = esp_timer_get_time();
-            recent_written = 0; // 重置最近写入的字节数
+            recent_read = 0; // 重置最近读取的字节数
         }
     }
     
     http->Close();
 
+    if (!pipeline.Finish()) {
+        return false;
+    }
+
     if (total_written != content_length) {
         ESP_LOGE(TAG, "Downloaded size (%u) does not match expected size (%u)", total_written, content_length);
         return false;
     }
 
-    ESP_LOGI(TAG, "Assets download completed, total written: %u bytes, total sectors erased: %u", 
-             total_written, current_sector);
+    ESP_LOGI(TAG, "Assets download completed, total written: %u bytes, total erased: %u bytes", 
+             total_written, total_erased);
 
     // 重新初始化资源分区
     if (!InitializePartition()) {
@@ -500,6 +580,184 @@ bool Assets::Download(std::string url, std::function<void(int progress, size_t s
     return true;
 }
 
+bool Assets::FetchTable(const std::string& url, AssetsTable& package) {
+    auto network = Board::GetInstance().GetNetwork();
+    auto http = network->CreateHttp(0);
+    http->SetHeader("Range", "bytes=0-" + std::to_string(ASSETS_TABLE_SLOT_SIZE - 1));
+    if (!http->Open("GET", url)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return false;
+    }
+    if (http->GetStatusCode() != 206) {
+        ESP_LOGI(TAG, "The server does not support range requests, status code: %d", http->GetStatusCode());
+        http->Close();
+        return false;
+    }
+    std::string data = http->ReadAll();
+    http->Close();
+    if (!package.Parse((const uint8_t*)data.data(), data.size())) {
+        ESP_LOGI(TAG, "The new assets are not a chunked container");
+        return false;
+    }
+    return true;
+}
+
+bool Assets::DownloadChanged(const std::string& url, const AssetsTable& package, std::function<void(int progress, size_t speed)> progress_callback) {
+    AssetsTable next;
+    std::vector<AssetsTransfer> transfers;
+    if (!table_.PlanUpdate(package, partition_->size, next, transfers)) {
+        ESP_LOGW(TAG, "Not enough free space for the changed assets, downloading all of them");
+        return DownloadAll(url, progress_callback);
+    }
+
+    size_t changed = 0;
+    for (auto& entry : next.entries) {
+        if (table_.FindByHash(entry.sha256) == nullptr) {
+            changed++;
+        }
+    }
+    size_t total_size = 0;
+    for (auto& transfer : transfers) {
+        total_size += transfer.length;
+    }
+    ESP_LOGI(TAG, "%u of %u assets changed, downloading %u of %lu bytes in %u requests",
+        changed, next.entries.size(), total_size, package.image_size, transfers.size());
+
+    if (!transfers.empty() && !DownloadTransfers(url, transfers, progress_callback)) {
+        return false;
+    }
+
+    // Until the new table is written the old one stays active, a bad download only loses this update
+    for (auto& entry : next.entries) {
+        if (table_.FindByHash(entry.sha256) != nullptr) {
+            continue;
+        }
+        std::array<uint8_t, 32> digest;
+        if (!HashRange(partition_, entry.offset + ASSETS_DATA_PREFIX_SIZE, entry.size, digest) || digest != entry.sha256) {
+            ESP_LOGE(TAG, "The asset %s does not match its hash", entry.name.c_str());
+            return false;
+        }
+    }
+
+    int slot = table_slot_ == 0 ? 1 : 0;
+    auto data = next.Serialize();
+    esp_err_t err = esp_partition_erase_range(partition_, slot * ASSETS_TABLE_SLOT_SIZE, ASSETS_TABLE_SLOT_SIZE);
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition_, slot * ASSETS_TABLE_SLOT_SIZE, data.data(), data.size());
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write the assets table to slot %d: %s", slot, esp_err_to_name(err));
+        return false;
+    }
+    ESP_LOGI(TAG, "Assets table sequence %lu written to slot %d", next.sequence, slot);
+
+    if (!InitializePartition()) {
+        ESP_LOGE(TAG, "Failed to re-initialize assets partition");
+        return false;
+    }
+    return true;
+}
+
+bool Assets::DownloadTransfers(const std::string& url, const std::vector<AssetsTransfer>& transfers, std::function<void(int progress, size_t speed)> progress_callback) {
+    size_t total_size = 0;
+    for (auto& transfer : transfers) {
+        total_size += transfer.length;
+    }
+
+    // The sink walks the transfers in the order they are requested below, erasing ahead of the
+    // writes in 64 KB blocks where aligned; the target sectors are unused by the active table
+    const size_t ERASE_BLOCK_SIZE = 64 * 1024;
+    size_t index = 0;
+    size_t written = 0;
+    size_t erased = 0;
+    DownloadPipeline pipeline([this, &transfers, &index, &written, &erased, ERASE_BLOCK_SIZE](const uint8_t* data, size_t size) {
+        while (size > 0) {
+            if (index >= transfers.size()) {
+                return false;
+            }
+            auto& transfer = transfers[index];
+            size_t n = std::min<size_t>(size, transfer.length - written);
+            size_t erase_end = (transfer.length + ASSETS_SECTOR_SIZE - 1) / ASSETS_SECTOR_SIZE * ASSETS_SECTOR_SIZE;
+            while (erased < written + n) {
+                size_t erase_size = ASSETS_SECTOR_SIZE;
+                if ((transfer.target_offset + erased) % ERASE_BLOCK_SIZE == 0 && erased + ERASE_BLOCK_SIZE <= erase_end) {
+                    erase_size = ERASE_BLOCK_SIZE;
+                }
+                esp_err_t err = esp_partition_erase_range(partition_, transfer.target_offset + erased, erase_size);
+                if (err != ESP_OK) {
+                    ESP_LOGE(TAG, "Failed to erase at offset %lu: %s", transfer.target_offset + erased, esp_err_to_name(err));
+                    return false;
+                }
+                erased += erase_size;
+            }
+            esp_err_t err = esp_partition_write(partition_, transfer.target_offset + written, data, n);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write to assets partition at offset %lu: %s", transfer.target_offset + written, esp_err_to_name(err));
+                return false;
+            }
+            data += n;
+            size -= n;
+            written += n;
+            if (written == transfer.length) {
+                index++;
+                written = 0;
+                erased = 0;
+            }
+        }
+        return true;
+    });
+    if (!pipeline.Start()) {
+        return false;
+    }
+
+    auto network = Board::GetInstance().GetNetwork();
+    size_t total_read = 0;
+    size_t recent_read = 0;
+    auto last_calc_time = esp_timer_get_time();
+    for (auto& transfer : transfers) {
+        auto http = network->CreateHttp(0);
+        http->SetHeader("Range", "bytes=" + std::to_string(transfer.source_offset) + "-" +
+            std::to_string(transfer.source_offset + transfer.length - 1));
+        if (!http->Open("GET", url)) {
+            ESP_LOGE(TAG, "Failed to open HTTP connection");
+            return false;
+        }
+        if (http->GetStatusCode() != 206) {
+            ESP_LOGE(TAG, "Failed to get assets range, status code: %d", http->GetStatusCode());
+            return false;
+        }
+
+        size_t remaining = transfer.length;
+        while (remaining > 0) {
+            size_t space;
+            auto buffer = pipeline.GetBuffer(space);
+            int ret = http->Read((char*)buffer, std::min(space, remaining));
+            if (ret <= 0) {
+                ESP_LOGE(TAG, "Failed to read HTTP data: %s", ret < 0 ? esp_err_to_name(ret) : "connection closed");
+                return false;
+            }
+            if (!pipeline.Commit(ret)) {
+                return false;
+            }
+            remaining -= ret;
+            total_read += ret;
+            recent_read += ret;
+
+            if (esp_timer_get_time() - last_calc_time >= 1000000 || total_read == total_size) {
+                size_t progress = total_read * 100 / total_size;
+                ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %u B/s", progress, total_read, total_size, recent_read);
+                if (progress_callback) {
+                    progress_callback(progress, recent_read);
+                }
+                last_calc_time = esp_timer_get_time();
+                recent_read = 0;
+            }
+        }
+        http->Close();
+    }
+    return pipeline.Finish();
+}
+
 bool Assets::GetAssetData(const std::string& name, void*& ptr, size_t& size) {
     auto asset = assets_.find(name);
     if (asset == assets_.end()) {
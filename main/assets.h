@@ -4,8 +4,10 @@
 #include <map>
 #include <string>
 #include <functional>
+#include <vector>
 
 #include "assets/cJSON.h"
+#include "assets_table.h"
 #include <esp_partition.h>
 #include <model_path.h>
 
@@ -37,7 +39,12 @@ private:
     Assets& operator=(const Assets&) = delete;
 
     bool InitializePartition();
+    bool LoadTable();
     uint32_t CalculateChecksum(const char* data, uint32_t length);
+    bool DownloadAll(const std::string& url, std::function<void(int progress, size_t speed)> progress_callback);
+    bool FetchTable(const std::string& url, AssetsTable& package);
+    bool DownloadChanged(const std::string& url, const AssetsTable& package, std::function<void(int progress, size_t speed)> progress_callback);
+    bool DownloadTransfers(const std::string& url, const std::vector<AssetsTransfer>& transfers, std::function<void(int progress, size_t speed)> progress_callback);
 
     const esp_partition_t* partition_ = nullptr;
     esp_partition_mmap_handle_t mmap_handle_ = 0;
@@ -47,6 +54,9 @@ private:
     std::string default_assets_url_;
     srmodel_list_t* models_list_ = nullptr;
     std::map<std::string, Asset> assets_;
+    // The active table of a chunked container, -1 for the original format
+    AssetsTable table_;
+    int table_slot_ = -1;
 };
 
 #endif
@@ -0,0 +1,202 @@
+#include "assets_table.h"
+
+#include <mbedtls/sha256.h>
+#include <cstring>
+#include <algorithm>
+#include <map>
+
+
+static uint32_t ReadLe32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t ReadLe16(const uint8_t* data) {
+    return data[0] | (data[1] << 8);
+}
+
+static void WriteLe32(uint8_t* data, uint32_t value) {
+    data[0] = value;
+    data[1] = value >> 8;
+    data[2] = value >> 16;
+    data[3] = value >> 24;
+}
+
+static void WriteLe16(uint8_t* data, uint16_t value) {
+    data[0] = value;
+    data[1] = value >> 8;
+}
+
+static uint32_t AlignUp(uint32_t value) {
+    return (value + ASSETS_SECTOR_SIZE - 1) / ASSETS_SECTOR_SIZE * ASSETS_SECTOR_SIZE;
+}
+
+// The first 16 bytes of the header and the entries, everything but the hash itself
+static void HashTable(const uint8_t* data, size_t entries_size, uint8_t* digest) {
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, 0);
+    mbedtls_sha256_update(&context, data, 16);
+    mbedtls_sha256_update(&context, data + ASSETS_TABLE_HEADER_SIZE, entries_size);
+    mbedtls_sha256_finish(&context, digest);
+    mbedtls_sha256_free(&context);
+}
+
+bool AssetsTable::IsTable(const uint8_t* data, size_t size) {
+    return size >= ASSETS_TABLE_HEADER_SIZE && memcmp(data, ASSETS_TABLE_MAGIC, 4) == 0;
+}
+
+bool AssetsTable::Parse(const uint8_t* data, size_t size) {
+    if (!IsTable(data, size)) {
+        return false;
+    }
+    uint32_t count = ReadLe32(data + 8);
+    if (count > (ASSETS_TABLE_SLOT_SIZE - ASSETS_TABLE_HEADER_SIZE) / ASSETS_TABLE_ENTRY_SIZE
+        || ASSETS_TABLE_HEADER_SIZE + count * ASSETS_TABLE_ENTRY_SIZE > size) {
+        return false;
+    }
+    uint8_t digest[32];
+    HashTable(data, count * ASSETS_TABLE_ENTRY_SIZE, digest);
+    if (memcmp(digest, data + 16, sizeof(digest)) != 0) {
+        return false;
+    }
+
+    sequence = ReadLe32(data + 4);
+    image_size = ReadLe32(data + 12);
+    entries.clear();
+    entries.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        auto item = data + ASSETS_TABLE_HEADER_SIZE + i * ASSETS_TABLE_ENTRY_SIZE;
+        AssetsTableEntry entry;
+        entry.name.assign((const char*)item, strnlen((const char*)item, ASSETS_NAME_LENGTH));
+        entry.size = ReadLe32(item + 32);
+        entry.offset = ReadLe32(item + 36);
+        entry.width = ReadLe16(item + 40);
+        entry.height = ReadLe16(item + 42);
+        memcpy(entry.sha256.data(), item + 44, 32);
+        if (entry.offset % ASSETS_SECTOR_SIZE != 0 || entry.offset < ASSETS_DATA_OFFSET
+            || entry.size > image_size || entry.end() > image_size) {
+            return false;
+        }
+        entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+std::vector<uint8_t> AssetsTable::Serialize() const {
+    std::vector<uint8_t> data(ASSETS_TABLE_HEADER_SIZE + entries.size() * ASSETS_TABLE_ENTRY_SIZE, 0);
+    memcpy(data.data(), ASSETS_TABLE_MAGIC, 4);
+    WriteLe32(data.data() + 4, sequence);
+    WriteLe32(data.data() + 8, entries.size());
+    WriteLe32(data.data() + 12, image_size);
+    for (size_t i = 0; i < entries.size(); i++) {
+        auto& entry = entries[i];
+        auto item = data.data() + ASSETS_TABLE_HEADER_SIZE + i * ASSETS_TABLE_ENTRY_SIZE;
+        memcpy(item, entry.name.data(), std::min<size_t>(entry.name.size(), ASSETS_NAME_LENGTH));
+        WriteLe32(item + 32, entry.size);
+        WriteLe32(item + 36, entry.offset);
+        WriteLe16(item + 40, entry.width);
+        WriteLe16(item + 42, entry.height);
+        memcpy(item + 44, entry.sha256.data(), 32);
+    }
+    HashTable(data.data(), entries.size() * ASSETS_TABLE_ENTRY_SIZE, data.data() + 16);
+    return data;
+}
+
+const AssetsTableEntry* AssetsTable::FindByHash(const std::array<uint8_t, 32>& sha256) const {
+    for (auto& entry : entries) {
+        if (entry.sha256 == sha256) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool AssetsTable::PlanUpdate(const AssetsTable& package, size_t partition_size,
+    AssetsTable& result, std::vector<AssetsTransfer>& transfers) const {
+    result = package;
+    result.sequence = sequence + 1;
+    transfers.clear();
+
+    // Free space is every sector the active table does not use
+    std::vector<std::pair<uint32_t, uint32_t>> used;
+    for (auto& entry : entries) {
+        used.emplace_back(entry.offset, AlignUp(entry.end()));
+    }
+    std::sort(used.begin(), used.end());
+    std::vector<std::pair<uint32_t, uint32_t>> gaps;
+    uint32_t limit = partition_size / ASSETS_SECTOR_SIZE * ASSETS_SECTOR_SIZE;
+    uint32_t position = ASSETS_DATA_OFFSET;
+    for (auto& [start, end] : used) {
+        if (start > position && position < limit) {
+            gaps.emplace_back(position, std::min(start, limit));
+        }
+        position = std::max(position, end);
+    }
+    if (position < limit) {
+        gaps.emplace_back(position, limit);
+    }
+    auto allocate = [&gaps](uint32_t size, uint32_t& offset) {
+        for (auto& gap : gaps) {
+            if (gap.second - gap.first >= size) {
+                offset = gap.first;
+                gap.first += size;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Content already in the partition is kept, the rest is downloaded once even if several
+    // names share it, keyed by its offset in the package
+    std::map<uint32_t, uint32_t> missing;
+    std::map<uint32_t, uint32_t> placed;
+    std::vector<bool> downloaded(result.entries.size(), false);
+    for (size_t i = 0; i < result.entries.size(); i++) {
+        auto& entry = result.entries[i];
+        auto existing = FindByHash(entry.sha256);
+        if (existing != nullptr && existing->size == entry.size) {
+            entry.offset = existing->offset;
+        } else {
+            missing[entry.offset] = entry.end();
+            downloaded[i] = true;
+        }
+    }
+
+    // Assets on consecutive sectors of the package are downloaded with one request when they
+    // fit together, otherwise one by one
+    auto run = missing.begin();
+    while (run != missing.end()) {
+        auto run_end = std::next(run);
+        uint32_t end = run->second;
+        while (run_end != missing.end() && run_end->first == AlignUp(end)) {
+            end = run_end->second;
+            ++run_end;
+        }
+        uint32_t target;
+        if (allocate(AlignUp(end) - run->first, target)) {
+            transfers.push_back({ run->first, target, end - run->first });
+            for (auto it = run; it != run_end; ++it) {
+                placed[it->first] = target + it->first - run->first;
+            }
+        } else {
+            for (auto it = run; it != run_end; ++it) {
+                if (!allocate(AlignUp(it->second) - it->first, target)) {
+                    return false;
+                }
+                transfers.push_back({ it->first, target, it->second - it->first });
+                placed[it->first] = target;
+            }
+        }
+        run = run_end;
+    }
+
+    result.image_size = ASSETS_DATA_OFFSET;
+    for (size_t i = 0; i < result.entries.size(); i++) {
+        auto& entry = result.entries[i];
+        if (downloaded[i]) {
+            entry.offset = placed[entry.offset];
+        }
+        result.image_size = std::max(result.image_size, entry.end());
+    }
+    return true;
+}
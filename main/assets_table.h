@@ -0,0 +1,71 @@
+#ifndef ASSETS_TABLE_H
+#define ASSETS_TABLE_H
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#define ASSETS_TABLE_MAGIC "XZA2"
+#define ASSETS_TABLE_SLOT_SIZE (16 * 1024)
+#define ASSETS_TABLE_SLOTS 2
+#define ASSETS_DATA_OFFSET (ASSETS_TABLE_SLOT_SIZE * ASSETS_TABLE_SLOTS)
+#define ASSETS_SECTOR_SIZE 4096
+#define ASSETS_TABLE_HEADER_SIZE 48
+#define ASSETS_TABLE_ENTRY_SIZE 76
+#define ASSETS_NAME_LENGTH 32
+// Every asset is stored after the "ZZ" magic, as in the original format
+#define ASSETS_DATA_PREFIX_SIZE 2
+
+struct AssetsTableEntry {
+    std::string name;
+    uint32_t offset;        // Of the prefix, from the start of the partition
+    uint32_t size;          // Without the prefix
+    uint16_t width;
+    uint16_t height;
+    std::array<uint8_t, 32> sha256;  // Of the asset content
+
+    uint32_t end() const { return offset + ASSETS_DATA_PREFIX_SIZE + size; }
+};
+
+// A range of the assets file downloaded into the partition
+struct AssetsTransfer {
+    uint32_t source_offset;
+    uint32_t target_offset;
+    uint32_t length;
+};
+
+/*
+ * The table of the chunked assets container made by scripts/spiffs_assets/build.py.
+ *
+ * The partition starts with two table slots, the valid one with the higher sequence is active.
+ * Each asset starts on its own sector, so one asset can be rewritten without touching the
+ * others. An update writes the changed assets into sectors the active table does not use,
+ * then writes the new table into the other slot, so a power loss at any point leaves either
+ * the old or the new assets.
+ * Integers are little endian:
+ *   slot: |magic "XZA2" 4|sequence 4u|count 4u|image_size 4u|sha256 32|entries...|
+ *   entry: |name 32|size 4u|offset 4u|width 2u|height 2u|sha256 32|
+ * The slot sha256 covers the first 16 bytes and the entries, so only the table is checked at
+ * boot; the asset hashes are checked when they are written.
+ */
+struct AssetsTable {
+    uint32_t sequence = 0;
+    uint32_t image_size = 0;    // End of the last asset
+    std::vector<AssetsTableEntry> entries;
+
+    static bool IsTable(const uint8_t* data, size_t size);
+
+    bool Parse(const uint8_t* data, size_t size);
+    std::vector<uint8_t> Serialize() const;
+    const AssetsTableEntry* FindByHash(const std::array<uint8_t, 32>& sha256) const;
+
+    // Lays out the assets of `package` (the table of the new assets file) in a partition that
+    // holds this table: assets with the same content stay where they are, the others go into
+    // free sectors, in as few transfers as possible. False if they do not fit.
+    bool PlanUpdate(const AssetsTable& package, size_t partition_size,
+        AssetsTable& result, std::vector<AssetsTransfer>& transfers) const;
+};
+
+#endif // ASSETS_TABLE_H
@@ -0,0 +1,65 @@
+#include "audio_frame_pool.h"
+#include <esp_log.h>
+
+#define TAG "AudioFramePool"
+
+
+void AudioTaskRecycler::operator()(AudioTask* task) const {
+    if (pool != nullptr) {
+        pool->Release(task);
+    } else {
+        delete task;
+    }
+}
+
+AudioFramePool::AudioFramePool(size_t capacity, size_t reserved_samples) {
+    frames_.reserve(capacity);
+    free_frames_.reserve(capacity);
+    for (size_t i = 0; i < capacity; i++) {
+        auto frame = std::make_unique<AudioTask>();
+        frame->pcm.reserve(reserved_samples);
+        free_frames_.push_back(frame.get());
+        frames_.push_back(std::move(frame));
+    }
+}
+
+AudioFramePool::~AudioFramePool() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_frames_.size() != frames_.size()) {
+        ESP_LOGW(TAG, "Pool destroyed with %u frames in use", frames_.size() - free_frames_.size());
+    }
+}
+
+AudioTaskPtr AudioFramePool::Acquire() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_frames_.empty()) {
+            auto task = free_frames_.back();
+            free_frames_.pop_back();
+            task->pcm.clear();
+            task->timestamp = 0;
+            task->segment = 0;
+            task->trace_time = 0;
+            return AudioTaskPtr(task, AudioTaskRecycler{this});
+        }
+        fallback_count_++;
+    }
+
+    // The pool is sized for the worst case queue depth, so this should not happen
+    ESP_LOGW(TAG, "Pool exhausted (%u frames), allocating from heap", frames_.size());
+    auto task = new AudioTask();
+    task->timestamp = 0;
+    task->segment = 0;
+    task->trace_time = 0;
+    return AudioTaskPtr(task, AudioTaskRecycler{nullptr});
+}
+
+void AudioFramePool::Release(AudioTask* task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_frames_.push_back(task);
+}
+
+size_t AudioFramePool::available() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return free_frames_.size();
+}
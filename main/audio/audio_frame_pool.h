@@ -0,0 +1,64 @@
+#ifndef AUDIO_FRAME_POOL_H
+#define AUDIO_FRAME_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+enum AudioTaskType {
+    kAudioTaskTypeEncodeToSendQueue,
+    kAudioTaskTypeEncodeToTestingQueue,
+    kAudioTaskTypeDecodeToPlaybackQueue,
+};
+
+struct AudioTask {
+    AudioTaskType type;
+    std::vector<int16_t> pcm;
+    uint32_t timestamp;
+    uint32_t segment;
+    int64_t trace_time;
+};
+
+class AudioFramePool;
+
+struct AudioTaskRecycler {
+    AudioFramePool* pool = nullptr;
+    void operator()(AudioTask* task) const;
+};
+
+using AudioTaskPtr = std::unique_ptr<AudioTask, AudioTaskRecycler>;
+
+/*
+ * A fixed-capacity pool of PCM frames.
+ *
+ * All frames are allocated once in the constructor. A frame handed out by Acquire() returns
+ * to the pool when its handle is destroyed, keeping the capacity of its PCM buffer, so the
+ * steady-state audio path never touches the heap. If the pool is exhausted, Acquire() falls
+ * back to a heap allocated frame which is freed normally.
+ */
+class AudioFramePool {
+public:
+    AudioFramePool(size_t capacity, size_t reserved_samples);
+    ~AudioFramePool();
+
+    AudioFramePool(const AudioFramePool&) = delete;
+    AudioFramePool& operator=(const AudioFramePool&) = delete;
+
+    AudioTaskPtr Acquire();
+    void Release(AudioTask* task);
+
+    size_t capacity() const { return frames_.size(); }
+    size_t available();
+    uint32_t fallback_count() const { return fallback_count_; }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<AudioTask>> frames_;
+    std::vector<AudioTask*> free_frames_;
+    uint32_t fallback_count_ = 0;
+};
+
+#endif // AUDIO_FRAME_POOL_H
@@ -0,0 +1,235 @@
+#include "audio_jitter_buffer.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cstdlib>
+
+#define TAG "JitterBuffer"
+
+// Gaps longer than this are skipped instead of concealed, PLC over a long gap sounds worse than a cut
+#define MAX_CONCEALED_FRAMES_IN_GAP 3
+// Sequence jumps larger than this are treated as a new stream
+#define MAX_SEQUENCE_JUMP 1000
+
+
+static inline int64_t NowMs() {
+    return esp_timer_get_time() / 1000;
+}
+
+void AudioJitterBuffer::Put(std::unique_ptr<AudioStreamPacket> packet) {
+    int64_t now = NowMs();
+    std::lock_guard<std::mutex> lock(mutex_);
+    statistics_.received++;
+
+    uint32_t sequence = packet->sequence;
+    int32_t offset = static_cast<int32_t>(sequence - next_sequence_);
+    if (!synchronized_ || offset < -MAX_SEQUENCE_JUMP || offset > MAX_SEQUENCE_JUMP) {
+        if (synchronized_) {
+            ESP_LOGW(TAG, "Sequence jumped from %lu to %lu, resynchronizing", next_sequence_, sequence);
+        }
+        Clear();
+        synchronized_ = true;
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+        offset = 0;
+    }
+
+    if (offset < 0) {
+        statistics_.late++;
+        return;
+    }
+    if (offset >= JITTER_BUFFER_SLOTS) {
+        // The server is sending faster than we play, drop the newest packet
+        ESP_LOGW(TAG, "Jitter buffer is full, dropping packet %lu", sequence);
+        return;
+    }
+
+    auto& slot = SlotOf(sequence);
+    if (slot.packet != nullptr) {
+        statistics_.duplicated++;
+        return;
+    }
+
+    if (static_cast<int32_t>(sequence - highest_sequence_) < 0) {
+        statistics_.reordered++;
+    } else {
+        highest_sequence_ = sequence;
+    }
+    sample_rate_ = packet->sample_rate;
+    frame_duration_ = packet->frame_duration > 0 ? packet->frame_duration : 60;
+    UpdateJitter(sequence, now, frame_duration_);
+
+    if (buffered_ == 0) {
+        oldest_arrival_ms_ = now;
+    }
+    slot.sequence = sequence;
+    slot.arrival_ms = now;
+    slot.packet = std::move(packet);
+    buffered_++;
+}
+
+bool AudioJitterBuffer::Pop(std::unique_ptr<AudioStreamPacket>& packet) {
+    int64_t now = NowMs();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffered_ == 0) {
+        if (playing_) {
+            // Drained, the next packet starts a new talkspurt with a fresh playout delay
+            playing_ = false;
+            has_transit_ = false;
+            last_arrival_ms_ = 0;
+            statistics_.underruns++;
+        }
+        return false;
+    }
+
+    int target_ms = GetTargetDelayMs();
+    size_t target_frames = target_ms / frame_duration_;
+    bool overdue = buffered_ >= target_frames || now - oldest_arrival_ms_ >= target_ms;
+    if (!playing_) {
+        if (!overdue) {
+            return false;
+        }
+        playing_ = true;
+    }
+
+    auto& slot = SlotOf(next_sequence_);
+    if (slot.packet == nullptr || slot.sequence != next_sequence_) {
+        // The next packet is missing, wait for it until it is due itself, however many
+        // packets after it are buffered
+        int64_t deadline = GetMissingDeadline(target_ms);
+        if (deadline != 0 ? now < deadline : !overdue) {
+            return false;
+        }
+
+        uint32_t gap = 1;
+        while (gap < JITTER_BUFFER_SLOTS && SlotOf(next_sequence_ + gap).packet == nullptr) {
+            gap++;
+        }
+        if (gap <= MAX_CONCEALED_FRAMES_IN_GAP) {
+            packet = std::make_unique<AudioStreamPacket>();
+            packet->sample_rate = sample_rate_;
+            packet->frame_duration = frame_duration_;
+            packet->segment = segment_;
+            packet->sequence = next_sequence_++;
+            if (last_arrival_ms_ != 0) {
+                last_arrival_ms_ += frame_duration_;
+            }
+            statistics_.lost++;
+            statistics_.concealed++;
+            return true;
+        }
+
+        ESP_LOGW(TAG, "Skipping %lu lost packets", gap);
+        statistics_.lost += gap;
+        next_sequence_ += gap;
+    }
+
+    auto& next_slot = SlotOf(next_sequence_);
+    packet = std::move(next_slot.packet);
+    last_arrival_ms_ = next_slot.arrival_ms;
+    segment_ = packet->segment;
+    next_sequence_++;
+    buffered_--;
+    statistics_.played++;
+    oldest_arrival_ms_ = GetOldestArrival();
+    return true;
+}
+
+int AudioJitterBuffer::GetWaitTime() {
+    int64_t now = NowMs();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffered_ == 0) {
+        return -1;
+    }
+    if (playing_ && SlotOf(next_sequence_).packet != nullptr) {
+        return 0;
+    }
+    int target_ms = GetTargetDelayMs();
+    int64_t deadline = playing_ ? GetMissingDeadline(target_ms) : 0;
+    if (deadline == 0 && buffered_ >= static_cast<size_t>(target_ms / frame_duration_)) {
+        return 0;
+    }
+    int64_t wait = (deadline != 0 ? deadline : oldest_arrival_ms_ + target_ms) - now;
+    return wait > 0 ? static_cast<int>(wait) : 0;
+}
+
+void AudioJitterBuffer::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Clear();
+    synchronized_ = false;
+}
+
+bool AudioJitterBuffer::IsEmpty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return buffered_ == 0;
+}
+
+bool AudioJitterBuffer::HasSegment(uint32_t segment) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& slot : slots_) {
+        if (slot.packet != nullptr && slot.packet->segment == segment) {
+            return true;
+        }
+    }
+    return false;
+}
+
+JitterBufferStatistics AudioJitterBuffer::GetStatistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    statistics_.jitter_ms = jitter_q4_ >> 4;
+    statistics_.target_delay_ms = frame_duration_ > 0 ? GetTargetDelayMs() : 0;
+    return statistics_;
+}
+
+// Cover three times the measured jitter, rounded up to whole frames
+int AudioJitterBuffer::GetTargetDelayMs() const {
+    int jitter_ms = jitter_q4_ >> 4;
+    int frames = (3 * jitter_ms + frame_duration_ - 1) / frame_duration_ + 1;
+    if (frames > JITTER_BUFFER_MAX_TARGET_FRAMES) {
+        frames = JITTER_BUFFER_MAX_TARGET_FRAMES;
+    }
+    return frames * frame_duration_;
+}
+
+// Interarrival jitter estimator from RFC 3550, in 1/16 ms
+void AudioJitterBuffer::UpdateJitter(uint32_t sequence, int64_t arrival_ms, int frame_duration) {
+    int32_t transit = static_cast<int32_t>(arrival_ms - static_cast<int64_t>(sequence) * frame_duration);
+    if (has_transit_) {
+        int32_t d = std::abs(transit - last_transit_ms_);
+        // Limit the impact of a server pause between sentences
+        if (d > 4 * frame_duration) {
+            d = 4 * frame_duration;
+        }
+        jitter_q4_ += d - ((jitter_q4_ + 8) >> 4);
+    }
+    last_transit_ms_ = transit;
+    has_transit_ = true;
+}
+
+// The missing next packet would have arrived a frame after the previous one, and is due the
+// playout delay after that. 0 if no packet was played in this talkspurt.
+int64_t AudioJitterBuffer::GetMissingDeadline(int target_ms) const {
+    if (last_arrival_ms_ == 0) {
+        return 0;
+    }
+    return last_arrival_ms_ + frame_duration_ + target_ms;
+}
+
+int64_t AudioJitterBuffer::GetOldestArrival() const {
+    int64_t oldest = 0;
+    for (const auto& slot : slots_) {
+        if (slot.packet != nullptr && (oldest == 0 || slot.arrival_ms < oldest)) {
+            oldest = slot.arrival_ms;
+        }
+    }
+    return oldest;
+}
+
+void AudioJitterBuffer::Clear() {
+    for (auto& slot : slots_) {
+        slot.packet.reset();
+    }
+    buffered_ = 0;
+    playing_ = false;
+    has_transit_ = false;
+    last_arrival_ms_ = 0;
+}
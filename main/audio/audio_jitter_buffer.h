@@ -0,0 +1,90 @@
+#ifndef AUDIO_JITTER_BUFFER_H
+#define AUDIO_JITTER_BUFFER_H
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "protocol.h"
+
+#define JITTER_BUFFER_SLOTS 64
+#define JITTER_BUFFER_MAX_TARGET_FRAMES 8
+
+
+struct JitterBufferStatistics {
+    uint32_t received = 0;
+    uint32_t played = 0;
+    uint32_t late = 0;          // Arrived after its playout slot, dropped
+    uint32_t duplicated = 0;
+    uint32_t lost = 0;          // Never arrived before its playout slot
+    uint32_t concealed = 0;     // Frames synthesized by the decoder PLC
+    uint32_t reordered = 0;     // Arrived out of order but in time
+    uint32_t underruns = 0;
+    uint32_t jitter_ms = 0;
+    uint32_t target_delay_ms = 0;
+};
+
+/*
+ * Adaptive jitter buffer for the audio received from the server.
+ *
+ * Packets are stored by sequence number, so reordered packets are played in order. The playout
+ * delay follows the inter-arrival jitter (RFC 3550 estimator). A missing packet is expected one
+ * frame after the previous one; if it has not arrived the playout delay after that, it is reported
+ * as lost and returned with an empty payload, which makes the Opus decoder run packet loss
+ * concealment instead of playing silence. Packets buffered after it do not make it lost sooner.
+ *
+ * Put() is called by the network task, Pop() by the decoder task.
+ */
+class AudioJitterBuffer {
+public:
+    AudioJitterBuffer() = default;
+
+    void Put(std::unique_ptr<AudioStreamPacket> packet);
+    // Returns false if no packet should be decoded now
+    bool Pop(std::unique_ptr<AudioStreamPacket>& packet);
+    // Milliseconds until Pop() may return a packet, -1 if the buffer is empty
+    int GetWaitTime();
+    void Reset();
+    bool IsEmpty();
+    // Whether packets of the playback segment are still waiting to be played
+    bool HasSegment(uint32_t segment);
+    JitterBufferStatistics GetStatistics();
+
+private:
+    struct Slot {
+        uint32_t sequence = 0;
+        int64_t arrival_ms = 0;
+        std::unique_ptr<AudioStreamPacket> packet;
+    };
+
+    std::mutex mutex_;
+    std::array<Slot, JITTER_BUFFER_SLOTS> slots_;
+    size_t buffered_ = 0;
+    bool synchronized_ = false;
+    bool playing_ = false;
+    uint32_t next_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    int64_t oldest_arrival_ms_ = 0;
+    // Arrival of the last packet played, a frame later for each concealed one, 0 after an underrun
+    int64_t last_arrival_ms_ = 0;
+
+    // Parameters of the last packet, used to conceal the lost ones
+    int sample_rate_ = 0;
+    int frame_duration_ = 0;
+    uint32_t segment_ = 0;
+
+    bool has_transit_ = false;
+    int32_t last_transit_ms_ = 0;
+    uint32_t jitter_q4_ = 0;
+    JitterBufferStatistics statistics_;
+
+    Slot& SlotOf(uint32_t sequence) { return slots_[sequence % JITTER_BUFFER_SLOTS]; }
+    int GetTargetDelayMs() const;
+    void UpdateJitter(uint32_t sequence, int64_t arrival_ms, int frame_duration);
+    int64_t GetOldestArrival() const;
+    int64_t GetMissingDeadline(int target_ms) const;
+    void Clear();
+};
+
+#endif // AUDIO_JITTER_BUFFER_H
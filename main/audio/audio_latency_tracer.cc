@@ -0,0 +1,112 @@
+#include "audio_latency_tracer.h"
+#include <esp_timer.h>
+#include <algorithm>
+#include <vector>
+
+#define SAMPLE_VALUE_MAX 0xFFFFFFFE
+
+
+static const char* const stage_names[] = {
+    "i2s_read",
+    "afe_fetch",
+    "encode_queue",
+    "opus_encode",
+    "send",
+    "decode_queue",
+    "opus_decode",
+    "playback_queue",
+    "output",
+    "response",
+    "channel_open",
+    "channel_saved",
+};
+static_assert(sizeof(stage_names) / sizeof(stage_names[0]) == kLatencyStageCount, "Missing stage name");
+
+// Upper bounds of the histogram buckets in milliseconds, the last bucket is unbounded
+static const int histogram_bounds_ms[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+
+
+const char* AudioLatencyTracer::GetStageName(AudioLatencyStage stage) {
+    return stage < kLatencyStageCount ? stage_names[stage] : "unknown";
+}
+
+size_t AudioLatencyTracer::GetRingOffset(int stage) {
+    if (stage < (int)kFrameStageCount) {
+        return stage * AUDIO_LATENCY_FRAME_TRACE_SIZE;
+    }
+    return kFrameStageCount * AUDIO_LATENCY_FRAME_TRACE_SIZE + (stage - kFrameStageCount) * AUDIO_LATENCY_EVENT_TRACE_SIZE;
+}
+
+size_t AudioLatencyTracer::GetRingSize(int stage) {
+    return stage < (int)kFrameStageCount ? AUDIO_LATENCY_FRAME_TRACE_SIZE : AUDIO_LATENCY_EVENT_TRACE_SIZE;
+}
+
+void AudioLatencyTracer::Record(AudioLatencyStage stage, int64_t elapsed_us) {
+    if (elapsed_us < 0 || stage >= kLatencyStageCount) {
+        return;
+    }
+    uint32_t value = std::min<int64_t>(elapsed_us, SAMPLE_VALUE_MAX - 1);
+    uint32_t index = next_[stage].fetch_add(1, std::memory_order_relaxed) % GetRingSize(stage);
+    samples_[GetRingOffset(stage) + index].store(value + 1, std::memory_order_relaxed);
+}
+
+void AudioLatencyTracer::RecordSince(AudioLatencyStage stage, int64_t start_us) {
+    if (start_us != 0) {
+        Record(stage, esp_timer_get_time() - start_us);
+    }
+}
+
+void AudioLatencyTracer::Reset() {
+    for (auto& sample : samples_) {
+        sample.store(0, std::memory_order_relaxed);
+    }
+}
+
+static double Percentile(const std::vector<uint32_t>& sorted, int percent) {
+    size_t index = (sorted.size() * percent + 99) / 100;
+    index = index > 0 ? index - 1 : 0;
+    return sorted[std::min(index, sorted.size() - 1)] / 1000.0;
+}
+
+cJSON* AudioLatencyTracer::GetStatsJson() {
+    cJSON* json = cJSON_CreateObject();
+    cJSON* bounds = cJSON_AddArrayToObject(json, "histogram_bounds_ms");
+    for (int bound : histogram_bounds_ms) {
+        cJSON_AddItemToArray(bounds, cJSON_CreateNumber(bound));
+    }
+
+    cJSON* stages = cJSON_AddObjectToObject(json, "stages");
+    std::vector<uint32_t> stage_values;
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        stage_values.clear();
+        size_t offset = GetRingOffset(i);
+        for (size_t j = 0; j < GetRingSize(i); j++) {
+            uint32_t sample = samples_[offset + j].load(std::memory_order_relaxed);
+            if (sample != 0) {
+                stage_values.push_back(sample - 1);
+            }
+        }
+        if (stage_values.empty()) {
+            continue;
+        }
+        std::sort(stage_values.begin(), stage_values.end());
+
+        cJSON* stage = cJSON_AddObjectToObject(stages, stage_names[i]);
+        cJSON_AddNumberToObject(stage, "count", stage_values.size());
+        cJSON_AddNumberToObject(stage, "window", GetRingSize(i));
+        cJSON_AddNumberToObject(stage, "p50_ms", Percentile(stage_values, 50));
+        cJSON_AddNumberToObject(stage, "p90_ms", Percentile(stage_values, 90));
+        cJSON_AddNumberToObject(stage, "p99_ms", Percentile(stage_values, 99));
+        cJSON_AddNumberToObject(stage, "max_ms", stage_values.back() / 1000.0);
+
+        cJSON* histogram = cJSON_AddArrayToObject(stage, "histogram");
+        auto begin = stage_values.begin();
+        for (int bound : histogram_bounds_ms) {
+            auto end = std::upper_bound(begin, stage_values.end(), uint32_t(bound * 1000));
+            cJSON_AddItemToArray(histogram, cJSON_CreateNumber(end - begin));
+            begin = end;
+        }
+        cJSON_AddItemToArray(histogram, cJSON_CreateNumber(stage_values.end() - begin));
+    }
+    return json;
+}
@@ -0,0 +1,66 @@
+#ifndef AUDIO_LATENCY_TRACER_H
+#define AUDIO_LATENCY_TRACER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include <cJSON.h>
+
+// Samples kept per stage. Frame stages record every frame, the others once per reply or connection
+#define AUDIO_LATENCY_FRAME_TRACE_SIZE 128
+#define AUDIO_LATENCY_EVENT_TRACE_SIZE 32
+
+
+enum AudioLatencyStage {
+    // Mic to network
+    kLatencyStageI2sRead,       // Blocking read of one input frame
+    kLatencyStageAfeFetch,      // Last input frame fed to the processor until its output
+    kLatencyStageEncodeQueue,   // Waiting in the encode queue
+    kLatencyStageOpusEncode,
+    kLatencyStageSend,          // Encoded until handed to the protocol
+    // Network to speaker
+    kLatencyStageDecodeQueue,   // Received until the decoder picks it up, including the jitter buffer delay
+    kLatencyStageOpusDecode,
+    kLatencyStagePlaybackQueue, // Waiting in the playback queue
+    kLatencyStageOutput,        // Blocking write of one output frame
+    // Stages from here on are recorded once per reply or connection
+    // End of the user speech until the first sample of the reply is played
+    kLatencyStageResponse,
+    // Wake word until the audio channel is ready, and the connect time a warm channel saved
+    kLatencyStageChannelOpen,
+    kLatencyStageChannelSaved,
+    kLatencyStageCount,
+};
+
+/*
+ * Hot path latency tracing for the audio pipeline.
+ *
+ * Every stage records the time spent by a frame into its own lock-free ring, so any task can record
+ * without blocking the audio tasks, and the frequent stages never evict the rare ones.
+ * GetStatsJson() computes the percentiles and a histogram per stage from its ring.
+ */
+class AudioLatencyTracer {
+public:
+    void Record(AudioLatencyStage stage, int64_t elapsed_us);
+    // Record the time elapsed since start_us, ignored if start_us is 0
+    void RecordSince(AudioLatencyStage stage, int64_t start_us);
+    void Reset();
+    cJSON* GetStatsJson();
+
+    static const char* GetStageName(AudioLatencyStage stage);
+
+private:
+    static constexpr size_t kFrameStageCount = kLatencyStageResponse;
+    static constexpr size_t kTraceSize = kFrameStageCount * AUDIO_LATENCY_FRAME_TRACE_SIZE +
+        (kLatencyStageCount - kFrameStageCount) * AUDIO_LATENCY_EVENT_TRACE_SIZE;
+
+    // The rings of all the stages back to back, a sample is stored as microseconds + 1, 0 marks an empty slot
+    std::array<std::atomic<uint32_t>, kTraceSize> samples_{};
+    std::array<std::atomic<uint32_t>, kLatencyStageCount> next_{};
+
+    static size_t GetRingOffset(int stage);
+    static size_t GetRingSize(int stage);
+};
+
+#endif // AUDIO_LATENCY_TRACER_H
@@ -0,0 +1,99 @@
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+
+/*
+ * A bounded single-producer / single-consumer lock-free ring.
+ *
+ * Push() must only be called by the producer task and Pop() only by the consumer task.
+ * Clear() may be called from any task: it marks everything pushed so far as discarded and
+ * the consumer destroys those items on its next Pop(), so the producer never races with it.
+ *
+ * Capacity is the logical queue depth used for backpressure, the slots are rounded up to a
+ * power of two so the free running indices can wrap around safely.
+ */
+template <typename T, size_t Capacity>
+class SpscRing {
+public:
+    static_assert(Capacity > 0, "Capacity must be greater than 0");
+
+    bool Push(T&& item) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= kSlots) {
+            return false;
+        }
+        slots_[tail & kMask] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t flush = flush_.load(std::memory_order_acquire);
+        // Drop the items discarded by Clear()
+        while (static_cast<int32_t>(flush - head) > 0 && head != tail) {
+            slots_[head & kMask] = T();
+            head++;
+        }
+        if (head == tail) {
+            head_.store(head, std::memory_order_release);
+            return false;
+        }
+        item = std::move(slots_[head & kMask]);
+        slots_[head & kMask] = T();
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void Clear() {
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t flush = flush_.load(std::memory_order_relaxed);
+        while (static_cast<int32_t>(tail - flush) > 0 &&
+            !flush_.compare_exchange_weak(flush, tail, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    size_t Size() const {
+        uint32_t head = head_.load(std::memory_order_acquire);
+        uint32_t flush = flush_.load(std::memory_order_acquire);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t begin = static_cast<int32_t>(flush - head) > 0 ? flush : head;
+        return static_cast<int32_t>(tail - begin) > 0 ? tail - begin : 0;
+    }
+
+    bool Empty() const { return Size() == 0; }
+
+    // Full means no room for backpressure purposes, or no free slot until the consumer drains discarded items
+    bool Full() const {
+        return Size() >= Capacity ||
+            tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire) >= kSlots;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    static constexpr size_t RoundUpPowerOfTwo(size_t n) {
+        size_t v = 1;
+        while (v < n) {
+            v <<= 1;
+        }
+        return v;
+    }
+
+    static constexpr uint32_t kSlots = RoundUpPowerOfTwo(Capacity);
+    static constexpr uint32_t kMask = kSlots - 1;
+
+    std::array<T, kSlots> slots_{};
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+    std::atomic<uint32_t> flush_{0};
+};
+
+#endif // AUDIO_RING_H
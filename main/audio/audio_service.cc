@@ -1,6 +1,9 @@
 #include "audio_service.h"
+#include "pcm_utils.h"
+#include "audio_payload_pool.h"
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -17,6 +20,27 @@
 
 #define TAG "AudioService"
 
+static inline void NotifyTask(TaskHandle_t task) {
+    if (task != nullptr) {
+        xTaskNotifyGive(task);
+    }
+}
+
+// Wake the producer blocked in WaitForSpace(), called by the consumer after it frees a slot
+static inline void WakeWaiter(std::atomic<TaskHandle_t>& waiter) {
+    NotifyTask(waiter.exchange(nullptr));
+}
+
+// Block the calling producer until the consumer frees a slot in the ring
+template <typename Ring>
+static void WaitForSpace(const Ring& ring, std::atomic<TaskHandle_t>& waiter) {
+    waiter.store(xTaskGetCurrentTaskHandle());
+    if (ring.Full()) {
+        // The timeout covers a second producer overwriting the waiter
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+    waiter.store(nullptr);
+}
 
 AudioService::AudioService() {
     event_group_ = xEventGroupCreate();
@@ -35,8 +59,16 @@ void AudioService::Initialize(AudioCodec* codec) {
 
     /* Setup the audio codec */
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    opus_encoder_ = std::make_unique<OpusUplinkEncoder>(16000, CONFIG_OPUS_UPLINK_FRAME_DURATION_MS);
     opus_encoder_->SetComplexity(0);
+    opus_encoder_->SetBitrate(CONFIG_OPUS_UPLINK_BITRATE);
+    bitrate_controller_.Configure(CONFIG_OPUS_UPLINK_BITRATE);
+
+    /* Preallocate the PCM frames for the encode and playback queues */
+    encode_frame_pool_ = std::make_unique<AudioFramePool>(MAX_ENCODE_TASKS_IN_QUEUE + AUDIO_FRAME_POOL_HEADROOM,
+        CONFIG_OPUS_UPLINK_FRAME_DURATION_MS * 16000 / 1000);
+    playback_frame_pool_ = std::make_unique<AudioFramePool>(MAX_PLAYBACK_TASKS_IN_QUEUE + AUDIO_FRAME_POOL_HEADROOM,
+        OPUS_FRAME_DURATION_MS * codec->output_sample_rate() / 1000);
 
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
@@ -50,10 +82,14 @@ void AudioService::Initialize(AudioCodec* codec) {
 #endif
 
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
+        latency_tracer_.RecordSince(kLatencyStageAfeFetch, last_input_time_us_);
+        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, data);
     });
 
     audio_processor_->OnVadStateChange([this](bool speaking) {
+        if (voice_detected_ && !speaking) {
+            voice_end_time_us_ = esp_timer_get_time();
+        }
         voice_detected_ = speaking;
         if (callbacks_.on_vad_change) {
             callbacks_.on_vad_change(speaking);
@@ -84,6 +120,7 @@ void AudioService::Start() {
     xTaskCreatePinnedToCore([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->AudioInputTask();
+        audio_service->audio_input_task_handle_ = nullptr;
         vTaskDelete(NULL);
     }, "audio_input", 2048 * 3, this, 8, &audio_input_task_handle_, 0);
 
@@ -91,6 +128,7 @@ void AudioService::Start() {
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->AudioOutputTask();
+        audio_service->audio_output_task_handle_ = nullptr;
         vTaskDelete(NULL);
     }, "audio_output", 2048 * 2, this, 4, &audio_output_task_handle_);
 #else
@@ -98,6 +136,7 @@ void AudioService::Start() {
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->AudioInputTask();
+        audio_service->audio_input_task_handle_ = nullptr;
         vTaskDelete(NULL);
     }, "audio_input", 2048 * 2, this, 8, &audio_input_task_handle_);
 
@@ -105,16 +144,39 @@ void AudioService::Start() {
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->AudioOutputTask();
+        audio_service->audio_output_task_handle_ = nullptr;
         vTaskDelete(NULL);
     }, "audio_output", 2048, this, 4, &audio_output_task_handle_);
 #endif
 
-    /* Start the opus codec task */
+#if CONFIG_USE_DUAL_OPUS_PIPELINE
+    /* Start the opus encoder and decoder tasks, so a long encode never delays playback */
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusEncoderTask();
+        audio_service->opus_encoder_task_handle_ = nullptr;
+        vTaskDelete(NULL);
+    }, "opus_encoder", 2048 * 12, this, CONFIG_OPUS_ENCODER_TASK_PRIORITY, &opus_encoder_task_handle_,
+        CONFIG_OPUS_ENCODER_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_OPUS_ENCODER_TASK_CORE);
+
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusDecoderTask();
+        audio_service->opus_decoder_task_handle_ = nullptr;
+        vTaskDelete(NULL);
+    }, "opus_decoder", 2048 * 6, this, CONFIG_OPUS_DECODER_TASK_PRIORITY, &opus_decoder_task_handle_,
+        CONFIG_OPUS_DECODER_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_OPUS_DECODER_TASK_CORE);
+#else
+    /* Start the opus codec task, it serves both the encode and the decode queue */
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->OpusCodecTask();
+        audio_service->opus_encoder_task_handle_ = nullptr;
+        audio_service->opus_decoder_task_handle_ = nullptr;
         vTaskDelete(NULL);
-    }, "opus_codec", 2048 * 13, this, 2, &opus_codec_task_handle_);
+    }, "opus_codec", 2048 * 13, this, 2, &opus_decoder_task_handle_);
+    opus_encoder_task_handle_ = opus_decoder_task_handle_;
+#endif
 }
 
 void AudioService::Stop() {
@@ -124,15 +186,36 @@ void AudioService::Stop() {
         AS_EVENT_WAKE_WORD_RUNNING |
         AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    audio_encode_queue_.Clear();
+    audio_playback_queue_.Clear();
+    {
+        std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+        audio_testing_queue_.clear();
+    }
+    NotifyTask(opus_decoder_task_handle_);
+    NotifyTask(opus_encoder_task_handle_);
+    NotifyTask(audio_output_task_handle_);
+    WakeWaiter(encode_space_waiter_);
 }
 
 bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
+    AudioInputBuffers buffers;
+    return ReadAudioData(data, sample_rate, samples, buffers);
+}
+
+// Read one frame from the codec and trace how long the read blocked
+bool AudioService::ReadCodecInput(std::vector<int16_t>& data) {
+    int64_t start_time = esp_timer_get_time();
+    if (!codec_->InputData(data)) {
+        return false;
+    }
+    int64_t now = esp_timer_get_time();
+    latency_tracer_.Record(kLatencyStageI2sRead, now - start_time);
+    last_input_time_us_ = now;
+    return true;
+}
+
+bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples, AudioInputBuffers& buffers) {
     if (!codec_->input_enabled()) {
         esp_timer_stop(audio_power_timer_);
         esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
@@ -141,33 +224,33 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
 
     if (codec_->input_sample_rate() != sample_rate) {
         data.resize(samples * codec_->input_sample_rate() / sample_rate * codec_->input_channels());
-        if (!codec_->InputData(data)) {
+        if (!ReadCodecInput(data)) {
             return false;
         }
         if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            size_t frames = data.size() / 2;
+            auto& channels = buffers.channels;
+            channels.resize(frames * 2);
+            DeinterleaveStereo(data.data(), channels.data(), channels.data() + frames, frames);
+
+            size_t resampled_frames = input_resampler_.GetOutputSamples(frames);
+            auto& resampled = buffers.resampled;
+            resampled.resize(resampled_frames * 2);
+            input_resampler_.Process(channels.data(), frames, resampled.data());
+            reference_resampler_.Process(channels.data() + frames, frames, resampled.data() + resampled_frames);
+
+            data.resize(resampled_frames * 2);
+            InterleaveStereo(resampled.data(), resampled.data() + resampled_frames, data.data(), resampled_frames);
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
+            auto& resampled = buffers.resampled;
+            resampled.resize(input_resampler_.GetOutputSamples(data.size()));
             input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            // Swap instead of move so both buffers keep their capacity for the next frame
+            data.swap(resampled);
         }
     } else {
         data.resize(samples * codec_->input_channels());
-        if (!codec_->InputData(data)) {
+        if (!ReadCodecInput(data)) {
             return false;
         }
     }
@@ -188,6 +271,7 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
 }
 
 void AudioService::AudioInputTask() {
+    auto& data = input_buffers_.data;
     while (true) {
         EventBits_t bits = xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
             AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING,
@@ -204,33 +288,34 @@ void AudioService::AudioInputTask() {
 
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            size_t testing_packets;
+            {
+                std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+                testing_packets = audio_testing_queue_.size();
+            }
+            if (testing_packets >= static_cast<size_t>(AUDIO_TESTING_MAX_DURATION_MS / uplink_frame_duration_)) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
                 continue;
             }
-            std::vector<int16_t> data;
             int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
-            if (ReadAudioData(data, 16000, samples)) {
-                // If input channels is 2, we need to fetch the left channel data
+            if (ReadAudioData(data, 16000, samples, input_buffers_)) {
+                // If input channels is 2, we need to fetch the left channel data (in place)
                 if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
+                    size_t mono_samples = data.size() / 2;
+                    ExtractLeftChannel(data.data(), data.data(), mono_samples);
+                    data.resize(mono_samples);
                 }
-                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
+                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, data);
                 continue;
             }
         }
 
         /* Feed the wake word */
         if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
+                if (ReadAudioData(data, 16000, samples, input_buffers_)) {
                     wake_word_->Feed(data);
                     continue;
                 }
@@ -239,10 +324,9 @@ void AudioService::AudioInputTask() {
 
         /* Feed the audio processor */
         if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
+                if (ReadAudioData(data, 16000, samples, input_buffers_)) {
                     audio_processor_->Feed(std::move(data));
                     continue;
                 }
@@ -257,24 +341,39 @@ void AudioService::AudioInputTask() {
 }
 
 void AudioService::AudioOutputTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
-        if (service_stopped_) {
-            break;
+    while (!service_stopped_) {
+        AudioTaskPtr task;
+        if (!audio_playback_queue_.Pop(task)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
         }
-
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
-        lock.unlock();
+        /* The codec task may be waiting for room in the playback queue */
+        NotifyTask(opus_decoder_task_handle_);
 
         if (!codec_->output_enabled()) {
             esp_timer_stop(audio_power_timer_);
             esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
             codec_->EnableOutput(true);
         }
+        latency_tracer_.RecordSince(kLatencyStagePlaybackQueue, task->trace_time);
+        int64_t output_start_time = esp_timer_get_time();
         codec_->OutputData(task->pcm);
+        latency_tracer_.Record(kLatencyStageOutput, esp_timer_get_time() - output_start_time);
+
+        /* The first reply frame after the user stopped speaking closes the response time */
+        if (task->segment != output_segment_) {
+            output_segment_ = task->segment;
+            int64_t voice_end_time = task->segment != 0 ? voice_end_time_us_.exchange(0) : 0;
+            if (voice_end_time != 0) {
+                latency_tracer_.Record(kLatencyStageResponse, output_start_time - voice_end_time);
+            }
+            /* Readers see the old segment at 0 ms rather than the new one with the old progress */
+            segment_played_samples_ = 0;
+            segment_played_ms_ = 0;
+            playing_segment_ = task->segment;
+        }
+        segment_played_samples_ += task->pcm.size();
+        segment_played_ms_ = segment_played_samples_ * 1000 / codec_->output_sample_rate();
 
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
@@ -283,8 +382,7 @@ void AudioService::AudioOutputTask() {
 #if CONFIG_USE_SERVER_AEC
         /* Record the timestamp for server AEC */
         if (task->timestamp > 0) {
-            lock.lock();
-            timestamp_queue_.push_back(task->timestamp);
+            timestamp_queue_.Push(uint32_t(task->timestamp));
         }
 #endif
     }
@@ -293,82 +391,281 @@ void AudioService::AudioOutputTask() {
 }
 
 void AudioService::OpusCodecTask() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
-        if (service_stopped_) {
-            break;
+    while (!service_stopped_) {
+        bool busy = DecodeNextPacket();
+        busy = EncodeNextTask() || busy;
+        if (!busy) {
+            ulTaskNotifyTake(pdTRUE, GetDecodeWaitTicks());
         }
+    }
 
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
-
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
-                // Resample if the sample rate is different
-                if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
-                }
+    ESP_LOGW(TAG, "Opus codec task stopped");
+}
 
-                lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
-            } else {
-                ESP_LOGE(TAG, "Failed to decode audio");
-                lock.lock();
-            }
-            debug_statistics_.decode_count++;
+void AudioService::OpusEncoderTask() {
+    while (!service_stopped_) {
+        if (!EncodeNextTask()) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
         }
-        
-        /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
-            packet->sample_rate = 16000;
-            packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
-                continue;
-            }
+    }
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
-                    callbacks_.on_send_queue_available();
-                }
-            } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
+    ESP_LOGW(TAG, "Opus encoder task stopped");
+}
+
+void AudioService::OpusDecoderTask() {
+    while (!service_stopped_) {
+        if (!DecodeNextPacket()) {
+            ulTaskNotifyTake(pdTRUE, GetDecodeWaitTicks());
+        }
+    }
+
+    ESP_LOGW(TAG, "Opus decoder task stopped");
+}
+
+// Decode one packet from the decode queue, returns false if there was nothing to do
+bool AudioService::DecodeNextPacket() {
+    std::unique_ptr<AudioStreamPacket> packet;
+    if (audio_playback_queue_.Full()) {
+        return false;
+    }
+    if (!PopPacketFromDecodeQueue(packet)) {
+        return FlushCrossfadeTail();
+    }
+
+    int64_t start_time = esp_timer_get_time();
+    latency_tracer_.RecordSince(kLatencyStageDecodeQueue, packet->trace_time);
+    auto task = playback_frame_pool_->Acquire();
+    task->type = kAudioTaskTypeDecodeToPlaybackQueue;
+    task->timestamp = packet->timestamp;
+    task->segment = packet->segment;
+
+    SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+    bool decoded;
+    if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+        // Decode into the scratch buffer and resample directly into the pooled frame
+        decoded = opus_decoder_->Decode(std::move(packet->payload), decode_buffer_);
+        if (decoded) {
+            TrimDecodedSamples(decode_buffer_, *packet);
+            task->pcm.resize(output_resampler_.GetOutputSamples(decode_buffer_.size()));
+            output_resampler_.Process(decode_buffer_.data(), decode_buffer_.size(), task->pcm.data());
+        }
+    } else {
+        decoded = opus_decoder_->Decode(std::move(packet->payload), task->pcm);
+        if (decoded) {
+            TrimDecodedSamples(task->pcm, *packet);
+        }
+    }
+    if (decoded) {
+        CrossfadeSegments(task->pcm, task->segment, IsSegmentEnd(task->segment));
+    }
+    AudioPayloadPool::GetInstance().Release(std::move(packet->payload));
+    int64_t end_time = esp_timer_get_time();
+    debug_statistics_.decode_timing.Record(end_time - start_time);
+    latency_tracer_.Record(kLatencyStageOpusDecode, end_time - start_time);
+
+    if (!decoded) {
+        ESP_LOGE(TAG, "Failed to decode audio");
+    } else if (!task->pcm.empty()) {
+        // A packet can be trimmed entirely by the Ogg pre-skip
+        task->trace_time = end_time;
+        audio_playback_queue_.Push(std::move(task));
+        NotifyTask(audio_output_task_handle_);
+    }
+    debug_statistics_.decode_count++;
+    return true;
+}
+
+// Encode one task from the encode queue, returns false if there was nothing to do
+bool AudioService::EncodeNextTask() {
+    AudioTaskPtr task;
+    if (IsSendQueueFull() || !audio_encode_queue_.Pop(task)) {
+        return false;
+    }
+    WakeWaiter(encode_space_waiter_);
+    ApplyUplinkParams();
+
+    int64_t start_time = esp_timer_get_time();
+    latency_tracer_.RecordSince(kLatencyStageEncodeQueue, task->trace_time);
+    // The encoder buffers the input, a task yields no packet or several if its duration differs from the frames
+    std::vector<std::unique_ptr<AudioStreamPacket>> packets;
+    // Packets for the server leave room for the protocol header, the testing ones are decoded locally
+    size_t headroom = task->type == kAudioTaskTypeEncodeToSendQueue ? AUDIO_PACKET_HEADROOM : 0;
+    bool encoded = opus_encoder_->Encode(task->pcm, headroom, [&](std::vector<uint8_t>&& payload) {
+        auto packet = std::make_unique<AudioStreamPacket>();
+        packet->frame_duration = opus_encoder_->duration_ms();
+        packet->sample_rate = 16000;
+        packet->timestamp = task->timestamp;
+        packet->headroom = headroom;
+        packet->payload = std::move(payload);
+        packets.push_back(std::move(packet));
+    });
+    int64_t end_time = esp_timer_get_time();
+    debug_statistics_.encode_timing.Record(end_time - start_time);
+    latency_tracer_.Record(kLatencyStageOpusEncode, end_time - start_time);
+    if (!encoded) {
+        ESP_LOGE(TAG, "Failed to encode audio");
+    }
+
+    for (auto& packet : packets) {
+        packet->trace_time = end_time;
+        if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+            if (!audio_send_queue_.Push(std::move(packet))) {
+                ESP_LOGW(TAG, "Send queue is full, dropping packet");
             }
-            debug_statistics_.encode_count++;
-            lock.lock();
+        } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
+            std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+            audio_testing_queue_.push_back(std::move(packet));
         }
+        debug_statistics_.encode_count++;
     }
 
-    ESP_LOGW(TAG, "Opus codec task stopped");
+    if (task->type == kAudioTaskTypeEncodeToSendQueue && !packets.empty()) {
+#if CONFIG_OPUS_UPLINK_ADAPTIVE_BITRATE
+        int duration = opus_encoder_->duration_ms();
+        int bitrate = bitrate_controller_.Update(audio_send_queue_.Size() * duration, duration);
+        opus_encoder_->SetBitrate(bitrate);
+        uplink_bitrate_ = bitrate;
+#endif
+        if (callbacks_.on_send_queue_available) {
+            callbacks_.on_send_queue_available();
+        }
+    }
+    return true;
+}
+
+void AudioService::ApplyUplinkParams() {
+    int frame_duration = pending_uplink_frame_duration_.exchange(0);
+    if (frame_duration > 0 && frame_duration != opus_encoder_->duration_ms() && opus_encoder_->SetDuration(frame_duration)) {
+        uplink_frame_duration_ = frame_duration;
+    }
+    int bitrate = pending_uplink_bitrate_.exchange(0);
+    if (bitrate > 0) {
+        bitrate_controller_.Configure(bitrate);
+        opus_encoder_->SetBitrate(bitrate);
+        uplink_bitrate_ = bitrate;
+    }
+}
+
+// The send queue is bounded by the duration of the audio in it, whatever the frame duration
+bool AudioService::IsSendQueueFull() const {
+    return audio_send_queue_.Full() ||
+        audio_send_queue_.Size() * uplink_frame_duration_ >= MAX_SEND_QUEUE_DURATION_MS;
+}
+
+void AudioService::SetUplinkParams(int frame_duration_ms, int bitrate) {
+    ESP_LOGI(TAG, "Uplink params: %d ms frames, %d bps", frame_duration_ms, bitrate);
+    pending_uplink_frame_duration_ = frame_duration_ms;
+    pending_uplink_bitrate_ = bitrate;
+    NotifyTask(opus_encoder_task_handle_);
+}
+
+bool AudioService::PopPacketFromDecodeQueue(std::unique_ptr<AudioStreamPacket>& packet) {
+    if (jitter_buffer_.Pop(packet)) {
+        return true;
+    }
+
+    if (PopSoundPacket(packet)) {
+        return true;
+    }
+
+    /* Play back the recorded audio after audio testing */
+    if (audio_testing_playback_) {
+        std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+        if (!audio_testing_queue_.empty()) {
+            packet = std::move(audio_testing_queue_.front());
+            audio_testing_queue_.pop_front();
+            return true;
+        }
+        audio_testing_playback_ = false;
+    }
+    return false;
+}
+
+// Pull the next packet of the sound being played, the Ogg data is demuxed as it plays
+bool AudioService::PopSoundPacket(std::unique_ptr<AudioStreamPacket>& packet) {
+    std::lock_guard<std::mutex> lock(sounds_mutex_);
+    while (!sounds_.empty()) {
+        auto& sound = sounds_.front();
+        packet = std::make_unique<AudioStreamPacket>();
+        if (sound->NextPacket(*packet)) {
+            return true;
+        }
+        sounds_.pop_front();
+    }
+    packet.reset();
+    return false;
+}
+
+void AudioService::TrimDecodedSamples(std::vector<int16_t>& pcm, const AudioStreamPacket& packet) {
+    if (packet.trim_start == 0 && packet.trim_end == 0) {
+        return;
+    }
+    size_t trim_start = std::min<size_t>(packet.trim_start, pcm.size());
+    size_t trim_end = std::min<size_t>(packet.trim_end, pcm.size() - trim_start);
+    pcm.erase(pcm.end() - trim_end, pcm.end());
+    pcm.erase(pcm.begin(), pcm.begin() + trim_start);
+}
+
+// The last frame of a segment is known once a later segment began or the timeline ended and no
+// packet of it is left in the jitter buffer. Segment 0 is the audio outside a reply, e.g. sounds.
+bool AudioService::IsSegmentEnd(uint32_t segment) {
+    if (segment == 0 || (segment == playback_segment_ && playback_timeline_open_)) {
+        return false;
+    }
+    return !jitter_buffer_.HasSegment(segment);
+}
+
+// The end of the last frame of a segment is held back, so the first frame of the next segment can
+// fade in over it
+void AudioService::CrossfadeSegments(std::vector<int16_t>& pcm, uint32_t segment, bool segment_end) {
+    if (crossfade_reset_.exchange(false)) {
+        crossfade_tail_.clear();
+    }
+    size_t length = codec_->output_sample_rate() / 1000 * AUDIO_SEGMENT_CROSSFADE_MS;
+    bool new_segment = segment != decoded_segment_;
+    decoded_segment_ = segment;
+
+    if (pcm.size() < 2 * length) {
+        // Too short to fade or hold anything back, e.g. the trimmed end of a sound
+        pcm.insert(pcm.begin(), crossfade_tail_.begin(), crossfade_tail_.end());
+        crossfade_tail_.clear();
+        return;
+    }
+
+    if (new_segment && crossfade_tail_.size() == length) {
+        for (size_t i = 0; i < length; i++) {
+            int32_t mixed = crossfade_tail_[i] * int32_t(length - i) + pcm[i] * int32_t(i);
+            pcm[i] = mixed / int32_t(length);
+        }
+        crossfade_tail_.clear();
+    }
+
+    // A tail that was not faded into, e.g. before a concealed frame of the same segment, plays first
+    pcm.insert(pcm.begin(), crossfade_tail_.begin(), crossfade_tail_.end());
+    crossfade_tail_.clear();
+    if (segment_end) {
+        crossfade_tail_.assign(pcm.end() - length, pcm.end());
+        pcm.resize(pcm.size() - length);
+    }
+}
+
+// Play the held back end of a segment once there is nothing left to decode
+bool AudioService::FlushCrossfadeTail() {
+    if (crossfade_reset_.exchange(false)) {
+        crossfade_tail_.clear();
+    }
+    if (crossfade_tail_.empty() || !jitter_buffer_.IsEmpty()) {
+        return false;
+    }
+
+    auto task = playback_frame_pool_->Acquire();
+    task->type = kAudioTaskTypeDecodeToPlaybackQueue;
+    task->segment = decoded_segment_;
+    task->pcm.assign(crossfade_tail_.begin(), crossfade_tail_.end());
+    crossfade_tail_.clear();
+    audio_playback_queue_.Push(std::move(task));
+    NotifyTask(audio_output_task_handle_);
+    return true;
 }
 
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
@@ -386,51 +683,83 @@ void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     }
 }
 
-void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, const std::vector<int16_t>& pcm) {
+    auto task = encode_frame_pool_->Acquire();
     task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+    task->pcm.assign(pcm.begin(), pcm.end());
+    task->trace_time = esp_timer_get_time();
 
     /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        size_t pending = timestamp_queue_.Size();
+        uint32_t timestamp;
+        if (timestamp_queue_.Pop(timestamp)) {
+            if (pending <= MAX_TIMESTAMPS_IN_QUEUE) {
+                task->timestamp = timestamp;
+            } else {
+                ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", pending);
+            }
         }
-        timestamp_queue_.pop_front();
     }
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+    /* Push the task to the encode queue, wait if the queue is full */
+    while (!service_stopped_) {
+        {
+            std::lock_guard<std::mutex> lock(encode_producer_mutex_);
+            if (audio_encode_queue_.Push(std::move(task))) {
+                break;
+            }
+        }
+        WaitForSpace(audio_encode_queue_, encode_space_waiter_);
+    }
+    NotifyTask(opus_encoder_task_handle_);
 }
 
-bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
-            return false;
-        }
+void AudioService::PushPacketToJitterBuffer(std::unique_ptr<AudioStreamPacket> packet) {
+    packet->segment = playback_segment_;
+    packet->trace_time = esp_timer_get_time();
+    jitter_buffer_.Put(std::move(packet));
+    NotifyTask(opus_decoder_task_handle_);
+}
+
+void AudioService::OpenPlaybackTimeline() {
+    playback_timeline_open_ = true;
+}
+
+uint32_t AudioService::BeginPlaybackSegment() {
+    return ++playback_segment_;
+}
+
+void AudioService::EndPlaybackTimeline() {
+    // The audio already received keeps playing
+    playback_timeline_open_ = false;
+}
+
+// The jitter buffer may hold packets back, wake up when the first one is due
+TickType_t AudioService::GetDecodeWaitTicks() {
+    if (audio_playback_queue_.Full()) {
+        // The output task notifies us when it frees a slot
+        return portMAX_DELAY;
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
-    return true;
+    int wait_ms = jitter_buffer_.GetWaitTime();
+    if (wait_ms < 0) {
+        return portMAX_DELAY;
+    }
+    return pdMS_TO_TICKS(wait_ms) + 1;
+}
+
+void AudioService::ClearSendQueue() {
+    audio_send_queue_.Clear();
+    NotifyTask(opus_encoder_task_handle_);
 }
 
 std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
+    std::unique_ptr<AudioStreamPacket> packet;
+    if (!audio_send_queue_.Pop(packet)) {
         return nullptr;
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
+    /* The codec task may be waiting for room in the send queue */
+    NotifyTask(opus_encoder_task_handle_);
     return packet;
 }
 
@@ -478,7 +807,7 @@ void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+            audio_processor_->Initialize(codec_, CONFIG_OPUS_UPLINK_FRAME_DURATION_MS, models_list_);
             audio_processor_initialized_ = true;
         }
 
@@ -499,17 +828,16 @@ void AudioService::EnableAudioTesting(bool enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        /* Let the codec task play back audio_testing_queue_ */
+        audio_testing_playback_ = true;
+        NotifyTask(opus_decoder_task_handle_);
     }
 }
 
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
     if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+        audio_processor_->Initialize(codec_, CONFIG_OPUS_UPLINK_FRAME_DURATION_MS, models_list_);
         audio_processor_initialized_ = true;
     }
 
@@ -520,118 +848,61 @@ void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
     callbacks_ = callbacks;
 }
 
-void AudioService::PlaySound(const std::string_view& ogg) {
+std::shared_ptr<SoundPlayback> AudioService::PlaySound(const std::string_view& ogg) {
     if (!codec_->output_enabled()) {
         esp_timer_stop(audio_power_timer_);
         esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
         codec_->EnableOutput(true);
     }
 
-    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
-    size_t size = ogg.size();
-    size_t offset = 0;
-
-    auto find_page = [&](size_t start)->size_t {
-        for (size_t i = start; i + 4 <= size; ++i) {
-            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
-        }
-        return static_cast<size_t>(-1);
-    };
-
-    bool seen_head = false;
-    bool seen_tags = false;
-    int sample_rate = 16000; // 默认值
-
-    while (true) {
-        size_t pos = find_page(offset);
-        if (pos == static_cast<size_t>(-1)) break;
-        offset = pos;
-        if (offset + 27 > size) break;
-
-        const uint8_t* page = buf + offset;
-        uint8_t page_segments = page[26];
-        size_t seg_table_off = offset + 27;
-        if (seg_table_off + page_segments > size) break;
-
-        size_t body_size = 0;
-        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
-
-        size_t body_off = seg_table_off + page_segments;
-        if (body_off + body_size > size) break;
-
-        // Parse packets using lacing
-        size_t cur = body_off;
-        size_t seg_idx = 0;
-        while (seg_idx < page_segments) {
-            size_t pkt_len = 0;
-            size_t pkt_start = cur;
-            bool continued = false;
-            do {
-                uint8_t l = page[27 + seg_idx++];
-                pkt_len += l;
-                cur += l;
-                continued = (l == 255);
-            } while (continued && seg_idx < page_segments);
-
-            if (pkt_len == 0) continue;
-            const uint8_t* pkt_ptr = buf + pkt_start;
-
-            if (!seen_head) {
-                // 解析OpusHead包
-                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
-                    seen_head = true;
-                    
-                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
-                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
-                    if (pkt_len >= 12) {
-                        uint8_t version = pkt_ptr[8];
-                        uint8_t channel_count = pkt_ptr[9];
-                        
-                        if (pkt_len >= 16) {
-                            // 读取输入采样率 (little-endian)
-                            sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | 
-                                        (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
-                            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", 
-                                   version, channel_count, sample_rate);
-                        }
-                    }
-                }
-                continue;
-            }
-            if (!seen_tags) {
-                // Expect OpusTags in second packet
-                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
-                    seen_tags = true;
-                }
-                continue;
-            }
-
-            // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->sample_rate = sample_rate;
-            packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
-            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
-            PushPacketToDecodeQueue(std::move(packet), true);
+    auto sound = std::make_shared<SoundPlayback>(ogg);
+    {
+        std::lock_guard<std::mutex> lock(sounds_mutex_);
+        if (sounds_.size() >= MAX_PENDING_SOUNDS) {
+            ESP_LOGW(TAG, "Too many pending sounds, dropping sound");
+            sound->Cancel();
+            return sound;
         }
-
-        offset = body_off + body_size;
+        sounds_.push_back(sound);
     }
+    NotifyTask(opus_decoder_task_handle_);
+    return sound;
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    {
+        std::lock_guard<std::mutex> lock(sounds_mutex_);
+        if (!sounds_.empty()) {
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+    return audio_encode_queue_.Empty() && jitter_buffer_.IsEmpty() &&
+        audio_playback_queue_.Empty() && audio_testing_queue_.empty();
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    // The rest of a discarded reply must not be queued again
+    playback_timeline_open_ = false;
     opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    timestamp_queue_.Clear();
+    jitter_buffer_.Reset();
+    crossfade_reset_ = true;
+    {
+        std::lock_guard<std::mutex> lock(sounds_mutex_);
+        for (auto& sound : sounds_) {
+            sound->Cancel();
+        }
+        sounds_.clear();
+    }
+    audio_playback_queue_.Clear();
+    {
+        std::lock_guard<std::mutex> lock(audio_testing_mutex_);
+        audio_testing_queue_.clear();
+    }
+    /* Wake the consumers so they release the discarded frames */
+    NotifyTask(opus_decoder_task_handle_);
+    NotifyTask(audio_output_task_handle_);
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
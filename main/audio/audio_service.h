@@ -3,7 +3,7 @@
 
 #include <memory>
 #include <deque>
-#include <condition_variable>
+#include <atomic>
 #include <chrono>
 #include <mutex>
 
@@ -18,6 +18,12 @@
 #include <opus_resampler.h>
 
 #include "audio_codec.h"
+#include "audio_frame_pool.h"
+#include "audio_jitter_buffer.h"
+#include "audio_latency_tracer.h"
+#include "audio_ring.h"
+#include "opus_uplink_encoder.h"
+#include "sound_playback.h"
 #include "audio_processor.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
@@ -27,21 +33,37 @@
 /*
  * There are two types of audio data flow:
  * 1. (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
- * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ * 2. (Server) -> {Jitter Buffer} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ *    Local sounds are pulled packet by packet from their Ogg data by the Opus Decoder instead.
  *
  * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
+ * With CONFIG_USE_DUAL_OPUS_PIPELINE, the Opus Encoder and Opus Decoder run in two tasks instead.
  * 
- * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
+ * Jitter Buffer and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
+ *
+ * The uplink frame duration and bitrate are negotiated in the hello exchange. The Send Queue is bounded
+ * by duration, and the encoder lowers its bitrate while audio backs up in it.
  * 
+ * The audio of a TTS reply is tagged with a playback segment per sentence. Starting a reply does not
+ * reset the decoder, so audio received ahead of the state change is kept, and the decoder cross-fades
+ * the boundary between two segments.
+ *
+ * Every queue is a lock-free single-producer / single-consumer ring. Producers wake the consumer task
+ * with a task notification, and producers blocked by backpressure are woken the same way.
  */
 
 #define OPUS_FRAME_DURATION_MS 60
 #define MAX_ENCODE_TASKS_IN_QUEUE 2
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
-#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+#define OPUS_UPLINK_MIN_FRAME_DURATION_MS 20
+#define MAX_SEND_QUEUE_DURATION_MS 2400
+#define MAX_SEND_PACKETS_IN_QUEUE (MAX_SEND_QUEUE_DURATION_MS / OPUS_UPLINK_MIN_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
 #define MAX_TIMESTAMPS_IN_QUEUE 3
+#define MAX_PENDING_SOUNDS 16
+#define AUDIO_SEGMENT_CROSSFADE_MS 10
+// Frames held outside the queues: one being filled by the producer and one being processed by the consumer
+#define AUDIO_FRAME_POOL_HEADROOM 2
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
@@ -60,16 +82,28 @@ struct AudioServiceCallbacks {
 };
 
 
-enum AudioTaskType {
-    kAudioTaskTypeEncodeToSendQueue,
-    kAudioTaskTypeEncodeToTestingQueue,
-    kAudioTaskTypeDecodeToPlaybackQueue,
+struct AudioInputBuffers {
+    std::vector<int16_t> data;
+    // Planar scratch buffers, the mic channel followed by the reference channel
+    std::vector<int16_t> channels;
+    std::vector<int16_t> resampled;
 };
 
-struct AudioTask {
-    AudioTaskType type;
-    std::vector<int16_t> pcm;
-    uint32_t timestamp;
+struct StageTiming {
+    uint32_t count = 0;
+    uint32_t last_us = 0;
+    uint32_t max_us = 0;
+    uint64_t total_us = 0;
+
+    void Record(int64_t elapsed_us) {
+        last_us = elapsed_us;
+        if (last_us > max_us) {
+            max_us = last_us;
+        }
+        total_us += last_us;
+        count++;
+    }
+    uint32_t average_us() const { return count > 0 ? total_us / count : 0; }
 };
 
 struct DebugStatistics {
@@ -77,6 +111,8 @@ struct DebugStatistics {
     uint32_t decode_count = 0;
     uint32_t encode_count = 0;
     uint32_t playback_count = 0;
+    StageTiming decode_timing;
+    StageTiming encode_timing;
 };
 
 class AudioService {
@@ -103,12 +139,30 @@ public:
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
-    bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
+    void PushPacketToJitterBuffer(std::unique_ptr<AudioStreamPacket> packet);
+    JitterBufferStatistics GetJitterBufferStatistics() { return jitter_buffer_.GetStatistics(); }
+    // Accepts the reply audio until EndPlaybackTimeline() or ResetDecoder()
+    void OpenPlaybackTimeline();
+    // Tags the audio received from now on with a new segment
+    uint32_t BeginPlaybackSegment();
+    void EndPlaybackTimeline();
+    bool IsPlaybackTimelineOpen() const { return playback_timeline_open_; }
+    // The segment being played and how much of it was played, e.g. to reveal the text of a sentence
+    uint32_t GetPlayingSegment() const { return playing_segment_; }
+    int GetSegmentPlayedMs() const { return segment_played_ms_; }
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
-    void PlaySound(const std::string_view& sound);
+    // Applied by the encoder before its next frame
+    void SetUplinkParams(int frame_duration_ms, int bitrate);
+    int GetUplinkBitrate() const { return uplink_bitrate_; }
+    // Queues the sound and returns immediately, the returned handle can cancel it
+    std::shared_ptr<SoundPlayback> PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
+    // Drop the encoded audio that was not sent, e.g. when the channel failed to open
+    void ClearSendQueue();
     void SetModelsList(srmodel_list_t* models_list);
+    const DebugStatistics& GetDebugStatistics() const { return debug_statistics_; }
+    AudioLatencyTracer& GetLatencyTracer() { return latency_tracer_; }
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -116,12 +170,28 @@ private:
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+    std::unique_ptr<OpusUplinkEncoder> opus_encoder_;
+    UplinkBitrateController bitrate_controller_;
+    // Set by SetUplinkParams(), 0 if unchanged
+    std::atomic<int> pending_uplink_frame_duration_ = 0;
+    std::atomic<int> pending_uplink_bitrate_ = 0;
+    std::atomic<int> uplink_frame_duration_ = CONFIG_OPUS_UPLINK_FRAME_DURATION_MS;
+    std::atomic<int> uplink_bitrate_ = CONFIG_OPUS_UPLINK_BITRATE;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
     OpusResampler output_resampler_;
+    std::unique_ptr<AudioFramePool> encode_frame_pool_;
+    std::unique_ptr<AudioFramePool> playback_frame_pool_;
     DebugStatistics debug_statistics_;
+    AudioLatencyTracer latency_tracer_;
+    // Trace points shared between tasks
+    std::atomic<int64_t> last_input_time_us_ = 0;
+    std::atomic<int64_t> voice_end_time_us_ = 0;
+    uint32_t output_segment_ = 0;
+    int64_t segment_played_samples_ = 0;
+    std::atomic<uint32_t> playing_segment_ = 0;
+    std::atomic<int> segment_played_ms_ = 0;
     srmodel_list_t* models_list_ = nullptr;
 
     EventGroupHandle_t event_group_;
@@ -129,16 +199,35 @@ private:
     // Audio encode / decode
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
-    TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    // Both handles point to the same opus_codec task unless CONFIG_USE_DUAL_OPUS_PIPELINE is enabled
+    TaskHandle_t opus_encoder_task_handle_ = nullptr;
+    TaskHandle_t opus_decoder_task_handle_ = nullptr;
+    SpscRing<std::unique_ptr<AudioStreamPacket>, MAX_SEND_PACKETS_IN_QUEUE> audio_send_queue_;
+    SpscRing<AudioTaskPtr, MAX_ENCODE_TASKS_IN_QUEUE> audio_encode_queue_;
+    SpscRing<AudioTaskPtr, MAX_PLAYBACK_TASKS_IN_QUEUE> audio_playback_queue_;
+    // Audio received from the server
+    AudioJitterBuffer jitter_buffer_;
     // For server AEC
-    std::deque<uint32_t> timestamp_queue_;
+    SpscRing<uint32_t, MAX_TIMESTAMPS_IN_QUEUE + 1> timestamp_queue_;
+    // The encode queue can be fed from more than one task, serialize its producers
+    std::mutex encode_producer_mutex_;
+    std::atomic<TaskHandle_t> encode_space_waiter_ = nullptr;
+    // Audio testing is not realtime, it records up to AUDIO_TESTING_MAX_DURATION_MS before playback
+    std::mutex audio_testing_mutex_;
+    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
+    std::atomic<bool> audio_testing_playback_ = false;
+    // Sounds waiting to be played, the front one is being decoded
+    std::mutex sounds_mutex_;
+    std::deque<std::shared_ptr<SoundPlayback>> sounds_;
+    // Scratch buffers owned by the input task and the codec task, reused for every frame
+    AudioInputBuffers input_buffers_;
+    std::vector<int16_t> decode_buffer_;
+    // Playback timeline, the segment state below the atomics is owned by the decoder task
+    std::atomic<bool> playback_timeline_open_ = false;
+    std::atomic<uint32_t> playback_segment_ = 0;
+    std::atomic<bool> crossfade_reset_ = false;
+    uint32_t decoded_segment_ = 0;
+    std::vector<int16_t> crossfade_tail_;
 
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
@@ -153,7 +242,22 @@ private:
     void AudioInputTask();
     void AudioOutputTask();
     void OpusCodecTask();
-    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
+    void OpusEncoderTask();
+    void OpusDecoderTask();
+    bool DecodeNextPacket();
+    bool EncodeNextTask();
+    void ApplyUplinkParams();
+    bool IsSendQueueFull() const;
+    bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples, AudioInputBuffers& buffers);
+    bool ReadCodecInput(std::vector<int16_t>& data);
+    void PushTaskToEncodeQueue(AudioTaskType type, const std::vector<int16_t>& pcm);
+    bool PopPacketFromDecodeQueue(std::unique_ptr<AudioStreamPacket>& packet);
+    bool PopSoundPacket(std::unique_ptr<AudioStreamPacket>& packet);
+    void TrimDecodedSamples(std::vector<int16_t>& pcm, const AudioStreamPacket& packet);
+    bool IsSegmentEnd(uint32_t segment);
+    void CrossfadeSegments(std::vector<int16_t>& pcm, uint32_t segment, bool segment_end);
+    bool FlushCrossfadeTail();
+    TickType_t GetDecodeWaitTicks();
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
     void CheckAndUpdateAudioPowerState();
 };
@@ -0,0 +1,217 @@
+#include "ogg_demuxer.h"
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "OggDemuxer"
+
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_HEADER_TYPE_CONTINUED 0x01
+#define OGG_HEADER_TYPE_END_OF_STREAM 0x04
+
+
+static inline uint16_t ReadLe16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t ReadLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+OggOpusDemuxer::OggOpusDemuxer(std::string_view data) : data_(data) {
+}
+
+bool OggOpusDemuxer::Open() {
+    const uint8_t* data;
+    size_t size;
+
+    // OpusHead: [0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
+    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
+    if (!ReadRawPacket(data, size) || size < 19 || std::memcmp(data, "OpusHead", 8) != 0) {
+        ESP_LOGE(TAG, "OpusHead not found");
+        return false;
+    }
+    channels_ = data[9];
+    pre_skip_ = ReadLe16(data + 10);
+    uint32_t input_sample_rate = ReadLe32(data + 12);
+    switch (input_sample_rate) {
+        case 8000:
+        case 12000:
+        case 16000:
+        case 24000:
+        case 48000:
+            sample_rate_ = input_sample_rate;
+            break;
+        default:
+            // The decoder can only output the Opus rates, 48 kHz is always valid
+            sample_rate_ = 48000;
+            break;
+    }
+    ESP_LOGD(TAG, "OpusHead: version=%d, channels=%d, pre_skip=%d, sample_rate=%lu",
+        data[8], channels_, pre_skip_, input_sample_rate);
+
+    if (!ReadRawPacket(data, size) || size < 8 || std::memcmp(data, "OpusTags", 8) != 0) {
+        ESP_LOGE(TAG, "OpusTags not found");
+        return false;
+    }
+    position_ = 0;
+    return true;
+}
+
+bool OggOpusDemuxer::NextPacket(OggOpusPacket& packet) {
+    while (ReadRawPacket(packet.data, packet.size)) {
+        packet.samples = GetPacketSamples(packet.data, packet.size);
+        if (packet.samples == 0) {
+            ESP_LOGW(TAG, "Skipping invalid packet of %u bytes", packet.size);
+            continue;
+        }
+
+        uint64_t start = position_;
+        position_ += packet.samples;
+        packet.trim_start = 0;
+        packet.trim_end = 0;
+        if (start < static_cast<uint64_t>(pre_skip_)) {
+            packet.trim_start = std::min<uint64_t>(pre_skip_ - start, packet.samples);
+        }
+        // The granule position of the last page marks the end of the audio, the rest is padding
+        if (end_of_stream_ && granule_position_ >= 0 && position_ > static_cast<uint64_t>(granule_position_)) {
+            packet.trim_end = std::min<uint64_t>(position_ - granule_position_, packet.samples - packet.trim_start);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool OggOpusDemuxer::LoadNextPage() {
+    auto buf = reinterpret_cast<const uint8_t*>(data_.data());
+    size_t size = data_.size();
+
+    while (offset_ + OGG_PAGE_HEADER_SIZE <= size) {
+        const uint8_t* page = buf + offset_;
+        if (std::memcmp(page, "OggS", 4) != 0) {
+            // Resynchronize on the next capture pattern
+            offset_++;
+            continue;
+        }
+
+        int segment_count = page[26];
+        size_t body_offset = offset_ + OGG_PAGE_HEADER_SIZE + segment_count;
+        if (body_offset > size) {
+            break;
+        }
+        size_t body_size = 0;
+        for (int i = 0; i < segment_count; i++) {
+            body_size += page[OGG_PAGE_HEADER_SIZE + i];
+        }
+        if (body_offset + body_size > size) {
+            break;
+        }
+
+        uint8_t header_type = page[5];
+        if (!continued_packet_.empty() && !(header_type & OGG_HEADER_TYPE_CONTINUED)) {
+            ESP_LOGW(TAG, "Dropping an unterminated packet of %u bytes", continued_packet_.size());
+            continued_packet_.clear();
+        }
+        granule_position_ = static_cast<int64_t>(ReadLe32(page + 6) | (static_cast<uint64_t>(ReadLe32(page + 10)) << 32));
+        end_of_stream_ = header_type & OGG_HEADER_TYPE_END_OF_STREAM;
+        segments_ = page + OGG_PAGE_HEADER_SIZE;
+        segment_count_ = segment_count;
+        segment_index_ = 0;
+        body_offset_ = body_offset;
+        offset_ = body_offset + body_size;
+        return true;
+    }
+
+    offset_ = size;
+    return false;
+}
+
+bool OggOpusDemuxer::ReadRawPacket(const uint8_t*& data, size_t& size) {
+    auto buf = reinterpret_cast<const uint8_t*>(data_.data());
+    // The packet returned by the previous call is no longer used
+    continued_packet_.clear();
+
+    while (true) {
+        if (segment_index_ >= segment_count_) {
+            if (!LoadNextPage()) {
+                return false;
+            }
+            continue;
+        }
+
+        // A packet ends with the first lacing value below 255
+        size_t start = body_offset_;
+        size_t length = 0;
+        bool complete = false;
+        while (segment_index_ < segment_count_) {
+            uint8_t lacing = segments_[segment_index_++];
+            length += lacing;
+            if (lacing < 255) {
+                complete = true;
+                break;
+            }
+        }
+        body_offset_ += length;
+
+        if (!complete) {
+            // The packet continues on the next page
+            continued_packet_.insert(continued_packet_.end(), buf + start, buf + start + length);
+            continue;
+        }
+
+        if (!continued_packet_.empty()) {
+            continued_packet_.insert(continued_packet_.end(), buf + start, buf + start + length);
+            data = continued_packet_.data();
+            size = continued_packet_.size();
+            return true;
+        }
+        if (length == 0) {
+            continue;
+        }
+        data = buf + start;
+        size = length;
+        return true;
+    }
+}
+
+// See RFC 6716 section 3.1 for the TOC byte
+uint32_t OggOpusDemuxer::GetPacketSamples(const uint8_t* data, size_t size) {
+    if (size < 1) {
+        return 0;
+    }
+
+    int config = data[0] >> 3;
+    uint32_t frame_samples;
+    if (config < 12) {
+        // SILK: 10, 20, 40, 60 ms
+        static const uint32_t silk_samples[] = {480, 960, 1920, 2880};
+        frame_samples = silk_samples[config & 3];
+    } else if (config < 16) {
+        // Hybrid: 10, 20 ms
+        frame_samples = (config & 1) ? 960 : 480;
+    } else {
+        // CELT: 2.5, 5, 10, 20 ms
+        frame_samples = 120 << (config & 3);
+    }
+
+    uint32_t frame_count;
+    switch (data[0] & 3) {
+        case 0:
+            frame_count = 1;
+            break;
+        case 1:
+        case 2:
+            frame_count = 2;
+            break;
+        default:
+            if (size < 2) {
+                return 0;
+            }
+            frame_count = data[1] & 0x3F;
+            break;
+    }
+
+    // A packet is at most 120 ms
+    uint32_t samples = frame_samples * frame_count;
+    return samples <= 5760 ? samples : 0;
+}
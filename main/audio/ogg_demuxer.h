@@ -0,0 +1,65 @@
+#ifndef OGG_DEMUXER_H
+#define OGG_DEMUXER_H
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+struct OggOpusPacket {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    // Duration of the packet and the samples to drop from the decoded output, at 48 kHz
+    uint32_t samples = 0;
+    uint32_t trim_start = 0;
+    uint32_t trim_end = 0;
+};
+
+/*
+ * A streaming demuxer for Ogg Opus data in memory (RFC 7845).
+ *
+ * Packets are returned one at a time and point into the source data, so a sound stored in the
+ * flash can be played without copying it to RAM. Only a packet spanning two pages is assembled
+ * into an internal buffer. The pre-skip of the OpusHead and the granule position of the last page
+ * are turned into the number of samples to drop from the decoded output.
+ */
+class OggOpusDemuxer {
+public:
+    explicit OggOpusDemuxer(std::string_view data);
+
+    // Parses OpusHead and OpusTags, returns false if the data is not an Ogg Opus stream
+    bool Open();
+    // Returns false at the end of the stream
+    bool NextPacket(OggOpusPacket& packet);
+
+    int sample_rate() const { return sample_rate_; }
+    int channels() const { return channels_; }
+    int pre_skip() const { return pre_skip_; }
+
+    // Number of samples at 48 kHz in an Opus packet, 0 if the packet is invalid
+    static uint32_t GetPacketSamples(const uint8_t* data, size_t size);
+
+private:
+    std::string_view data_;
+    size_t offset_ = 0;
+
+    // Current page
+    const uint8_t* segments_ = nullptr;
+    int segment_count_ = 0;
+    int segment_index_ = 0;
+    size_t body_offset_ = 0;
+    int64_t granule_position_ = -1;
+    bool end_of_stream_ = false;
+    std::vector<uint8_t> continued_packet_;
+
+    int sample_rate_ = 48000;
+    int channels_ = 1;
+    int pre_skip_ = 0;
+    uint64_t position_ = 0;
+
+    bool LoadNextPage();
+    bool ReadRawPacket(const uint8_t*& data, size_t& size);
+};
+
+#endif // OGG_DEMUXER_H
@@ -0,0 +1,139 @@
+#include "opus_uplink_encoder.h"
+#include "audio_payload_pool.h"
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "OpusUplinkEncoder"
+
+#define MAX_OPUS_PACKET_SIZE 1500
+
+// Backlog that triggers a back off, and how long to wait for it to take effect
+#define BACKLOG_HIGH_WATERMARK_MS 360
+#define BACKOFF_COOLDOWN_MS 600
+// The queue must stay short this long before the bitrate goes up again
+#define RECOVERY_CALM_MS 2000
+#define RECOVERY_STEP 2000
+
+
+OpusUplinkEncoder::OpusUplinkEncoder(int sample_rate, int duration_ms)
+    : sample_rate_(sample_rate), duration_ms_(duration_ms) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate_, 1, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+    }
+    frame_size_ = sample_rate_ / 1000 * duration_ms_;
+    in_buffer_.reserve(frame_size_ * 2);
+}
+
+OpusUplinkEncoder::~OpusUplinkEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void OpusUplinkEncoder::SetComplexity(int complexity) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void OpusUplinkEncoder::SetBitrate(int bitrate) {
+    if (encoder_ == nullptr || bitrate == bitrate_) {
+        return;
+    }
+    if (opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate)) == OPUS_OK) {
+        bitrate_ = bitrate;
+    }
+}
+
+bool OpusUplinkEncoder::SetDuration(int duration_ms) {
+    if (duration_ms != 20 && duration_ms != 40 && duration_ms != 60) {
+        ESP_LOGE(TAG, "Unsupported frame duration: %d", duration_ms);
+        return false;
+    }
+    duration_ms_ = duration_ms;
+    frame_size_ = sample_rate_ / 1000 * duration_ms_;
+    return true;
+}
+
+bool OpusUplinkEncoder::Encode(const std::vector<int16_t>& pcm, size_t headroom, std::function<void(std::vector<uint8_t>&& packet)> handler) {
+    if (encoder_ == nullptr) {
+        return false;
+    }
+
+    const int16_t* input = pcm.data();
+    size_t available = pcm.size();
+    if (!in_buffer_.empty()) {
+        in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+        input = in_buffer_.data();
+        available = in_buffer_.size();
+    }
+
+    // Twice the average packet size leaves the VBR enough room without holding large buffers in the send queue
+    int max_bytes = MAX_OPUS_PACKET_SIZE;
+    if (bitrate_ > 0) {
+        max_bytes = std::min(bitrate_ / 8 * duration_ms_ / 1000 * 2 + 64, MAX_OPUS_PACKET_SIZE);
+    }
+
+    size_t offset = 0;
+    bool ok = true;
+    while (available - offset >= static_cast<size_t>(frame_size_)) {
+        auto packet = AudioPayloadPool::GetInstance().Acquire(headroom + max_bytes);
+        packet.resize(headroom + max_bytes);
+        int ret = opus_encode(encoder_, input + offset, frame_size_, packet.data() + headroom, max_bytes);
+        offset += frame_size_;
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+            ok = false;
+            continue;
+        }
+        packet.resize(headroom + ret);
+        handler(std::move(packet));
+    }
+
+    // Keep the remainder for the next call
+    if (input == in_buffer_.data()) {
+        in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + offset);
+    } else if (offset < available) {
+        in_buffer_.assign(input + offset, input + available);
+    }
+    return ok;
+}
+
+void OpusUplinkEncoder::ResetState() {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+    in_buffer_.clear();
+}
+
+void UplinkBitrateController::Configure(int target_bitrate) {
+    target_bitrate_ = target_bitrate;
+    bitrate_ = target_bitrate;
+    calm_ms_ = 0;
+    cooldown_ms_ = 0;
+}
+
+int UplinkBitrateController::Update(int backlog_ms, int frame_duration_ms) {
+    cooldown_ms_ = std::max(cooldown_ms_ - frame_duration_ms, 0);
+
+    if (backlog_ms >= BACKLOG_HIGH_WATERMARK_MS) {
+        calm_ms_ = 0;
+        if (cooldown_ms_ == 0 && bitrate_ > OPUS_UPLINK_MIN_BITRATE) {
+            bitrate_ = std::max(bitrate_ * 3 / 4, OPUS_UPLINK_MIN_BITRATE);
+            cooldown_ms_ = BACKOFF_COOLDOWN_MS;
+            ESP_LOGW(TAG, "Send queue backlog %d ms, lowering bitrate to %d", backlog_ms, bitrate_);
+        }
+    } else if (backlog_ms <= frame_duration_ms) {
+        calm_ms_ += frame_duration_ms;
+        if (calm_ms_ >= RECOVERY_CALM_MS && bitrate_ < target_bitrate_) {
+            bitrate_ = std::min(bitrate_ + RECOVERY_STEP, target_bitrate_);
+            calm_ms_ = 0;
+            ESP_LOGI(TAG, "Send queue drained, raising bitrate to %d", bitrate_);
+        }
+    } else {
+        calm_ms_ = 0;
+    }
+    return bitrate_;
+}
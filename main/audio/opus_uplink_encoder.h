@@ -0,0 +1,68 @@
+#ifndef OPUS_UPLINK_ENCODER_H
+#define OPUS_UPLINK_ENCODER_H
+
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+#include <opus.h>
+
+#define OPUS_UPLINK_MIN_BITRATE 8000
+
+
+/*
+ * Opus encoder for the uplink whose frame duration and bitrate can change at runtime.
+ *
+ * The input is buffered, so PCM chunks of any size can be fed while the frame duration changes.
+ */
+class OpusUplinkEncoder {
+public:
+    OpusUplinkEncoder(int sample_rate, int duration_ms);
+    ~OpusUplinkEncoder();
+
+    OpusUplinkEncoder(const OpusUplinkEncoder&) = delete;
+    OpusUplinkEncoder& operator=(const OpusUplinkEncoder&) = delete;
+
+    int sample_rate() const { return sample_rate_; }
+    int duration_ms() const { return duration_ms_; }
+    int bitrate() const { return bitrate_; }
+
+    void SetComplexity(int complexity);
+    void SetBitrate(int bitrate);
+    // 20, 40 or 60 ms, the buffered input is kept
+    bool SetDuration(int duration_ms);
+    // Calls the handler for every complete packet, returns false on an encoder error.
+    // Each packet is encoded in place after `headroom` reserved bytes of a pooled buffer.
+    bool Encode(const std::vector<int16_t>& pcm, size_t headroom, std::function<void(std::vector<uint8_t>&& packet)> handler);
+    void ResetState();
+
+private:
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int duration_ms_;
+    int frame_size_;
+    int bitrate_ = OPUS_AUTO;
+    std::vector<int16_t> in_buffer_;
+};
+
+/*
+ * Adapts the uplink bitrate to the send queue backlog (AIMD).
+ *
+ * The bitrate backs off by a quarter when the backlog grows beyond the high watermark, and comes
+ * back in small steps once the queue has stayed short for a while, up to the negotiated target.
+ */
+class UplinkBitrateController {
+public:
+    void Configure(int target_bitrate);
+    // Called once per encoded frame, returns the bitrate for the next frames
+    int Update(int backlog_ms, int frame_duration_ms);
+    int bitrate() const { return bitrate_; }
+
+private:
+    int target_bitrate_ = 0;
+    int bitrate_ = 0;
+    int calm_ms_ = 0;
+    int cooldown_ms_ = 0;
+};
+
+#endif // OPUS_UPLINK_ENCODER_H
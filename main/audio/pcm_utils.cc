@@ -0,0 +1,96 @@
+#include "pcm_utils.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Word access to int16_t buffers without breaking strict aliasing
+typedef uint32_t __attribute__((__may_alias__)) pcm_word_t;
+
+
+static inline bool IsWordAligned(const void* p) {
+    return (reinterpret_cast<uintptr_t>(p) & 3) == 0;
+}
+
+void DeinterleaveStereo(const int16_t* input, int16_t* left, int16_t* right, size_t frames) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 8 <= frames; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i * 2));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i * 2 + 8));
+        // Sign extend the low and high half of every 32-bit lane, then pack them back to 16 bits
+        __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        __m128i r = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(left + i), l);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(right + i), r);
+    }
+#else
+    if (IsWordAligned(input) && IsWordAligned(left) && IsWordAligned(right)) {
+        auto in = reinterpret_cast<const pcm_word_t*>(input);
+        auto l = reinterpret_cast<pcm_word_t*>(left);
+        auto r = reinterpret_cast<pcm_word_t*>(right);
+        for (; i + 2 <= frames; i += 2) {
+            uint32_t w0 = in[i];
+            uint32_t w1 = in[i + 1];
+            l[i / 2] = (w0 & 0xFFFF) | (w1 << 16);
+            r[i / 2] = (w0 >> 16) | (w1 & 0xFFFF0000);
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        left[i] = input[i * 2];
+        right[i] = input[i * 2 + 1];
+    }
+}
+
+void InterleaveStereo(const int16_t* left, const int16_t* right, int16_t* output, size_t frames) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 8 <= frames; i += 8) {
+        __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + i));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * 2), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * 2 + 8), _mm_unpackhi_epi16(l, r));
+    }
+#else
+    if (IsWordAligned(left) && IsWordAligned(right) && IsWordAligned(output)) {
+        auto l = reinterpret_cast<const pcm_word_t*>(left);
+        auto r = reinterpret_cast<const pcm_word_t*>(right);
+        auto out = reinterpret_cast<pcm_word_t*>(output);
+        for (; i + 2 <= frames; i += 2) {
+            uint32_t lw = l[i / 2];
+            uint32_t rw = r[i / 2];
+            out[i] = (lw & 0xFFFF) | (rw << 16);
+            out[i + 1] = (lw >> 16) | (rw & 0xFFFF0000);
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        output[i * 2] = left[i];
+        output[i * 2 + 1] = right[i];
+    }
+}
+
+void ExtractLeftChannel(const int16_t* input, int16_t* output, size_t frames) {
+    size_t i = 0;
+    // Every step reads ahead of what it writes, so working in place is safe
+#if defined(__SSE2__)
+    for (; i + 8 <= frames; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i * 2));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i * 2 + 8));
+        __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), l);
+    }
+#else
+    if (IsWordAligned(input) && IsWordAligned(output)) {
+        auto in = reinterpret_cast<const pcm_word_t*>(input);
+        auto out = reinterpret_cast<pcm_word_t*>(output);
+        for (; i + 2 <= frames; i += 2) {
+            out[i / 2] = (in[i] & 0xFFFF) | (in[i + 1] << 16);
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        output[i] = input[i * 2];
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef PCM_UTILS_H
+#define PCM_UTILS_H
+
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * Channel conversion kernels for interleaved 16-bit stereo PCM.
+ *
+ * They move two samples per 32-bit word when the buffers are word aligned, which is the case for
+ * std::vector storage, and fall back to scalar loops otherwise. The host build uses SSE2.
+ */
+
+// Splits interleaved stereo into the left and right channels
+void DeinterleaveStereo(const int16_t* input, int16_t* left, int16_t* right, size_t frames);
+// Merges the left and right channels into interleaved stereo
+void InterleaveStereo(const int16_t* left, const int16_t* right, int16_t* output, size_t frames);
+// Copies the left channel of interleaved stereo, output may be the same buffer as input
+void ExtractLeftChannel(const int16_t* input, int16_t* output, size_t frames);
+
+#endif // PCM_UTILS_H
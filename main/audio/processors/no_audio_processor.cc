@@ -1,5 +1,6 @@
 #include "no_audio_processor.h"
 #include <esp_log.h>
+#include "pcm_utils.h"
 
 #define TAG "NoAudioProcessor"
 
@@ -14,15 +15,12 @@ void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
     }
 
     if (codec_->input_channels() == 2) {
-        // If input channels is 2, we need to fetch the left channel data
-        auto mono_data = std::vector<int16_t>(data.size() / 2);
-        for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-            mono_data[i] = data[j];
-        }
-        output_callback_(std::move(mono_data));
-    } else {
-        output_callback_(std::move(data));
+        // If input channels is 2, we need to fetch the left channel data (in place, no allocation)
+        size_t mono_samples = data.size() / 2;
+        ExtractLeftChannel(data.data(), data.data(), mono_samples);
+        data.resize(mono_samples);
     }
+    output_callback_(std::move(data));
 }
 
 void NoAudioProcessor::Start() {
@@ -0,0 +1,39 @@
+#include "sound_playback.h"
+#include <esp_log.h>
+
+#define TAG "SoundPlayback"
+
+
+SoundPlayback::SoundPlayback(std::string_view ogg) : demuxer_(ogg) {
+}
+
+bool SoundPlayback::NextPacket(AudioStreamPacket& packet) {
+    if (cancelled_ || finished_) {
+        finished_ = true;
+        return false;
+    }
+    if (!opened_) {
+        opened_ = demuxer_.Open();
+        if (!opened_) {
+            ESP_LOGE(TAG, "Invalid Ogg Opus sound");
+            finished_ = true;
+            return false;
+        }
+    }
+
+    OggOpusPacket ogg_packet;
+    if (!demuxer_.NextPacket(ogg_packet)) {
+        finished_ = true;
+        return false;
+    }
+
+    // Trimming is counted at 48 kHz, the decoder runs at the rate of the OpusHead
+    int sample_rate = demuxer_.sample_rate();
+    int ratio = 48000 / sample_rate;
+    packet.sample_rate = sample_rate;
+    packet.frame_duration = (ogg_packet.samples + 47) / 48;
+    packet.trim_start = ogg_packet.trim_start / ratio;
+    packet.trim_end = ogg_packet.trim_end / ratio;
+    packet.payload.assign(ogg_packet.data, ogg_packet.data + ogg_packet.size);
+    return true;
+}
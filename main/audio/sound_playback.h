@@ -0,0 +1,38 @@
+#ifndef SOUND_PLAYBACK_H
+#define SOUND_PLAYBACK_H
+
+#include <atomic>
+#include <memory>
+#include <string_view>
+
+#include "ogg_demuxer.h"
+#include "protocol.h"
+
+
+/*
+ * A sound queued by AudioService::PlaySound().
+ *
+ * The Opus decoder pulls the packets one at a time while the sound plays, so only the packet
+ * being decoded is held in RAM. The Ogg data must stay valid until the sound is finished,
+ * which is always true for the sounds embedded in the firmware or the assets partition.
+ */
+class SoundPlayback {
+public:
+    explicit SoundPlayback(std::string_view ogg);
+
+    // Stops the sound before its next packet, the frames already decoded still play out
+    void Cancel() { cancelled_ = true; }
+    bool IsCancelled() const { return cancelled_; }
+    bool IsFinished() const { return finished_ || cancelled_; }
+
+    // Called by the decoder task, returns false when the sound is over
+    bool NextPacket(AudioStreamPacket& packet);
+
+private:
+    OggOpusDemuxer demuxer_;
+    bool opened_ = false;
+    std::atomic<bool> cancelled_ = false;
+    std::atomic<bool> finished_ = false;
+};
+
+#endif // SOUND_PLAYBACK_H
@@ -1,4 +1,5 @@
 #include "custom_wake_word.h"
+#include "pcm_utils.h"
 #include "audio_service.h"
 #include "system_info.h"
 #include "assets.h"
@@ -146,15 +147,13 @@ void CustomWakeWord::Feed(const std::vector<int16_t>& data) {
     esp_mn_state_t mn_state;
     // If input channels is 2, we need to fetch the left channel data
     if (codec_->input_channels() == 2) {
+        // The stored copy is the only mono buffer, detect on it directly
         auto mono_data = std::vector<int16_t>(data.size() / 2);
-        for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-            mono_data[i] = data[j];
-        }
-
-        StoreWakeWordData(mono_data);
-        mn_state = multinet_->detect(multinet_model_data_, const_cast<int16_t*>(mono_data.data()));
+        ExtractLeftChannel(data.data(), mono_data.data(), mono_data.size());
+        auto& stored = StoreWakeWordData(std::move(mono_data));
+        mn_state = multinet_->detect(multinet_model_data_, const_cast<int16_t*>(stored.data()));
     } else {
-        StoreWakeWordData(data);
+        StoreWakeWordData(std::vector<int16_t>(data));
         mn_state = multinet_->detect(multinet_model_data_, const_cast<int16_t*>(data.data()));
     }
     
@@ -189,13 +188,14 @@ size_t CustomWakeWord::GetFeedSize() {
     return multinet_->get_samp_chunksize(multinet_model_data_);
 }
 
-void CustomWakeWord::StoreWakeWordData(const std::vector<int16_t>& data) {
+const std::vector<int16_t>& CustomWakeWord::StoreWakeWordData(std::vector<int16_t>&& data) {
     // store audio data to wake_word_pcm_
-    wake_word_pcm_.push_back(data);
+    wake_word_pcm_.push_back(std::move(data));
     // keep about 2 seconds of data, detect duration is 30ms (sample_rate == 16000, chunksize == 512)
     while (wake_word_pcm_.size() > 2000 / 30) {
         wake_word_pcm_.pop_front();
     }
+    return wake_word_pcm_.back();
 }
 
 void CustomWakeWord::EncodeWakeWordData() {
@@ -62,7 +62,7 @@ private:
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
 
-    void StoreWakeWordData(const std::vector<int16_t>& data);
+    const std::vector<int16_t>& StoreWakeWordData(std::vector<int16_t>&& data);
     void ParseWakenetModelConfig();
 };
 
@@ -130,7 +130,13 @@ std::string Ml307Board::GetDeviceStatusJson() {
      *     "network": {
      *         "type": "cellular",
      *         "carrier": "CHINA MOBILE",
-     *         "csq": 10
+     *         "csq": 10,
+     *         "audio_link": {
+     *             "transport": "udp",
+     *             "loss_percent": 0.5,
+     *             "jitter_ms": 12,
+     *             ...
+     *         }
      *     }
      * }
      */
@@ -187,6 +193,11 @@ std::string Ml307Board::GetDeviceStatusJson() {
     } else if (csq >= 25 && csq <= 31) {
         cJSON_AddStringToObject(network, "signal", "strong");
     }
+    // Lets the server adapt its TTS bitrate to the audio link
+    auto audio_link = Application::GetInstance().GetAudioLinkStatisticsJson();
+    if (audio_link != nullptr) {
+        cJSON_AddItemToObject(network, "audio_link", audio_link);
+    }
     cJSON_AddItemToObject(root, "network", network);
 
     auto json_str = cJSON_PrintUnformatted(root);
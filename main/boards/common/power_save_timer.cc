@@ -128,5 +128,8 @@ void PowerSaveTimer::WakeUp() {
         if (on_exit_sleep_mode_) {
             on_exit_sleep_mode_();
         }
+
+        // The user is likely to talk soon, connect ahead of the wake word
+        Application::GetInstance().WarmUpAudioChannel();
     }
 }
@@ -193,7 +193,13 @@ std::string WifiBoard::GetDeviceStatusJson() {
      *     "network": {
      *         "type": "wifi",
      *         "ssid": "Xiaozhi",
-     *         "rssi": -60
+     *         "rssi": -60,
+     *         "audio_link": {
+     *             "transport": "udp",
+     *             "loss_percent": 0.5,
+     *             "jitter_ms": 12,
+     *             ...
+     *         }
      *     },
      *     "chip": {
      *         "temperature": 25
@@ -250,6 +256,11 @@ std::string WifiBoard::GetDeviceStatusJson() {
     } else {
         cJSON_AddStringToObject(network, "signal", "weak");
     }
+    // Lets the server adapt its TTS bitrate to the audio link
+    auto audio_link = Application::GetInstance().GetAudioLinkStatisticsJson();
+    if (audio_link != nullptr) {
+        cJSON_AddItemToObject(network, "audio_link", audio_link);
+    }
     cJSON_AddItemToObject(root, "network", network);
 
     // Chip
@@ -68,6 +68,8 @@ void OttoEmojiDisplay::SetupGifContainer() {
     if (chat_message_label_) {
         lv_obj_del(chat_message_label_);
     }
+    // The message list lives in content_, chat messages go to the label below instead
+    chat_message_list_.reset();
     if (content_) {
         lv_obj_del(content_);
     }
@@ -0,0 +1,103 @@
+#include "chat_text_pacer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "ChatTextPacer"
+
+// Played audio that does not advance for this long has stopped, e.g. the reply was aborted
+#define STALL_TIMEOUT_MS 600
+// The audio of a sentence may never come, e.g. in a text only reply
+#define WAIT_TIMEOUT_MS 3000
+// Shorter sentences are not used for learning the speaking rate
+#define MIN_LEARN_DURATION_MS 500
+
+static int CountGlyphs(const std::string& text) {
+    // Continuation bytes of UTF-8 are 10xxxxxx
+    return std::count_if(text.begin(), text.end(), [](char c) { return (c & 0xC0) != 0x80; });
+}
+
+void ChatTextPacer::Queue(uint32_t segment, std::string text, int64_t now_ms) {
+    if (text.empty()) {
+        return;
+    }
+    int glyphs = CountGlyphs(text);
+    sentences_.push_back(Sentence{segment, std::move(text), glyphs});
+    sentences_.back().progress_time = now_ms;
+}
+
+bool ChatTextPacer::Tick(uint32_t playing_segment, int played_ms, int64_t now_ms, const AppendCallback& append) {
+    bool advanced = playing_segment != last_segment_ || played_ms != last_played_ms_;
+    last_segment_ = playing_segment;
+    last_played_ms_ = played_ms;
+    while (!sentences_.empty()) {
+        auto& sentence = sentences_.front();
+        // Segments only grow, the difference tells which side of the sentence the playback is
+        int32_t distance = static_cast<int32_t>(playing_segment - sentence.segment);
+        if (distance > 0) {
+            // The audio of the sentence is over, so its duration is known
+            if (sentence.played_ms >= MIN_LEARN_DURATION_MS) {
+                float rate = sentence.glyphs * 1000.0f / sentence.played_ms;
+                glyphs_per_second_ = std::clamp(glyphs_per_second_ * 0.7f + rate * 0.3f, 2.0f, 30.0f);
+                ESP_LOGD(TAG, "Speaking rate %.1f glyphs/s", glyphs_per_second_);
+            }
+            Reveal(sentence, sentence.glyphs, append);
+            Pop(now_ms);
+            continue;
+        }
+
+        if (distance == 0 && played_ms > sentence.played_ms) {
+            sentence.played_ms = played_ms;
+            sentence.progress_time = now_ms;
+        } else if (distance < 0 && advanced) {
+            // The audio before the sentence is still playing
+            sentence.progress_time = now_ms;
+        }
+        int timeout = sentence.played_ms > 0 ? STALL_TIMEOUT_MS : WAIT_TIMEOUT_MS;
+        if (now_ms - sentence.progress_time >= timeout) {
+            Reveal(sentence, sentence.glyphs, append);
+            Pop(now_ms);
+            continue;
+        }
+        if (sentence.played_ms > 0) {
+            // The first glyph shows with the first frame
+            Reveal(sentence, 1 + static_cast<int>(sentence.played_ms * glyphs_per_second_ / 1000), append);
+        }
+        break;
+    }
+    return !sentences_.empty();
+}
+
+void ChatTextPacer::Flush(const AppendCallback& append) {
+    while (!sentences_.empty()) {
+        auto& sentence = sentences_.front();
+        Reveal(sentence, sentence.glyphs, append);
+        sentences_.pop_front();
+    }
+}
+
+void ChatTextPacer::Reveal(Sentence& sentence, int glyphs, const AppendCallback& append) {
+    glyphs = std::min(glyphs, sentence.glyphs);
+    if (glyphs <= sentence.shown_glyphs) {
+        return;
+    }
+    size_t begin = sentence.shown_bytes;
+    size_t end = begin;
+    for (int i = sentence.shown_glyphs; i < glyphs; i++) {
+        do {
+            end++;
+        } while (end < sentence.text.size() && (sentence.text[end] & 0xC0) == 0x80);
+    }
+    bool start = sentence.shown_glyphs == 0;
+    sentence.shown_glyphs = glyphs;
+    sentence.shown_bytes = end;
+    append(sentence.text.substr(begin, end - begin).c_str(), start);
+}
+
+void ChatTextPacer::Pop(int64_t now_ms) {
+    sentences_.pop_front();
+    if (!sentences_.empty()) {
+        // The next sentence waits for its audio from now on
+        sentences_.front().progress_time = now_ms;
+    }
+}
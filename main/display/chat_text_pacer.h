@@ -0,0 +1,50 @@
+#ifndef CHAT_TEXT_PACER_H
+#define CHAT_TEXT_PACER_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+
+
+/*
+ * Reveals the text of the TTS sentences while their audio plays.
+ *
+ * Every sentence is queued with the playback segment its audio is tagged with. Tick() is given the
+ * segment being played and how long it has played, and hands out the part of the text the speech
+ * has reached, at a speaking rate learned from the sentences played before. The text of a sentence
+ * is shown entirely once the next segment plays, or when its audio stops or never comes.
+ */
+class ChatTextPacer {
+public:
+    // `start` is set on the first chunk of a sentence
+    using AppendCallback = std::function<void(const char* chunk, bool start)>;
+
+    void Queue(uint32_t segment, std::string text, int64_t now_ms);
+    // Returns false once all the text is shown
+    bool Tick(uint32_t playing_segment, int played_ms, int64_t now_ms, const AppendCallback& append);
+    // Shows all the queued text at once
+    void Flush(const AppendCallback& append);
+    bool empty() const { return sentences_.empty(); }
+
+private:
+    struct Sentence {
+        uint32_t segment;
+        std::string text;
+        int glyphs;                 // UTF-8 code points of the text
+        int shown_glyphs = 0;
+        size_t shown_bytes = 0;
+        int played_ms = 0;
+        int64_t progress_time = 0;  // Of the last progress, or since the sentence waits for its audio
+    };
+
+    std::deque<Sentence> sentences_;
+    float glyphs_per_second_ = 5.0f;
+    uint32_t last_segment_ = 0;
+    int last_played_ms_ = 0;
+
+    void Reveal(Sentence& sentence, int glyphs, const AppendCallback& append);
+    void Pop(int64_t now_ms);
+};
+
+#endif // CHAT_TEXT_PACER_H
@@ -45,6 +45,14 @@ void Display::SetChatMessage(const char* role, const char* content) {
     ESP_LOGW(TAG, "     %s", content);
 }
 
+void Display::AppendChatText(const char* role, const char* chunk, bool start) {
+    if (start) {
+        streaming_text_.clear();
+    }
+    streaming_text_ += chunk;
+    SetChatMessage(role, streaming_text_.c_str());
+}
+
 void Display::SetTheme(Theme* theme) {
     current_theme_ = theme;
     Settings settings("display", true);
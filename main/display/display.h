@@ -35,6 +35,8 @@ public:
     virtual void ShowNotification(const std::string &notification, int duration_ms = 3000);
     virtual void SetEmotion(const char* emotion);
     virtual void SetChatMessage(const char* role, const char* content);
+    // Streams a message in chunks, `start` begins a new message
+    virtual void AppendChatText(const char* role, const char* chunk, bool start = false);
     virtual void SetTheme(Theme* theme);
     virtual Theme* GetTheme() { return current_theme_; }
     virtual void UpdateStatusBar(bool update_all = false);
@@ -48,6 +50,8 @@ protected:
     int height_ = 0;
 
     Theme* current_theme_ = nullptr;
+    // The streamed message, for the displays that show it again as a whole
+    std::string streaming_text_;
 
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
@@ -71,6 +75,10 @@ private:
 };
 
 class NoDisplay : public Display {
+public:
+    // The text is logged when it is received, not once per chunk
+    virtual void AppendChatText(const char* role, const char* chunk, bool start = false) override {}
+
 private:
     virtual bool Lock(int timeout_ms = 0) override {
         return true;
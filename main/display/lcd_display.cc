@@ -11,6 +11,7 @@
 #include <esp_err.h>
 #include <esp_lvgl_port.h>
 #include <esp_psram.h>
+#include <esp_heap_caps.h>
 #include <cstring>
 
 #include "board.h"
@@ -92,15 +93,38 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
                            int width, int height, int offset_x, int offset_y, bool mirror_x, bool mirror_y, bool swap_xy)
     : LcdDisplay(panel_io, panel, width, height) {
 
-    // draw white
-    std::vector<uint16_t> buffer(width_, 0xFFFF);
-    for (int y = 0; y < height_; y++) {
-        esp_lcd_panel_draw_bitmap(panel_, 0, y, width_, y + 1, buffer.data());
+    // Draw buffer height, the same internal RAM as the single 20-line buffer unless PSRAM frees more
+    int buffer_lines = CONFIG_LCD_DRAW_BUFFER_LINES;
+    if (buffer_lines == 0) {
+#if CONFIG_LCD_DOUBLE_BUFFER && CONFIG_SPIRAM
+        buffer_lines = 20;
+#elif CONFIG_LCD_DOUBLE_BUFFER
+        buffer_lines = 10;
+#else
+        buffer_lines = 20;
+#endif
+    }
+    buffer_lines = std::min(buffer_lines, height_);
+
+    // draw white, one transfer per stripe instead of per line
+    int clear_lines = buffer_lines;
+    auto buffer = (uint16_t*)heap_caps_malloc(width_ * clear_lines * sizeof(uint16_t), MALLOC_CAP_DMA);
+    if (buffer == nullptr) {
+        clear_lines = 1;
+        buffer = (uint16_t*)heap_caps_malloc(width_ * sizeof(uint16_t), MALLOC_CAP_DMA);
+    }
+    if (buffer != nullptr) {
+        std::fill_n(buffer, width_ * clear_lines, 0xFFFF);
+        for (int y = 0; y < height_; y += clear_lines) {
+            esp_lcd_panel_draw_bitmap(panel_, 0, y, width_, std::min(y + clear_lines, height_), buffer);
+        }
     }
 
     // Set the display to on
     ESP_LOGI(TAG, "Turning display on");
+    // The command waits for the queued color transfers, so the buffer can be freed after it
     ESP_ERROR_CHECK(esp_lcd_panel_disp_on_off(panel_, true));
+    heap_caps_free(buffer);
 
     ESP_LOGI(TAG, "Initialize LVGL library");
     lv_init();
@@ -130,8 +154,12 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .control_handle = nullptr,
-        .buffer_size = static_cast<uint32_t>(width_ * 20),
+        .buffer_size = static_cast<uint32_t>(width_ * buffer_lines),
+#if CONFIG_LCD_DOUBLE_BUFFER
+        .double_buffer = true,
+#else
         .double_buffer = false,
+#endif
         .trans_size = 0,
         .hres = static_cast<uint32_t>(width_),
         .vres = static_cast<uint32_t>(height_),
@@ -157,6 +185,8 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         ESP_LOGE(TAG, "Failed to add display");
         return;
     }
+    ESP_LOGI(TAG, "Draw buffer: %d x %d lines%s", width_, buffer_lines, display_cfg.double_buffer ? " x 2" : "");
+    TrackRenderStats();
 
     if (offset_x != 0 || offset_y != 0) {
         lv_display_set_offset(display_, offset_x, offset_y);
@@ -219,6 +249,7 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         ESP_LOGE(TAG, "Failed to add RGB display");
         return;
     }
+    TrackRenderStats();
     
     if (offset_x != 0 || offset_y != 0) {
         lv_display_set_offset(display_, offset_x, offset_y);
@@ -276,6 +307,7 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
         ESP_LOGE(TAG, "Failed to add display");
         return;
     }
+    TrackRenderStats();
 
     if (offset_x != 0 || offset_y != 0) {
         lv_display_set_offset(display_, offset_x, offset_y);
@@ -304,6 +336,8 @@ LcdDisplay::~LcdDisplay() {
     if (chat_message_label_ != nullptr) {
         lv_obj_del(chat_message_label_);
     }
+    // The bubbles are children of content_
+    chat_message_list_.reset();
     if (emoji_label_ != nullptr) {
         lv_obj_del(emoji_label_);
     }
@@ -346,6 +380,11 @@ void LcdDisplay::Unlock() {
 }
 
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
+#if CONFIG_IDF_TARGET_ESP32P4
+#define  MAX_MESSAGES 40
+#else
+#define  MAX_MESSAGES 20
+#endif
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
 
@@ -390,12 +429,8 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_scrollbar_mode(content_, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_scroll_dir(content_, LV_DIR_VER);
     
-    // Create a flex container for chat messages
-    lv_obj_set_flex_flow(content_, LV_FLEX_FLOW_COLUMN);
-    lv_obj_set_flex_align(content_, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_START);
-    lv_obj_set_style_pad_row(content_, lvgl_theme->spacing(4), 0); // Space between messages
-
-    // We'll create chat messages dynamically in SetChatMessage
+    // Chat messages are placed by ChatMessageList, which only creates the visible bubbles
+    chat_message_list_ = std::make_unique<ChatMessageList>(content_, lvgl_theme, MAX_MESSAGES);
     chat_message_label_ = nullptr;
 
     /* Status bar */
@@ -463,287 +498,43 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_style_text_color(emoji_label_, lvgl_theme->text_color(), 0);
     lv_label_set_text(emoji_label_, FONT_AWESOME_MICROCHIP_AI);
 }
-#if CONFIG_IDF_TARGET_ESP32P4
-#define  MAX_MESSAGES 40
-#else
-#define  MAX_MESSAGES 20
-#endif
 void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     DisplayLockGuard lock(this);
-    if (content_ == nullptr) {
+    if (chat_message_list_ == nullptr) {
         return;
     }
-    
-    // 检查消息数量是否超过限制
-    uint32_t child_count = lv_obj_get_child_cnt(content_);
-    if (child_count >= MAX_MESSAGES) {
-        // 删除最早的消息（第一个子对象）
-        lv_obj_t* first_child = lv_obj_get_child(content_, 0);
-        lv_obj_t* last_child = lv_obj_get_child(content_, child_count - 1);
-        if (first_child != nullptr) {
-            lv_obj_del(first_child);
-        }
-        // Scroll to the last message immediately
-        if (last_child != nullptr) {
-            lv_obj_scroll_to_view_recursive(last_child, LV_ANIM_OFF);
-        }
-    }
-    
-    // 折叠系统消息（如果是系统消息，检查最后一个消息是否也是系统消息）
-    if (strcmp(role, "system") == 0) {
-        if (child_count > 0) {
-            // 获取最后一个消息容器
-            lv_obj_t* last_container = lv_obj_get_child(content_, child_count - 1);
-            if (last_container != nullptr && lv_obj_get_child_cnt(last_container) > 0) {
-                // 获取容器内的气泡
-                lv_obj_t* last_bubble = lv_obj_get_child(last_container, 0);
-                if (last_bubble != nullptr) {
-                    // 检查气泡类型是否为系统消息
-                    void* bubble_type_ptr = lv_obj_get_user_data(last_bubble);
-                    if (bubble_type_ptr != nullptr && strcmp((const char*)bubble_type_ptr, "system") == 0) {
-                        // 如果最后一个消息也是系统消息，则删除它
-                        lv_obj_del(last_container);
-                    }
-                }
-            }
-        }
-    } else {
+
+    if (strcmp(role, "system") != 0) {
         // 隐藏居中显示的 AI logo
         lv_obj_add_flag(emoji_label_, LV_OBJ_FLAG_HIDDEN);
     }
+    chat_message_list_->AddMessage(role, content);
+}
 
-    //避免出现空的消息框
-    if(strlen(content) == 0) {
+void LcdDisplay::AppendChatText(const char* role, const char* chunk, bool start) {
+    if (chat_message_list_ == nullptr) {
+        // Displays that replaced the message list show the text through their SetChatMessage
+        Display::AppendChatText(role, chunk, start);
         return;
     }
+    DisplayLockGuard lock(this);
 
-    auto lvgl_theme = static_cast<LvglTheme*>(current_theme_);
-    auto text_font = lvgl_theme->text_font()->font();
-
-    // Create a message bubble
-    lv_obj_t* msg_bubble = lv_obj_create(content_);
-    lv_obj_set_style_radius(msg_bubble, 8, 0);
-    lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
-    lv_obj_set_style_border_width(msg_bubble, 0, 0);
-    lv_obj_set_style_pad_all(msg_bubble, lvgl_theme->spacing(4), 0);
-
-    // Create the message text
-    lv_obj_t* msg_text = lv_label_create(msg_bubble);
-    lv_label_set_text(msg_text, content);
-    
-    // 计算文本实际宽度
-    lv_coord_t text_width = lv_txt_get_width(content, strlen(content), text_font, 0);
-
-    // 计算气泡宽度
-    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;  // 屏幕宽度的85%
-    lv_coord_t min_width = 20;  
-    lv_coord_t bubble_width;
-    
-    // 确保文本宽度不小于最小宽度
-    if (text_width < min_width) {
-        text_width = min_width;
-    }
-
-    // 如果文本宽度小于最大宽度，使用文本宽度
-    if (text_width < max_width) {
-        bubble_width = text_width; 
-    } else {
-        bubble_width = max_width;
-    }
-    
-    // 设置消息文本的宽度
-    lv_obj_set_width(msg_text, bubble_width);  // 减去padding
-    lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
-
-    // 设置气泡宽度
-    lv_obj_set_width(msg_bubble, bubble_width);
-    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-
-    // Set alignment and style based on message role
-    if (strcmp(role, "user") == 0) {
-        // User messages are right-aligned with green background
-        lv_obj_set_style_bg_color(msg_bubble, lvgl_theme->user_bubble_color(), 0);
-        lv_obj_set_style_bg_opa(msg_bubble, LV_OPA_70, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, lvgl_theme->text_color(), 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"user");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "assistant") == 0) {
-        // Assistant messages are left-aligned with white background
-        lv_obj_set_style_bg_color(msg_bubble, lvgl_theme->assistant_bubble_color(), 0);
-        lv_obj_set_style_bg_opa(msg_bubble, LV_OPA_70, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, lvgl_theme->text_color(), 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "system") == 0) {
-        // System messages are center-aligned with light gray background
-        lv_obj_set_style_bg_color(msg_bubble, lvgl_theme->system_bubble_color(), 0);
-        lv_obj_set_style_bg_opa(msg_bubble, LV_OPA_70, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, lvgl_theme->system_text_color(), 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"system");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    }
-    
-    // Create a full-width container for user messages to ensure right alignment
-    if (strcmp(role, "user") == 0) {
-        // Create a full-width container
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // Make container transparent and borderless
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // Move the message bubble into this container
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // Right align the bubble in the container
-        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
-        
-        // Auto-scroll to this container
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else if (strcmp(role, "system") == 0) {
-        // 为系统消息创建全宽容器以确保居中对齐
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // 使容器透明且无边框
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // 将消息气泡移入此容器
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // 将气泡居中对齐在容器中
-        lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
-        
-        // 自动滚动底部
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else {
-        // For assistant messages
-        // Left align assistant messages
-        lv_obj_align(msg_bubble, LV_ALIGN_LEFT_MID, 0, 0);
-
-        // Auto-scroll to the message bubble
-        lv_obj_scroll_to_view_recursive(msg_bubble, LV_ANIM_ON);
+    if (strcmp(role, "system") != 0) {
+        lv_obj_add_flag(emoji_label_, LV_OBJ_FLAG_HIDDEN);
     }
-    
-    // Store reference to the latest message label
-    chat_message_label_ = msg_text;
+    chat_message_list_->AppendText(role, chunk, start);
 }
 
 void LcdDisplay::SetPreviewImage(std::unique_ptr<LvglImage> image) {
     DisplayLockGuard lock(this);
-    if (content_ == nullptr) {
+    if (chat_message_list_ == nullptr) {
         return;
     }
 
     if (image == nullptr) {
         return;
     }
-    
-    auto lvgl_theme = static_cast<LvglTheme*>(current_theme_);
-    // Create a message bubble for image preview
-    lv_obj_t* img_bubble = lv_obj_create(content_);
-    lv_obj_set_style_radius(img_bubble, 8, 0);
-    lv_obj_set_scrollbar_mode(img_bubble, LV_SCROLLBAR_MODE_OFF);
-    lv_obj_set_style_border_width(img_bubble, 0, 0);
-    lv_obj_set_style_pad_all(img_bubble, lvgl_theme->spacing(4), 0);
-    
-    // Set image bubble background color (similar to system message)
-    lv_obj_set_style_bg_color(img_bubble, lvgl_theme->assistant_bubble_color(), 0);
-    lv_obj_set_style_bg_opa(img_bubble, LV_OPA_70, 0);
-    
-    // 设置自定义属性标记气泡类型
-    lv_obj_set_user_data(img_bubble, (void*)"image");
-
-    // Create the image object inside the bubble
-    lv_obj_t* preview_image = lv_image_create(img_bubble);
-    
-    // Calculate appropriate size for the image
-    lv_coord_t max_width = LV_HOR_RES * 70 / 100;  // 70% of screen width
-    lv_coord_t max_height = LV_VER_RES * 50 / 100; // 50% of screen height
-    
-    // Calculate zoom factor to fit within maximum dimensions
-    auto img_dsc = image->image_dsc();
-    lv_coord_t img_width = img_dsc->header.w;
-    lv_coord_t img_height = img_dsc->header.h;
-    if (img_width == 0 || img_height == 0) {
-        img_width = max_width;
-        img_height = max_height;
-        ESP_LOGW(TAG, "Invalid image dimensions: %ld x %ld, using default dimensions: %ld x %ld", img_width, img_height, max_width, max_height);
-    }
-    
-    lv_coord_t zoom_w = (max_width * 256) / img_width;
-    lv_coord_t zoom_h = (max_height * 256) / img_height;
-    lv_coord_t zoom = (zoom_w < zoom_h) ? zoom_w : zoom_h;
-    
-    // Ensure zoom doesn't exceed 256 (100%)
-    if (zoom > 256) zoom = 256;
-    
-    // Set image properties
-    lv_image_set_src(preview_image, img_dsc);
-    lv_image_set_scale(preview_image, zoom);
-    
-    // Add event handler to clean up LvglImage when image is deleted
-    // We need to transfer ownership of the unique_ptr to the event callback
-    LvglImage* raw_image = image.release(); // 释放智能指针的所有权
-    lv_obj_add_event_cb(preview_image, [](lv_event_t* e) {
-        LvglImage* img = (LvglImage*)lv_event_get_user_data(e);
-        if (img != nullptr) {
-            delete img; // 通过删除 LvglImage 对象来正确释放内存
-        }
-    }, LV_EVENT_DELETE, (void*)raw_image);
-    
-    // Calculate actual scaled image dimensions
-    lv_coord_t scaled_width = (img_width * zoom) / 256;
-    lv_coord_t scaled_height = (img_height * zoom) / 256;
-    
-    // Set bubble size to be 16 pixels larger than the image (8 pixels on each side)
-    lv_obj_set_width(img_bubble, scaled_width + 16);
-    lv_obj_set_height(img_bubble, scaled_height + 16);
-    
-    // Don't grow in flex layout
-    lv_obj_set_style_flex_grow(img_bubble, 0, 0);
-    
-    // Center the image within the bubble
-    lv_obj_center(preview_image);
-    
-    // Left align the image bubble like assistant messages
-    lv_obj_align(img_bubble, LV_ALIGN_LEFT_MID, 0, 0);
-
-    // Auto-scroll to the image bubble
-    lv_obj_scroll_to_view_recursive(img_bubble, LV_ANIM_ON);
+    chat_message_list_->AddImage(std::move(image));
 }
 #else
 void LcdDisplay::SetupUI() {
@@ -945,8 +736,9 @@ void LcdDisplay::SetEmotion(const char* emotion) {
         
         if (gif_controller_->IsLoaded()) {
             // Set up frame update callback
+            // Redraw only the area each frame changed instead of setting the source again
             gif_controller_->SetFrameCallback([this]() {
-                lv_image_set_src(emoji_image_, gif_controller_->image_dsc());
+                gif_controller_->Invalidate(emoji_image_);
             });
             
             // Set initial frame and start animation
@@ -968,8 +760,8 @@ void LcdDisplay::SetEmotion(const char* emotion) {
 
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
     // Wechat message style中，如果emotion是neutral，则不显示
-    uint32_t child_count = lv_obj_get_child_cnt(content_);
-    if (strcmp(emotion, "neutral") == 0 && child_count > 0) {
+    bool has_messages = chat_message_list_ != nullptr && !chat_message_list_->empty();
+    if (strcmp(emotion, "neutral") == 0 && has_messages) {
         // Stop GIF animation if running
         if (gif_controller_) {
             gif_controller_->Stop();
@@ -1034,69 +826,8 @@ void LcdDisplay::SetTheme(Theme* theme) {
 
     // If we have the chat message style, update all message bubbles
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
-    // Iterate through all children of content (message containers or bubbles)
-    uint32_t child_count = lv_obj_get_child_cnt(content_);
-    for (uint32_t i = 0; i < child_count; i++) {
-        lv_obj_t* obj = lv_obj_get_child(content_, i);
-        if (obj == nullptr) continue;
-        
-        lv_obj_t* bubble = nullptr;
-        
-        // 检查这个对象是容器还是气泡
-        // 如果是容器（用户或系统消息），则获取其子对象作为气泡
-        // 如果是气泡（助手消息），则直接使用
-        if (lv_obj_get_child_cnt(obj) > 0) {
-            // 可能是容器，检查它是否为用户或系统消息容器
-            // 用户和系统消息容器是透明的
-            lv_opa_t bg_opa = lv_obj_get_style_bg_opa(obj, 0);
-            if (bg_opa == LV_OPA_TRANSP) {
-                // 这是用户或系统消息的容器
-                bubble = lv_obj_get_child(obj, 0);
-            } else {
-                // 这可能是助手消息的气泡自身
-                bubble = obj;
-            }
-        } else {
-            // 没有子元素，可能是其他UI元素，跳过
-            continue;
-        }
-        
-        if (bubble == nullptr) continue;
-        
-        // 使用保存的用户数据来识别气泡类型
-        void* bubble_type_ptr = lv_obj_get_user_data(bubble);
-        if (bubble_type_ptr != nullptr) {
-            const char* bubble_type = static_cast<const char*>(bubble_type_ptr);
-            
-            // 根据气泡类型应用正确的颜色
-            if (strcmp(bubble_type, "user") == 0) {
-                lv_obj_set_style_bg_color(bubble, lvgl_theme->user_bubble_color(), 0);
-            } else if (strcmp(bubble_type, "assistant") == 0) {
-                lv_obj_set_style_bg_color(bubble, lvgl_theme->assistant_bubble_color(), 0); 
-            } else if (strcmp(bubble_type, "system") == 0) {
-                lv_obj_set_style_bg_color(bubble, lvgl_theme->system_bubble_color(), 0);
-            } else if (strcmp(bubble_type, "image") == 0) {
-                lv_obj_set_style_bg_color(bubble, lvgl_theme->system_bubble_color(), 0);
-            }
-            
-            // Update border color
-            lv_obj_set_style_border_color(bubble, lvgl_theme->border_color(), 0);
-            
-            // Update text color for the message
-            if (lv_obj_get_child_cnt(bubble) > 0) {
-                lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                if (text != nullptr) {
-                    // 根据气泡类型设置文本颜色
-                    if (strcmp(bubble_type, "system") == 0) {
-                        lv_obj_set_style_text_color(text, lvgl_theme->system_text_color(), 0);
-                    } else {
-                        lv_obj_set_style_text_color(text, lvgl_theme->text_color(), 0);
-                    }
-                }
-            }
-        } else {
-            ESP_LOGW(TAG, "child[%lu] Bubble type is not found", i);
-        }
+    if (chat_message_list_ != nullptr) {
+        chat_message_list_->SetTheme(lvgl_theme);
     }
 #else
     // Simple UI mode - just update the main chat message
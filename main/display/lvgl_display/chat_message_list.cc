@@ -0,0 +1,358 @@
+#include "chat_message_list.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "ChatMessageList"
+
+static void OnContentScroll(lv_event_t* e) {
+    auto list = static_cast<ChatMessageList*>(lv_event_get_user_data(e));
+    list->Layout();
+}
+
+ChatMessageList::ChatMessageList(lv_obj_t* content, LvglTheme* theme, size_t capacity)
+    : content_(content), theme_(theme), messages_(capacity) {
+    spacer_ = lv_obj_create(content_);
+    lv_obj_remove_style_all(spacer_);
+    lv_obj_set_size(spacer_, 1, 1);
+    lv_obj_remove_flag(spacer_, LV_OBJ_FLAG_CLICKABLE);
+
+    lv_obj_add_event_cb(content_, OnContentScroll, LV_EVENT_SCROLL, this);
+}
+
+ChatMessageList::~ChatMessageList() {
+    lv_obj_remove_event_cb_with_user_data(content_, OnContentScroll, this);
+    for (auto& row : rows_) {
+        lv_obj_del(row.bubble);
+    }
+    lv_obj_del(spacer_);
+}
+
+void ChatMessageList::AddMessage(const char* role, const char* content) {
+    bool system = strcmp(role, "system") == 0;
+    if (system && count_ > 0 && At(count_ - 1).role == kRoleSystem) {
+        PopLast();
+    }
+
+    // 避免出现空的消息框
+    if (strlen(content) == 0) {
+        Layout();
+        return;
+    }
+
+    Role message_role = kRoleAssistant;
+    if (system) {
+        message_role = kRoleSystem;
+    } else if (strcmp(role, "user") == 0) {
+        message_role = kRoleUser;
+    }
+    auto& message = Push(message_role);
+    message.text = content;
+    Measure(message);
+    ScrollToEnd();
+}
+
+void ChatMessageList::AddImage(std::unique_ptr<LvglImage> image) {
+    auto& message = Push(kRoleImage);
+    message.image = std::move(image);
+    Measure(message);
+    ScrollToEnd();
+}
+
+void ChatMessageList::AppendText(const char* role, const char* chunk, bool start) {
+    if (start || count_ == 0 || At(count_ - 1).id != streaming_id_) {
+        AddMessage(role, chunk);
+        streaming_id_ = count_ > 0 && chunk[0] != '\0' ? At(count_ - 1).id : 0;
+        return;
+    }
+
+    auto& message = At(count_ - 1);
+    lv_coord_t height = message.height;
+    message.text += chunk;
+    MeasureText(message);
+
+    bool visible = false;
+    for (auto& row : rows_) {
+        if (row.message_id == message.id) {
+            // The text may have moved when it grew
+            lv_label_set_text_static(row.label, message.text.c_str());
+            lv_obj_set_width(row.label, message.text_width);
+            lv_obj_set_size(row.bubble, message.width, message.height);
+            visible = true;
+        }
+    }
+    // Follow the new lines unless the message was scrolled out of the view
+    if (visible && message.height != height) {
+        ScrollToEnd();
+    } else {
+        Layout();
+    }
+}
+
+void ChatMessageList::SetTheme(LvglTheme* theme) {
+    theme_ = theme;
+    for (auto& row : rows_) {
+        lv_obj_set_style_pad_all(row.bubble, theme_->spacing(4), 0);
+        Release(row);
+        row.role = -1;
+    }
+    // Fonts and spacing may differ, so every bubble is measured and placed again
+    lv_coord_t y = Top();
+    for (size_t i = 0; i < count_; i++) {
+        auto& message = At(i);
+        Measure(message);
+        message.y = y;
+        y += message.height + theme_->spacing(4);
+    }
+    Layout();
+}
+
+ChatMessageList::Message& ChatMessageList::Push(Role role) {
+    lv_coord_t y = 0;
+    if (count_ > 0) {
+        auto& last = At(count_ - 1);
+        y = last.y + last.height + theme_->spacing(4);
+    }
+    if (count_ == messages_.size()) {
+        // Everything moves up by the height of the oldest message, scroll along so the view stays
+        lv_coord_t top = Top();
+        PopFirst();
+        lv_obj_scroll_by(content_, 0, Top() - top, LV_ANIM_OFF);
+    }
+
+    auto& message = At(count_);
+    count_++;
+    message.id = next_id_++;
+    message.role = role;
+    message.text.clear();
+    message.image.reset();
+    message.y = y;
+    return message;
+}
+
+void ChatMessageList::Release(Row& row) {
+    // The label shows the message text without a copy, so it must not keep pointing to it
+    lv_label_set_text_static(row.label, "");
+    lv_image_set_src(row.image, nullptr);
+    lv_obj_add_flag(row.bubble, LV_OBJ_FLAG_HIDDEN);
+    row.message_id = 0;
+}
+
+void ChatMessageList::PopFirst() {
+    auto& message = At(0);
+    for (auto& row : rows_) {
+        if (row.message_id == message.id) {
+            Release(row);
+        }
+    }
+    message.text.clear();
+    message.image.reset();
+    first_ = (first_ + 1) % messages_.size();
+    count_--;
+}
+
+void ChatMessageList::PopLast() {
+    auto& message = At(count_ - 1);
+    for (auto& row : rows_) {
+        if (row.message_id == message.id) {
+            Release(row);
+        }
+    }
+    message.text.clear();
+    message.image.reset();
+    count_--;
+}
+
+void ChatMessageList::Measure(Message& message) {
+    if (message.role == kRoleImage) {
+        // Fit within 70% of the screen width and 50% of its height, never enlarged
+        lv_coord_t max_width = LV_HOR_RES * 70 / 100;
+        lv_coord_t max_height = LV_VER_RES * 50 / 100;
+        auto img_dsc = message.image->image_dsc();
+        lv_coord_t img_width = img_dsc->header.w;
+        lv_coord_t img_height = img_dsc->header.h;
+        if (img_width == 0 || img_height == 0) {
+            img_width = max_width;
+            img_height = max_height;
+            ESP_LOGW(TAG, "Invalid image dimensions, using default dimensions: %ld x %ld", max_width, max_height);
+        }
+        lv_coord_t zoom = std::min((max_width * 256) / img_width, (max_height * 256) / img_height);
+        zoom = std::min<lv_coord_t>(zoom, 256);
+        message.image_scale = zoom;
+        message.text_width = img_width * zoom / 256;
+        message.text_height = img_height * zoom / 256;
+        // 8 pixels around the image on each side
+        message.width = message.text_width + 16;
+        message.height = message.text_height + 16;
+        return;
+    }
+
+    message.line_start = 0;
+    message.lines = 0;
+    message.text_width = 0;
+    MeasureText(message);
+}
+
+// Continues from the last line measured, like lv_text_get_size() for the whole text
+void ChatMessageList::MeasureText(Message& message) {
+    auto font = theme_->text_font()->font();
+    lv_coord_t padding = theme_->spacing(4);
+    // 气泡宽度为最长一行的宽度，不超过屏幕宽度的85%
+    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;
+    lv_coord_t min_width = 20;
+    const char* text = message.text.c_str();
+    size_t length = message.text.size();
+    size_t start = message.line_start;
+    lv_coord_t text_width = message.text_width;
+    while (start < length) {
+        uint32_t size = lv_text_get_next_line(&text[start], length - start, font, 0, max_width, nullptr, LV_TEXT_FLAG_NONE);
+        text_width = std::max(text_width, lv_text_get_width(&text[start], size, font, 0));
+        if (size == 0 || start + size >= length) {
+            break;
+        }
+        message.lines++;
+        start += size;
+    }
+    message.line_start = start;
+
+    int lines = message.lines + 1;
+    if (length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r')) {
+        // A line break at the end starts an empty line
+        lines++;
+    }
+    message.text_width = std::clamp(text_width, min_width, max_width);
+    message.text_height = lines * lv_font_get_line_height(font);
+    message.width = message.text_width + padding * 2;
+    message.height = message.text_height + padding * 2;
+}
+
+lv_coord_t ChatMessageList::Bottom() {
+    if (count_ == 0) {
+        return Top();
+    }
+    auto& last = At(count_ - 1);
+    return last.y + last.height;
+}
+
+void ChatMessageList::Bind(Row& row, Message& message) {
+    if (row.role != message.role) {
+        lv_color_t bubble_color = theme_->assistant_bubble_color();
+        lv_color_t text_color = theme_->text_color();
+        if (message.role == kRoleUser) {
+            bubble_color = theme_->user_bubble_color();
+        } else if (message.role == kRoleSystem) {
+            bubble_color = theme_->system_bubble_color();
+            text_color = theme_->system_text_color();
+        }
+        lv_obj_set_style_bg_color(row.bubble, bubble_color, 0);
+        lv_obj_set_style_text_color(row.label, text_color, 0);
+        row.role = message.role;
+    }
+
+    if (row.message_id != message.id) {
+        if (message.role == kRoleImage) {
+            lv_obj_add_flag(row.label, LV_OBJ_FLAG_HIDDEN);
+            lv_image_set_src(row.image, message.image->image_dsc());
+            lv_image_set_scale(row.image, message.image_scale);
+            lv_obj_remove_flag(row.image, LV_OBJ_FLAG_HIDDEN);
+            lv_obj_center(row.image);
+        } else {
+            lv_image_set_src(row.image, nullptr);
+            lv_obj_add_flag(row.image, LV_OBJ_FLAG_HIDDEN);
+            lv_label_set_text_static(row.label, message.text.c_str());
+            lv_obj_set_width(row.label, message.text_width);
+            lv_obj_remove_flag(row.label, LV_OBJ_FLAG_HIDDEN);
+        }
+        lv_obj_set_size(row.bubble, message.width, message.height);
+        row.message_id = message.id;
+    }
+
+    // User messages on the right, system messages centered, the others on the left
+    lv_coord_t x = 0;
+    lv_coord_t content_width = lv_obj_get_content_width(content_);
+    if (message.role == kRoleUser) {
+        x = content_width - message.width;
+    } else if (message.role == kRoleSystem) {
+        x = (content_width - message.width) / 2;
+    }
+    lv_obj_set_pos(row.bubble, x, message.y - Top());
+    if (lv_obj_has_flag(row.bubble, LV_OBJ_FLAG_HIDDEN)) {
+        lv_obj_remove_flag(row.bubble, LV_OBJ_FLAG_HIDDEN);
+    }
+}
+
+void ChatMessageList::Layout() {
+    lv_coord_t top = Top();
+    lv_obj_set_pos(spacer_, 0, std::max<lv_coord_t>(0, Bottom() - top - 1));
+
+    // Messages are sorted by position, find the ones overlapping the visible part of the content
+    lv_coord_t view_top = top + lv_obj_get_scroll_y(content_);
+    lv_coord_t view_bottom = view_top + lv_obj_get_content_height(content_);
+    size_t low = 0, high = count_;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        auto& message = At(middle);
+        if (message.y + message.height <= view_top) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    size_t first = low;
+    size_t last = first;
+    while (last < count_ && At(last).y < view_bottom) {
+        last++;
+    }
+
+    // Release the rows of messages that scrolled out, ids grow with the position
+    uint32_t first_id = first < last ? At(first).id : 0;
+    uint32_t last_id = first < last ? At(last - 1).id : 0;
+    for (auto& row : rows_) {
+        if (row.message_id != 0 && (row.message_id < first_id || row.message_id > last_id)) {
+            Release(row);
+        }
+    }
+
+    for (size_t i = first; i < last; i++) {
+        auto& message = At(i);
+        Row* target = nullptr;
+        for (auto& row : rows_) {
+            if (row.message_id == message.id) {
+                target = &row;
+                break;
+            }
+        }
+        for (size_t j = 0; target == nullptr && j < rows_.size(); j++) {
+            if (rows_[j].message_id == 0) {
+                target = &rows_[j];
+            }
+        }
+        if (target == nullptr) {
+            // The pool only grows to the number of bubbles visible at once
+            Row row;
+            row.bubble = lv_obj_create(content_);
+            lv_obj_set_style_radius(row.bubble, 8, 0);
+            lv_obj_set_scrollbar_mode(row.bubble, LV_SCROLLBAR_MODE_OFF);
+            lv_obj_set_style_border_width(row.bubble, 0, 0);
+            lv_obj_set_style_pad_all(row.bubble, theme_->spacing(4), 0);
+            lv_obj_set_style_bg_opa(row.bubble, LV_OPA_70, 0);
+            row.label = lv_label_create(row.bubble);
+            lv_label_set_long_mode(row.label, LV_LABEL_LONG_WRAP);
+            row.image = lv_image_create(row.bubble);
+            row.message_id = 0;
+            row.role = -1;
+            rows_.push_back(row);
+            target = &rows_.back();
+            ESP_LOGD(TAG, "%d bubbles in the pool", (int)rows_.size());
+        }
+        Bind(*target, message);
+    }
+}
+
+void ChatMessageList::ScrollToEnd() {
+    Layout();
+    lv_obj_update_layout(content_);
+    lv_coord_t end = std::max<lv_coord_t>(0, Bottom() - Top() - lv_obj_get_content_height(content_));
+    lv_obj_scroll_to_y(content_, end, LV_ANIM_ON);
+}
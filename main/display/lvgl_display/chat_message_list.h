@@ -0,0 +1,94 @@
+#ifndef CHAT_MESSAGE_LIST_H
+#define CHAT_MESSAGE_LIST_H
+
+#include "lvgl_image.h"
+#include "lvgl_theme.h"
+
+#include <lvgl.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/*
+ * Chat bubbles of the WeChat message style, drawn by a small pool of recycled LVGL objects.
+ *
+ * The last `capacity` messages are kept in a ring with the bubble size measured once when they
+ * are added, a streamed message is measured again from its last line as it grows. Rows are placed at fixed positions in the scrollable `content` object, which has no
+ * layout of its own, and only the messages inside the visible part of it are bound to a row, so
+ * adding a message or scrolling never creates objects or lays out the whole conversation.
+ */
+class ChatMessageList {
+public:
+    ChatMessageList(lv_obj_t* content, LvglTheme* theme, size_t capacity);
+    ~ChatMessageList();
+
+    // A system message replaces the previous one if that was a system message too
+    void AddMessage(const char* role, const char* content);
+    void AddImage(std::unique_ptr<LvglImage> image);
+    // Grows the last message if it was streamed too, only its last line is measured again
+    void AppendText(const char* role, const char* chunk, bool start);
+    // Measures every message again with the fonts and colors of the theme
+    void SetTheme(LvglTheme* theme);
+    // Binds the rows to the messages in the visible part of the content
+    void Layout();
+    // No message yet, the rows and the spacer are children of the content either way
+    bool empty() const { return count_ == 0; }
+
+private:
+    enum Role {
+        kRoleUser,
+        kRoleAssistant,
+        kRoleSystem,
+        kRoleImage,
+    };
+
+    struct Message {
+        uint32_t id = 0;
+        Role role = kRoleAssistant;
+        std::string text;
+        std::unique_ptr<LvglImage> image;
+        lv_coord_t width = 0;       // Of the bubble
+        lv_coord_t height = 0;
+        lv_coord_t text_width = 0;  // Of the label, or the scaled image
+        lv_coord_t text_height = 0;
+        int32_t image_scale = LV_SCALE_NONE;
+        lv_coord_t y = 0;           // From the first message ever added
+        size_t line_start = 0;      // Of the last line, the lines before it keep their breaks
+        int lines = 0;              // Before the last line
+    };
+
+    struct Row {
+        lv_obj_t* bubble;
+        lv_obj_t* label;
+        lv_obj_t* image;
+        uint32_t message_id;        // 0 while unused
+        int role;                   // Styled for this role, -1 for none yet
+    };
+
+    lv_obj_t* content_;
+    LvglTheme* theme_;
+    // Keeps the scroll range at the height of all messages
+    lv_obj_t* spacer_;
+    std::vector<Message> messages_;
+    size_t first_ = 0;
+    size_t count_ = 0;
+    uint32_t next_id_ = 1;
+    uint32_t streaming_id_ = 0;
+    std::vector<Row> rows_;
+
+    Message& At(size_t index) { return messages_[(first_ + index) % messages_.size()]; }
+    Message& Push(Role role);
+    void PopFirst();
+    void PopLast();
+    void Measure(Message& message);
+    void MeasureText(Message& message);
+    lv_coord_t Top() { return count_ > 0 ? At(0).y : 0; }
+    lv_coord_t Bottom();
+    void Bind(Row& row, Message& message);
+    void Release(Row& row);
+    void ScrollToEnd();
+};
+
+#endif // CHAT_MESSAGE_LIST_H
@@ -28,7 +28,8 @@ typedef struct Table {
 #define LZW_CACHE_SIZE              (LZW_TABLE_SIZE * 4)
 #endif
 
-static gd_GIF  * gif_open(gd_GIF * gif);
+static gd_GIF  * gif_open(gd_GIF * gif, uint8_t cf);
+static bool gif_is_opaque(gd_GIF * gif, uint16_t width, uint16_t height, int gct_sz);
 static bool f_gif_open(gd_GIF * gif, const void * path, bool is_file);
 static void f_gif_read(gd_GIF * gif, void * buf, size_t len);
 static int f_gif_seek(gd_GIF * gif, size_t pos, int k);
@@ -56,11 +57,17 @@ gd_open_gif_file(const char * fname)
     bool res = f_gif_open(&gif_base, fname, true);
     if(!res) return NULL;
 
-    return gif_open(&gif_base);
+    return gif_open(&gif_base, GD_CF_ARGB8888);
 }
 
 gd_GIF *
 gd_open_gif_data(const void * data)
+{
+    return gd_open_gif_data_cf(data, GD_CF_ARGB8888);
+}
+
+gd_GIF *
+gd_open_gif_data_cf(const void * data, uint8_t cf)
 {
     gd_GIF gif_base;
     memset(&gif_base, 0, sizeof(gif_base));
@@ -68,10 +75,79 @@ gd_open_gif_data(const void * data)
     bool res = f_gif_open(&gif_base, data, false);
     if(!res) return NULL;
 
-    return gif_open(&gif_base);
+    return gif_open(&gif_base, cf);
+}
+
+static inline uint16_t
+rgb565(const uint8_t * color)
+{
+    return ((color[0] & 0xF8) << 8) | ((color[1] & 0xFC) << 3) | (color[2] >> 3);
 }
 
-static gd_GIF * gif_open(gd_GIF * gif_base)
+static void
+convert_palette(gd_GIF * gif, gd_Palette * palette)
+{
+    if(gif->cf == GD_CF_ARGB8888) return;
+    for(int i = 0; i < palette->size; i++) {
+        palette->rgb565[i] = rgb565(&palette->colors[i * 3]);
+    }
+}
+
+/* Fill a rect of the canvas, i is the index of its first pixel */
+static void
+fill_rect(gd_GIF * gif, uint8_t * buffer, int i, uint16_t w, uint16_t h, const uint8_t * color, uint8_t opa)
+{
+    int j, k;
+    if(gif->cf == GD_CF_ARGB8888) {
+#ifdef GIFDEC_FILL_BG
+        GIFDEC_FILL_BG(&buffer[i * 4], w, h, gif->width, color, opa);
+#else
+        for(j = 0; j < h; j++) {
+            for(k = 0; k < w; k++) {
+                buffer[(i + k) * 4 + 0] = *(color + 2);
+                buffer[(i + k) * 4 + 1] = *(color + 1);
+                buffer[(i + k) * 4 + 2] = *(color + 0);
+                buffer[(i + k) * 4 + 3] = opa;
+            }
+            i += gif->width;
+        }
+#endif
+        return;
+    }
+
+    uint16_t value = rgb565(color);
+    uint16_t * pixels = (uint16_t *) buffer;
+    uint8_t * alpha = gif->cf == GD_CF_RGB565A8 ? buffer + 2 * gif->width * gif->height : NULL;
+    for(j = 0; j < h; j++) {
+        for(k = 0; k < w; k++) {
+            pixels[i + k] = value;
+        }
+        if(alpha) memset(&alpha[i], opa, w);
+        i += gif->width;
+    }
+}
+
+/* Grow the changed area of the canvas */
+static void
+add_dirty(gd_GIF * gif, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+    if(w == 0 || h == 0) return;
+    if(gif->dw == 0) {
+        gif->dx = x;
+        gif->dy = y;
+        gif->dw = w;
+        gif->dh = h;
+        return;
+    }
+    uint16_t x2 = MAX(gif->dx + gif->dw, x + w);
+    uint16_t y2 = MAX(gif->dy + gif->dh, y + h);
+    gif->dx = MIN(gif->dx, x);
+    gif->dy = MIN(gif->dy, y);
+    gif->dw = x2 - gif->dx;
+    gif->dh = y2 - gif->dy;
+}
+
+static gd_GIF * gif_open(gd_GIF * gif_base, uint8_t cf)
 {
     uint8_t sigver[3];
     uint16_t width, height, depth;
@@ -116,31 +192,39 @@ static gd_GIF * gif_open(gd_GIF * gif_base)
         ESP_LOGW(TAG, "Zero size image");
         goto fail;
     }
+    if(cf == GD_CF_RGB565A8 && gif_is_opaque(gif_base, width, height, gct_sz)) {
+        cf = GD_CF_RGB565;
+    }
+    /* Canvas bytes per pixel, plus one for the frame indexes */
+    int bpp = cf == GD_CF_ARGB8888 ? 4 : (cf == GD_CF_RGB565 ? 2 : 3);
 #if LV_GIF_CACHE_DECODE_DATA
-    if(0 == (INT_MAX - sizeof(gd_GIF) - LZW_CACHE_SIZE) / width / height / 5){
+    if(0 == (INT_MAX - sizeof(gd_GIF) - LZW_CACHE_SIZE) / width / height / (bpp + 1)){
         ESP_LOGW(TAG, "Image dimensions are too large");
         goto fail;
     } 
-    gif = lv_malloc(sizeof(gd_GIF) + 5 * width * height + LZW_CACHE_SIZE);
+    gif = lv_malloc(sizeof(gd_GIF) + (bpp + 1) * width * height + LZW_CACHE_SIZE);
 #else
-    if(0 == (INT_MAX - sizeof(gd_GIF)) / width / height / 5){
+    if(0 == (INT_MAX - sizeof(gd_GIF)) / width / height / (bpp + 1)){
         ESP_LOGW(TAG, "Image dimensions are too large");
         goto fail;
     } 
-    gif = lv_malloc(sizeof(gd_GIF) + 5 * width * height);
+    gif = lv_malloc(sizeof(gd_GIF) + (bpp + 1) * width * height);
 #endif
     if(!gif) goto fail;
     memcpy(gif, gif_base, sizeof(gd_GIF));
     gif->width  = width;
     gif->height = height;
     gif->depth  = depth;
+    gif->cf = cf;
     /* Read GCT */
     gif->gct.size = gct_sz;
     f_gif_read(gif, gif->gct.colors, 3 * gif->gct.size);
+    convert_palette(gif, &gif->gct);
     gif->palette = &gif->gct;
     gif->bgindex = bgidx;
     gif->canvas = (uint8_t *) &gif[1];
-    gif->frame = &gif->canvas[4 * width * height];
+    gif->canvas_size = bpp * width * height;
+    gif->frame = &gif->canvas[gif->canvas_size];
     if(gif->bgindex) {
         memset(gif->frame, gif->bgindex, gif->width * gif->height);
     }
@@ -149,16 +233,8 @@ static gd_GIF * gif_open(gd_GIF * gif_base)
     gif->lzw_cache = gif->frame + width * height;
     #endif
 
-#ifdef GIFDEC_FILL_BG
-    GIFDEC_FILL_BG(gif->canvas, gif->width * gif->height, 1, gif->width * gif->height, bgcolor, 0x00);
-#else
-    for(int i = 0; i < gif->width * gif->height; i++) {
-        gif->canvas[i * 4 + 0] = *(bgcolor + 2);
-        gif->canvas[i * 4 + 1] = *(bgcolor + 1);
-        gif->canvas[i * 4 + 2] = *(bgcolor + 0);
-        gif->canvas[i * 4 + 3] = 0x00;  // 初始化为透明，让第一帧根据自己的透明度设置来渲染
-    }
-#endif
+    // 初始化为透明，让第一帧根据自己的透明度设置来渲染
+    fill_rect(gif, gif->canvas, 0, gif->width, gif->height, bgcolor, 0x00);
     gif->anim_start = f_gif_seek(gif, 0, LV_FS_SEEK_CUR);
     gif->loop_count = -1;
     goto ok;
@@ -179,6 +255,57 @@ discard_sub_blocks(gd_GIF * gif)
     } while(size);
 }
 
+/* True if the first frame covers the canvas without transparent pixels and no frame with a
+ * transparent color is restored to background, so the canvas never gets alpha. Transparent
+ * pixels of the other frames only keep what is already on the canvas. Only walks the blocks,
+ * nothing is decoded. */
+static bool
+gif_is_opaque(gd_GIF * gif, uint16_t width, uint16_t height, int gct_sz)
+{
+    size_t start = f_gif_seek(gif, 0, LV_FS_SEEK_CUR);
+    bool opaque = true;
+    bool first = true;
+    uint8_t sep, label, flags;
+    uint8_t gce_flags = 0;
+
+    f_gif_seek(gif, 3 * gct_sz, LV_FS_SEEK_CUR);
+    while(opaque) {
+        f_gif_read(gif, &sep, 1);
+        if(sep == '!') {
+            f_gif_read(gif, &label, 1);
+            if(label == 0xF9) {
+                /* Block size, then the packed fields with the transparency flag */
+                f_gif_seek(gif, 1, LV_FS_SEEK_CUR);
+                f_gif_read(gif, &gce_flags, 1);
+                f_gif_seek(gif, 3, LV_FS_SEEK_CUR);
+            }
+            discard_sub_blocks(gif);
+        }
+        else if(sep == ',') {
+            uint16_t fx = read_num(gif);
+            uint16_t fy = read_num(gif);
+            uint16_t fw = read_num(gif);
+            uint16_t fh = read_num(gif);
+            bool transparent = gce_flags & 1;
+            if(first && (fx != 0 || fy != 0 || fw != width || fh != height || transparent)) opaque = false;
+            if(transparent && ((gce_flags >> 2) & 7) == 2) opaque = false;
+            first = false;
+            gce_flags = 0;
+            f_gif_read(gif, &flags, 1);
+            if(flags & 0x80) f_gif_seek(gif, 3 * (1 << ((flags & 0x07) + 1)), LV_FS_SEEK_CUR);
+            /* LZW minimum code size */
+            f_gif_seek(gif, 1, LV_FS_SEEK_CUR);
+            discard_sub_blocks(gif);
+        }
+        else {
+            if(sep != ';') opaque = false;
+            break;
+        }
+    }
+    f_gif_seek(gif, start, LV_FS_SEEK_SET);
+    return opaque && !first;
+}
+
 static void
 read_plain_text_ext(gd_GIF * gif)
 {
@@ -649,6 +776,7 @@ read_image(gd_GIF * gif)
         /* Read LCT */
         gif->lct.size = 1 << ((fisrz & 0x07) + 1);
         f_gif_read(gif, gif->lct.colors, 3 * gif->lct.size);
+        convert_palette(gif, &gif->lct);
         gif->palette = &gif->lct;
     }
     else
@@ -657,10 +785,49 @@ read_image(gd_GIF * gif)
     return read_image_data(gif, interlace);
 }
 
+/* 2 bytes per pixel, and the A8 plane after them for GD_CF_RGB565A8 */
+static void
+render_frame_rect_rgb565(gd_GIF * gif, uint8_t * buffer, int i)
+{
+    int j, k;
+    uint16_t * pixels = (uint16_t *) buffer;
+    const uint16_t * palette = gif->palette->rgb565;
+    int tindex = gif->gce.transparency ? gif->gce.tindex : 0x100;
+
+    if(gif->cf == GD_CF_RGB565A8) {
+        uint8_t * alpha = buffer + 2 * gif->width * gif->height;
+        for(j = 0; j < gif->fh; j++) {
+            const uint8_t * index = &gif->frame[i];
+            for(k = 0; k < gif->fw; k++) {
+                if(index[k] != tindex) {
+                    pixels[i + k] = palette[index[k]];
+                    alpha[i + k] = 0xFF;
+                }
+            }
+            i += gif->width;
+        }
+    }
+    else {
+        for(j = 0; j < gif->fh; j++) {
+            const uint8_t * index = &gif->frame[i];
+            for(k = 0; k < gif->fw; k++) {
+                if(index[k] != tindex) {
+                    pixels[i + k] = palette[index[k]];
+                }
+            }
+            i += gif->width;
+        }
+    }
+}
+
 static void
 render_frame_rect(gd_GIF * gif, uint8_t * buffer)
 {
     int i = gif->fy * gif->width + gif->fx;
+    if(gif->cf != GD_CF_ARGB8888) {
+        render_frame_rect_rgb565(gif, buffer, i);
+        return;
+    }
 #ifdef GIFDEC_RENDER_FRAME
     GIFDEC_RENDER_FRAME(&buffer[i * 4], gif->fw, gif->fh, gif->width,
                         &gif->frame[i], gif->palette->colors,
@@ -690,6 +857,7 @@ dispose(gd_GIF * gif)
 {
     int i;
     uint8_t * bgcolor;
+    gif->dw = gif->dh = 0;
     switch(gif->gce.disposal) {
         case 2: /* Restore to background color. */
             bgcolor = &gif->palette->colors[gif->bgindex * 3];
@@ -698,27 +866,19 @@ dispose(gd_GIF * gif)
             if(gif->gce.transparency) opa = 0x00;
 
             i = gif->fy * gif->width + gif->fx;
-#ifdef GIFDEC_FILL_BG
-            GIFDEC_FILL_BG(&(gif->canvas[i * 4]), gif->fw, gif->fh, gif->width, bgcolor, opa);
-#else
-            int j, k;
-            for(j = 0; j < gif->fh; j++) {
-                for(k = 0; k < gif->fw; k++) {
-                    gif->canvas[(i + k) * 4 + 0] = *(bgcolor + 2);
-                    gif->canvas[(i + k) * 4 + 1] = *(bgcolor + 1);
-                    gif->canvas[(i + k) * 4 + 2] = *(bgcolor + 0);
-                    gif->canvas[(i + k) * 4 + 3] = opa;
-                }
-                i += gif->width;
-            }
-#endif
+            fill_rect(gif, gif->canvas, i, gif->fw, gif->fh, bgcolor, opa);
+            add_dirty(gif, gif->fx, gif->fy, gif->fw, gif->fh);
             break;
         case 3: /* Restore to previous, i.e., don't update canvas.*/
             break;
         default:
-            /* Add frame non-transparent pixels to canvas. */
-            render_frame_rect(gif, gif->canvas);
+            /* Add frame non-transparent pixels to canvas, unless gd_render_frame() already did. */
+            if(!gif->composited) {
+                render_frame_rect(gif, gif->canvas);
+                add_dirty(gif, gif->fx, gif->fy, gif->fw, gif->fh);
+            }
     }
+    gif->composited = 0;
 }
 
 /* Return 1 if got a frame; 0 if got GIF trailer; -1 if error. */
@@ -732,6 +892,7 @@ gd_get_frame(gd_GIF * gif)
     while(sep != ',') {
         if(sep == ';') {
             f_gif_seek(gif, gif->anim_start, LV_FS_SEEK_SET);
+            gif->loops++;
             if(gif->loop_count == 1 || gif->loop_count < 0) {
                 return 0;
             }
@@ -753,6 +914,10 @@ void
 gd_render_frame(gd_GIF * gif, uint8_t * buffer)
 {
     render_frame_rect(gif, buffer);
+    if(buffer == gif->canvas) {
+        gif->composited = 1;
+        add_dirty(gif, gif->fx, gif->fy, gif->fw, gif->fh);
+    }
 }
 
 void
@@ -9,9 +9,16 @@ extern "C" {
 
 #include <stdint.h>
 
+/* Canvas color formats */
+#define GD_CF_ARGB8888  0
+#define GD_CF_RGB565    1
+/* RGB565 plane followed by an A8 plane, opened as GD_CF_RGB565 when no frame is transparent */
+#define GD_CF_RGB565A8  2
+
 typedef struct _gd_Palette {
     int size;
     uint8_t colors[0x100 * 3];
+    uint16_t rgb565[0x100];
 } gd_Palette;
 
 typedef struct _gd_GCE {
@@ -44,7 +51,15 @@ typedef struct _gd_GIF {
     void (*comment)(struct _gd_GIF * gif);
     void (*application)(struct _gd_GIF * gif, char id[8], char auth[3]);
     uint16_t fx, fy, fw, fh;
+    /* Canvas area changed by the last gd_get_frame() and gd_render_frame(), dw is 0 if none */
+    uint16_t dx, dy, dw, dh;
     uint8_t bgindex;
+    uint8_t cf;
+    /* The last frame was rendered into the canvas, so disposal does not render it again */
+    uint8_t composited;
+    /* Times the animation went back to its first frame */
+    uint32_t loops;
+    uint32_t canvas_size;
     uint8_t * canvas, * frame;
 #if LV_GIF_CACHE_DECODE_DATA
     uint8_t *lzw_cache;
@@ -55,6 +70,8 @@ gd_GIF * gd_open_gif_file(const char * fname);
 
 gd_GIF * gd_open_gif_data(const void * data);
 
+gd_GIF * gd_open_gif_data_cf(const void * data, uint8_t cf);
+
 void gd_render_frame(gd_GIF * gif, uint8_t * buffer);
 
 int gd_get_frame(gd_GIF * gif);
@@ -1,7 +1,14 @@
 #include "lvgl_gif.h"
 #include <esp_log.h>
+#include <esp_heap_caps.h>
 #include <cstring>
 
+#define TAG "LvglGif"
+
+#ifndef CONFIG_GIF_FRAME_CACHE_SIZE
+#define CONFIG_GIF_FRAME_CACHE_SIZE 0
+#endif
+
 LvglGif::LvglGif(const lv_image_dsc_t* img_dsc)
     : gif_(nullptr), timer_(nullptr), last_call_(0), playing_(false), loaded_(false) {
     if (!img_dsc || !img_dsc->data) {
@@ -9,7 +16,13 @@ LvglGif::LvglGif(const lv_image_dsc_t* img_dsc)
         return;
     }
 
+#if LV_COLOR_DEPTH == 16
+    // RGB565 panels draw the canvas as is instead of converting it from ARGB8888 on every
+    // refresh, the alpha plane is left out when no frame is transparent
+    gif_ = gd_open_gif_data_cf(img_dsc->data, GD_CF_RGB565A8);
+#else
     gif_ = gd_open_gif_data(img_dsc->data);
+#endif
     if (!gif_) {
         ESP_LOGE(TAG, "Failed to open GIF from image descriptor");
         return;
@@ -19,12 +32,22 @@ LvglGif::LvglGif(const lv_image_dsc_t* img_dsc)
     memset(&img_dsc_, 0, sizeof(img_dsc_));
     img_dsc_.header.magic = LV_IMAGE_HEADER_MAGIC;
     img_dsc_.header.flags = LV_IMAGE_FLAGS_MODIFIABLE;
-    img_dsc_.header.cf = LV_COLOR_FORMAT_ARGB8888;
+    if (gif_->cf == GD_CF_RGB565) {
+        img_dsc_.header.cf = LV_COLOR_FORMAT_RGB565;
+        img_dsc_.header.stride = gif_->width * 2;
+    } else if (gif_->cf == GD_CF_RGB565A8) {
+        img_dsc_.header.cf = LV_COLOR_FORMAT_RGB565A8;
+        img_dsc_.header.stride = gif_->width * 2;
+    } else {
+        img_dsc_.header.cf = LV_COLOR_FORMAT_ARGB8888;
+        img_dsc_.header.stride = gif_->width * 4;
+    }
     img_dsc_.header.w = gif_->width;
     img_dsc_.header.h = gif_->height;
-    img_dsc_.header.stride = gif_->width * 4;
     img_dsc_.data = gif_->canvas;
-    img_dsc_.data_size = gif_->width * gif_->height * 4;
+    img_dsc_.data_size = gif_->canvas_size;
+    lv_area_set(&dirty_area_, 0, 0, gif_->width - 1, gif_->height - 1);
+    caching_ = CONFIG_GIF_FRAME_CACHE_SIZE > 0;
 
     // Render first frame
     if (gif_->canvas) {
@@ -102,6 +125,9 @@ void LvglGif::Stop() {
         lv_timer_pause(timer_);
     }
 
+    ClearFrameCache();
+    caching_ = CONFIG_GIF_FRAME_CACHE_SIZE > 0;
+
     if (gif_) {
         gd_rewind(gif_);
         NextFrame();
@@ -150,11 +176,35 @@ void LvglGif::SetFrameCallback(std::function<void()> callback) {
     frame_callback_ = callback;
 }
 
+void LvglGif::Invalidate(lv_obj_t* image) const {
+    if (!loaded_ || dirty_area_.x2 < dirty_area_.x1) {
+        return;
+    }
+    lv_image_cache_drop(&img_dsc_);
+
+    // Canvas pixels map 1:1 to the screen only when the image is shown unscaled at its own size
+    if (lv_image_get_scale(image) != LV_SCALE_NONE || lv_image_get_rotation(image) != 0
+        || lv_obj_get_content_width(image) != gif_->width || lv_obj_get_content_height(image) != gif_->height) {
+        lv_obj_invalidate(image);
+        return;
+    }
+    lv_area_t coords;
+    lv_obj_get_content_coords(image, &coords);
+    lv_area_t area = dirty_area_;
+    lv_area_move(&area, coords.x1, coords.y1);
+    lv_obj_invalidate_area(image, &area);
+}
+
 void LvglGif::NextFrame() {
     if (!loaded_ || !gif_ || !playing_) {
         return;
     }
 
+    if (cached_frame_ >= 0) {
+        NextCachedFrame();
+        return;
+    }
+
     // Check if enough time has passed for the next frame
     uint32_t elapsed = lv_tick_elaps(last_call_);
     if (elapsed < gif_->gce.delay * 10) {
@@ -164,6 +214,7 @@ void LvglGif::NextFrame() {
     last_call_ = lv_tick_get();
 
     // Get next frame
+    uint32_t loops = gif_->loops;
     int has_next = gd_get_frame(gif_);
     if (has_next == 0) {
         // Animation finished, pause timer
@@ -173,10 +224,33 @@ void LvglGif::NextFrame() {
         }
         ESP_LOGD(TAG, "GIF animation completed");
     }
+    if (has_next != 1) {
+        ClearFrameCache();
+        caching_ = false;
+    }
 
     // Render current frame
     if (gif_->canvas) {
         gd_render_frame(gif_, gif_->canvas);
+        UpdateDirtyArea();
+        if (caching_) {
+            if (gif_->loops != loops) {
+                // The second loop repeats the first exactly when it starts from the same canvas
+                // with the same graphic control, which later frames without one inherit
+                auto& first = frame_cache_.empty() ? gif_->gce : frame_cache_[0].gce;
+                if (!frame_cache_.empty() && memcmp(frame_cache_[0].data, gif_->canvas, gif_->canvas_size) == 0
+                    && first.delay == gif_->gce.delay && first.disposal == gif_->gce.disposal
+                    && first.transparency == gif_->gce.transparency && first.tindex == gif_->gce.tindex) {
+                    cached_frame_ = 0;
+                    ESP_LOGD(TAG, "Replaying %d cached frames (%d bytes)", (int)frame_cache_.size(), (int)frame_cache_bytes_);
+                } else {
+                    ClearFrameCache();
+                }
+                caching_ = false;
+            } else {
+                CacheFrame();
+            }
+        }
         
         // Call frame callback if set
         if (frame_callback_) {
@@ -185,6 +259,91 @@ void LvglGif::NextFrame() {
     }
 }
 
+void LvglGif::UpdateDirtyArea() {
+    if (gif_->dw == 0) {
+        lv_area_set(&dirty_area_, 0, 0, -1, -1);
+    } else {
+        lv_area_set(&dirty_area_, gif_->dx, gif_->dy, gif_->dx + gif_->dw - 1, gif_->dy + gif_->dh - 1);
+    }
+}
+
+void LvglGif::CacheFrame() {
+    size_t size = gif_->canvas_size;
+    uint8_t* data = nullptr;
+    if (frame_cache_bytes_ + size <= CONFIG_GIF_FRAME_CACHE_SIZE * 1024) {
+#if CONFIG_SPIRAM
+        data = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+#endif
+    }
+    if (data == nullptr) {
+        // Too long to cache, keep decoding every loop
+        ClearFrameCache();
+        caching_ = false;
+        return;
+    }
+    memcpy(data, gif_->canvas, size);
+    frame_cache_.push_back({ data, gif_->gce, dirty_area_ });
+    frame_cache_bytes_ += size;
+}
+
+void LvglGif::NextCachedFrame() {
+    if (lv_tick_elaps(last_call_) < frame_cache_[cached_frame_].gce.delay * 10) {
+        return;
+    }
+    last_call_ = lv_tick_get();
+
+    size_t next = cached_frame_ + 1;
+    if (next == frame_cache_.size()) {
+        // Same loop counting as gd_get_frame()
+        if (gif_->loop_count == 1 || gif_->loop_count < 0) {
+            playing_ = false;
+            if (timer_) {
+                lv_timer_pause(timer_);
+            }
+            return;
+        }
+        if (gif_->loop_count > 1) {
+            gif_->loop_count--;
+        }
+        next = 0;
+    }
+
+    auto& frame = frame_cache_[next];
+    if (next == 0) {
+        memcpy(gif_->canvas, frame.data, gif_->canvas_size);
+        lv_area_set(&dirty_area_, 0, 0, gif_->width - 1, gif_->height - 1);
+    } else if (frame.area.x2 >= frame.area.x1) {
+        // Only the rows of the area this frame changed are copied
+        size_t bpp = gif_->cf == GD_CF_ARGB8888 ? 4 : 2;
+        size_t alpha_plane = (size_t)gif_->width * gif_->height * 2;
+        size_t width = frame.area.x2 - frame.area.x1 + 1;
+        for (int y = frame.area.y1; y <= frame.area.y2; y++) {
+            size_t i = (size_t)y * gif_->width + frame.area.x1;
+            memcpy(gif_->canvas + i * bpp, frame.data + i * bpp, width * bpp);
+            if (gif_->cf == GD_CF_RGB565A8) {
+                memcpy(gif_->canvas + alpha_plane + i, frame.data + alpha_plane + i, width);
+            }
+        }
+        dirty_area_ = frame.area;
+    } else {
+        dirty_area_ = frame.area;
+    }
+    cached_frame_ = next;
+
+    if (frame_callback_) {
+        frame_callback_();
+    }
+}
+
+void LvglGif::ClearFrameCache() {
+    for (auto& frame : frame_cache_) {
+        heap_caps_free(frame.data);
+    }
+    frame_cache_.clear();
+    frame_cache_bytes_ = 0;
+    cached_frame_ = -1;
+}
+
 void LvglGif::Cleanup() {
     // Stop and delete timer
     if (timer_) {
@@ -192,6 +351,8 @@ void LvglGif::Cleanup() {
         timer_ = nullptr;
     }
 
+    ClearFrameCache();
+
     // Close GIF decoder
     if (gif_) {
         gd_close_gif(gif_);
@@ -5,6 +5,7 @@
 #include <lvgl.h>
 #include <memory>
 #include <functional>
+#include <vector>
 
 /**
  * C++ implementation of LVGL GIF widget
@@ -69,6 +70,16 @@ public:
      */
     void SetFrameCallback(std::function<void()> callback);
 
+    /**
+     * Canvas area changed by the last frame, in image coordinates
+     */
+    const lv_area_t& dirty_area() const { return dirty_area_; }
+
+    /**
+     * Redraw only the part of an image object showing this GIF that the last frame changed
+     */
+    void Invalidate(lv_obj_t* image) const;
+
 private:
     // GIF decoder instance
     gd_GIF* gif_;
@@ -88,11 +99,30 @@ private:
     
     // Frame update callback
     std::function<void()> frame_callback_;
-    
+
+    lv_area_t dirty_area_;
+
+    // Frames of the first loop kept in PSRAM and replayed without decoding
+    struct CachedFrame {
+        uint8_t* data;
+        gd_GCE gce;
+        lv_area_t area;
+    };
+    std::vector<CachedFrame> frame_cache_;
+    size_t frame_cache_bytes_ = 0;
+    bool caching_ = false;
+    // Index of the frame shown from the cache, -1 while decoding
+    int cached_frame_ = -1;
+
     /**
      * Update to next frame
      */
     void NextFrame();
+
+    void UpdateDirtyArea();
+    void CacheFrame();
+    void NextCachedFrame();
+    void ClearFrameCache();
     
     /**
      * Cleanup resources
@@ -4,7 +4,7 @@
 #include <stddef.h>
 #include <string.h>
 #include <memory>
-#include <esp_attr.h>
+#include <algorithm>
 #include <esp_heap_caps.h>
 #include <esp_log.h>
 
@@ -28,63 +28,6 @@ static void *_malloc(size_t size)
     return NULL;
 }
 
-static IRAM_ATTR void convert_line_format(uint8_t * src, pixformat_t format, uint8_t * dst, size_t width, size_t in_channels, size_t line)
-{
-    int i=0, o=0, l=0;
-    if(format == PIXFORMAT_GRAYSCALE) {
-        memcpy(dst, src + line * width, width);
-    } else if(format == PIXFORMAT_RGB888) {
-        l = width * 3;
-        src += l * line;
-        for(i=0; i<l; i+=3) {
-            dst[o++] = src[i+2];
-            dst[o++] = src[i+1];
-            dst[o++] = src[i];
-        }
-    } else if(format == PIXFORMAT_RGB565) {
-        l = width * 2;
-        src += l * line;
-        for(i=0; i<l; i+=2) {
-            dst[o++] = src[i] & 0xF8;
-            dst[o++] = (src[i] & 0x07) << 5 | (src[i+1] & 0xE0) >> 3;
-            dst[o++] = (src[i+1] & 0x1F) << 3;
-        }
-    } else if(format == PIXFORMAT_YUV422) {
-        // YUV422转RGB的简化实现
-        l = width * 2;
-        src += l * line;
-        for(i=0; i<l; i+=4) {
-            int y0 = src[i];
-            int u = src[i+1];
-            int y1 = src[i+2];
-            int v = src[i+3];
-
-            // 简化的YUV到RGB转换
-            int c = y0 - 16;
-            int d = u - 128;
-            int e = v - 128;
-            
-            int r = (298 * c + 409 * e + 128) >> 8;
-            int g = (298 * c - 100 * d - 208 * e + 128) >> 8;
-            int b = (298 * c + 516 * d + 128) >> 8;
-            
-            dst[o++] = (r < 0) ? 0 : ((r > 255) ? 255 : r);
-            dst[o++] = (g < 0) ? 0 : ((g > 255) ? 255 : g);
-            dst[o++] = (b < 0) ? 0 : ((b > 255) ? 255 : b);
-
-            // Y1像素
-            c = y1 - 16;
-            r = (298 * c + 409 * e + 128) >> 8;
-            g = (298 * c - 100 * d - 208 * e + 128) >> 8;
-            b = (298 * c + 516 * d + 128) >> 8;
-            
-            dst[o++] = (r < 0) ? 0 : ((r > 255) ? 255 : r);
-            dst[o++] = (g < 0) ? 0 : ((g > 255) ? 255 : g);
-            dst[o++] = (b < 0) ? 0 : ((b > 255) ? 255 : b);
-        }
-    }
-}
-
 // 回调流实现 - 用于回调版本的JPEG编码
 class callback_stream : public jpge2_simple::output_stream {
 protected:
@@ -161,6 +104,26 @@ static bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixform
     comp_params.m_subsampling = subsampling;
     comp_params.m_quality = quality;
 
+    // 编码器直接读取的源像素格式
+    jpge2_simple::source_format_t source_format;
+    int bytes_per_pixel;
+    if(format == PIXFORMAT_GRAYSCALE) {
+        source_format = jpge2_simple::SRC_GRAY8;
+        bytes_per_pixel = 1;
+    } else if(format == PIXFORMAT_RGB888) {
+        source_format = jpge2_simple::SRC_BGR888;
+        bytes_per_pixel = 3;
+    } else if(format == PIXFORMAT_RGB565) {
+        source_format = jpge2_simple::SRC_RGB565_BE;
+        bytes_per_pixel = 2;
+    } else if(format == PIXFORMAT_YUV422) {
+        source_format = jpge2_simple::SRC_YUV422;
+        bytes_per_pixel = 2;
+    } else {
+        ESP_LOGE(TAG, "Unsupported pixel format: %d", format);
+        return false;
+    }
+
     // ⚠️ 关键：必须在堆上创建编码器！约8KB内存从堆分配
     auto dst_image = std::make_unique<jpge2_simple::jpeg_encoder>();
 
@@ -169,21 +132,16 @@ static bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixform
         return false;
     }
 
-    uint8_t* line = (uint8_t*)_malloc(width * num_channels);
-    if(!line) {
-        ESP_LOGE(TAG, "Scan line malloc failed");
-        return false;
-    }
-
-    for (int i = 0; i < height; i++) {
-        convert_line_format(src, format, line, width, num_channels, i);
-        if (!dst_image->process_scanline(line)) {
-            ESP_LOGE(TAG, "JPG process line %u failed", i);
-            free(line);
+    // 按 MCU 行批量编码，源像素直接转换为 YCbCr，不再逐扫描线转换
+    int stride = width * bytes_per_pixel;
+    int mcu_height = dst_image->get_mcu_height();
+    for (int y = 0; y < height; y += mcu_height) {
+        int lines = std::min(mcu_height, height - y);
+        if (!dst_image->encode_mcu_row(src + y * stride, stride, lines, source_format)) {
+            ESP_LOGE(TAG, "JPG process lines %d failed", y);
             return false;
         }
     }
-    free(line);
 
     if (!dst_image->process_scanline(NULL)) {
         ESP_LOGE(TAG, "JPG image finish failed");
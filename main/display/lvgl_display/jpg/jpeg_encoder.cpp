@@ -74,12 +74,15 @@ namespace jpge2_simple {
         return static_cast<uint8>(i);
     }
 
+    static inline void RGB_to_YCC_pixel(uint8* pDst, int r, int g, int b) {
+        pDst[0] = static_cast<uint8>((r * YR + g * YG + b * YB + 32768) >> 16);
+        pDst[1] = clamp(128 + ((r * CB_R + g * CB_G + b * CB_B + 32768) >> 16));
+        pDst[2] = clamp(128 + ((r * CR_R + g * CR_G + b * CR_B + 32768) >> 16));
+    }
+
     static void RGB_to_YCC(uint8* pDst, const uint8 *pSrc, int num_pixels) {
         for ( ; num_pixels; pDst += 3, pSrc += 3, num_pixels--) {
-            const int r = pSrc[0], g = pSrc[1], b = pSrc[2];
-            pDst[0] = static_cast<uint8>((r * YR + g * YG + b * YB + 32768) >> 16);
-            pDst[1] = clamp(128 + ((r * CB_R + g * CB_G + b * CB_B + 32768) >> 16));
-            pDst[2] = clamp(128 + ((r * CR_R + g * CR_G + b * CR_B + 32768) >> 16));
+            RGB_to_YCC_pixel(pDst, pSrc[0], pSrc[1], pSrc[2]);
         }
     }
 
@@ -97,39 +100,112 @@ namespace jpge2_simple {
         }
     }
 
-    // Forward DCT - DCT derived from jfdctint.
-    enum { CONST_BITS = 13, ROW_BITS = 2 };
-#define DCT_DESCALE(x, n) (((x) + (((int32)1) << ((n) - 1))) >> (n))
-#define DCT_MUL(var, c) (static_cast<int16>(var) * static_cast<int32>(c))
-#define DCT1D(s0, s1, s2, s3, s4, s5, s6, s7) \
+    // 以下为 encode_mcu_row() 使用的转换：源像素直接写成 YCbCr，省去中间的 RGB888 扫描线。
+    // 每次处理两个像素（RGB565 / YUV422 的一个 32 位字），结果与原来先转 RGB888 再转换的路径一致
+    static inline int RGB565_BE_r(const uint8 *p) { return p[0] & 0xF8; }
+    static inline int RGB565_BE_g(const uint8 *p) { return ((p[0] & 0x07) << 5) | ((p[1] & 0xE0) >> 3); }
+    static inline int RGB565_BE_b(const uint8 *p) { return (p[1] & 0x1F) << 3; }
+
+    // YUV422 为 BT.601 限幅范围（Y 16-235，C 16-240），JFIF 要求全范围
+    static inline uint8 expand_luma(int y) { return clamp(((y - 16) * 298 + 128) >> 8); }
+    static inline uint8 expand_chroma(int c) { return clamp(128 + (((c - 128) * 291 + 128) >> 8)); }
+
+    static void convert_to_YCC(uint8* pDst, const uint8 *pSrc, int num_pixels, source_format_t format) {
+        switch (format) {
+            case SRC_GRAY8:
+                Y_to_YCC(pDst, pSrc, num_pixels);
+                break;
+            case SRC_BGR888:
+                for ( ; num_pixels; pDst += 3, pSrc += 3, num_pixels--) {
+                    RGB_to_YCC_pixel(pDst, pSrc[2], pSrc[1], pSrc[0]);
+                }
+                break;
+            case SRC_RGB565_BE:
+                for ( ; num_pixels >= 2; pDst += 6, pSrc += 4, num_pixels -= 2) {
+                    RGB_to_YCC_pixel(pDst, RGB565_BE_r(pSrc), RGB565_BE_g(pSrc), RGB565_BE_b(pSrc));
+                    RGB_to_YCC_pixel(pDst + 3, RGB565_BE_r(pSrc + 2), RGB565_BE_g(pSrc + 2), RGB565_BE_b(pSrc + 2));
+                }
+                if (num_pixels) {
+                    RGB_to_YCC_pixel(pDst, RGB565_BE_r(pSrc), RGB565_BE_g(pSrc), RGB565_BE_b(pSrc));
+                }
+                break;
+            case SRC_YUV422:
+                for ( ; num_pixels >= 2; pDst += 6, pSrc += 4, num_pixels -= 2) {
+                    const uint8 cb = expand_chroma(pSrc[1]), cr = expand_chroma(pSrc[3]);
+                    pDst[0] = expand_luma(pSrc[0]); pDst[1] = cb; pDst[2] = cr;
+                    pDst[3] = expand_luma(pSrc[2]); pDst[4] = cb; pDst[5] = cr;
+                }
+                if (num_pixels) {
+                    // 奇数宽度的最后一个像素没有 V
+                    pDst[0] = expand_luma(pSrc[0]); pDst[1] = expand_chroma(pSrc[1]); pDst[2] = 128;
+                }
+                break;
+        }
+    }
+
+    static void convert_to_Y(uint8* pDst, const uint8 *pSrc, int num_pixels, source_format_t format) {
+        switch (format) {
+            case SRC_GRAY8:
+                memcpy(pDst, pSrc, num_pixels);
+                break;
+            case SRC_BGR888:
+                for ( ; num_pixels; pDst++, pSrc += 3, num_pixels--) {
+                    pDst[0] = static_cast<uint8>((pSrc[2] * YR + pSrc[1] * YG + pSrc[0] * YB + 32768) >> 16);
+                }
+                break;
+            case SRC_RGB565_BE:
+                for ( ; num_pixels; pDst++, pSrc += 2, num_pixels--) {
+                    pDst[0] = static_cast<uint8>((RGB565_BE_r(pSrc) * YR + RGB565_BE_g(pSrc) * YG + RGB565_BE_b(pSrc) * YB + 32768) >> 16);
+                }
+                break;
+            case SRC_YUV422:
+                for ( ; num_pixels; pDst++, pSrc += 2, num_pixels--) {
+                    pDst[0] = expand_luma(pSrc[0]);
+                }
+                break;
+        }
+    }
+
+    // Forward DCT - fixed-point AAN (Arai, Agui, Nakajima) derived from jfdctfst, 5 multiplies per 1-D pass.
+    // The outputs are not descaled, they are 2^AAN_PASS_BITS * 8 * aan_scale[u] * aan_scale[v] times the DCT
+    // coefficients, which is folded into the quantization reciprocals, so no division is left per coefficient.
+    // AAN_PASS_BITS extra fraction bits of the samples keep the rounding of the multiplies out of the results.
+    enum { AAN_BITS = 14, AAN_PASS_BITS = 2, QUANT_RECIP_BITS = 16 };
+    static const int32 AAN_0_382683433 = 6270, AAN_0_541196100 = 8867, AAN_0_707106781 = 11585, AAN_1_306562965 = 21407;
+#define AAN_MUL(var, c) (((var) * (c) + (1 << (AAN_BITS - 1))) >> AAN_BITS)
+#define AAN_DCT1D(s0, s1, s2, s3, s4, s5, s6, s7) \
     int32 t0 = s0 + s7, t7 = s0 - s7, t1 = s1 + s6, t6 = s1 - s6, t2 = s2 + s5, t5 = s2 - s5, t3 = s3 + s4, t4 = s3 - s4; \
     int32 t10 = t0 + t3, t13 = t0 - t3, t11 = t1 + t2, t12 = t1 - t2; \
-    int32 u1 = DCT_MUL(t12 + t13, 4433); \
-    s2 = u1 + DCT_MUL(t13, 6270); \
-    s6 = u1 + DCT_MUL(t12, -15137); \
-    u1 = t4 + t7; \
-    int32 u2 = t5 + t6, u3 = t4 + t6, u4 = t5 + t7; \
-    int32 z5 = DCT_MUL(u3 + u4, 9633); \
-    t4 = DCT_MUL(t4, 2446); t5 = DCT_MUL(t5, 16819); \
-    t6 = DCT_MUL(t6, 25172); t7 = DCT_MUL(t7, 12299); \
-    u1 = DCT_MUL(u1, -7373); u2 = DCT_MUL(u2, -20995); \
-    u3 = DCT_MUL(u3, -16069); u4 = DCT_MUL(u4, -3196); \
-    u3 += z5; u4 += z5; \
-    s0 = t10 + t11; s1 = t7 + u1 + u4; s3 = t6 + u2 + u3; s4 = t10 - t11; s5 = t5 + u2 + u4; s7 = t4 + u1 + u3;
+    s0 = t10 + t11; s4 = t10 - t11; \
+    int32 z1 = AAN_MUL(t12 + t13, AAN_0_707106781); \
+    s2 = t13 + z1; s6 = t13 - z1; \
+    t10 = t4 + t5; t11 = t5 + t6; t12 = t6 + t7; \
+    int32 z5 = AAN_MUL(t10 - t12, AAN_0_382683433); \
+    int32 z2 = AAN_MUL(t10, AAN_0_541196100) + z5, z4 = AAN_MUL(t12, AAN_1_306562965) + z5; \
+    int32 z3 = AAN_MUL(t11, AAN_0_707106781); \
+    int32 z11 = t7 + z3, z13 = t7 - z3; \
+    s5 = z13 + z2; s3 = z13 - z2; s1 = z11 + z4; s7 = z11 - z4;
+
+    // aan_scale[u] * aan_scale[v] in natural order, scaled by 2^14, aan_scale[0] = 1, aan_scale[k] = cos(k * pi / 16) * sqrt(2)
+    static const int16 s_aan_scales[64] = {
+        16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520, 22725, 31521, 29692, 26722, 22725, 17855, 12299,  6270,
+        21407, 29692, 27969, 25172, 21407, 16819, 11585,  5906, 19266, 26722, 25172, 22654, 19266, 15137, 10426,  5315,
+        16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520, 12873, 17855, 16819, 15137, 12873, 10114,  6967,  3552,
+         8867, 12299, 11585, 10426,  8867,  6967,  4799,  2446,  4520,  6270,  5906,  5315,  4520,  3552,  2446,  1247
+    };
 
     static void DCT2D(int32 *p) {
         int32 c, *q = p;
         for (c = 7; c >= 0; c--, q += 8) {
-            int32 s0 = q[0], s1 = q[1], s2 = q[2], s3 = q[3], s4 = q[4], s5 = q[5], s6 = q[6], s7 = q[7];
-            DCT1D(s0, s1, s2, s3, s4, s5, s6, s7);
-            q[0] = s0 << ROW_BITS; q[1] = DCT_DESCALE(s1, CONST_BITS-ROW_BITS); q[2] = DCT_DESCALE(s2, CONST_BITS-ROW_BITS); q[3] = DCT_DESCALE(s3, CONST_BITS-ROW_BITS);
-            q[4] = s4 << ROW_BITS; q[5] = DCT_DESCALE(s5, CONST_BITS-ROW_BITS); q[6] = DCT_DESCALE(s6, CONST_BITS-ROW_BITS); q[7] = DCT_DESCALE(s7, CONST_BITS-ROW_BITS);
+            int32 s0 = q[0] << AAN_PASS_BITS, s1 = q[1] << AAN_PASS_BITS, s2 = q[2] << AAN_PASS_BITS, s3 = q[3] << AAN_PASS_BITS;
+            int32 s4 = q[4] << AAN_PASS_BITS, s5 = q[5] << AAN_PASS_BITS, s6 = q[6] << AAN_PASS_BITS, s7 = q[7] << AAN_PASS_BITS;
+            AAN_DCT1D(s0, s1, s2, s3, s4, s5, s6, s7);
+            q[0] = s0; q[1] = s1; q[2] = s2; q[3] = s3; q[4] = s4; q[5] = s5; q[6] = s6; q[7] = s7;
         }
         for (q = p, c = 7; c >= 0; c--, q++) {
             int32 s0 = q[0*8], s1 = q[1*8], s2 = q[2*8], s3 = q[3*8], s4 = q[4*8], s5 = q[5*8], s6 = q[6*8], s7 = q[7*8];
-            DCT1D(s0, s1, s2, s3, s4, s5, s6, s7);
-            q[0*8] = DCT_DESCALE(s0, ROW_BITS+3); q[1*8] = DCT_DESCALE(s1, CONST_BITS+ROW_BITS+3); q[2*8] = DCT_DESCALE(s2, CONST_BITS+ROW_BITS+3); q[3*8] = DCT_DESCALE(s3, CONST_BITS+ROW_BITS+3);
-            q[4*8] = DCT_DESCALE(s4, ROW_BITS+3); q[5*8] = DCT_DESCALE(s5, CONST_BITS+ROW_BITS+3); q[6*8] = DCT_DESCALE(s6, CONST_BITS+ROW_BITS+3); q[7*8] = DCT_DESCALE(s7, CONST_BITS+ROW_BITS+3);
+            AAN_DCT1D(s0, s1, s2, s3, s4, s5, s6, s7);
+            q[0*8] = s0; q[1*8] = s1; q[2*8] = s2; q[3*8] = s3; q[4*8] = s4; q[5*8] = s5; q[6*8] = s6; q[7*8] = s7;
         }
     }
 
@@ -370,26 +446,16 @@ namespace jpge2_simple {
 
     void jpeg_encoder::load_quantized_coefficients(int component_num)
     {
-        int32 *q = m_quantization_tables[component_num > 0];
+        // Multiply by the reciprocal instead of dividing, rounding half away from zero like (|j| + q / 2) / q
+        const int32 *r = m_quantization_recip[component_num > 0];
         int16 *pDst = m_coefficient_array;
         for (int i = 0; i < 64; i++)
         {
             sample_array_t j = m_sample_array[s_zag[i]];
             if (j < 0)
-            {
-                if ((j = -j + (*q >> 1)) < *q)
-                    *pDst++ = 0;
-                else
-                    *pDst++ = static_cast<int16>(-(j / *q));
-            }
+                *pDst++ = static_cast<int16>(-((-j * r[i] + (1 << (QUANT_RECIP_BITS + AAN_PASS_BITS - 1))) >> (QUANT_RECIP_BITS + AAN_PASS_BITS)));
             else
-            {
-                if ((j = j + (*q >> 1)) < *q)
-                    *pDst++ = 0;
-                else
-                    *pDst++ = static_cast<int16>((j / *q));
-            }
-            q++;
+                *pDst++ = static_cast<int16>((j * r[i] + (1 << (QUANT_RECIP_BITS + AAN_PASS_BITS - 1))) >> (QUANT_RECIP_BITS + AAN_PASS_BITS));
         }
     }
 
@@ -419,11 +485,7 @@ namespace jpge2_simple {
             temp1 = -temp1; temp2--;
         }
 
-        nbits = 0;
-        while (temp1)
-        {
-            nbits++; temp1 >>= 1;
-        }
+        nbits = temp1 ? 32 - __builtin_clz(temp1) : 0;
 
         put_bits(codes[0][nbits], code_sizes[0][nbits]);
         if (nbits) put_bits(temp2 & ((1 << nbits) - 1), nbits);
@@ -444,9 +506,7 @@ namespace jpge2_simple {
                     temp1 = -temp1;
                     temp2--;
                 }
-                nbits = 1;
-                while (temp1 >>= 1)
-                    nbits++;
+                nbits = 32 - __builtin_clz(temp1);
                 j = (run_len << 4) + nbits;
                 put_bits(codes[1][j], code_sizes[1][j]);
                 put_bits(temp2 & ((1 << nbits) - 1), nbits);
@@ -517,24 +577,30 @@ namespace jpge2_simple {
                 Y_to_YCC(pDst, Psrc, m_image_x);
         }
 
-        // Possibly duplicate pixels at end of scanline if not a multiple of 8 or 16
+        pad_mcu_line(m_mcu_y_ofs);
+
+        if (++m_mcu_y_ofs == m_mcu_y)
+        {
+            process_mcu_row();
+            m_mcu_y_ofs = 0;
+        }
+    }
+
+    // Possibly duplicate pixels at end of scanline if not a multiple of 8 or 16
+    void jpeg_encoder::pad_mcu_line(int line)
+    {
+        uint8 *pDst = m_mcu_lines[line];
         if (m_num_components == 1)
-            memset(m_mcu_lines[m_mcu_y_ofs] + m_image_bpl_xlt, pDst[m_image_bpl_xlt - 1], m_image_x_mcu - m_image_x);
+            memset(pDst + m_image_bpl_xlt, pDst[m_image_bpl_xlt - 1], m_image_x_mcu - m_image_x);
         else
         {
             const uint8 y = pDst[m_image_bpl_xlt - 3 + 0], cb = pDst[m_image_bpl_xlt - 3 + 1], cr = pDst[m_image_bpl_xlt - 3 + 2];
-            uint8 *q = m_mcu_lines[m_mcu_y_ofs] + m_image_bpl_xlt;
+            uint8 *q = pDst + m_image_bpl_xlt;
             for (int i = m_image_x; i < m_image_x_mcu; i++)
             {
                 *q++ = y; *q++ = cb; *q++ = cr;
             }
         }
-
-        if (++m_mcu_y_ofs == m_mcu_y)
-        {
-            process_mcu_row();
-            m_mcu_y_ofs = 0;
-        }
     }
 
     // Quantization table generation.
@@ -552,6 +618,17 @@ namespace jpge2_simple {
         }
     }
 
+    // Reciprocals of the quantization table (zigzag order) times the AAN output scale, once per quality
+    void jpeg_encoder::compute_quant_recip(int32 *pDst, const int32 *pQuant)
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            // The divisor is q * 8 * aan_scale, aan_scale being scaled by 2^14
+            int32 d = pQuant[i] * s_aan_scales[s_zag[i]];
+            *pDst++ = ((1 << (QUANT_RECIP_BITS + 14 - 3)) + (d >> 1)) / d;
+        }
+    }
+
     // Higher-level methods.
     bool jpeg_encoder::jpg_open(int p_x_res, int p_y_res, int src_channels)
     {
@@ -609,6 +686,8 @@ namespace jpge2_simple {
             m_last_quality = m_params.m_quality;
             compute_quant_table(m_quantization_tables[0], s_std_lum_quant);
             compute_quant_table(m_quantization_tables[1], s_std_croma_quant);
+            compute_quant_recip(m_quantization_recip[0], m_quantization_tables[0]);
+            compute_quant_recip(m_quantization_recip[1], m_quantization_tables[1]);
         }
 
         if(!m_huff_initialized){
@@ -719,4 +798,27 @@ namespace jpge2_simple {
         return m_all_stream_writes_succeeded;
     }
 
+    bool jpeg_encoder::encode_mcu_row(const void* pSrc, int stride, int lines, source_format_t format)
+    {
+        if ((m_pass_num < 1) || (m_pass_num > 2) || (m_mcu_y_ofs != 0) || (lines < 1) || (lines > m_mcu_y)) {
+            return false;
+        }
+        if (m_all_stream_writes_succeeded) {
+            const uint8* pLine = static_cast<const uint8*>(pSrc);
+            for (int i = 0; i < lines; i++, pLine += stride) {
+                if (m_num_components == 1)
+                    convert_to_Y(m_mcu_lines[i], pLine, m_image_x, format);
+                else
+                    convert_to_YCC(m_mcu_lines[i], pLine, m_image_x, format);
+                pad_mcu_line(i);
+            }
+            // The last row of MCUs repeats the bottom line of the image
+            for (int i = lines; i < m_mcu_y; i++) {
+                memcpy(m_mcu_lines[i], m_mcu_lines[lines - 1], m_image_bpl_mcu);
+            }
+            process_mcu_row();
+        }
+        return m_all_stream_writes_succeeded;
+    }
+
 } // namespace jpge2_simple
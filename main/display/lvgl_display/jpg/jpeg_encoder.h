@@ -15,6 +15,10 @@ namespace jpge2_simple
 
     enum subsampling_t { Y_ONLY = 0, H1V1 = 1, H2V1 = 2, H2V2 = 3 };
 
+    // encode_mcu_row() 可直接转换的源像素格式
+    // GRAY8: Y；BGR888: B G R（esp32-camera 的 RGB888）；RGB565_BE: 高字节在前；YUV422: Y0 U Y1 V
+    enum source_format_t { SRC_GRAY8 = 0, SRC_BGR888 = 1, SRC_RGB565_BE = 2, SRC_YUV422 = 3 };
+
     struct params {
         inline params() : m_quality(85), m_subsampling(H2V2) { }
         inline bool check() const {
@@ -42,6 +46,11 @@ namespace jpge2_simple
 
             bool init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params = params());
             bool process_scanline(const void* pScanline);
+            // 批量接口：一次处理一整行 MCU（get_mcu_height() 行，最后一次可以更少），
+            // 源像素直接转换为 YCbCr 写入 MCU 缓冲区，不经过中间的 RGB 扫描线。
+            // 全部行处理完后仍需调用 process_scanline(NULL) 结束图像
+            bool encode_mcu_row(const void* pSrc, int stride, int lines, source_format_t format);
+            int get_mcu_height() const { return m_mcu_y; }
             void deinit();
 
         private:
@@ -77,6 +86,7 @@ namespace jpge2_simple
             // 直接声明为类成员变量（约8KB）
             int32 m_last_quality;
             int32 m_quantization_tables[2][64];      // 512 bytes
+            int32 m_quantization_recip[2][64];       // 512 bytes，含 AAN DCT 缩放因子的量化倒数
             bool m_huff_initialized;
             uint m_huff_codes[4][256];               // 4096 bytes
             uint8 m_huff_code_sizes[4][256];         // 1024 bytes  
@@ -100,6 +110,7 @@ namespace jpge2_simple
             void emit_dhts();
             void emit_sos();
             void compute_quant_table(int32 *dst, const int16 *src);
+            void compute_quant_recip(int32 *dst, const int32 *quant);
             void load_quantized_coefficients(int component_num);
             void load_block_8_8_grey(int x);
             void load_block_8_8(int x, int y, int c);
@@ -110,6 +121,7 @@ namespace jpge2_simple
             void process_mcu_row();
             bool process_end_of_image();
             void load_mcu(const void* src);
+            void pad_mcu_line(int line);
             void clear();
             void compute_huffman_table(uint *codes, uint8 *code_sizes, uint8 *bits, uint8 *val);
     };
@@ -3,6 +3,7 @@
 #include <string>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <font_awesome.h>
 
 #include "lvgl_display.h"
@@ -215,6 +216,63 @@ void LvglDisplay::SetPowerSaveMode(bool on) {
     }
 }
 
+void LvglDisplay::TrackRenderStats() {
+    // A frame runs from the start of a refresh that renders something until the refresh is done,
+    // a flush wait is the time LVGL blocks until the panel has taken the previous buffer
+    lv_display_add_event_cb(display_, [](lv_event_t* e) {
+        auto& stats = static_cast<LvglDisplay*>(lv_event_get_user_data(e))->render_stats_;
+        int64_t now = esp_timer_get_time();
+        switch (lv_event_get_code(e)) {
+            case LV_EVENT_REFR_START:
+                stats.frame_start_us = now;
+                stats.rendering = false;
+                break;
+            case LV_EVENT_RENDER_START:
+                stats.rendering = true;
+                break;
+            case LV_EVENT_REFR_READY:
+                if (stats.rendering) {
+                    uint32_t elapsed = now - stats.frame_start_us;
+                    stats.frames++;
+                    stats.frame_time_us += elapsed;
+                    stats.max_frame_time_us = std::max(stats.max_frame_time_us, elapsed);
+                    stats.rendering = false;
+                }
+                break;
+            case LV_EVENT_FLUSH_WAIT_START:
+                stats.wait_start_us = now;
+                break;
+            case LV_EVENT_FLUSH_WAIT_FINISH: {
+                uint32_t elapsed = now - stats.wait_start_us;
+                stats.flush_waits++;
+                stats.flush_wait_us += elapsed;
+                stats.max_flush_wait_us = std::max(stats.max_flush_wait_us, elapsed);
+                break;
+            }
+            default:
+                break;
+        }
+    }, LV_EVENT_ALL, this);
+}
+
+cJSON* LvglDisplay::GetRenderStatsJson(bool reset) {
+    DisplayLockGuard lock(this);
+    auto& stats = render_stats_;
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "frames", stats.frames);
+    cJSON_AddNumberToObject(json, "avg_frame_ms", stats.frames ? stats.frame_time_us / 1000.0 / stats.frames : 0);
+    cJSON_AddNumberToObject(json, "max_frame_ms", stats.max_frame_time_us / 1000.0);
+    cJSON_AddNumberToObject(json, "flush_waits", stats.flush_waits);
+    cJSON_AddNumberToObject(json, "flush_wait_ms", stats.flush_wait_us / 1000.0);
+    cJSON_AddNumberToObject(json, "max_flush_wait_ms", stats.max_flush_wait_us / 1000.0);
+    // Share of the frame time spent waiting for the panel instead of rendering
+    cJSON_AddNumberToObject(json, "flush_wait_ratio", stats.frame_time_us ? (double)stats.flush_wait_us / stats.frame_time_us : 0);
+    if (reset) {
+        stats = RenderStats();
+    }
+    return json;
+}
+
 bool LvglDisplay::SnapshotToJpeg(std::string& jpeg_data, int quality) {
 #if CONFIG_LV_USE_SNAPSHOT
     DisplayLockGuard lock(this);
@@ -10,6 +10,7 @@
 #include <esp_timer.h>
 #include <esp_log.h>
 #include <esp_pm.h>
+#include <cJSON.h>
 
 #include <string>
 #include <chrono>
@@ -26,6 +27,8 @@ public:
     virtual void UpdateStatusBar(bool update_all = false);
     virtual void SetPowerSaveMode(bool on);
     virtual bool SnapshotToJpeg(std::string& jpeg_data, int quality = 80);
+    // Frame time and flush wait counters since the display was added or the last reset
+    cJSON* GetRenderStatsJson(bool reset = false);
 
 protected:
     esp_pm_lock_handle_t pm_lock_ = nullptr;
@@ -46,6 +49,22 @@ protected:
     std::chrono::system_clock::time_point last_status_update_time_;
     esp_timer_handle_t notification_timer_ = nullptr;
 
+    // Updated by the LVGL task from the display events, read under the display lock
+    struct RenderStats {
+        uint32_t frames = 0;
+        uint64_t frame_time_us = 0;
+        uint32_t max_frame_time_us = 0;
+        uint32_t flush_waits = 0;
+        uint64_t flush_wait_us = 0;
+        uint32_t max_flush_wait_us = 0;
+        int64_t frame_start_us = 0;
+        int64_t wait_start_us = 0;
+        bool rendering = false;
+    } render_stats_;
+
+    // Call once display_ is added
+    void TrackRenderStats();
+
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
     virtual void Unlock() = 0;
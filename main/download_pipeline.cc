@@ -0,0 +1,143 @@
+#include "download_pipeline.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/task.h>
+
+#define TAG "DownloadPipeline"
+
+
+DownloadPipeline::DownloadPipeline(Sink sink) : sink_(sink) {
+}
+
+DownloadPipeline::~DownloadPipeline() {
+    Stop();
+    if (free_queue_ != nullptr) {
+        vQueueDelete(free_queue_);
+    }
+    if (full_queue_ != nullptr) {
+        vQueueDelete(full_queue_);
+    }
+    for (auto chunk : chunks_) {
+        if (chunk != nullptr) {
+            heap_caps_free(chunk);
+        }
+    }
+}
+
+bool DownloadPipeline::Start() {
+#if CONFIG_SPIRAM
+    chunk_size_ = DOWNLOAD_PIPELINE_CHUNK_SIZE;
+    uint32_t caps = MALLOC_CAP_SPIRAM;
+#else
+    chunk_size_ = DOWNLOAD_PIPELINE_INTERNAL_CHUNK_SIZE;
+    uint32_t caps = MALLOC_CAP_8BIT;
+#endif
+    free_queue_ = xQueueCreate(DOWNLOAD_PIPELINE_CHUNKS, sizeof(uint8_t*));
+    full_queue_ = xQueueCreate(DOWNLOAD_PIPELINE_CHUNKS + 1, sizeof(Chunk));
+    if (free_queue_ == nullptr || full_queue_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create queues");
+        return false;
+    }
+    for (auto& chunk : chunks_) {
+        chunk = (uint8_t*)heap_caps_malloc(chunk_size_, caps);
+        if (chunk == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes", chunk_size_);
+            return false;
+        }
+        xQueueSend(free_queue_, &chunk, 0);
+    }
+
+    // Same priority as the downloading task, so neither side starves the other
+    owner_task_ = xTaskGetCurrentTaskHandle();
+    if (xTaskCreate([](void* arg) {
+        ((DownloadPipeline*)arg)->WriterTask();
+        vTaskDelete(NULL);
+    }, "download_writer", 2048 * 3, this, uxTaskPriorityGet(NULL), nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create writer task");
+        return false;
+    }
+    started_ = true;
+    start_time_us_ = esp_timer_get_time();
+    return true;
+}
+
+void DownloadPipeline::WriterTask() {
+    Chunk chunk;
+    while (xQueueReceive(full_queue_, &chunk, portMAX_DELAY) == pdTRUE) {
+        if (chunk.data == nullptr) {
+            break;
+        }
+        // After a failure the chunks are only recycled, so the downloading task never blocks
+        if (!failed_) {
+            int64_t start_time = esp_timer_get_time();
+            if (!sink_(chunk.data, chunk.size)) {
+                failed_ = true;
+            }
+            sink_time_us_ += esp_timer_get_time() - start_time;
+        }
+        xQueueSend(free_queue_, &chunk.data, portMAX_DELAY);
+    }
+    // The owner may destroy the pipeline as soon as it sees writer_done_, so nothing of it is
+    // touched after that, the notification only touches the owner task
+    TaskHandle_t owner = owner_task_;
+    writer_done_ = true;
+    xTaskNotifyGive(owner);
+}
+
+uint8_t* DownloadPipeline::GetBuffer(size_t& space) {
+    if (current_ == nullptr) {
+        int64_t start_time = esp_timer_get_time();
+        xQueueReceive(free_queue_, &current_, portMAX_DELAY);
+        stall_time_us_ += esp_timer_get_time() - start_time;
+        filled_ = 0;
+    }
+    space = chunk_size_ - filled_;
+    return current_ + filled_;
+}
+
+bool DownloadPipeline::Commit(size_t size) {
+    filled_ += size;
+    total_bytes_ += size;
+    if (filled_ == chunk_size_) {
+        Submit(current_, filled_);
+        current_ = nullptr;
+    }
+    return !failed_;
+}
+
+void DownloadPipeline::Submit(uint8_t* data, size_t size) {
+    Chunk chunk = { data, size };
+    xQueueSend(full_queue_, &chunk, portMAX_DELAY);
+}
+
+bool DownloadPipeline::Finish() {
+    if (!started_) {
+        return false;
+    }
+    if (current_ != nullptr && filled_ > 0) {
+        Submit(current_, filled_);
+        current_ = nullptr;
+    }
+    Stop();
+
+    int64_t elapsed_ms = (esp_timer_get_time() - start_time_us_) / 1000;
+    ESP_LOGI(TAG, "%u bytes in %lld ms (%lld KB/s), sink busy %lld ms, download waited %lld ms for the sink",
+        total_bytes_, elapsed_ms, elapsed_ms > 0 ? (int64_t)total_bytes_ / elapsed_ms : 0,
+        sink_time_us_ / 1000, stall_time_us_ / 1000);
+    return !failed_;
+}
+
+void DownloadPipeline::Stop() {
+    if (!started_ || finished_) {
+        return;
+    }
+    Chunk end = { nullptr, 0 };
+    xQueueSend(full_queue_, &end, portMAX_DELAY);
+    // Notifications sent to this task for other reasons only wake it early
+    while (!writer_done_) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    finished_ = true;
+}
@@ -0,0 +1,80 @@
+#ifndef DOWNLOAD_PIPELINE_H
+#define DOWNLOAD_PIPELINE_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#define DOWNLOAD_PIPELINE_CHUNKS 2
+#define DOWNLOAD_PIPELINE_CHUNK_SIZE (16 * 1024)
+// Without PSRAM the chunks come from internal RAM, keep them small
+#define DOWNLOAD_PIPELINE_INTERNAL_CHUNK_SIZE (4 * 1024)
+
+
+/*
+ * Overlaps the network reads of a download with the flash writes.
+ *
+ * The downloading task reads straight into one chunk while a writer task passes the previous
+ * chunk to the sink (esp_ota_write, partition erase and write), so the network is not idle
+ * during a flash erase and the flash is not idle while waiting for the network.
+ *
+ *   uint8_t* data = pipeline.GetBuffer(space);
+ *   int ret = http->Read((char*)data, space);
+ *   pipeline.Commit(ret);
+ *   ...
+ *   pipeline.Finish();
+ *
+ * The sink is called in order, from the writer task, and stops the download by returning false.
+ */
+class DownloadPipeline {
+public:
+    using Sink = std::function<bool(const uint8_t* data, size_t size)>;
+
+    DownloadPipeline(Sink sink);
+    ~DownloadPipeline();
+
+    bool Start();
+    // Free space in the current chunk, waits for the writer when all chunks are full
+    uint8_t* GetBuffer(size_t& space);
+    // False once the sink has failed
+    bool Commit(size_t size);
+    // Writes the last partial chunk and waits for the writer, true if the sink took all data
+    bool Finish();
+
+private:
+    struct Chunk {
+        uint8_t* data;
+        size_t size;
+    };
+
+    Sink sink_;
+    size_t chunk_size_ = 0;
+    uint8_t* chunks_[DOWNLOAD_PIPELINE_CHUNKS] = {};
+    QueueHandle_t free_queue_ = nullptr;
+    QueueHandle_t full_queue_ = nullptr;
+    // The task that started the pipeline, notified by the writer when it is done
+    TaskHandle_t owner_task_ = nullptr;
+    std::atomic<bool> writer_done_{false};
+    bool started_ = false;
+    bool finished_ = false;
+    std::atomic<bool> failed_{false};
+    uint8_t* current_ = nullptr;
+    size_t filled_ = 0;
+
+    // Throughput instrumentation, logged by Finish()
+    int64_t start_time_us_ = 0;
+    size_t total_bytes_ = 0;
+    int64_t sink_time_us_ = 0;
+    int64_t stall_time_us_ = 0;
+
+    void WriterTask();
+    void Submit(uint8_t* data, size_t size);
+    void Stop();
+};
+
+#endif // DOWNLOAD_PIPELINE_H
@@ -20,6 +20,10 @@
 
 #define TAG "MCP"
 
+#define MCP_WORKER_IDLE_SECONDS 10
+
+thread_local const McpServer::ToolCall* McpServer::current_call_ = nullptr;
+
 McpServer::McpServer() {
 }
 
@@ -37,6 +41,7 @@ void McpServer::AddCommonTools() {
 
     // Backup the original tools list and restore it after adding the common tools.
     auto original_tools = std::move(tools_);
+    tool_index_.clear();
     auto& board = Board::GetInstance();
 
     // Do not add custom tools here.
@@ -108,21 +113,23 @@ void McpServer::AddCommonTools() {
             PropertyList({
                 Property("question", kPropertyTypeString)
             }),
-            [camera](const PropertyList& properties) -> ReturnValue {
+            [this, camera](const PropertyList& properties) -> ReturnValue {
                 // Lower the priority to do the camera capture
                 TaskPriorityReset priority_reset(1);
 
                 if (!camera->Capture()) {
                     throw std::runtime_error("Failed to capture photo");
                 }
+                ReportProgress(1, 2, "Photo captured");
                 auto question = properties["question"].value<std::string>();
                 return camera->Explain(question);
-            });
+            }, kMcpToolExecutionBackground);
     }
 #endif
 
     // Restore the original tools list to the end of the tools list
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+    RebuildToolIndex();
 }
 
 void McpServer::AddUserOnlyTools() {
@@ -135,6 +142,20 @@ void McpServer::AddUserOnlyTools() {
             return board.GetSystemInfoJson();
         });
 
+    AddUserOnlyTool("self.audio.get_latency_stats",
+        "Get the latency percentiles and histograms of every audio pipeline stage, from the mic to the network and from the network to the speaker",
+        PropertyList({
+            Property("reset", kPropertyTypeBoolean, false)
+        }),
+        [this](const PropertyList& properties) -> ReturnValue {
+            auto& tracer = Application::GetInstance().GetAudioService().GetLatencyTracer();
+            auto json = tracer.GetStatsJson();
+            if (properties["reset"].value<bool>()) {
+                tracer.Reset();
+            }
+            return json;
+        });
+
     AddUserOnlyTool("self.reboot", "Reboot the system",
         PropertyList(),
         [this](const PropertyList& properties) -> ReturnValue {
@@ -186,6 +207,15 @@ void McpServer::AddUserOnlyTools() {
                     cJSON_AddBoolToObject(json, "monochrome", false);
                 }
                 return json;
+            }, kMcpToolExecutionInline);
+
+        AddUserOnlyTool("self.screen.get_render_stats",
+            "Get the frame times and the time LVGL spent waiting for the panel to take each flushed buffer",
+            PropertyList({
+                Property("reset", kPropertyTypeBoolean, false)
+            }),
+            [display](const PropertyList& properties) -> ReturnValue {
+                return display->GetRenderStatsJson(properties["reset"].value<bool>());
             });
 
 #if CONFIG_LV_USE_SNAPSHOT
@@ -241,7 +271,7 @@ void McpServer::AddUserOnlyTools() {
                 http->Close();
                 ESP_LOGI(TAG, "Snapshot screen result: %s", result.c_str());
                 return true;
-            });
+            }, kMcpToolExecutionBackground);
         
         AddUserOnlyTool("self.screen.preview_image", "Preview an image on the screen",
             PropertyList({
@@ -281,7 +311,7 @@ void McpServer::AddUserOnlyTools() {
                 auto image = std::make_unique<LvglAllocatedImage>(data, content_length);
                 display->SetPreviewImage(std::move(image));
                 return true;
-            });
+            }, kMcpToolExecutionBackground);
 #endif // CONFIG_LV_USE_SNAPSHOT
     }
 #endif // HAVE_LVGL
@@ -304,22 +334,42 @@ void McpServer::AddUserOnlyTools() {
 
 void McpServer::AddTool(McpTool* tool) {
     // Prevent adding duplicate tools
-    if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
+    if (tool_index_.count(tool->name()) > 0) {
         ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
         return;
     }
 
     ESP_LOGI(TAG, "Add tool: %s%s", tool->name().c_str(), tool->user_only() ? " [user]" : "");
+    // Serialize the schema now, tools/list only concatenates the cached strings
+    tool->json();
+    tool_index_[tool->name()] = tools_.size();
     tools_.push_back(tool);
 }
 
-void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
-    AddTool(new McpTool(name, description, properties, callback));
+void McpServer::RebuildToolIndex() {
+    tool_index_.clear();
+    for (size_t i = 0; i < tools_.size(); i++) {
+        tool_index_[tools_[i]->name()] = i;
+    }
+}
+
+McpTool* McpServer::FindTool(const std::string& name) const {
+    auto it = tool_index_.find(name);
+    return it != tool_index_.end() ? tools_[it->second] : nullptr;
 }
 
-void McpServer::AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
+void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+    McpToolExecution execution) {
+    auto tool = new McpTool(name, description, properties, callback);
+    tool->set_execution(execution);
+    AddTool(tool);
+}
+
+void McpServer::AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+    McpToolExecution execution) {
     auto tool = new McpTool(name, description, properties, callback);
     tool->set_user_only(true);
+    tool->set_execution(execution);
     AddTool(tool);
 }
 
@@ -430,7 +480,13 @@ void McpServer::ParseMessage(const cJSON* json) {
             ReplyError(id_int, "Invalid arguments");
             return;
         }
-        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments);
+        // The caller asks for progress notifications with params._meta.progressToken
+        const cJSON* progress_token = nullptr;
+        auto meta = cJSON_GetObjectItem(params, "_meta");
+        if (cJSON_IsObject(meta)) {
+            progress_token = cJSON_GetObjectItem(meta, "progressToken");
+        }
+        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments, progress_token);
     } else {
         ESP_LOGE(TAG, "Method not implemented: %s", method_str.c_str());
         ReplyError(id_int, "Method not implemented: " + method_str);
@@ -458,36 +514,30 @@ void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_o
     const int max_payload_size = 8000;
     std::string json = "{\"tools\":[";
     
-    bool found_cursor = cursor.empty();
-    auto it = tools_.begin();
+    // Resume from the cursor tool, an unknown cursor lists nothing
+    size_t start = 0;
+    if (!cursor.empty()) {
+        auto it = tool_index_.find(cursor);
+        start = it != tool_index_.end() ? it->second : tools_.size();
+    }
     std::string next_cursor = "";
     
-    while (it != tools_.end()) {
-        // 如果我们还没有找到起始位置，继续搜索
-        if (!found_cursor) {
-            if ((*it)->name() == cursor) {
-                found_cursor = true;
-            } else {
-                ++it;
-                continue;
-            }
-        }
-
-        if (!list_user_only_tools && (*it)->user_only()) {
-            ++it;
+    for (size_t i = start; i < tools_.size(); i++) {
+        auto tool = tools_[i];
+        if (!list_user_only_tools && tool->user_only()) {
             continue;
         }
         
         // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
+        const std::string& tool_json = tool->json();
+        if (json.length() + tool_json.length() + 1 + 30 > max_payload_size) {
             // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
-            next_cursor = (*it)->name();
+            next_cursor = tool->name();
             break;
         }
         
         json += tool_json;
-        ++it;
+        json += ',';
     }
     
     if (json.back() == ',') {
@@ -510,19 +560,15 @@ void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_o
     ReplyResult(id, json);
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
+void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, const cJSON* progress_token) {
+    auto tool = FindTool(tool_name);
+    if (tool == nullptr) {
         ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
         ReplyError(id, "Unknown tool: " + tool_name);
         return;
     }
 
-    PropertyList arguments = (*tool_iter)->properties();
+    PropertyList arguments = tool->properties();
     try {
         for (auto& argument : arguments) {
             bool found = false;
@@ -552,14 +598,156 @@ void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* to
         return;
     }
 
-    // Use main thread to call the tool
-    auto& app = Application::GetInstance();
-    app.Schedule([this, id, tool_iter, arguments = std::move(arguments)]() {
-        try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
-        } catch (const std::exception& e) {
-            ESP_LOGE(TAG, "tools/call: %s", e.what());
-            ReplyError(id, e.what());
+    ToolCall call{tool, id, std::move(arguments), "", call_generation_.load()};
+    if (cJSON_IsString(progress_token) || cJSON_IsNumber(progress_token)) {
+        char* token = cJSON_PrintUnformatted(progress_token);
+        call.progress_token = token;
+        cJSON_free(token);
+    }
+
+    switch (tool->execution()) {
+    case kMcpToolExecutionInline:
+        RunToolCall(call);
+        break;
+    case kMcpToolExecutionMainLoop:
+        if (main_loop_calls_.fetch_add(1) >= MCP_MAX_MAIN_LOOP_CALLS) {
+            main_loop_calls_--;
+            ESP_LOGW(TAG, "tools/call: Too many calls, rejecting %s", tool_name.c_str());
+            ReplyError(id, "Too many tool calls");
+            return;
         }
-    });
+        Application::GetInstance().Schedule([this, call = std::move(call)]() {
+            RunToolCall(call);
+            main_loop_calls_--;
+        });
+        break;
+    case kMcpToolExecutionBackground: {
+        std::unique_lock<std::mutex> lock(calls_mutex_);
+        if (pending_calls_.size() >= MCP_MAX_PENDING_BACKGROUND_CALLS) {
+            lock.unlock();
+            ESP_LOGW(TAG, "tools/call: Too many calls, rejecting %s", tool_name.c_str());
+            ReplyError(id, "Too many tool calls");
+            return;
+        }
+        pending_calls_.push_back(std::move(call));
+        // Workers are started on demand and exit when idle, so the stacks are only held while tools run
+        if (idle_workers_ == 0 && worker_count_ < MCP_MAX_BACKGROUND_WORKERS) {
+            worker_count_++;
+            if (xTaskCreate([](void* arg) {
+                ((McpServer*)arg)->ToolWorkerTask();
+                vTaskDelete(NULL);
+            }, "mcp_tool", 2048 * 4, this, 2, nullptr) != pdPASS) {
+                // Out of memory for the stack, the call was queued last and no worker has seen it
+                worker_count_--;
+                pending_calls_.pop_back();
+                lock.unlock();
+                ESP_LOGE(TAG, "tools/call: Failed to create worker task for %s", tool_name.c_str());
+                ReplyError(id, "Failed to start tool " + tool_name);
+                return;
+            }
+        }
+        calls_cv_.notify_one();
+        break;
+    }
+    }
+}
+
+void McpServer::RunToolCall(const ToolCall& call) {
+    if (call.generation != call_generation_) {
+        return;
+    }
+
+    std::string result;
+    std::string error;
+    current_call_ = &call;
+    try {
+        result = call.tool->Call(call.arguments);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    current_call_ = nullptr;
+
+    if (call.generation != call_generation_) {
+        ESP_LOGW(TAG, "tools/call: %s finished after the session closed", call.tool->name().c_str());
+        return;
+    }
+    if (!error.empty()) {
+        ESP_LOGE(TAG, "tools/call: %s", error.c_str());
+        ReplyError(call.id, error);
+        return;
+    }
+    ReplyResult(call.id, result);
+}
+
+void McpServer::ToolWorkerTask() {
+    std::unique_lock<std::mutex> lock(calls_mutex_);
+    while (true) {
+        // Take the oldest call whose tool is not running on another worker
+        auto it = std::find_if(pending_calls_.begin(), pending_calls_.end(), [this](const ToolCall& call) {
+            return std::find(running_tools_.begin(), running_tools_.end(), call.tool) == running_tools_.end();
+        });
+        if (it == pending_calls_.end()) {
+            idle_workers_++;
+            auto status = calls_cv_.wait_for(lock, std::chrono::seconds(MCP_WORKER_IDLE_SECONDS));
+            idle_workers_--;
+            if (status == std::cv_status::timeout && pending_calls_.empty()) {
+                worker_count_--;
+                return;
+            }
+            continue;
+        }
+
+        ToolCall call = std::move(*it);
+        pending_calls_.erase(it);
+        running_tools_.push_back(call.tool);
+        lock.unlock();
+
+        current_call_ = &call;
+        ReportProgress(0, 0, "Started");
+        current_call_ = nullptr;
+        RunToolCall(call);
+
+        lock.lock();
+        running_tools_.erase(std::find(running_tools_.begin(), running_tools_.end(), call.tool));
+        // Another call of the same tool may be waiting for this one
+        calls_cv_.notify_all();
+    }
+}
+
+void McpServer::CancelToolCalls() {
+    std::lock_guard<std::mutex> lock(calls_mutex_);
+    call_generation_++;
+    if (!pending_calls_.empty()) {
+        ESP_LOGW(TAG, "Cancel %u pending tool calls", pending_calls_.size());
+        pending_calls_.clear();
+    }
+}
+
+bool McpServer::IsToolCallCancelled() const {
+    return current_call_ != nullptr && current_call_->generation != call_generation_;
+}
+
+void McpServer::ReportProgress(int progress, int total, const std::string& message) {
+    auto call = current_call_;
+    if (call == nullptr || call->progress_token.empty() || call->generation != call_generation_) {
+        return;
+    }
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "jsonrpc", "2.0");
+    cJSON_AddStringToObject(json, "method", "notifications/progress");
+    cJSON* params = cJSON_CreateObject();
+    cJSON_AddRawToObject(params, "progressToken", call->progress_token.c_str());
+    cJSON_AddNumberToObject(params, "progress", progress);
+    if (total > 0) {
+        cJSON_AddNumberToObject(params, "total", total);
+    }
+    if (!message.empty()) {
+        cJSON_AddStringToObject(params, "message", message.c_str());
+    }
+    cJSON_AddItemToObject(json, "params", params);
+    char* payload = cJSON_PrintUnformatted(json);
+    Application::GetInstance().SendMcpMessage(payload);
+    cJSON_free(payload);
+    cJSON_Delete(json);
 }
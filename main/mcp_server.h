@@ -4,11 +4,16 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <functional>
 #include <variant>
 #include <optional>
 #include <stdexcept>
 #include <thread>
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <condition_variable>
 #include <mbedtls/base64.h>
 
 #include <cJSON.h>
@@ -49,6 +54,17 @@ public:
 // 添加类型别名
 using ReturnValue = std::variant<bool, int, std::string, cJSON*, ImageContent*>;
 
+// Where a tool runs when it is called
+enum McpToolExecution {
+    kMcpToolExecutionMainLoop,      // On the main event loop, serialized with the device state changes
+    kMcpToolExecutionInline,        // Right away on the task that received the call, for quick thread safe tools
+    kMcpToolExecutionBackground,    // On a worker task, for slow tools like the camera or HTTP uploads
+};
+
+#define MCP_MAX_MAIN_LOOP_CALLS 4
+#define MCP_MAX_BACKGROUND_WORKERS 2
+#define MCP_MAX_PENDING_BACKGROUND_CALLS 4
+
 enum PropertyType {
     kPropertyTypeBoolean,
     kPropertyTypeInteger,
@@ -120,7 +136,7 @@ public:
         value_ = value;
     }
 
-    std::string to_json() const {
+    cJSON* to_cjson() const {
         cJSON *json = cJSON_CreateObject();
         
         if (type_ == kPropertyTypeBoolean) {
@@ -145,7 +161,11 @@ public:
                 cJSON_AddStringToObject(json, "default", value<std::string>().c_str());
             }
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = to_cjson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -188,14 +208,16 @@ public:
         return required;
     }
 
-    std::string to_json() const {
+    cJSON* to_cjson() const {
         cJSON *json = cJSON_CreateObject();
-        
         for (const auto& property : properties_) {
-            cJSON *prop_json = cJSON_Parse(property.to_json().c_str());
-            cJSON_AddItemToObject(json, property.name().c_str(), prop_json);
+            cJSON_AddItemToObject(json, property.name().c_str(), property.to_cjson());
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = to_cjson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -212,6 +234,9 @@ private:
     PropertyList properties_;
     std::function<ReturnValue(const PropertyList&)> callback_;
     bool user_only_ = false;
+    McpToolExecution execution_ = kMcpToolExecutionMainLoop;
+    // Serialized schema, tools never change once registered so it is built only once
+    mutable std::string json_;
 
 public:
     McpTool(const std::string& name, 
@@ -223,11 +248,13 @@ public:
         properties_(properties), 
         callback_(callback) {}
 
-    void set_user_only(bool user_only) { user_only_ = user_only; }
+    void set_user_only(bool user_only) { user_only_ = user_only; json_.clear(); }
     inline const std::string& name() const { return name_; }
     inline const std::string& description() const { return description_; }
     inline const PropertyList& properties() const { return properties_; }
     inline bool user_only() const { return user_only_; }
+    void set_execution(McpToolExecution execution) { execution_ = execution; }
+    inline McpToolExecution execution() const { return execution_; }
 
     std::string to_json() const {
         std::vector<std::string> required = properties_.GetRequired();
@@ -239,8 +266,7 @@ public:
         cJSON *input_schema = cJSON_CreateObject();
         cJSON_AddStringToObject(input_schema, "type", "object");
         
-        cJSON *properties = cJSON_Parse(properties_.to_json().c_str());
-        cJSON_AddItemToObject(input_schema, "properties", properties);
+        cJSON_AddItemToObject(input_schema, "properties", properties_.to_cjson());
         
         if (!required.empty()) {
             cJSON *required_array = cJSON_CreateArray();
@@ -269,6 +295,13 @@ public:
         return result;
     }
 
+    const std::string& json() const {
+        if (json_.empty()) {
+            json_ = to_json();
+        }
+        return json_;
+    }
+
     std::string Call(const PropertyList& properties) {
         ReturnValue return_value = callback_(properties);
         // 返回结果
@@ -321,12 +354,30 @@ public:
     void AddCommonTools();
     void AddUserOnlyTools();
     void AddTool(McpTool* tool);
-    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
-    void AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+        McpToolExecution execution = kMcpToolExecutionMainLoop);
+    void AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+        McpToolExecution execution = kMcpToolExecutionMainLoop);
     void ParseMessage(const cJSON* json);
     void ParseMessage(const std::string& message);
 
+    // Drops the queued tool calls and the results of the running ones, called when the session closes
+    void CancelToolCalls();
+    // For use inside a tool callback: sends a progress notification if the caller asked for them
+    void ReportProgress(int progress, int total, const std::string& message);
+    // For use inside a tool callback: true once the session of the call has closed, long tools may stop early
+    bool IsToolCallCancelled() const;
+
 private:
+    struct ToolCall {
+        McpTool* tool;
+        int id;
+        PropertyList arguments;
+        // JSON text of the progress token, empty if the caller did not ask for progress
+        std::string progress_token;
+        uint32_t generation;
+    };
+
     McpServer();
     ~McpServer();
 
@@ -336,9 +387,28 @@ private:
     void ReplyError(int id, const std::string& message);
 
     void GetToolsList(int id, const std::string& cursor, bool list_user_only_tools);
-    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments);
+    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, const cJSON* progress_token);
+    McpTool* FindTool(const std::string& name) const;
+    void RebuildToolIndex();
+    void RunToolCall(const ToolCall& call);
+    void ToolWorkerTask();
 
     std::vector<McpTool*> tools_;
+    // Position of each tool in tools_, for tools/call and the tools/list cursor
+    std::unordered_map<std::string, size_t> tool_index_;
+
+    // Bumped by CancelToolCalls(), calls of an older generation are not answered
+    std::atomic<uint32_t> call_generation_{0};
+    std::atomic<int> main_loop_calls_{0};
+    std::mutex calls_mutex_;
+    std::condition_variable calls_cv_;
+    std::deque<ToolCall> pending_calls_;
+    // Background tools that are running, a tool never runs twice at the same time
+    std::vector<McpTool*> running_tools_;
+    int worker_count_ = 0;
+    int idle_workers_ = 0;
+    // The call the current task is running, for ReportProgress() and IsToolCallCancelled()
+    static thread_local const ToolCall* current_call_;
 };
 
 #endif // MCP_SERVER_H
@@ -1,4 +1,6 @@
 #include "ota.h"
+#include "ota_patch.h"
+#include "download_pipeline.h"
 #include "system_info.h"
 #include "settings.h"
 #include "assets/lang_config.h"
@@ -10,6 +12,10 @@
 #include <esp_app_format.h>
 #include <esp_efuse.h>
 #include <esp_efuse_table.h>
+#include <mbedtls/sha256.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #ifdef SOC_HMAC_SUPPORTED
 #include <esp_hmac.h>
 #endif
@@ -18,9 +24,14 @@
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <array>
 
 #define TAG "Ota"
 
+// A dropped connection is resumed with a Range request, this many times in a row without progress
+#define OTA_MAX_RESUME_ATTEMPTS 5
+#define OTA_WRITE_BLOCK_SIZE ((size_t)64 * 1024)
+
 
 Ota::Ota() {
 #ifdef ESP_EFUSE_BLOCK_USR_DATA
@@ -106,6 +117,7 @@ bool Ota::CheckVersion() {
     http->Close();
 
     // Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
+    // Optional in "firmware": "patch_url" (delta patch from the running version), "sha256" (of the image at "url")
     // Parse the JSON response and check if the version is newer
     // If it is, set has_new_version_ to true and store the new version and URL
     
@@ -217,6 +229,11 @@ bool Ota::CheckVersion() {
         if (cJSON_IsString(url)) {
             firmware_url_ = url->valuestring;
         }
+        // A patch from the running version to the new one, made by scripts/ota_patch.py
+        cJSON *patch_url = cJSON_GetObjectItem(firmware, "patch_url");
+        firmware_patch_url_ = cJSON_IsString(patch_url) ? patch_url->valuestring : "";
+        cJSON *sha256 = cJSON_GetObjectItem(firmware, "sha256");
+        firmware_sha256_ = cJSON_IsString(sha256) ? sha256->valuestring : "";
 
         if (cJSON_IsString(version) && cJSON_IsString(url)) {
             // Check if the version is newer, for example, 0.1.0 is newer than 0.0.1
@@ -260,91 +277,264 @@ void Ota::MarkCurrentVersionValid() {
     }
 }
 
-bool Ota::Upgrade(const std::string& firmware_url) {
-    ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
-    esp_ota_handle_t update_handle = 0;
-    auto update_partition = esp_ota_get_next_update_partition(NULL);
-    if (update_partition == NULL) {
-        ESP_LOGE(TAG, "Failed to get update partition");
+static bool ParseSha256(const std::string& hex, std::array<uint8_t, 32>& digest) {
+    if (hex.size() != digest.size() * 2) {
         return false;
     }
+    for (size_t i = 0; i < digest.size(); i++) {
+        char byte[3] = { hex[i * 2], hex[i * 2 + 1], 0 };
+        char* end;
+        digest[i] = strtoul(byte, &end, 16);
+        if (end != byte + 2) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
-    bool image_header_checked = false;
-    std::string image_header;
+static bool HashPartition(const esp_partition_t* partition, size_t size, std::array<uint8_t, 32>& digest) {
+    if (size > partition->size) {
+        return false;
+    }
+    std::vector<uint8_t> buffer(4096);
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, 0);
+    bool success = true;
+    for (size_t offset = 0; offset < size; offset += buffer.size()) {
+        size_t n = std::min(buffer.size(), size - offset);
+        if (esp_partition_read(partition, offset, buffer.data(), n) != ESP_OK) {
+            success = false;
+            break;
+        }
+        mbedtls_sha256_update(&context, buffer.data(), n);
+    }
+    mbedtls_sha256_finish(&context, digest.data());
+    mbedtls_sha256_free(&context);
+    return success;
+}
 
+bool Ota::Download(const std::string& url, const std::function<bool(const char* data, size_t size)>& on_data) {
     auto network = Board::GetInstance().GetNetwork();
-    auto http = network->CreateHttp(0);
-    if (!http->Open("GET", firmware_url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
+    size_t content_length = 0, total_read = 0, recent_read = 0;
+    auto last_calc_time = esp_timer_get_time();
+    int attempts = 0;
+
+    // The data is written and hashed on the pipeline's task while the next chunk downloads
+    DownloadPipeline pipeline([&on_data](const uint8_t* data, size_t size) {
+        return on_data((const char*)data, size);
+    });
+    if (!pipeline.Start()) {
         return false;
     }
 
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get firmware, status code: %d", http->GetStatusCode());
-        return false;
+    while (true) {
+        auto http = network->CreateHttp(0);
+        if (total_read > 0) {
+            // Continue where the connection dropped, the data already written stays valid
+            http->SetHeader("Range", "bytes=" + std::to_string(total_read) + "-");
+        }
+        if (http->Open("GET", url)) {
+            int status_code = http->GetStatusCode();
+            if (total_read == 0 && status_code == 200) {
+                content_length = http->GetBodyLength();
+                if (content_length == 0) {
+                    ESP_LOGE(TAG, "Failed to get content length");
+                    return false;
+                }
+            } else if (total_read == 0 || status_code != 206) {
+                // A server that ignores the Range header sends everything again, which cannot be appended
+                ESP_LOGE(TAG, "Failed to get firmware, status code: %d", status_code);
+                return false;
+            }
+
+            while (total_read < content_length) {
+                size_t space;
+                auto buffer = pipeline.GetBuffer(space);
+                int ret = http->Read((char*)buffer, std::min(space, content_length - total_read));
+                if (ret <= 0) {
+                    ESP_LOGE(TAG, "Failed to read HTTP data: %s", ret < 0 ? esp_err_to_name(ret) : "connection closed");
+                    break;
+                }
+                if (!pipeline.Commit(ret)) {
+                    return false;
+                }
+                attempts = 0;
+
+                // Calculate speed and progress every second
+                recent_read += ret;
+                total_read += ret;
+                if (esp_timer_get_time() - last_calc_time >= 1000000 || total_read == content_length) {
+                    size_t progress = total_read * 100 / content_length;
+                    ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, total_read, content_length, recent_read);
+                    if (upgrade_callback_) {
+                        upgrade_callback_(progress, recent_read);
+                    }
+                    last_calc_time = esp_timer_get_time();
+                    recent_read = 0;
+                }
+            }
+            http->Close();
+            if (total_read == content_length) {
+                return pipeline.Finish();
+            }
+        } else {
+            ESP_LOGE(TAG, "Failed to open HTTP connection");
+            if (total_read == 0) {
+                return false;
+            }
+        }
+
+        if (++attempts > OTA_MAX_RESUME_ATTEMPTS) {
+            ESP_LOGE(TAG, "Download failed at %u/%u bytes", total_read, content_length);
+            return false;
+        }
+        ESP_LOGW(TAG, "Resuming download at %u/%u bytes, attempt %d", total_read, content_length, attempts);
+        vTaskDelay(pdMS_TO_TICKS(1000 * attempts));
     }
+}
 
-    size_t content_length = http->GetBodyLength();
-    if (content_length == 0) {
-        ESP_LOGE(TAG, "Failed to get content length");
+bool Ota::UpgradeFrom(const std::string& url, bool is_patch, const std::string& sha256) {
+    ESP_LOGI(TAG, "Upgrading firmware from %s%s", url.c_str(), is_patch ? " (patch)" : "");
+    esp_ota_handle_t update_handle = 0;
+    auto update_partition = esp_ota_get_next_update_partition(NULL);
+    if (update_partition == NULL) {
+        ESP_LOGE(TAG, "Failed to get update partition");
         return false;
     }
 
-    char buffer[512];
-    size_t total_read = 0, recent_read = 0;
-    auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+    ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
+    bool image_header_checked = false;
+    std::string image_header;
+
+    // Everything written is hashed, so the image is verified before it can boot
+    std::array<uint8_t, 32> expected_sha256;
+    bool has_expected_sha256 = !is_patch && ParseSha256(sha256, expected_sha256);
+    mbedtls_sha256_context sha256_context;
+    mbedtls_sha256_init(&sha256_context);
+    mbedtls_sha256_starts(&sha256_context, 0);
+
+#if CONFIG_SPIRAM
+    // esp_ota_write erases the sectors it is given, a whole aligned 64 KB block is erased several
+    // times faster than its 16 sectors one by one, so writes are combined into blocks in PSRAM
+    std::unique_ptr<uint8_t, decltype(&heap_caps_free)> block(
+        (uint8_t*)heap_caps_malloc(OTA_WRITE_BLOCK_SIZE, MALLOC_CAP_SPIRAM), heap_caps_free);
+#else
+    std::unique_ptr<uint8_t, decltype(&heap_caps_free)> block(nullptr, heap_caps_free);
+#endif
+    size_t block_filled = 0;
+
+    auto ota_write = [&](const void* data, size_t size) -> bool {
+        auto err = esp_ota_write(update_handle, data, size);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
             return false;
         }
-
-        // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
-            size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, total_read, content_length, recent_read);
-            if (upgrade_callback_) {
-                upgrade_callback_(progress, recent_read);
+        return true;
+    };
+    auto flush_block = [&]() -> bool {
+        size_t size = block_filled;
+        block_filled = 0;
+        return size == 0 || ota_write(block.get(), size);
+    };
+    auto flash_write = [&](const uint8_t* data, size_t size) -> bool {
+        if (block == nullptr) {
+            return ota_write(data, size);
+        }
+        while (size > 0) {
+            size_t n = std::min(size, OTA_WRITE_BLOCK_SIZE - block_filled);
+            memcpy(block.get() + block_filled, data, n);
+            block_filled += n;
+            data += n;
+            size -= n;
+            if (block_filled == OTA_WRITE_BLOCK_SIZE && !flush_block()) {
+                return false;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_read = 0;
         }
+        return true;
+    };
 
-        if (ret == 0) {
-            break;
+    auto write_image = [&](const uint8_t* data, size_t size) -> bool {
+        mbedtls_sha256_update(&sha256_context, data, size);
+        if (image_header_checked) {
+            return flash_write(data, size);
         }
 
-        if (!image_header_checked) {
-            image_header.append(buffer, ret);
-            if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
-                
-                auto current_version = esp_app_get_description()->version;
-                ESP_LOGI(TAG, "Current version: %s, New version: %s", current_version, new_app_info.version);
-
-                if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
-                    esp_ota_abort(update_handle);
-                    ESP_LOGE(TAG, "Failed to begin OTA");
+        // Hold the data back until the app description can be read, it is written right after esp_ota_begin
+        image_header.append((const char*)data, size);
+        if (image_header.size() < sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
+            return true;
+        }
+        esp_app_desc_t new_app_info;
+        memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
+        
+        auto current_version = esp_app_get_description()->version;
+        ESP_LOGI(TAG, "Current version: %s, New version: %s", current_version, new_app_info.version);
+
+        if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
+            esp_ota_abort(update_handle);
+            ESP_LOGE(TAG, "Failed to begin OTA");
+            return false;
+        }
+
+        image_header_checked = true;
+        bool success = flash_write((const uint8_t*)image_header.data(), image_header.size());
+        std::string().swap(image_header);
+        return success;
+    };
+
+    std::unique_ptr<OtaPatch> patch;
+    if (is_patch) {
+        auto running_partition = esp_ota_get_running_partition();
+        patch = std::make_unique<OtaPatch>(
+            [running_partition](size_t offset, uint8_t* data, size_t size) {
+                return esp_partition_read(running_partition, offset, data, size) == ESP_OK;
+            },
+            write_image,
+            [&](const OtaPatchHeader& header) {
+                // The patch only rebuilds the new image from the exact image it was made against
+                std::array<uint8_t, 32> source_sha256;
+                if (!HashPartition(running_partition, header.source_size, source_sha256) || source_sha256 != header.source_sha256) {
+                    ESP_LOGW(TAG, "The patch was made for another firmware image");
                     return false;
                 }
+                expected_sha256 = header.target_sha256;
+                has_expected_sha256 = true;
+                return true;
+            });
+    }
 
-                image_header_checked = true;
-                std::string().swap(image_header);
-            }
+    bool success = Download(url, [&](const char* data, size_t size) {
+        if (patch) {
+            return patch->Feed((const uint8_t*)data, size);
         }
-        auto err = esp_ota_write(update_handle, buffer, ret);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
+        return write_image((const uint8_t*)data, size);
+    });
+    if (success && patch && !patch->IsFinished()) {
+        ESP_LOGE(TAG, "The patch is truncated");
+        success = false;
+    }
+
+    std::array<uint8_t, 32> actual_sha256;
+    mbedtls_sha256_finish(&sha256_context, actual_sha256.data());
+    mbedtls_sha256_free(&sha256_context);
+    if (success && image_header_checked && !flush_block()) {
+        success = false;
+    }
+    if (success && has_expected_sha256 && actual_sha256 != expected_sha256) {
+        ESP_LOGE(TAG, "SHA-256 of the new image does not match");
+        success = false;
+    }
+    if (!success) {
+        if (image_header_checked) {
             esp_ota_abort(update_handle);
-            return false;
         }
+        return false;
+    }
+    if (!image_header_checked) {
+        ESP_LOGE(TAG, "The image is too small");
+        return false;
     }
-    http->Close();
 
     esp_err_t err = esp_ota_end(update_handle);
     if (err != ESP_OK) {
@@ -366,14 +556,24 @@ bool Ota::Upgrade(const std::string& firmware_url) {
     return true;
 }
 
+bool Ota::Upgrade(const std::string& firmware_url, const std::string& patch_url, const std::string& sha256) {
+    if (!patch_url.empty()) {
+        if (UpgradeFrom(patch_url, true, "")) {
+            return true;
+        }
+        ESP_LOGW(TAG, "Delta upgrade failed, downloading the full image");
+    }
+    return UpgradeFrom(firmware_url, false, sha256);
+}
+
 bool Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
     upgrade_callback_ = callback;
-    return Upgrade(firmware_url_);
+    return Upgrade(firmware_url_, firmware_patch_url_, firmware_sha256_);
 }
 
 bool Ota::StartUpgradeFromUrl(const std::string& url, std::function<void(int progress, size_t speed)> callback) {
     upgrade_callback_ = callback;
-    return Upgrade(url);
+    return Upgrade(url, "", "");
 }
 
 std::vector<int> Ota::ParseVersion(const std::string& version) {
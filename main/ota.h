@@ -44,11 +44,16 @@ private:
     std::string current_version_;
     std::string firmware_version_;
     std::string firmware_url_;
+    // Delta patch against the running version, and the SHA-256 of the full image, both optional
+    std::string firmware_patch_url_;
+    std::string firmware_sha256_;
     std::string activation_challenge_;
     std::string serial_number_;
     int activation_timeout_ms_ = 30000;
 
-    bool Upgrade(const std::string& firmware_url);
+    bool Upgrade(const std::string& firmware_url, const std::string& patch_url, const std::string& sha256);
+    bool UpgradeFrom(const std::string& url, bool is_patch, const std::string& sha256);
+    bool Download(const std::string& url, const std::function<bool(const char* data, size_t size)>& on_data);
     std::function<void(int progress, size_t speed)> upgrade_callback_;
     std::vector<int> ParseVersion(const std::string& version);
     bool IsNewVersionAvailable(const std::string& currentVersion, const std::string& newVersion);
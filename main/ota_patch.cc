@@ -0,0 +1,190 @@
+#include "ota_patch.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "OtaPatch"
+
+
+static uint32_t ReadLe32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+OtaPatch::OtaPatch(ReadSource read_source, WriteTarget write_target, CheckHeader check_header)
+    : read_source_(read_source), write_target_(write_target), check_header_(check_header) {
+}
+
+bool OtaPatch::IsPatch(const uint8_t* data, size_t size) {
+    return size >= 4 && memcmp(data, OTA_PATCH_MAGIC, 4) == 0;
+}
+
+bool OtaPatch::Feed(const uint8_t* data, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        switch (state_) {
+        case kStateHeader: {
+            size_t n = std::min(size - i, header_buffer_.size() - header_received_);
+            memcpy(header_buffer_.data() + header_received_, data + i, n);
+            header_received_ += n;
+            i += n;
+            if (header_received_ == header_buffer_.size() && !ParseHeader()) {
+                return false;
+            }
+            break;
+        }
+        case kStateOp: {
+            uint8_t op = data[i++];
+            varint_ = 0;
+            varint_shift_ = 0;
+            if (op == kOtaPatchOpCopy) {
+                state_ = kStateCopyOffset;
+            } else if (op == kOtaPatchOpLiteral) {
+                state_ = kStateLiteralLength;
+            } else if (op == kOtaPatchOpFill) {
+                state_ = kStateFillLength;
+            } else if (op == kOtaPatchOpEnd) {
+                if (written_ != header_.target_size) {
+                    return Fail("patch ended before the target size");
+                }
+                state_ = kStateDone;
+            } else {
+                return Fail("unknown op");
+            }
+            break;
+        }
+        case kStateCopyOffset:
+            if (ReadVarint(data[i++])) {
+                // Zigzag decoded, then relative to the end of the previous copy
+                copy_offset_ = source_end_ + ((varint_ >> 1) ^ -(varint_ & 1));
+                varint_ = 0;
+                varint_shift_ = 0;
+                state_ = kStateCopyLength;
+            }
+            break;
+        case kStateCopyLength:
+            if (ReadVarint(data[i++])) {
+                if (!Copy(copy_offset_, varint_)) {
+                    return false;
+                }
+                source_end_ = copy_offset_ + varint_;
+                state_ = kStateOp;
+            }
+            break;
+        case kStateLiteralLength:
+            if (ReadVarint(data[i++])) {
+                remaining_ = varint_;
+                state_ = remaining_ > 0 ? kStateLiteral : kStateOp;
+            }
+            break;
+        case kStateLiteral: {
+            // Literals are written straight from the network buffer
+            size_t n = std::min<size_t>(size - i, remaining_);
+            if (!Write(data + i, n)) {
+                return false;
+            }
+            i += n;
+            remaining_ -= n;
+            if (remaining_ == 0) {
+                state_ = kStateOp;
+            }
+            break;
+        }
+        case kStateFillLength:
+            if (ReadVarint(data[i++])) {
+                remaining_ = varint_;
+                state_ = kStateFill;
+            }
+            break;
+        case kStateFill:
+            if (!Fill(data[i++], remaining_)) {
+                return false;
+            }
+            state_ = kStateOp;
+            break;
+        case kStateDone:
+            return Fail("data after the end of the patch");
+        case kStateError:
+            return false;
+        }
+        if (state_ == kStateError) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool OtaPatch::ReadVarint(uint8_t byte) {
+    // The fifth byte holds the top 4 bits of the 32 bit value, a larger one (or a sixth byte) is malformed
+    if (varint_shift_ == 28 && byte > 0x0F) {
+        Fail("varint exceeds 32 bits");
+        return false;
+    }
+    varint_ |= (uint32_t)(byte & 0x7F) << varint_shift_;
+    varint_shift_ += 7;
+    return (byte & 0x80) == 0;
+}
+
+bool OtaPatch::ParseHeader() {
+    auto data = header_buffer_.data();
+    if (!IsPatch(data, header_buffer_.size())) {
+        return Fail("bad magic");
+    }
+    header_.source_size = ReadLe32(data + 4);
+    header_.target_size = ReadLe32(data + 8);
+    memcpy(header_.source_sha256.data(), data + 12, 32);
+    memcpy(header_.target_sha256.data(), data + 44, 32);
+    ESP_LOGI(TAG, "Patch from %lu to %lu bytes", (unsigned long)header_.source_size, (unsigned long)header_.target_size);
+    if (check_header_ && !check_header_(header_)) {
+        return Fail("rejected");
+    }
+    state_ = kStateOp;
+    return true;
+}
+
+bool OtaPatch::Copy(uint32_t offset, uint32_t length) {
+    if ((uint64_t)offset + length > header_.source_size) {
+        return Fail("copy out of the source image");
+    }
+    while (length > 0) {
+        size_t n = std::min<size_t>(length, chunk_.size());
+        if (!read_source_(offset, chunk_.data(), n)) {
+            return Fail("failed to read the source image");
+        }
+        if (!Write(chunk_.data(), n)) {
+            return false;
+        }
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool OtaPatch::Fill(uint8_t value, uint32_t length) {
+    chunk_.fill(value);
+    while (length > 0) {
+        size_t n = std::min<size_t>(length, chunk_.size());
+        if (!Write(chunk_.data(), n)) {
+            return false;
+        }
+        length -= n;
+    }
+    return true;
+}
+
+bool OtaPatch::Write(const uint8_t* data, size_t size) {
+    if (written_ + size > header_.target_size) {
+        return Fail("output exceeds the target size");
+    }
+    if (!write_target_(data, size)) {
+        return Fail("failed to write the target image");
+    }
+    written_ += size;
+    return true;
+}
+
+bool OtaPatch::Fail(const char* reason) {
+    ESP_LOGE(TAG, "Invalid patch: %s", reason);
+    state_ = kStateError;
+    return false;
+}
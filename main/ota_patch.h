@@ -0,0 +1,96 @@
+#ifndef OTA_PATCH_H
+#define OTA_PATCH_H
+
+#include <array>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#define OTA_PATCH_MAGIC "XZP1"
+#define OTA_PATCH_HEADER_SIZE 76
+#define OTA_PATCH_COPY_CHUNK 512
+
+enum OtaPatchOp : uint8_t {
+    kOtaPatchOpEnd = 0x00,
+    kOtaPatchOpCopy = 0x01,
+    kOtaPatchOpLiteral = 0x02,
+    kOtaPatchOpFill = 0x03,
+};
+
+struct OtaPatchHeader {
+    uint32_t source_size;
+    uint32_t target_size;
+    std::array<uint8_t, 32> source_sha256;
+    std::array<uint8_t, 32> target_sha256;
+};
+
+/*
+ * Streaming applier for the firmware delta patches made by scripts/ota_patch.py.
+ *
+ * The new image is rebuilt from the running one, so only the changed bytes are downloaded.
+ * Integers are little endian, lengths and offsets are LEB128 varints:
+ *   |magic "XZP1" 4|source_size 4u|target_size 4u|source_sha256 32|target_sha256 32|
+ *   |op 1u|...     COPY: |offset|length|  from the running image, the offset is zigzag encoded
+ *                                         relative to the end of the previous copy
+ *                  LITERAL: |length|bytes|
+ *                  FILL: |length|byte 1u|
+ *                  END
+ *
+ * Feed() takes the patch in chunks of any size, as they come from the network, and keeps its
+ * state between calls, so a download resumed with a Range request just keeps feeding.
+ */
+class OtaPatch {
+public:
+    using ReadSource = std::function<bool(size_t offset, uint8_t* data, size_t size)>;
+    using WriteTarget = std::function<bool(const uint8_t* data, size_t size)>;
+    // Called once the header is complete, return false to reject the patch (wrong source image)
+    using CheckHeader = std::function<bool(const OtaPatchHeader& header)>;
+
+    OtaPatch(ReadSource read_source, WriteTarget write_target, CheckHeader check_header);
+
+    static bool IsPatch(const uint8_t* data, size_t size);
+
+    // False if the patch is malformed, rejected, or a read or write failed
+    bool Feed(const uint8_t* data, size_t size);
+    bool IsFinished() const { return state_ == kStateDone; }
+    const OtaPatchHeader& header() const { return header_; }
+    size_t written() const { return written_; }
+
+private:
+    enum State {
+        kStateHeader,
+        kStateOp,
+        kStateCopyOffset,
+        kStateCopyLength,
+        kStateLiteralLength,
+        kStateLiteral,
+        kStateFillLength,
+        kStateFill,
+        kStateDone,
+        kStateError,
+    };
+
+    ReadSource read_source_;
+    WriteTarget write_target_;
+    CheckHeader check_header_;
+    State state_ = kStateHeader;
+    OtaPatchHeader header_ = {};
+    std::array<uint8_t, OTA_PATCH_HEADER_SIZE> header_buffer_;
+    size_t header_received_ = 0;
+    uint32_t varint_ = 0;
+    int varint_shift_ = 0;
+    uint32_t copy_offset_ = 0;
+    uint32_t source_end_ = 0;
+    uint32_t remaining_ = 0;
+    size_t written_ = 0;
+    std::array<uint8_t, OTA_PATCH_COPY_CHUNK> chunk_;
+
+    bool ReadVarint(uint8_t byte);
+    bool ParseHeader();
+    bool Copy(uint32_t offset, uint32_t length);
+    bool Fill(uint8_t value, uint32_t length);
+    bool Write(const uint8_t* data, size_t size);
+    bool Fail(const char* reason);
+};
+
+#endif // OTA_PATCH_H
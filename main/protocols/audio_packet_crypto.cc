@@ -0,0 +1,100 @@
+#include "audio_packet_crypto.h"
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "AudioPacketCrypto"
+
+
+static inline void WriteBe16(uint8_t* p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static inline void WriteBe32(uint8_t* p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static inline uint32_t ReadBe32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+AudioPacketCrypto::AudioPacketCrypto() {
+    mbedtls_aes_init(&aes_ctx_);
+}
+
+AudioPacketCrypto::~AudioPacketCrypto() {
+    mbedtls_aes_free(&aes_ctx_);
+}
+
+bool AudioPacketCrypto::SetKey(const std::string& key, const std::string& nonce) {
+    ready_ = false;
+    if (key.size() != 16 || nonce.size() != AUDIO_PACKET_NONCE_SIZE) {
+        ESP_LOGE(TAG, "Invalid key or nonce size: %u, %u", key.size(), nonce.size());
+        return false;
+    }
+    mbedtls_aes_free(&aes_ctx_);
+    mbedtls_aes_init(&aes_ctx_);
+    if (mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)key.data(), 128) != 0) {
+        ESP_LOGE(TAG, "Failed to set the AES key");
+        return false;
+    }
+    memcpy(nonce_, nonce.data(), AUDIO_PACKET_NONCE_SIZE);
+#if CONFIG_MBEDTLS_HARDWARE_AES
+    ESP_LOGD(TAG, "Using the AES accelerator");
+#endif
+    ready_ = true;
+    return true;
+}
+
+size_t AudioPacketCrypto::Encrypt(const AudioStreamPacket& packet, uint32_t sequence, uint8_t* out) {
+    if (!ready_) {
+        return 0;
+    }
+    size_t size = packet.opus_size();
+    uint8_t nonce[AUDIO_PACKET_NONCE_SIZE];
+    memcpy(nonce, nonce_, sizeof(nonce));
+    WriteBe16(nonce + 2, size);
+    WriteBe32(nonce + 8, packet.timestamp);
+    WriteBe32(nonce + 12, sequence);
+
+    // mbedtls advances the counter block, the header is written from the untouched copy
+    uint8_t counter[AUDIO_PACKET_NONCE_SIZE];
+    memcpy(counter, nonce, sizeof(counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16];
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, counter, stream_block, packet.opus_data(),
+        out + AUDIO_PACKET_NONCE_SIZE) != 0) {
+        ESP_LOGE(TAG, "Failed to encrypt audio data");
+        return 0;
+    }
+    memcpy(out, nonce, sizeof(nonce));
+    return AUDIO_PACKET_NONCE_SIZE + size;
+}
+
+bool AudioPacketCrypto::Decrypt(const uint8_t* data, size_t size, uint8_t* out) {
+    if (!ready_ || size < AUDIO_PACKET_NONCE_SIZE) {
+        return false;
+    }
+    uint8_t counter[AUDIO_PACKET_NONCE_SIZE];
+    memcpy(counter, data, sizeof(counter));
+    size_t nc_off = 0;
+    uint8_t stream_block[16];
+    int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, size - AUDIO_PACKET_NONCE_SIZE, &nc_off, counter, stream_block,
+        data + AUDIO_PACKET_NONCE_SIZE, out);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+uint32_t AudioPacketCrypto::GetTimestamp(const uint8_t* data) {
+    return ReadBe32(data + 8);
+}
+
+uint32_t AudioPacketCrypto::GetSequence(const uint8_t* data) {
+    return ReadBe32(data + 12);
+}
@@ -0,0 +1,57 @@
+#ifndef AUDIO_PACKET_CRYPTO_H
+#define AUDIO_PACKET_CRYPTO_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include <mbedtls/aes.h>
+
+#include "protocol.h"
+
+#define AUDIO_PACKET_NONCE_SIZE 16
+
+
+/*
+ * AES-128-CTR for the UDP audio packets.
+ *
+ * Every packet starts with its 16 byte nonce, which is also the initial counter block:
+ * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
+ * The output is either a separate buffer or the input itself (in place, the nonce then goes into the
+ * packet headroom), so a packet is encrypted or decrypted in a single pass without temporary buffers. mbedtls uses the AES accelerator of the SoC
+ * when CONFIG_MBEDTLS_HARDWARE_AES is enabled.
+ *
+ * The key and nonce template are set when the channel opens, Encrypt() and Decrypt() may then
+ * run concurrently from the sending and the receiving task.
+ */
+class AudioPacketCrypto {
+public:
+    AudioPacketCrypto();
+    ~AudioPacketCrypto();
+
+    AudioPacketCrypto(const AudioPacketCrypto&) = delete;
+    AudioPacketCrypto& operator=(const AudioPacketCrypto&) = delete;
+
+    // Both are 16 bytes, binary
+    bool SetKey(const std::string& key, const std::string& nonce);
+    bool IsReady() const { return ready_; }
+
+    // Writes the nonce and the encrypted Opus data to `out`, which needs room for
+    // AUDIO_PACKET_NONCE_SIZE + opus_size() bytes. `out` is either a separate buffer or
+    // opus_data() - AUDIO_PACKET_NONCE_SIZE. Returns the packet size, 0 on failure.
+    size_t Encrypt(const AudioStreamPacket& packet, uint32_t sequence, uint8_t* out);
+    // Decrypts the payload of a received packet to `out`, which may be `data + AUDIO_PACKET_NONCE_SIZE`
+    bool Decrypt(const uint8_t* data, size_t size, uint8_t* out);
+
+    // Header fields of a received packet
+    static uint8_t GetType(const uint8_t* data) { return data[0]; }
+    static uint32_t GetTimestamp(const uint8_t* data);
+    static uint32_t GetSequence(const uint8_t* data);
+
+private:
+    mbedtls_aes_context aes_ctx_;
+    uint8_t nonce_[AUDIO_PACKET_NONCE_SIZE] = {0};
+    bool ready_ = false;
+};
+
+#endif // AUDIO_PACKET_CRYPTO_H
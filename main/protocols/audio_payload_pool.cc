@@ -0,0 +1,30 @@
+#include "audio_payload_pool.h"
+
+
+AudioPayloadPool::AudioPayloadPool() {
+    free_buffers_.reserve(AUDIO_PAYLOAD_POOL_SIZE);
+}
+
+std::vector<uint8_t> AudioPayloadPool::Acquire(size_t capacity) {
+    std::vector<uint8_t> buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_buffers_.empty()) {
+            buffer = std::move(free_buffers_.back());
+            free_buffers_.pop_back();
+        }
+    }
+    buffer.clear();
+    buffer.reserve(capacity);
+    return buffer;
+}
+
+void AudioPayloadPool::Release(std::vector<uint8_t>&& buffer) {
+    if (buffer.capacity() == 0 || buffer.capacity() > AUDIO_PAYLOAD_MAX_CAPACITY) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_buffers_.size() < AUDIO_PAYLOAD_POOL_SIZE) {
+        free_buffers_.push_back(std::move(buffer));
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef AUDIO_PAYLOAD_POOL_H
+#define AUDIO_PAYLOAD_POOL_H
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#define AUDIO_PAYLOAD_POOL_SIZE 32
+// Larger buffers are freed instead of being kept in the pool
+#define AUDIO_PAYLOAD_MAX_CAPACITY 2048
+
+
+/*
+ * Recycles the payload buffers of the audio packets.
+ *
+ * The network task acquires a buffer for every packet it receives and the decoder releases it after
+ * decoding, the encoder and the sender do the same in the other direction. Once the pool is warm,
+ * the audio packets no longer allocate from the heap.
+ */
+class AudioPayloadPool {
+public:
+    static AudioPayloadPool& GetInstance() {
+        static AudioPayloadPool instance;
+        return instance;
+    }
+
+    // Returns an empty buffer with room for at least `capacity` bytes
+    std::vector<uint8_t> Acquire(size_t capacity);
+    void Release(std::vector<uint8_t>&& buffer);
+
+private:
+    AudioPayloadPool();
+
+    std::mutex mutex_;
+    std::vector<std::vector<uint8_t>> free_buffers_;
+};
+
+#endif // AUDIO_PAYLOAD_POOL_H
@@ -0,0 +1,286 @@
+#include "json_message.h"
+#include <esp_log.h>
+
+#define TAG "JsonMessage"
+
+
+static inline size_t SkipWhitespace(std::string_view text, size_t pos) {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+        pos++;
+    }
+    return pos;
+}
+
+// `pos` is on the opening quote, returns the position after the closing quote, 0 if unterminated
+static size_t SkipString(std::string_view text, size_t pos, bool& escaped) {
+    escaped = false;
+    for (pos++; pos < text.size(); pos++) {
+        if (text[pos] == '\\') {
+            escaped = true;
+            pos++;
+        } else if (text[pos] == '"') {
+            return pos + 1;
+        }
+    }
+    return 0;
+}
+
+// Skips a nested object or array without recursion, returns the position after it, 0 if unbalanced
+static size_t SkipContainer(std::string_view text, size_t pos) {
+    int depth = 0;
+    bool escaped;
+    while (pos < text.size()) {
+        char c = text[pos];
+        if (c == '"') {
+            pos = SkipString(text, pos, escaped);
+            if (pos == 0) {
+                return 0;
+            }
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                return pos + 1;
+            }
+        }
+        pos++;
+    }
+    return 0;
+}
+
+static size_t SkipLiteral(std::string_view text, size_t pos) {
+    while (pos < text.size()) {
+        char c = text[pos];
+        if (c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            break;
+        }
+        pos++;
+    }
+    return pos;
+}
+
+static void AppendUtf8(std::string& out, uint32_t code_point) {
+    if (code_point < 0x80) {
+        out.push_back(code_point);
+    } else if (code_point < 0x800) {
+        out.push_back(0xC0 | (code_point >> 6));
+        out.push_back(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        out.push_back(0xE0 | (code_point >> 12));
+        out.push_back(0x80 | ((code_point >> 6) & 0x3F));
+        out.push_back(0x80 | (code_point & 0x3F));
+    } else {
+        out.push_back(0xF0 | (code_point >> 18));
+        out.push_back(0x80 | ((code_point >> 12) & 0x3F));
+        out.push_back(0x80 | ((code_point >> 6) & 0x3F));
+        out.push_back(0x80 | (code_point & 0x3F));
+    }
+}
+
+static bool ReadHex4(std::string_view text, size_t pos, uint32_t& value) {
+    if (pos + 4 > text.size()) {
+        return false;
+    }
+    value = 0;
+    for (size_t i = pos; i < pos + 4; i++) {
+        char c = text[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= c - '0';
+        else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+static bool Unescape(std::string_view text, std::string& out) {
+    out.clear();
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c != '\\') {
+            out.push_back(c);
+            continue;
+        }
+        if (++i >= text.size()) {
+            return false;
+        }
+        switch (text[i]) {
+            case '"': out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/': out.push_back('/'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                uint32_t code_point;
+                if (!ReadHex4(text, i + 1, code_point)) {
+                    return false;
+                }
+                i += 4;
+                // A character outside the BMP is escaped as a surrogate pair
+                uint32_t low;
+                if (code_point >= 0xD800 && code_point < 0xDC00 && i + 2 < text.size() &&
+                    text[i + 1] == '\\' && text[i + 2] == 'u' && ReadHex4(text, i + 3, low) && low >= 0xDC00 && low < 0xE000) {
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                }
+                AppendUtf8(out, code_point);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+bool JsonMessage::Parse(std::string_view text) {
+    text_ = text;
+    type_ = std::string_view();
+    type_hash_ = 0;
+    member_count_ = 0;
+
+    size_t pos = SkipWhitespace(text, 0);
+    if (pos >= text.size() || text[pos] != '{') {
+        return false;
+    }
+    pos = SkipWhitespace(text, pos + 1);
+    if (pos < text.size() && text[pos] == '}') {
+        return true;
+    }
+
+    while (pos < text.size()) {
+        bool escaped;
+        if (text[pos] != '"') {
+            return false;
+        }
+        size_t key_end = SkipString(text, pos, escaped);
+        if (key_end == 0) {
+            return false;
+        }
+        std::string_view key = text.substr(pos + 1, key_end - pos - 2);
+
+        pos = SkipWhitespace(text, key_end);
+        if (pos >= text.size() || text[pos] != ':') {
+            return false;
+        }
+        pos = SkipWhitespace(text, pos + 1);
+        if (pos >= text.size()) {
+            return false;
+        }
+
+        size_t value_start = pos;
+        JsonValueType type;
+        escaped = false;
+        switch (text[pos]) {
+            case '"':
+                type = kJsonValueString;
+                pos = SkipString(text, pos, escaped);
+                break;
+            case '{':
+                type = kJsonValueObject;
+                pos = SkipContainer(text, pos);
+                break;
+            case '[':
+                type = kJsonValueArray;
+                pos = SkipContainer(text, pos);
+                break;
+            case 't':
+            case 'f':
+                type = kJsonValueBool;
+                pos = SkipLiteral(text, pos);
+                break;
+            case 'n':
+                type = kJsonValueNull;
+                pos = SkipLiteral(text, pos);
+                break;
+            default:
+                type = kJsonValueNumber;
+                pos = SkipLiteral(text, pos);
+                break;
+        }
+        if (pos == 0 || pos == value_start) {
+            return false;
+        }
+
+        if (member_count_ < members_.size()) {
+            auto& member = members_[member_count_++];
+            member.key = key;
+            member.value = text.substr(value_start, pos - value_start);
+            member.type = type;
+            member.escaped = escaped;
+            if (type == kJsonValueString && key == "type") {
+                type_ = member.value.substr(1, member.value.size() - 2);
+                type_hash_ = JsonTypeHash(type_);
+            }
+        } else {
+            ESP_LOGW(TAG, "Ignoring member %.*s, too many members", (int)key.size(), key.data());
+        }
+
+        pos = SkipWhitespace(text, pos);
+        if (pos >= text.size()) {
+            return false;
+        }
+        if (text[pos] == '}') {
+            return true;
+        }
+        if (text[pos] != ',') {
+            return false;
+        }
+        pos = SkipWhitespace(text, pos + 1);
+    }
+    return false;
+}
+
+const JsonMessage::Member* JsonMessage::Find(std::string_view key) const {
+    for (size_t i = 0; i < member_count_; i++) {
+        if (members_[i].key == key) {
+            return &members_[i];
+        }
+    }
+    return nullptr;
+}
+
+bool JsonMessage::IsObject(std::string_view key) const {
+    auto member = Find(key);
+    return member != nullptr && member->type == kJsonValueObject;
+}
+
+bool JsonMessage::GetString(std::string_view key, std::string& value) const {
+    auto member = Find(key);
+    if (member == nullptr || member->type != kJsonValueString) {
+        return false;
+    }
+    auto content = member->value.substr(1, member->value.size() - 2);
+    if (!member->escaped) {
+        value.assign(content.data(), content.size());
+        return true;
+    }
+    return Unescape(content, value);
+}
+
+std::string_view JsonMessage::GetStringView(std::string_view key) const {
+    auto member = Find(key);
+    if (member == nullptr || member->type != kJsonValueString) {
+        return std::string_view();
+    }
+    return member->value.substr(1, member->value.size() - 2);
+}
+
+std::string_view JsonMessage::GetRaw(std::string_view key) const {
+    auto member = Find(key);
+    return member != nullptr ? member->value : std::string_view();
+}
+
+cJSON* JsonMessage::ParseMember(std::string_view key) const {
+    auto member = Find(key);
+    if (member == nullptr) {
+        return nullptr;
+    }
+    return cJSON_ParseWithLength(member->value.data(), member->value.size());
+}
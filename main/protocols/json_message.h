@@ -0,0 +1,84 @@
+#ifndef JSON_MESSAGE_H
+#define JSON_MESSAGE_H
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+#include <cJSON.h>
+
+#define JSON_MESSAGE_MAX_MEMBERS 16
+
+
+enum JsonValueType : uint8_t {
+    kJsonValueNull,
+    kJsonValueBool,
+    kJsonValueNumber,
+    kJsonValueString,
+    kJsonValueObject,
+    kJsonValueArray,
+};
+
+// FNV-1a of a message type, constexpr so the types can be dispatched with a switch:
+// two handled types with the same hash are duplicate case labels, a compile error
+constexpr uint32_t JsonTypeHash(std::string_view type) {
+    uint32_t hash = 2166136261u;
+    for (char c : type) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * A control message from the server, scanned in place without building a cJSON tree.
+ *
+ * Parse() only tokenizes the top level object: every member keeps a view of its value in the
+ * message text, nested objects and arrays are skipped over. Handlers then read the few fields
+ * they need, and a nested object that needs a tree (the MCP payload) is parsed on its own with
+ * ParseMember(), so no part of the message is parsed twice or serialized again.
+ *
+ * The message text must outlive the JsonMessage.
+ */
+class JsonMessage {
+public:
+    bool Parse(std::string_view text);
+
+    std::string_view text() const { return text_; }
+    // Raw value of the "type" member, empty if missing
+    std::string_view type() const { return type_; }
+    uint32_t type_hash() const { return type_hash_; }
+    // Confirms a case of a switch on type_hash(), an unhandled type may have the hash of a handled one
+    bool IsType(std::string_view type) const { return type_ == type; }
+
+    bool Has(std::string_view key) const { return Find(key) != nullptr; }
+    bool IsObject(std::string_view key) const;
+    // Unescaped value of a string member, false if missing or not a string
+    bool GetString(std::string_view key, std::string& value) const;
+    // Value of a string member as it appears in the text, for enum-like values without escapes
+    std::string_view GetStringView(std::string_view key) const;
+    // JSON text of a member value, empty if missing
+    std::string_view GetRaw(std::string_view key) const;
+    // Builds a cJSON tree of a single member, nullptr if missing or invalid, the caller deletes it
+    cJSON* ParseMember(std::string_view key) const;
+
+private:
+    struct Member {
+        std::string_view key;
+        // As it appears in the text, strings with their quotes
+        std::string_view value;
+        JsonValueType type;
+        bool escaped;
+    };
+
+    std::string_view text_;
+    std::string_view type_;
+    uint32_t type_hash_ = 0;
+    std::array<Member, JSON_MESSAGE_MAX_MEMBERS> members_;
+    size_t member_count_ = 0;
+
+    const Member* Find(std::string_view key) const;
+};
+
+#endif // JSON_MESSAGE_H
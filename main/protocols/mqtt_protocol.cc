@@ -37,7 +37,7 @@ MqttProtocol::~MqttProtocol() {
         esp_timer_delete(reconnect_timer_);
     }
 
-    udp_.reset();
+    udp_channel_.Close();
     mqtt_.reset();
     
     if (event_group_handle_ != nullptr) {
@@ -91,32 +91,35 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
+        // Control messages are scanned in place, only the hello gets a full tree
+        JsonMessage message;
+        if (!message.Parse(payload)) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
             return;
         }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (!cJSON_IsString(type)) {
+        if (message.type().empty()) {
             ESP_LOGE(TAG, "Message type is invalid");
-            cJSON_Delete(root);
             return;
         }
 
-        if (strcmp(type->valuestring, "hello") == 0) {
-            ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+        if (message.type() == "hello") {
+            cJSON* root = cJSON_ParseWithLength(payload.data(), payload.size());
+            if (root != nullptr) {
+                ParseServerHello(root);
+                cJSON_Delete(root);
+            }
+        } else if (message.type() == "goodbye") {
+            std::string session_id;
+            bool has_session_id = message.GetString("session_id", session_id);
+            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", has_session_id ? session_id.c_str() : "null");
+            if (!has_session_id || session_id_ == session_id) {
                 Application::GetInstance().Schedule([this]() {
                     CloseAudioChannel();
                 });
             }
         } else if (on_incoming_json_ != nullptr) {
-            on_incoming_json_(root);
+            on_incoming_json_(message);
         }
-        cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -153,36 +156,11 @@ bool MqttProtocol::SendText(const std::string& text) {
 }
 
 bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
-    std::lock_guard<std::mutex> lock(channel_mutex_);
-    if (udp_ == nullptr) {
-        return false;
-    }
-
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
-        ESP_LOGE(TAG, "Failed to encrypt audio data");
-        return false;
-    }
-
-    return udp_->Send(encrypted) > 0;
+    return udp_channel_.Send(std::move(packet));
 }
 
 void MqttProtocol::CloseAudioChannel() {
-    {
-        std::lock_guard<std::mutex> lock(channel_mutex_);
-        udp_.reset();
-    }
+    udp_channel_.Close();
 
     std::string message = "{";
     message += "\"session_id\":\"" + session_id_ + "\",";
@@ -220,56 +198,16 @@ bool MqttProtocol::OpenAudioChannel() {
         return false;
     }
 
-    std::lock_guard<std::mutex> lock(channel_mutex_);
-    auto network = Board::GetInstance().GetNetwork();
-    udp_ = network->CreateUdp(2);
-    udp_->OnMessage([this](const std::string& data) {
-        /*
-         * UDP Encrypted OPUS Packet Format:
-         * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
-         * |payload payload_len|
-         */
-        if (data.size() < sizeof(aes_nonce_)) {
-            ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
-            return;
-        }
-        if (data[0] != 0x01) {
-            ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
-            return;
-        }
-        uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
-        uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
-
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
-        packet->sample_rate = server_sample_rate_;
-        packet->frame_duration = server_frame_duration_;
-        packet->timestamp = timestamp;
-        packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
-            return;
-        }
+    if (!udp_channel_.Open(server_sample_rate_, server_frame_duration_, [this](std::unique_ptr<AudioStreamPacket> packet) {
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
-    });
-
-    udp_->Connect(udp_server_, udp_port_);
+    })) {
+        ESP_LOGE(TAG, "Failed to open UDP channel");
+        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        return false;
+    }
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -289,12 +227,7 @@ std::string MqttProtocol::GetHelloMessage() {
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
     cJSON_AddItemToObject(root, "features", features);
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
+    cJSON_AddItemToObject(root, "audio_params", CreateAudioParams());
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
     cJSON_free(json_str);
@@ -315,58 +248,23 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
-    // Get sample rate from hello message
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (cJSON_IsObject(audio_params)) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (cJSON_IsNumber(sample_rate)) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
-        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
-        if (cJSON_IsNumber(frame_duration)) {
-            server_frame_duration_ = frame_duration->valueint;
-        }
-    }
+    ParseAudioParams(cJSON_GetObjectItem(root, "audio_params"));
 
     auto udp = cJSON_GetObjectItem(root, "udp");
     if (!cJSON_IsObject(udp)) {
         ESP_LOGE(TAG, "UDP is not specified");
         return;
     }
-    udp_server_ = cJSON_GetObjectItem(udp, "server")->valuestring;
-    udp_port_ = cJSON_GetObjectItem(udp, "port")->valueint;
-    auto key = cJSON_GetObjectItem(udp, "key")->valuestring;
-    auto nonce = cJSON_GetObjectItem(udp, "nonce")->valuestring;
-
-    // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
-    // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
-    local_sequence_ = 0;
-    remote_sequence_ = 0;
+    if (!udp_channel_.Configure(udp)) {
+        return;
+    }
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
-static const char hex_chars[] = "0123456789ABCDEF";
-// 辅助函数，将单个十六进制字符转换为对应的数值
-static inline uint8_t CharToHex(char c) {
-    if (c >= '0' && c <= '9') return c - '0';
-    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-    return 0;  // 对于无效输入，返回0
-}
-
-std::string MqttProtocol::DecodeHexString(const std::string& hex_string) {
-    std::string decoded;
-    decoded.reserve(hex_string.size() / 2);
-    for (size_t i = 0; i < hex_string.size(); i += 2) {
-        char byte = (CharToHex(hex_string[i]) << 4) | CharToHex(hex_string[i + 1]);
-        decoded.push_back(byte);
-    }
-    return decoded;
+cJSON* MqttProtocol::GetLinkStatisticsJson() {
+    return udp_channel_.GetStatisticsJson();
 }
 
 bool MqttProtocol::IsAudioChannelOpened() const {
-    return udp_ != nullptr && !error_occurred_ && !IsTimeout();
+    return udp_channel_.IsOpen() && !error_occurred_ && !IsTimeout();
 }
@@ -3,10 +3,9 @@
 
 
 #include "protocol.h"
+#include "udp_audio_channel.h"
 #include <mqtt.h>
-#include <udp.h>
 #include <cJSON.h>
-#include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <esp_timer.h>
@@ -31,26 +30,19 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    cJSON* GetLinkStatisticsJson() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
 
     std::string publish_topic_;
 
-    std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
-    std::unique_ptr<Udp> udp_;
-    mbedtls_aes_context aes_ctx_;
-    std::string aes_nonce_;
-    std::string udp_server_;
-    int udp_port_;
-    uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    UdpAudioChannel udp_channel_;
     esp_timer_handle_t reconnect_timer_;
 
     bool StartMqttClient(bool report_error=false);
     void ParseServerHello(const cJSON* root);
-    std::string DecodeHexString(const std::string& hex_string);
 
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
@@ -1,10 +1,16 @@
 #include "protocol.h"
 
 #include <esp_log.h>
+#include <cstring>
+#include <arpa/inet.h>
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
+static bool IsValidUplinkFrameDuration(int frame_duration) {
+    return frame_duration == 20 || frame_duration == 40 || frame_duration == 60;
+}
+
+void Protocol::OnIncomingJson(std::function<void(const JsonMessage& message)> callback) {
     on_incoming_json_ = callback;
 }
 
@@ -78,6 +84,58 @@ void Protocol::SendMcpMessage(const std::string& payload) {
     SendText(message);
 }
 
+cJSON* Protocol::CreateAudioParams() const {
+    // frame_duration is the preferred uplink duration, the server may pick another one of frame_durations
+    cJSON* audio_params = cJSON_CreateObject();
+    cJSON_AddStringToObject(audio_params, "format", "opus");
+    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
+    cJSON_AddNumberToObject(audio_params, "channels", 1);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", CONFIG_OPUS_UPLINK_FRAME_DURATION_MS);
+    cJSON* frame_durations = cJSON_CreateArray();
+    cJSON_AddItemToArray(frame_durations, cJSON_CreateNumber(20));
+    cJSON_AddItemToArray(frame_durations, cJSON_CreateNumber(40));
+    cJSON_AddItemToArray(frame_durations, cJSON_CreateNumber(60));
+    cJSON_AddItemToObject(audio_params, "frame_durations", frame_durations);
+    cJSON_AddNumberToObject(audio_params, "bitrate", CONFIG_OPUS_UPLINK_BITRATE);
+    return audio_params;
+}
+
+void Protocol::ParseAudioParams(const cJSON* audio_params) {
+    // A server that does not negotiate gets what we asked for
+    uplink_frame_duration_ = CONFIG_OPUS_UPLINK_FRAME_DURATION_MS;
+    uplink_bitrate_ = CONFIG_OPUS_UPLINK_BITRATE;
+    if (!cJSON_IsObject(audio_params)) {
+        return;
+    }
+
+    auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
+    if (cJSON_IsNumber(sample_rate)) {
+        server_sample_rate_ = sample_rate->valueint;
+    }
+    auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+    if (cJSON_IsNumber(frame_duration)) {
+        server_frame_duration_ = frame_duration->valueint;
+    }
+
+    auto uplink_frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+    if (cJSON_IsNumber(uplink_frame_duration)) {
+        if (IsValidUplinkFrameDuration(uplink_frame_duration->valueint)) {
+            uplink_frame_duration_ = uplink_frame_duration->valueint;
+        } else {
+            ESP_LOGW(TAG, "Ignoring unsupported uplink frame duration: %d", uplink_frame_duration->valueint);
+        }
+    }
+    auto uplink_bitrate = cJSON_GetObjectItem(audio_params, "uplink_bitrate");
+    if (cJSON_IsNumber(uplink_bitrate)) {
+        if (uplink_bitrate->valueint >= 6000 && uplink_bitrate->valueint <= 64000) {
+            uplink_bitrate_ = uplink_bitrate->valueint;
+        } else {
+            ESP_LOGW(TAG, "Ignoring unsupported uplink bitrate: %d", uplink_bitrate->valueint);
+        }
+    }
+    ESP_LOGI(TAG, "Uplink audio: %d ms frames, %d bps", uplink_frame_duration_, uplink_bitrate_);
+}
+
 bool Protocol::IsTimeout() const {
     const int kTimeoutSeconds = 120;
     auto now = std::chrono::steady_clock::now();
@@ -88,3 +146,75 @@ bool Protocol::IsTimeout() const {
     }
     return timeout;
 }
+
+size_t GetBinaryHeaderSize(int version) {
+    switch (version) {
+        case 2:
+            return sizeof(BinaryProtocol2);
+        case 3:
+            return sizeof(BinaryProtocol3);
+        default:
+            return 0;
+    }
+}
+
+uint8_t* WriteBinaryHeader(int version, AudioStreamPacket& packet) {
+    size_t header_size = GetBinaryHeaderSize(version);
+    if (packet.headroom < header_size) {
+        // Packets not produced by the uplink encoder, like the wake word audio, have no headroom
+        packet.payload.insert(packet.payload.begin(), header_size - packet.headroom, 0);
+        packet.headroom = header_size;
+    }
+
+    size_t payload_size = packet.opus_size();
+    uint8_t* frame = packet.payload.data() + packet.headroom - header_size;
+    if (version == 2) {
+        BinaryProtocol2 bp2;
+        bp2.version = htons(version);
+        bp2.type = 0;
+        bp2.reserved = 0;
+        bp2.timestamp = htonl(packet.timestamp);
+        bp2.payload_size = htonl(payload_size);
+        memcpy(frame, &bp2, sizeof(bp2));
+    } else if (version == 3) {
+        BinaryProtocol3 bp3;
+        bp3.type = 0;
+        bp3.reserved = 0;
+        bp3.payload_size = htons(payload_size);
+        memcpy(frame, &bp3, sizeof(bp3));
+    }
+    return frame;
+}
+
+bool ParseBinaryFrame(int version, const uint8_t* data, size_t size, const uint8_t*& payload, size_t& payload_size,
+    uint32_t& timestamp) {
+    timestamp = 0;
+    if (version == 2) {
+        BinaryProtocol2 bp2;
+        if (size < sizeof(bp2)) {
+            return false;
+        }
+        memcpy(&bp2, data, sizeof(bp2));
+        payload_size = ntohl(bp2.payload_size);
+        if (payload_size > size - sizeof(bp2)) {
+            return false;
+        }
+        timestamp = ntohl(bp2.timestamp);
+        payload = data + sizeof(bp2);
+    } else if (version == 3) {
+        BinaryProtocol3 bp3;
+        if (size < sizeof(bp3)) {
+            return false;
+        }
+        memcpy(&bp3, data, sizeof(bp3));
+        payload_size = ntohs(bp3.payload_size);
+        if (payload_size > size - sizeof(bp3)) {
+            return false;
+        }
+        payload = data + sizeof(bp3);
+    } else {
+        payload = data;
+        payload_size = size;
+    }
+    return true;
+}
@@ -6,12 +6,32 @@
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "json_message.h"
+
+// Room reserved in front of an outgoing Opus payload, enough for any protocol header or the UDP nonce
+#define AUDIO_PACKET_HEADROOM 16
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    uint32_t sequence = 0;
+    // Playback segment (sentence) of the audio, assigned by the AudioService
+    uint32_t segment = 0;
+    // esp_timer time the packet entered the current stage, for latency tracing
+    int64_t trace_time = 0;
+    // Decoded samples to drop at the start and the end, used by the Ogg pre-skip and end trimming
+    uint16_t trim_start = 0;
+    uint16_t trim_end = 0;
+    // Bytes in front of the Opus data, the transport writes its header there to frame the packet in place
+    uint16_t headroom = 0;
     std::vector<uint8_t> payload;
+
+    const uint8_t* opus_data() const { return payload.data() + headroom; }
+    size_t opus_size() const { return payload.size() - headroom; }
 };
 
 struct BinaryProtocol2 {
@@ -30,6 +50,16 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+static_assert(sizeof(BinaryProtocol2) <= AUDIO_PACKET_HEADROOM, "The headroom must fit the protocol header");
+
+// Header size of the binary audio frames of a protocol version, version 1 sends the bare Opus data
+size_t GetBinaryHeaderSize(int version);
+// Writes the header in front of the Opus data, growing the headroom if needed, and returns the frame start
+uint8_t* WriteBinaryHeader(int version, AudioStreamPacket& packet);
+// Locates the Opus data in a received frame without copying it, returns false if the frame is malformed
+bool ParseBinaryFrame(int version, const uint8_t* data, size_t size, const uint8_t*& payload, size_t& payload_size,
+    uint32_t& timestamp);
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -51,12 +81,19 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
+    // Uplink parameters agreed in the hello exchange, 0 before the first server hello
+    inline int uplink_frame_duration() const {
+        return uplink_frame_duration_;
+    }
+    inline int uplink_bitrate() const {
+        return uplink_bitrate_;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    void OnIncomingJson(std::function<void(const JsonMessage& message)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -73,9 +110,11 @@ public:
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendMcpMessage(const std::string& message);
+    // Link quality of the audio channel, nullptr if the transport does not measure it
+    virtual cJSON* GetLinkStatisticsJson() { return nullptr; }
 
 protected:
-    std::function<void(const cJSON* root)> on_incoming_json_;
+    std::function<void(const JsonMessage& message)> on_incoming_json_;
     std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
@@ -85,10 +124,16 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int uplink_frame_duration_ = 0;
+    int uplink_bitrate_ = 0;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
+    // The audio_params of the client hello, and the parsing of the server hello one
+    cJSON* CreateAudioParams() const;
+    void ParseAudioParams(const cJSON* audio_params);
+
     virtual bool SendText(const std::string& text) = 0;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
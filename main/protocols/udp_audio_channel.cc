@@ -0,0 +1,182 @@
+#include "udp_audio_channel.h"
+#include "board.h"
+#include "application.h"
+#include "audio_payload_pool.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "UdpAudioChannel"
+
+#define PROBE_INTERVAL_MS 200
+
+
+static inline uint8_t CharToHex(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return 0;  // 对于无效输入，返回0
+}
+
+static std::string DecodeHexString(const std::string& hex_string) {
+    std::string decoded;
+    decoded.reserve(hex_string.size() / 2);
+    for (size_t i = 0; i + 1 < hex_string.size(); i += 2) {
+        char byte = (CharToHex(hex_string[i]) << 4) | CharToHex(hex_string[i + 1]);
+        decoded.push_back(byte);
+    }
+    return decoded;
+}
+
+UdpAudioChannel::UdpAudioChannel() {
+    event_group_handle_ = xEventGroupCreate();
+}
+
+UdpAudioChannel::~UdpAudioChannel() {
+    Close();
+    vEventGroupDelete(event_group_handle_);
+}
+
+bool UdpAudioChannel::Configure(const cJSON* udp) {
+    auto server = cJSON_GetObjectItem(udp, "server");
+    auto port = cJSON_GetObjectItem(udp, "port");
+    auto key = cJSON_GetObjectItem(udp, "key");
+    auto nonce = cJSON_GetObjectItem(udp, "nonce");
+    if (!cJSON_IsString(server) || !cJSON_IsNumber(port) || !cJSON_IsString(key) || !cJSON_IsString(nonce)) {
+        ESP_LOGE(TAG, "Invalid UDP parameters");
+        return false;
+    }
+    server_ = server->valuestring;
+    port_ = port->valueint;
+    if (!crypto_.SetKey(DecodeHexString(key->valuestring), DecodeHexString(nonce->valuestring))) {
+        return false;
+    }
+    local_sequence_ = 0;
+    last_sequence_ = 0;
+    link_monitor_.Reset();
+    return true;
+}
+
+bool UdpAudioChannel::Open(int sample_rate, int frame_duration, std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_audio) {
+    if (!crypto_.IsReady()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    xEventGroupClearBits(event_group_handle_, UDP_AUDIO_CHANNEL_PROBE_EVENT);
+    auto network = Board::GetInstance().GetNetwork();
+    udp_ = network->CreateUdp(2);
+    if (udp_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create UDP");
+        return false;
+    }
+    udp_->OnMessage([this, sample_rate, frame_duration, on_audio](const std::string& data) {
+        OnMessage(data, sample_rate, frame_duration, on_audio);
+    });
+    return udp_->Connect(server_, port_);
+}
+
+void UdpAudioChannel::OnMessage(const std::string& data, int sample_rate, int frame_duration,
+    const std::function<void(std::unique_ptr<AudioStreamPacket> packet)>& on_audio) {
+    /*
+     * UDP Encrypted OPUS Packet Format:
+     * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
+     * |payload payload_len|
+     */
+    auto bytes = (const uint8_t*)data.data();
+    if (data.size() < AUDIO_PACKET_NONCE_SIZE) {
+        ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
+        return;
+    }
+    if (AudioPacketCrypto::GetType(bytes) != 0x01) {
+        ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
+        return;
+    }
+    uint32_t timestamp = AudioPacketCrypto::GetTimestamp(bytes);
+    uint32_t sequence = AudioPacketCrypto::GetSequence(bytes);
+    // Late packets within the replay window are passed on, the jitter buffer puts them back in order
+    if (!link_monitor_.OnPacketReceived(sequence, timestamp, frame_duration)) {
+        ESP_LOGD(TAG, "Dropping replayed or too old audio packet: %lu", sequence);
+        return;
+    }
+
+    size_t decrypted_size = data.size() - AUDIO_PACKET_NONCE_SIZE;
+    if (decrypted_size == 0) {
+        // An answer to one of our probes
+        xEventGroupSetBits(event_group_handle_, UDP_AUDIO_CHANNEL_PROBE_EVENT);
+        return;
+    }
+
+    // Decrypt from the network buffer straight into a pooled buffer
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->sample_rate = sample_rate;
+    packet->frame_duration = frame_duration;
+    packet->timestamp = timestamp;
+    packet->sequence = sequence;
+    packet->payload = AudioPayloadPool::GetInstance().Acquire(decrypted_size);
+    packet->payload.resize(decrypted_size);
+    if (!crypto_.Decrypt(bytes, data.size(), packet->payload.data())) {
+        return;
+    }
+    if (static_cast<int32_t>(sequence - last_sequence_.load()) > 0) {
+        last_sequence_ = sequence;
+    }
+    xEventGroupSetBits(event_group_handle_, UDP_AUDIO_CHANNEL_PROBE_EVENT);
+    if (on_audio != nullptr) {
+        on_audio(std::move(packet));
+    }
+}
+
+void UdpAudioChannel::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    udp_.reset();
+}
+
+bool UdpAudioChannel::IsOpen() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return udp_ != nullptr;
+}
+
+bool UdpAudioChannel::Send(std::unique_ptr<AudioStreamPacket> packet) {
+    if (!IsOpen()) {
+        return false;
+    }
+
+    // Without server AEC the timestamp is free, stamp it so a server echoing it lets us measure the RTT
+    if (packet->timestamp == 0 && Application::GetInstance().GetAecMode() != kAecOnServerSide) {
+        packet->timestamp = static_cast<uint32_t>(esp_timer_get_time() / 1000);
+        link_monitor_.OnPacketSent(packet->timestamp);
+    }
+
+    // Encrypt straight into the send buffer, the cipher pass is the only copy of the payload
+    send_buffer_.resize(AUDIO_PACKET_NONCE_SIZE + packet->opus_size());
+    if (crypto_.Encrypt(*packet, ++local_sequence_, (uint8_t*)send_buffer_.data()) == 0) {
+        return false;
+    }
+    AudioPayloadPool::GetInstance().Release(std::move(packet->payload));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (udp_ == nullptr) {
+        return false;
+    }
+    return udp_->Send(send_buffer_) > 0;
+}
+
+bool UdpAudioChannel::Probe(int timeout_ms) {
+    int64_t deadline = esp_timer_get_time() / 1000 + timeout_ms;
+    int64_t remaining = timeout_ms;
+    while (remaining > 0) {
+        // UDP may drop the probe as well as the answer, so probe again until the deadline
+        if (!Send(std::make_unique<AudioStreamPacket>())) {
+            return false;
+        }
+        int wait_ms = remaining < PROBE_INTERVAL_MS ? remaining : PROBE_INTERVAL_MS;
+        EventBits_t bits = xEventGroupWaitBits(event_group_handle_, UDP_AUDIO_CHANNEL_PROBE_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(wait_ms));
+        if (bits & UDP_AUDIO_CHANNEL_PROBE_EVENT) {
+            return true;
+        }
+        remaining = deadline - esp_timer_get_time() / 1000;
+    }
+    ESP_LOGW(TAG, "No answer from %s:%d in %d ms", server_.c_str(), port_, timeout_ms);
+    return false;
+}
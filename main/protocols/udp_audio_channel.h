@@ -0,0 +1,66 @@
+#ifndef UDP_AUDIO_CHANNEL_H
+#define UDP_AUDIO_CHANNEL_H
+
+#include "protocol.h"
+#include "audio_packet_crypto.h"
+#include "udp_link_monitor.h"
+
+#include <udp.h>
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#define UDP_AUDIO_CHANNEL_PROBE_EVENT (1 << 0)
+
+
+/*
+ * The encrypted UDP audio channel negotiated in a server hello.
+ *
+ * The "udp" object of the hello carries the server address and the AES-CTR key and nonce, see
+ * docs/mqtt-udp.md for the packet format. Packets with an empty payload are probes: they are
+ * answered by the server but never passed on to the decoder, Probe() uses them to find out if
+ * UDP gets through before any audio is sent.
+ */
+class UdpAudioChannel {
+public:
+    UdpAudioChannel();
+    ~UdpAudioChannel();
+
+    // Reads server, port, key and nonce from the "udp" object of a server hello
+    bool Configure(const cJSON* udp);
+    bool Open(int sample_rate, int frame_duration, std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_audio);
+    void Close();
+    bool IsOpen() const;
+
+    bool Send(std::unique_ptr<AudioStreamPacket> packet);
+    // Sends probes until the server answers one, returns false after `timeout_ms`
+    bool Probe(int timeout_ms);
+
+    // Highest sequence passed on to the decoder, so another transport can continue the numbering
+    uint32_t last_sequence() const { return last_sequence_.load(); }
+    cJSON* GetStatisticsJson() { return link_monitor_.GetStatisticsJson(); }
+
+private:
+    EventGroupHandle_t event_group_handle_;
+    mutable std::mutex mutex_;
+    std::unique_ptr<Udp> udp_;
+    AudioPacketCrypto crypto_;
+    // Reused for every outgoing packet, the Udp interface takes a std::string
+    std::string send_buffer_;
+    std::string server_;
+    int port_ = 0;
+    uint32_t local_sequence_ = 0;
+    std::atomic<uint32_t> last_sequence_{0};
+    UdpLinkMonitor link_monitor_{CONFIG_UDP_AUDIO_REPLAY_WINDOW};
+
+    void OnMessage(const std::string& data, int sample_rate, int frame_duration,
+        const std::function<void(std::unique_ptr<AudioStreamPacket> packet)>& on_audio);
+};
+
+#endif // UDP_AUDIO_CHANNEL_H
@@ -0,0 +1,173 @@
+#include "udp_link_monitor.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "UdpLinkMonitor"
+
+// Sequence jumps larger than this are treated as a new stream
+#define MAX_SEQUENCE_JUMP 1000
+
+
+static inline int64_t NowMs() {
+    return esp_timer_get_time() / 1000;
+}
+
+UdpLinkMonitor::UdpLinkMonitor(int window) {
+    // The bitmap is made of 32 bit words
+    window_ = (window + 31) / 32 * 32;
+    bitmap_.resize(window_ / 32);
+}
+
+bool UdpLinkMonitor::OnPacketReceived(uint32_t sequence, uint32_t timestamp, int frame_duration) {
+    int64_t now = NowMs();
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    int32_t ahead = static_cast<int32_t>(sequence - highest_sequence_);
+    if (!synchronized_ || ahead > MAX_SEQUENCE_JUMP || ahead < -MAX_SEQUENCE_JUMP) {
+        if (synchronized_) {
+            ESP_LOGW(TAG, "Sequence jumped from %lu to %lu, resynchronizing", highest_sequence_, sequence);
+            previous_expected_ += highest_sequence_ - first_sequence_ + 1;
+        }
+        std::fill(bitmap_.begin(), bitmap_.end(), 0);
+        synchronized_ = true;
+        first_sequence_ = sequence;
+        highest_sequence_ = sequence;
+        has_transit_ = false;
+        ahead = 0;
+    }
+
+    if (ahead > 0) {
+        Slide(ahead);
+        highest_sequence_ = sequence;
+    } else if (static_cast<uint32_t>(-ahead) >= window_) {
+        statistics_.too_late++;
+        return false;
+    }
+    if (TestAndSet(sequence)) {
+        statistics_.duplicated++;
+        return false;
+    }
+
+    statistics_.received++;
+    if (ahead < 0) {
+        statistics_.reordered++;
+        if (static_cast<uint32_t>(-ahead) > statistics_.max_reorder_depth) {
+            statistics_.max_reorder_depth = -ahead;
+        }
+    }
+    UpdateJitter(sequence, timestamp, now, frame_duration);
+    UpdateRtt(timestamp, now);
+    return true;
+}
+
+void UdpLinkMonitor::OnPacketSent(uint32_t timestamp) {
+    int64_t now = NowMs();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& probe = rtt_probes_[rtt_probe_index_];
+    probe.timestamp = timestamp;
+    probe.send_time_ms = now;
+    rtt_probe_index_ = (rtt_probe_index_ + 1) % UDP_LINK_RTT_PROBES;
+}
+
+void UdpLinkMonitor::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::fill(bitmap_.begin(), bitmap_.end(), 0);
+    synchronized_ = false;
+    previous_expected_ = 0;
+    statistics_ = UdpLinkStatistics();
+    has_transit_ = false;
+    jitter_q4_ = 0;
+    rtt_probes_ = {};
+    srtt_ms_ = -1;
+}
+
+UdpLinkStatistics UdpLinkMonitor::GetStatistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Everything between the first and the highest sequence was expected, late packets may still fill the gaps
+    if (synchronized_) {
+        uint32_t expected = previous_expected_ + highest_sequence_ - first_sequence_ + 1;
+        statistics_.lost = expected > statistics_.received ? expected - statistics_.received : 0;
+    }
+    statistics_.jitter_ms = jitter_q4_ >> 4;
+    statistics_.rtt_ms = srtt_ms_;
+    return statistics_;
+}
+
+cJSON* UdpLinkMonitor::GetStatisticsJson() {
+    auto statistics = GetStatistics();
+    uint32_t expected = statistics.received + statistics.lost;
+    auto json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "transport", "udp");
+    cJSON_AddNumberToObject(json, "received", statistics.received);
+    cJSON_AddNumberToObject(json, "lost", statistics.lost);
+    cJSON_AddNumberToObject(json, "loss_percent", expected > 0 ? statistics.lost * 1000 / expected / 10.0 : 0);
+    cJSON_AddNumberToObject(json, "reordered", statistics.reordered);
+    cJSON_AddNumberToObject(json, "max_reorder_depth", statistics.max_reorder_depth);
+    cJSON_AddNumberToObject(json, "duplicated", statistics.duplicated);
+    cJSON_AddNumberToObject(json, "too_late", statistics.too_late);
+    cJSON_AddNumberToObject(json, "jitter_ms", statistics.jitter_ms);
+    if (statistics.rtt_ms >= 0) {
+        cJSON_AddNumberToObject(json, "rtt_ms", statistics.rtt_ms);
+    }
+    return json;
+}
+
+// Bit i of the bitmap is the sequence highest_sequence_ - i
+bool UdpLinkMonitor::TestAndSet(uint32_t sequence) {
+    uint32_t offset = highest_sequence_ - sequence;
+    uint32_t& word = bitmap_[offset / 32];
+    uint32_t mask = 1u << (offset % 32);
+    bool seen = word & mask;
+    word |= mask;
+    return seen;
+}
+
+void UdpLinkMonitor::Slide(uint32_t distance) {
+    size_t words = bitmap_.size();
+    if (distance >= window_) {
+        std::fill(bitmap_.begin(), bitmap_.end(), 0);
+        return;
+    }
+    // Shift the whole bitmap towards the older sequences
+    size_t word_shift = distance / 32;
+    uint32_t bit_shift = distance % 32;
+    for (size_t i = words; i-- > 0;) {
+        uint32_t value = 0;
+        if (i >= word_shift) {
+            value = bitmap_[i - word_shift] << bit_shift;
+            if (bit_shift != 0 && i > word_shift) {
+                value |= bitmap_[i - word_shift - 1] >> (32 - bit_shift);
+            }
+        }
+        bitmap_[i] = value;
+    }
+}
+
+// Interarrival jitter estimator from RFC 3550, in 1/16 ms. Servers that do not stamp their packets
+// are measured against the sequence number instead.
+void UdpLinkMonitor::UpdateJitter(uint32_t sequence, uint32_t timestamp, int64_t arrival_ms, int frame_duration) {
+    int64_t sent = timestamp != 0 ? timestamp : static_cast<int64_t>(sequence) * frame_duration;
+    int32_t transit = static_cast<int32_t>(arrival_ms - sent);
+    if (has_transit_) {
+        int32_t d = std::abs(transit - last_transit_ms_);
+        jitter_q4_ += d - ((jitter_q4_ + 8) >> 4);
+    }
+    last_transit_ms_ = transit;
+    has_transit_ = true;
+}
+
+void UdpLinkMonitor::UpdateRtt(uint32_t timestamp, int64_t arrival_ms) {
+    if (timestamp == 0) {
+        return;
+    }
+    for (auto& probe : rtt_probes_) {
+        if (probe.send_time_ms != 0 && probe.timestamp == timestamp) {
+            int32_t rtt = arrival_ms - probe.send_time_ms;
+            srtt_ms_ = srtt_ms_ < 0 ? rtt : (srtt_ms_ * 7 + rtt) / 8;
+            probe.send_time_ms = 0;
+            break;
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef UDP_LINK_MONITOR_H
+#define UDP_LINK_MONITOR_H
+
+#include <array>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include <cJSON.h>
+
+#define UDP_LINK_RTT_PROBES 16
+
+
+struct UdpLinkStatistics {
+    uint32_t received = 0;
+    uint32_t lost = 0;
+    uint32_t reordered = 0;         // Accepted after a packet with a higher sequence
+    uint32_t max_reorder_depth = 0;
+    uint32_t duplicated = 0;        // Rejected by the replay window
+    uint32_t too_late = 0;          // Older than the replay window
+    uint32_t jitter_ms = 0;
+    int32_t rtt_ms = -1;            // -1 until the server echoes one of our timestamps
+};
+
+/*
+ * Replay protection and link quality of the UDP audio channel.
+ *
+ * A bitmap over the last `window` sequence numbers (RFC 4303 style) accepts packets that arrive late
+ * but have not been seen yet, and rejects duplicates and packets older than the window. Loss and
+ * reordering are derived from the same window, the jitter follows RFC 3550 on the packet timestamps.
+ *
+ * The RTT is measured when the server echoes the timestamp of one of our packets in its audio, the
+ * send time of the last UDP_LINK_RTT_PROBES stamped packets is kept for that.
+ */
+class UdpLinkMonitor {
+public:
+    explicit UdpLinkMonitor(int window);
+
+    // Called for every received packet before decrypting it, returns false if it must be dropped
+    bool OnPacketReceived(uint32_t sequence, uint32_t timestamp, int frame_duration);
+    void OnPacketSent(uint32_t timestamp);
+    void Reset();
+
+    UdpLinkStatistics GetStatistics();
+    cJSON* GetStatisticsJson();
+
+private:
+    struct RttProbe {
+        uint32_t timestamp = 0;
+        int64_t send_time_ms = 0;
+    };
+
+    std::mutex mutex_;
+    uint32_t window_;
+    std::vector<uint32_t> bitmap_;
+    bool synchronized_ = false;
+    uint32_t first_sequence_ = 0;
+    // Packets expected before the last resynchronization
+    uint32_t previous_expected_ = 0;
+    uint32_t highest_sequence_ = 0;
+    UdpLinkStatistics statistics_;
+
+    bool has_transit_ = false;
+    int32_t last_transit_ms_ = 0;
+    uint32_t jitter_q4_ = 0;
+
+    std::array<RttProbe, UDP_LINK_RTT_PROBES> rtt_probes_;
+    size_t rtt_probe_index_ = 0;
+    int32_t srtt_ms_ = -1;
+
+    bool TestAndSet(uint32_t sequence);
+    void Slide(uint32_t distance);
+    void UpdateJitter(uint32_t sequence, uint32_t timestamp, int64_t arrival_ms, int frame_duration);
+    void UpdateRtt(uint32_t timestamp, int64_t arrival_ms);
+};
+
+#endif // UDP_LINK_MONITOR_H
@@ -3,6 +3,7 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_payload_pool.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -30,31 +31,12 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         return false;
     }
 
-    if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
-        bp2->version = htons(version_);
-        bp2->type = 0;
-        bp2->reserved = 0;
-        bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
-        bp3->type = 0;
-        bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
-    }
+    // The header goes into the headroom reserved by the encoder, so the Opus data is not copied
+    auto frame = WriteBinaryHeader(version_, *packet);
+    size_t frame_size = GetBinaryHeaderSize(version_) + packet->opus_size();
+    bool sent = websocket_->Send((const char*)frame, frame_size, true);
+    AudioPayloadPool::GetInstance().Release(std::move(packet->payload));
+    return sent;
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
@@ -89,6 +71,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
     }
 
     error_occurred_ = false;
+    remote_sequence_ = 0;
 
     auto network = Board::GetInstance().GetNetwork();
     websocket_ = network->CreateWebSocket(1);
@@ -110,56 +93,23 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
-                if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
-                } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
-                } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
-                }
-            }
+            OnBinaryFrame(data, len);
         } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
+            // Control messages are scanned in place, only the hello gets a full tree
+            JsonMessage message;
+            if (!message.Parse(std::string_view(data, len))) {
+                ESP_LOGE(TAG, "Invalid JSON message: %.*s", (int)len, data);
+            } else if (message.type().empty()) {
+                ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
+            } else if (message.type() == "hello") {
+                auto root = cJSON_ParseWithLength(data, len);
+                if (root != nullptr) {
                     ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
+                    cJSON_Delete(root);
                 }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+            } else if (on_incoming_json_ != nullptr) {
+                on_incoming_json_(message);
             }
-            cJSON_Delete(root);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
@@ -192,6 +142,8 @@ bool WebsocketProtocol::OpenAudioChannel() {
         return false;
     }
 
+    OnChannelReady();
+
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
     }
@@ -199,8 +151,38 @@ bool WebsocketProtocol::OpenAudioChannel() {
     return true;
 }
 
+void WebsocketProtocol::OnBinaryFrame(const char* data, size_t len) {
+    if (on_incoming_audio_ != nullptr) {
+        const uint8_t* payload;
+        size_t payload_size;
+        uint32_t timestamp;
+        if (!ParseBinaryFrame(version_, (const uint8_t*)data, len, payload, payload_size, timestamp)) {
+            ESP_LOGE(TAG, "Invalid audio frame of %u bytes", len);
+            return;
+        }
+        // The only copy of the received audio, into a pooled buffer released by the decoder
+        auto packet = std::make_unique<AudioStreamPacket>();
+        packet->sample_rate = server_sample_rate_;
+        packet->frame_duration = server_frame_duration_;
+        packet->timestamp = timestamp;
+        packet->sequence = ++remote_sequence_;
+        packet->payload = AudioPayloadPool::GetInstance().Acquire(payload_size);
+        packet->payload.assign(payload, payload + payload_size);
+        on_incoming_audio_(std::move(packet));
+    }
+}
+
 std::string WebsocketProtocol::GetHelloMessage() {
-    // keys: message type, version, audio_params (format, sample_rate, channels)
+    cJSON* root = CreateHelloMessage();
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string message(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return message;
+}
+
+cJSON* WebsocketProtocol::CreateHelloMessage() {
+    // keys: message type, version, audio_params (format, sample_rate, channels, frame_duration, bitrate)
     cJSON* root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "type", "hello");
     cJSON_AddNumberToObject(root, "version", version_);
@@ -211,17 +193,8 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "mcp", true);
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
-    cJSON_Delete(root);
-    return message;
+    cJSON_AddItemToObject(root, "audio_params", CreateAudioParams());
+    return root;
 }
 
 void WebsocketProtocol::ParseServerHello(const cJSON* root) {
@@ -237,17 +210,7 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (cJSON_IsObject(audio_params)) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (cJSON_IsNumber(sample_rate)) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
-        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
-        if (cJSON_IsNumber(frame_duration)) {
-            server_frame_duration_ = frame_duration->valueint;
-        }
-    }
+    ParseAudioParams(cJSON_GetObjectItem(root, "audio_params"));
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
@@ -13,7 +13,7 @@
 class WebsocketProtocol : public Protocol {
 public:
     WebsocketProtocol();
-    ~WebsocketProtocol();
+    virtual ~WebsocketProtocol();
 
     bool Start() override;
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
@@ -21,13 +21,21 @@ public:
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
 
-private:
+protected:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
-
-    void ParseServerHello(const cJSON* root);
+    // Websocket frames arrive in order, number them for the jitter buffer
+    uint32_t remote_sequence_ = 0;
+
+    virtual cJSON* CreateHelloMessage();
+    virtual void ParseServerHello(const cJSON* root);
+    virtual void OnBinaryFrame(const char* data, size_t len);
+    // Called after the server hello, before the audio channel is reported as opened
+    virtual void OnChannelReady() {}
     bool SendText(const std::string& text) override;
+
+private:
     std::string GetHelloMessage();
 };
 
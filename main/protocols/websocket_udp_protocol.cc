@@ -0,0 +1,96 @@
+#include "websocket_udp_protocol.h"
+
+#include <esp_log.h>
+
+#define TAG "WSUDP"
+
+// Time for the server to answer a UDP probe before the audio stays on the websocket
+#define UDP_PROBE_TIMEOUT_MS 1000
+
+
+bool WebsocketUdpProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    if (udp_active_) {
+        return udp_channel_.Send(std::move(packet));
+    }
+    return WebsocketProtocol::SendAudio(std::move(packet));
+}
+
+bool WebsocketUdpProtocol::OpenAudioChannel() {
+    udp_active_ = false;
+    udp_offered_ = false;
+    udp_channel_.Close();
+    return WebsocketProtocol::OpenAudioChannel();
+}
+
+void WebsocketUdpProtocol::CloseAudioChannel() {
+    udp_active_ = false;
+    udp_channel_.Close();
+    WebsocketProtocol::CloseAudioChannel();
+}
+
+cJSON* WebsocketUdpProtocol::GetLinkStatisticsJson() {
+    if (!udp_active_) {
+        return nullptr;
+    }
+    return udp_channel_.GetStatisticsJson();
+}
+
+cJSON* WebsocketUdpProtocol::CreateHelloMessage() {
+    cJSON* root = WebsocketProtocol::CreateHelloMessage();
+    cJSON_AddBoolToObject(cJSON_GetObjectItem(root, "features"), "udp", true);
+    return root;
+}
+
+void WebsocketUdpProtocol::ParseServerHello(const cJSON* root) {
+    // Parsed before the base class signals the hello, OpenAudioChannel() is waiting for it
+    auto udp = cJSON_GetObjectItem(root, "udp");
+    udp_offered_ = cJSON_IsObject(udp) && udp_channel_.Configure(udp);
+    if (!udp_offered_) {
+        ESP_LOGI(TAG, "UDP is not offered, audio stays on the websocket");
+    }
+    WebsocketProtocol::ParseServerHello(root);
+}
+
+void WebsocketUdpProtocol::OnBinaryFrame(const char* data, size_t len) {
+    if (udp_active_) {
+        // The server lost our UDP packets and fell back to in-band audio, follow it
+        ESP_LOGW(TAG, "Server sent audio on the websocket, falling back from UDP");
+        udp_active_ = false;
+        remote_sequence_ = udp_channel_.last_sequence();
+    }
+    WebsocketProtocol::OnBinaryFrame(data, len);
+}
+
+void WebsocketUdpProtocol::OnChannelReady() {
+    if (!udp_offered_) {
+        return;
+    }
+
+    bool opened = udp_channel_.Open(server_sample_rate_, server_frame_duration_, [this](std::unique_ptr<AudioStreamPacket> packet) {
+        // Packets still in flight after a fallback would break the websocket numbering
+        if (!udp_active_) {
+            return;
+        }
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(packet));
+        }
+        last_incoming_time_ = std::chrono::steady_clock::now();
+    });
+    if (opened && udp_channel_.Probe(UDP_PROBE_TIMEOUT_MS)) {
+        ESP_LOGI(TAG, "UDP audio channel is up");
+        udp_active_ = true;
+        SendAudioTransport("udp");
+    } else {
+        ESP_LOGW(TAG, "UDP is blocked, audio stays on the websocket");
+        SendAudioTransport("websocket");
+    }
+}
+
+void WebsocketUdpProtocol::SendAudioTransport(const char* transport) {
+    std::string message = "{";
+    message += "\"session_id\":\"" + session_id_ + "\",";
+    message += "\"type\":\"transport\",";
+    message += "\"audio\":\"" + std::string(transport) + "\"";
+    message += "}";
+    SendText(message);
+}
@@ -0,0 +1,39 @@
+#ifndef _WEBSOCKET_UDP_PROTOCOL_H_
+#define _WEBSOCKET_UDP_PROTOCOL_H_
+
+
+#include "websocket_protocol.h"
+#include "udp_audio_channel.h"
+
+#include <atomic>
+
+/*
+ * Websocket protocol with the audio on a UDP side channel.
+ *
+ * The client hello asks for UDP with the "udp" feature, a server that supports it answers with a
+ * "udp" object like the MQTT hello (server, port, key, nonce) and the packets use the same AES-CTR
+ * framing. JSON and MCP messages stay on the websocket. If the UDP probe is not answered, or the
+ * server starts sending binary frames, the audio falls back to the websocket.
+ */
+class WebsocketUdpProtocol : public WebsocketProtocol {
+public:
+    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    cJSON* GetLinkStatisticsJson() override;
+
+protected:
+    cJSON* CreateHelloMessage() override;
+    void ParseServerHello(const cJSON* root) override;
+    void OnBinaryFrame(const char* data, size_t len) override;
+    void OnChannelReady() override;
+
+private:
+    UdpAudioChannel udp_channel_;
+    bool udp_offered_ = false;
+    std::atomic<bool> udp_active_{false};
+
+    void SendAudioTransport(const char* transport);
+};
+
+#endif
@@ -0,0 +1,211 @@
+import argparse
+import hashlib
+import struct
+import sys
+
+
+'''
+  Delta patches for the firmware OTA, applied on the device by main/ota_patch.cc.
+
+  The patch rebuilds the new image from the image the device is running, so a release that
+  only changes a few functions downloads a fraction of the full binary. The server returns
+  the patch made against the device's current version as "patch_url" in the firmware
+  section of the check version response, the device falls back to "url" if the patch does
+  not match its running image.
+
+  python scripts/ota_patch.py diff old.bin new.bin patch.bin
+  python scripts/ota_patch.py apply old.bin patch.bin out.bin
+'''
+
+MAGIC = b'XZP1'
+OP_END, OP_COPY, OP_LITERAL, OP_FILL = 0, 1, 2, 3
+
+KEY_SIZE = 8
+# Copies shorter than this cost more than the literal bytes
+MIN_COPY = 8
+MIN_FILL = 16
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return (value << 1) if value >= 0 else ((-value << 1) - 1)
+
+
+def unzigzag(value):
+    return (value >> 1) if not value & 1 else -((value + 1) >> 1)
+
+
+def match_length(a, ai, b, bi):
+    limit = min(len(a) - ai, len(b) - bi)
+    length = 0
+    step = 256
+    while length < limit:
+        n = min(step, limit - length)
+        if a[ai + length:ai + length + n] == b[bi + length:bi + length + n]:
+            length += n
+        elif n == 1:
+            break
+        else:
+            step = max(1, n // 4)
+    return length
+
+
+def build_index(source):
+    # Only a quarter of the positions are indexed, chosen by content, so shifted code is still found
+    index = {}
+    for i in range(len(source) - KEY_SIZE + 1):
+        key = source[i:i + KEY_SIZE]
+        if hash(key) & 3 == 0:
+            index.setdefault(key, i)
+    return index
+
+
+def diff(source, target):
+    index = build_index(source)
+    ops = bytearray()
+    literal = bytearray()
+
+    def flush_literal():
+        if literal:
+            ops.extend(bytes([OP_LITERAL]) + varint(len(literal)) + literal)
+            literal.clear()
+
+    i = 0
+    last_delta = 0
+    # Copy offsets are stored relative to the end of the previous copy, mostly a few bytes
+    source_end = 0
+    while i < len(target):
+        best_source, best_length = 0, 0
+        # Continue the previous copy first: code that only changed some addresses keeps its alignment
+        s = i + last_delta
+        if 0 <= s < len(source):
+            best_source, best_length = s, match_length(source, s, target, i)
+        key = target[i:i + KEY_SIZE]
+        if best_length < 64 and len(key) == KEY_SIZE and hash(key) & 3 == 0:
+            s = index.get(key)
+            if s is not None:
+                length = match_length(source, s, target, i)
+                if length > best_length:
+                    best_source, best_length = s, length
+
+        if best_length >= MIN_COPY:
+            # Take back the literal bytes that also match before the copy
+            while literal and best_source > 0 and source[best_source - 1] == literal[-1]:
+                literal.pop()
+                best_source -= 1
+                best_length += 1
+                i -= 1
+            flush_literal()
+            ops.extend(bytes([OP_COPY]) + varint(zigzag(best_source - source_end)) + varint(best_length))
+            source_end = best_source + best_length
+            last_delta = best_source - i
+            i += best_length
+            continue
+
+        run = match_length(target, i + 1, target, i) + 1 if i + 1 < len(target) else 1
+        if run >= MIN_FILL and target[i + 1:i + run] == target[i:i + 1] * (run - 1):
+            flush_literal()
+            ops.extend(bytes([OP_FILL]) + varint(run) + target[i:i + 1])
+            i += run
+            continue
+
+        literal.append(target[i])
+        i += 1
+
+    flush_literal()
+    ops.append(OP_END)
+    header = MAGIC + struct.pack('<II', len(source), len(target))
+    header += hashlib.sha256(source).digest() + hashlib.sha256(target).digest()
+    return header + bytes(ops)
+
+
+def read_varint(data, pos):
+    value, shift = 0, 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        # Values are 32 bits, like on the device
+        if shift == 28 and byte > 0x0F:
+            raise ValueError('varint exceeds 32 bits')
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def apply(source, patch):
+    if patch[:4] != MAGIC:
+        raise ValueError('not a patch')
+    source_size, target_size = struct.unpack_from('<II', patch, 4)
+    if hashlib.sha256(source[:source_size]).digest() != patch[12:44]:
+        raise ValueError('patch was made for another source image')
+    target = bytearray()
+    pos = 76
+    source_end = 0
+    while True:
+        op = patch[pos]
+        pos += 1
+        if op == OP_END:
+            break
+        if op == OP_COPY:
+            offset, pos = read_varint(patch, pos)
+            length, pos = read_varint(patch, pos)
+            offset = source_end + unzigzag(offset)
+            target += source[offset:offset + length]
+            source_end = offset + length
+        elif op == OP_LITERAL:
+            length, pos = read_varint(patch, pos)
+            target += patch[pos:pos + length]
+            pos += length
+        elif op == OP_FILL:
+            length, pos = read_varint(patch, pos)
+            target += patch[pos:pos + 1] * length
+            pos += 1
+        else:
+            raise ValueError(f'unknown op {op}')
+    if len(target) != target_size or hashlib.sha256(target).digest() != patch[44:76]:
+        raise ValueError('target image does not match')
+    return bytes(target)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='固件差分升级包工具')
+    sub = parser.add_subparsers(dest='command', required=True)
+    p = sub.add_parser('diff', help='生成差分包')
+    p.add_argument('old')
+    p.add_argument('new')
+    p.add_argument('patch')
+    p = sub.add_parser('apply', help='应用差分包（用于校验）')
+    p.add_argument('old')
+    p.add_argument('patch')
+    p.add_argument('out')
+    args = parser.parse_args()
+
+    if args.command == 'diff':
+        source = open(args.old, 'rb').read()
+        target = open(args.new, 'rb').read()
+        patch = diff(source, target)
+        # Make sure the device will rebuild exactly the new image
+        apply(source, patch)
+        open(args.patch, 'wb').write(patch)
+        print(f'{args.patch}: {len(patch)} bytes, {len(patch) * 100 / len(target):.1f}% of {len(target)} bytes')
+    else:
+        source = open(args.old, 'rb').read()
+        target = apply(source, open(args.patch, 'rb').read())
+        open(args.out, 'wb').write(target)
+        print(f'{args.out}: {len(target)} bytes, SHA-256 verified')
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,183 @@
+import hashlib
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import ota_patch
+
+
+'''
+  Tests of the delta patches of scripts/ota_patch.py against the applier of the firmware,
+  main/ota_patch.cc, built for the host as tests/host/build/ota_patch_apply.
+
+  python scripts/ota_patch_test.py
+
+  The driver is built with make first, set OTA_PATCH_APPLY to use another build of it.
+'''
+
+HOST_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'tests', 'host')
+APPLY = os.environ.get('OTA_PATCH_APPLY', os.path.join(HOST_DIR, 'build', 'ota_patch_apply'))
+
+
+def setUpModule():
+    if 'OTA_PATCH_APPLY' not in os.environ:
+        subprocess.run(['make', '-C', HOST_DIR, 'build/ota_patch_apply'], check=True, stdout=subprocess.DEVNULL)
+
+
+def make_images():
+    # An image with code-like random bytes, erased flash and a table of addresses
+    rng = random.Random(1)
+    source = bytearray(rng.randbytes(48 * 1024))
+    source[20000:24000] = b'\xff' * 4000
+    for i in range(30000, 34000, 4):
+        source[i:i + 4] = struct.pack('<I', 0x42000000 + i * 3)
+
+    target = bytearray(source)
+    # A function grew, everything after it shifted
+    target[5000:5000] = rng.randbytes(300)
+    # The addresses moved with it
+    for i in range(30300, 34300, 4):
+        target[i:i + 4] = struct.pack('<I', 0x42000000 + i * 3 + 300)
+    # A removed block, a new string table and a longer erased area
+    del target[40000:41000]
+    target += b'new strings\x00' * 50 + b'\xff' * 3000
+    return bytes(source), bytes(target)
+
+
+def header(source, target_size, target=b''):
+    return (ota_patch.MAGIC + struct.pack('<II', len(source), target_size) +
+            hashlib.sha256(source).digest() + hashlib.sha256(target).digest())
+
+
+def op_boundaries(patch):
+    '''Offsets where an op starts, the first one right after the header, the last one the END op'''
+    boundaries = []
+    pos = 76
+    while True:
+        boundaries.append(pos)
+        op = patch[pos]
+        pos += 1
+        if op == ota_patch.OP_END:
+            return boundaries
+        if op == ota_patch.OP_COPY:
+            _, pos = ota_patch.read_varint(patch, pos)
+            _, pos = ota_patch.read_varint(patch, pos)
+        elif op == ota_patch.OP_LITERAL:
+            length, pos = ota_patch.read_varint(patch, pos)
+            pos += length
+        elif op == ota_patch.OP_FILL:
+            _, pos = ota_patch.read_varint(patch, pos)
+            pos += 1
+
+
+class OtaPatchTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.tmp = tempfile.TemporaryDirectory()
+        cls.source, cls.target = make_images()
+        cls.patch = ota_patch.diff(cls.source, cls.target)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.tmp.cleanup()
+
+    def run_apply(self, source, patch, chunk_size=0):
+        '''Returns the rebuilt image, or None and the reason the device code gave'''
+        paths = [os.path.join(self.tmp.name, name) for name in ('source.bin', 'patch.bin', 'output.bin')]
+        for path, data in zip(paths, (source, patch)):
+            with open(path, 'wb') as f:
+                f.write(data)
+        result = subprocess.run([APPLY] + paths + [str(chunk_size)], capture_output=True, text=True)
+        if result.returncode != 0:
+            self.assertEqual(result.returncode, 1, result.stderr)
+            return None, result.stderr
+        with open(paths[2], 'rb') as f:
+            return f.read(), result.stderr
+
+    def assertRejected(self, source, patch, reason):
+        output, log = self.run_apply(source, patch)
+        self.assertIsNone(output)
+        self.assertIn(reason, log)
+
+    def test_round_trip(self):
+        self.assertLess(len(self.patch), len(self.target) // 2)
+        self.assertEqual(ota_patch.apply(self.source, self.patch), self.target)
+        # Byte by byte, in network sized chunks and in one piece
+        for chunk_size in (1, 0, len(self.patch)):
+            output, log = self.run_apply(self.source, self.patch, chunk_size)
+            self.assertEqual(output, self.target, log)
+
+    def test_identical_and_empty_images(self):
+        for source, target in ((self.source, self.source), (self.source, b''), (b'', self.target[:1000])):
+            patch = ota_patch.diff(source, target)
+            output, log = self.run_apply(source, patch)
+            self.assertEqual(output, target, log)
+
+    def test_truncated_at_every_op(self):
+        boundaries = op_boundaries(self.patch)
+        self.assertGreater(len(boundaries), 5)
+        self.assertEqual(boundaries[-1], len(self.patch) - 1)
+        # In the header, at every op and one byte into it
+        cuts = {0, 4, 40, 75}
+        for boundary in boundaries:
+            cuts.update((boundary, boundary + 1))
+        for cut in sorted(cuts):
+            if cut < len(self.patch):
+                with self.subTest(cut=cut):
+                    output, _ = self.run_apply(self.source, self.patch[:cut])
+                    self.assertIsNone(output)
+
+    def test_wrong_source(self):
+        source = bytearray(self.source)
+        source[len(source) // 2] ^= 0x01
+        self.assertRejected(bytes(source), self.patch, 'Invalid patch: rejected')
+        # The source SHA-256 in the header is checked, not only the image size
+        patch = bytearray(self.patch)
+        patch[12] ^= 0x01
+        self.assertRejected(self.source, bytes(patch), 'Invalid patch: rejected')
+        self.assertRejected(self.source[:-1], self.patch, 'Invalid patch: rejected')
+
+    def test_output_overruns_target_size(self):
+        patch = bytearray(self.patch)
+        struct.pack_into('<I', patch, 8, len(self.target) - 1)
+        self.assertRejected(self.source, bytes(patch), 'output exceeds the target size')
+        # Each op kind writing past the end
+        source = self.source[:100]
+        for ops in (bytes([ota_patch.OP_FILL]) + ota_patch.varint(11) + b'A',
+                    bytes([ota_patch.OP_LITERAL]) + ota_patch.varint(11) + b'B' * 11,
+                    bytes([ota_patch.OP_COPY]) + ota_patch.varint(0) + ota_patch.varint(11)):
+            with self.subTest(op=ops[0]):
+                self.assertRejected(source, header(source, 10) + ops + bytes([ota_patch.OP_END]),
+                                    'output exceeds the target size')
+
+    def test_end_before_target_size(self):
+        self.assertRejected(self.source, header(self.source, 10) + bytes([ota_patch.OP_END]),
+                            'patch ended before the target size')
+
+    def test_varint_overflow(self):
+        source = b''
+        # 5 in the longest encoding a 32 bit value may have
+        patch = header(source, 5, b'AAAAA') + bytes([ota_patch.OP_FILL, 0x85, 0x80, 0x80, 0x80, 0x00]) + b'A'
+        output, log = self.run_apply(source, patch + bytes([ota_patch.OP_END]))
+        self.assertEqual(output, b'AAAAA', log)
+        # Bits 32 and up used to be dropped, which applied 0x10 << 28 as a fill of 0 bytes
+        for last in (0x10, 0x7F, 0x80):
+            with self.subTest(last=last):
+                ops = bytes([ota_patch.OP_FILL, 0x80, 0x80, 0x80, 0x80, last]) + b'A'
+                patch = header(source, 0) + ops + bytes([ota_patch.OP_END])
+                self.assertRejected(source, patch, 'varint exceeds 32 bits')
+                with self.assertRaises(ValueError):
+                    ota_patch.apply(source, patch)
+
+    def test_unknown_op_and_trailing_data(self):
+        self.assertRejected(self.source, self.patch[:-1] + b'\x07', 'unknown op')
+        self.assertRejected(self.source, self.patch + b'\x00', 'data after the end of the patch')
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,181 @@
+import argparse
+import hashlib
+import struct
+import sys
+
+
+'''
+  Chunked assets container, read on the device by main/assets_table.cc.
+
+  The file is an image of the assets partition: two table slots, then every asset on its own
+  4 KB sector, prefixed with "ZZ". Each table entry carries the SHA-256 of the asset, so a
+  device that already runs a container downloads the table with a Range request and then only
+  the assets whose hash it does not have, writes them into free sectors and switches to the
+  new table by writing it into its other slot. The whole file is still a valid image for a
+  first download or for flashing.
+
+  python assets_container.py convert build/output/assets.bin build/assets.bin
+  python assets_container.py verify build/assets.bin
+  python assets_container.py diff old/assets.bin new/assets.bin
+'''
+
+MAGIC = b'XZA2'
+SLOT_SIZE = 16 * 1024
+SLOTS = 2
+DATA_OFFSET = SLOT_SIZE * SLOTS
+SECTOR_SIZE = 4096
+HEADER_SIZE = 48
+ENTRY_SIZE = 76
+NAME_LENGTH = 32
+PREFIX = b'ZZ'
+MAX_ENTRIES = (SLOT_SIZE - HEADER_SIZE) // ENTRY_SIZE
+
+
+def align_up(value):
+    return (value + SECTOR_SIZE - 1) // SECTOR_SIZE * SECTOR_SIZE
+
+
+def table_hash(header16, entries):
+    return hashlib.sha256(header16 + entries).digest()
+
+
+def serialize_table(sequence, image_size, entries):
+    if len(entries) > MAX_ENTRIES:
+        raise ValueError(f'{len(entries)} assets, the table holds at most {MAX_ENTRIES}')
+    body = bytearray()
+    for name, offset, size, width, height, digest in entries:
+        encoded = name.encode('utf-8')
+        if len(encoded) > NAME_LENGTH:
+            print(f'\033[1;33mWarn:\033[0m "{name}" exceeds {NAME_LENGTH} bytes and will be truncated.')
+        body += encoded[:NAME_LENGTH].ljust(NAME_LENGTH, b'\0')
+        body += struct.pack('<IIHH', size, offset, width, height) + digest
+    header16 = MAGIC + struct.pack('<III', sequence, len(entries), image_size)
+    return header16 + table_hash(header16, bytes(body)) + bytes(body)
+
+
+def parse_table(slot):
+    if slot[:4] != MAGIC:
+        return None
+    sequence, count, image_size = struct.unpack_from('<III', slot, 4)
+    if count > MAX_ENTRIES:
+        return None
+    body = slot[HEADER_SIZE:HEADER_SIZE + count * ENTRY_SIZE]
+    if table_hash(slot[:16], body) != slot[16:48]:
+        return None
+    entries = []
+    for i in range(count):
+        item = body[i * ENTRY_SIZE:(i + 1) * ENTRY_SIZE]
+        name = item[:NAME_LENGTH].split(b'\0', 1)[0].decode('utf-8', errors='replace')
+        size, offset, width, height = struct.unpack_from('<IIHH', item, NAME_LENGTH)
+        entries.append((name, offset, size, width, height, item[44:76]))
+    return sequence, image_size, entries
+
+
+def active_table(image):
+    '''The valid table with the highest sequence, as the device picks it'''
+    best = None
+    for slot in range(SLOTS):
+        table = parse_table(image[slot * SLOT_SIZE:(slot + 1) * SLOT_SIZE])
+        if table and (best is None or ((table[0] - best[0]) & 0xFFFFFFFF) < 0x80000000):
+            best = table
+    return best
+
+
+def pack(assets):
+    '''assets: [(name, data, width, height)], identical contents are stored once'''
+    image = bytearray(b'\xFF' * DATA_OFFSET)
+    stored = {}
+    entries = []
+    for name, data, width, height in assets:
+        digest = hashlib.sha256(data).digest()
+        if digest not in stored:
+            stored[digest] = len(image)
+            image += PREFIX + data
+            image += b'\xFF' * (align_up(len(image)) - len(image))
+        entries.append((name, stored[digest], len(data), width, height, digest))
+    # The padding after the last asset is not part of the image
+    image_size = max([offset + len(PREFIX) + size for _, offset, size, _, _, _ in entries], default=DATA_OFFSET)
+    del image[image_size:]
+    table = serialize_table(1, image_size, entries)
+    image[:len(table)] = table
+    return bytes(image)
+
+
+def unpack(image):
+    '''[(name, data, width, height)] from the active table, every hash checked'''
+    table = active_table(image)
+    if table is None:
+        raise ValueError('no valid assets table')
+    assets = []
+    for name, offset, size, width, height, digest in table[2]:
+        if image[offset:offset + len(PREFIX)] != PREFIX:
+            raise ValueError(f'{name}: bad prefix at 0x{offset:x}')
+        data = image[offset + len(PREFIX):offset + len(PREFIX) + size]
+        if len(data) != size or hashlib.sha256(data).digest() != digest:
+            raise ValueError(f'{name}: content does not match its hash')
+        assets.append((name, bytes(data), width, height))
+    return assets
+
+
+def read_mmap_assets(image):
+    '''The assets of the original format made by spiffs_assets_gen.py'''
+    count, _, _ = struct.unpack_from('<III', image, 0)
+    table_size = 44 * count
+    assets = []
+    for i in range(count):
+        item = image[12 + i * 44:12 + (i + 1) * 44]
+        name = item[:NAME_LENGTH].split(b'\0', 1)[0].decode('utf-8')
+        size, offset, width, height = struct.unpack_from('<IIHH', item, NAME_LENGTH)
+        start = 12 + table_size + offset + len(PREFIX)
+        assets.append((name, bytes(image[start:start + size]), width, height))
+    return assets
+
+
+def convert(legacy):
+    assets = read_mmap_assets(legacy)
+    image = pack(assets)
+    # Make sure the device will read back exactly the same assets
+    if unpack(image) != assets:
+        raise ValueError('round trip mismatch')
+    return image
+
+
+def changed_bytes(old, new):
+    '''What a device running `old` downloads to update to `new`'''
+    have = {digest for _, _, _, _, _, digest in active_table(old)[2]}
+    sources = {}
+    for _, offset, size, _, _, digest in active_table(new)[2]:
+        if digest not in have:
+            sources[offset] = size + len(PREFIX)
+    return len(sources), sum(sources.values())
+
+
+def main():
+    parser = argparse.ArgumentParser(description='分块资源容器工具')
+    sub = parser.add_subparsers(dest='command', required=True)
+    p = sub.add_parser('convert', help='将 spiffs_assets_gen.py 生成的 assets.bin 转为分块容器')
+    p.add_argument('input')
+    p.add_argument('output')
+    p = sub.add_parser('verify', help='校验容器中每个资源的哈希')
+    p.add_argument('input')
+    p = sub.add_parser('diff', help='统计从旧容器升级需要下载的数据量')
+    p.add_argument('old')
+    p.add_argument('new')
+    args = parser.parse_args()
+
+    if args.command == 'convert':
+        image = convert(open(args.input, 'rb').read())
+        open(args.output, 'wb').write(image)
+        print(f'{args.output}: {len(active_table(image)[2])} assets, {len(image)} bytes')
+    elif args.command == 'verify':
+        assets = unpack(open(args.input, 'rb').read())
+        print(f'{args.input}: {len(assets)} assets, all hashes match')
+    else:
+        old = open(args.old, 'rb').read()
+        new = open(args.new, 'rb').read()
+        count, size = changed_bytes(old, new)
+        print(f'{count} changed assets, {size} of {len(new)} bytes to download')
+
+
+if __name__ == '__main__':
+    sys.exit(main())
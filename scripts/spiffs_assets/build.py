@@ -21,6 +21,8 @@ import subprocess
 import json
 from pathlib import Path
 
+import assets_container
+
 
 def ensure_dir(directory):
     """Ensure directory exists, create if not"""
@@ -345,6 +347,8 @@ def main():
 
     parser.add_argument('--res_path', help='Path to res directory')
     parser.add_argument('--target_board', help='Path to target board directory')
+    parser.add_argument('--chunked', action='store_true',
+                        help='Output the chunked assets container, for firmware that updates single assets')
     
     args = parser.parse_args()
     
@@ -392,7 +396,16 @@ def main():
         sys.exit(1)
     
     # Copy build/output/assets.bin to build/assets.bin
-    shutil.copy(os.path.join(build_dir, "output", "assets.bin"), os.path.join(build_dir, "assets.bin"))
+    output_path = os.path.join(build_dir, "output", "assets.bin")
+    if args.chunked:
+        # Repack as a chunked container, so devices only download the assets that changed
+        with open(output_path, 'rb') as f:
+            image = assets_container.convert(f.read())
+        with open(os.path.join(build_dir, "assets.bin"), 'wb') as f:
+            f.write(image)
+        print(f"Packed chunked assets container: {len(image)} bytes")
+    else:
+        shutil.copy(output_path, os.path.join(build_dir, "assets.bin"))
     print("Build completed!")
 
 
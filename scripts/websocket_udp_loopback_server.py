@@ -0,0 +1,211 @@
+import argparse
+import asyncio
+import json
+import os
+import random
+import struct
+import time
+import uuid
+
+import websockets
+from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+
+
+'''
+  Loopback test server for the websocket protocol with a UDP audio channel (CONFIG_WEBSOCKET_UDP_AUDIO).
+
+  The websocket hello is answered with a "udp" object, the device then probes the UDP port and reports
+  the transport it picked with a "transport" message. The audio recorded while the device listens is
+  played back to it as TTS when it stops listening, on the same transport it arrived on.
+
+  --block-udp ignores all UDP packets to test the fallback to the websocket, --loss drops a share of
+  the UDP packets in both directions and --fallback-after switches the playback to websocket binary
+  frames after some seconds, like a server that lost the UDP path.
+
+  Requires: pip install websockets cryptography
+'''
+
+
+class Session:
+    def __init__(self, websocket, version):
+        self.websocket = websocket
+        self.version = version
+        self.id = str(uuid.uuid4())
+        self.key = os.urandom(16)
+        # |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
+        self.ssrc = os.urandom(4)
+        self.nonce = bytes([0x01, 0x00, 0x00, 0x00]) + self.ssrc + bytes(8)
+        self.udp_address = None
+        self.udp_audio = False
+        self.sequence = 0
+        self.frame_duration = 60
+        self.recording = []
+        self.started_at = time.monotonic()
+
+    def crypt(self, nonce, data):
+        cipher = Cipher(algorithms.AES(self.key), modes.CTR(nonce)).encryptor()
+        return cipher.update(data) + cipher.finalize()
+
+    def pack_udp(self, payload, timestamp):
+        self.sequence += 1
+        nonce = bytearray(self.nonce)
+        struct.pack_into('>H', nonce, 2, len(payload))
+        struct.pack_into('>II', nonce, 8, timestamp, self.sequence)
+        return bytes(nonce) + self.crypt(bytes(nonce), payload)
+
+    def pack_binary(self, payload, timestamp):
+        if self.version == 2:
+            return struct.pack('>HHIII', 2, 0, 0, timestamp, len(payload)) + payload
+        if self.version == 3:
+            return struct.pack('>BBH', 0, 0, len(payload)) + payload
+        return payload
+
+    def unpack_binary(self, frame):
+        if self.version == 2:
+            _, _, _, timestamp, size = struct.unpack_from('>HHIII', frame)
+            return frame[16:16 + size], timestamp
+        if self.version == 3:
+            _, _, size = struct.unpack_from('>BBH', frame)
+            return frame[4:4 + size], 0
+        return frame, 0
+
+
+class LoopbackServer:
+    def __init__(self, args):
+        self.args = args
+        self.sessions = {}
+        self.transport = None
+
+    # UDP side
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, address):
+        if self.args.block_udp or len(data) < 16 or data[0] != 0x01:
+            return
+        if random.random() * 100 < self.args.loss:
+            return
+        session = self.sessions.get(data[4:8])
+        if session is None:
+            return
+        payload = session.crypt(data[:16], data[16:])
+        timestamp, = struct.unpack_from('>I', data, 8)
+        session.udp_address = address
+        if len(payload) == 0:
+            # Answer the probe, the timestamp is echoed so the device can measure the RTT
+            self.send_udp(session, b'', timestamp)
+            return
+        session.recording.append((payload, timestamp))
+
+    def error_received(self, exc):
+        print(f"UDP error: {exc}")
+
+    def connection_lost(self, exc):
+        pass
+
+    def send_udp(self, session, payload, timestamp):
+        if session.udp_address is None or random.random() * 100 < self.args.loss:
+            session.sequence += 1
+            return
+        self.transport.sendto(session.pack_udp(payload, timestamp), session.udp_address)
+
+    # Websocket side
+    async def handle(self, websocket):
+        headers = websocket.request.headers
+        session = Session(websocket, int(headers.get('Protocol-Version', '1')))
+        print(f"Device {headers.get('Device-Id')} connected, binary protocol version {session.version}")
+        try:
+            async for message in websocket:
+                if isinstance(message, bytes):
+                    session.recording.append(session.unpack_binary(message))
+                    continue
+                await self.on_json(session, json.loads(message))
+        except websockets.ConnectionClosed:
+            pass
+        finally:
+            self.sessions.pop(session.ssrc, None)
+            print(f"Session {session.id} closed")
+
+    async def on_json(self, session, message):
+        type = message.get('type')
+        if type == 'hello':
+            audio_params = message.get('audio_params', {})
+            session.frame_duration = audio_params.get('frame_duration', 60)
+            hello = {
+                'type': 'hello',
+                'transport': 'websocket',
+                'session_id': session.id,
+                'audio_params': {
+                    'format': 'opus',
+                    'sample_rate': audio_params.get('sample_rate', 16000),
+                    'channels': 1,
+                    'frame_duration': session.frame_duration,
+                },
+            }
+            if message.get('features', {}).get('udp'):
+                self.sessions[session.ssrc] = session
+                hello['udp'] = {
+                    'server': self.args.udp_host,
+                    'port': self.args.udp_port,
+                    'key': session.key.hex(),
+                    'nonce': session.nonce.hex(),
+                }
+            await session.websocket.send(json.dumps(hello))
+        elif type == 'transport':
+            session.udp_audio = message.get('audio') == 'udp'
+            print(f"Session {session.id} sends audio over {message.get('audio')}")
+        elif type == 'listen':
+            state = message.get('state')
+            if state in ('start', 'detect'):
+                session.recording = []
+            elif state == 'stop':
+                await self.play_back(session)
+        elif type == 'mcp':
+            # Keep the device happy, the tools are not used by the loopback
+            pass
+        else:
+            print(f"Message: {message}")
+
+    async def play_back(self, session):
+        recording, session.recording = session.recording, []
+        print(f"Playing back {len(recording)} packets")
+        await session.websocket.send(json.dumps({'session_id': session.id, 'type': 'tts', 'state': 'start'}))
+        start = time.monotonic()
+        for index, (payload, timestamp) in enumerate(recording):
+            fallback = self.args.fallback_after > 0 and start - session.started_at >= self.args.fallback_after
+            if session.udp_audio and not fallback:
+                self.send_udp(session, payload, timestamp)
+            else:
+                await session.websocket.send(session.pack_binary(payload, timestamp))
+            # Pace the frames like a real server, a little ahead of real time
+            delay = start + index * session.frame_duration / 1000 - 0.1 - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+        await session.websocket.send(json.dumps({'session_id': session.id, 'type': 'tts', 'state': 'stop'}))
+
+
+async def main(args):
+    server = LoopbackServer(args)
+    loop = asyncio.get_running_loop()
+    await loop.create_datagram_endpoint(lambda: server, local_addr=('0.0.0.0', args.udp_port))
+    async with websockets.serve(server.handle, '0.0.0.0', args.port):
+        print(f"Listening on ws://0.0.0.0:{args.port}, UDP {args.udp_host}:{args.udp_port}")
+        await asyncio.Future()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Websocket + UDP 音频回环测试服务器')
+    parser.add_argument('--port', '-p', type=int, default=8000,
+                        help='Websocket 端口 (默认: 8000)')
+    parser.add_argument('--udp-port', type=int, default=8001,
+                        help='UDP 端口 (默认: 8001)')
+    parser.add_argument('--udp-host', required=True,
+                        help='设备访问本机的 IP 地址')
+    parser.add_argument('--block-udp', action='store_true',
+                        help='忽略所有 UDP 包，测试回退到 Websocket')
+    parser.add_argument('--loss', type=float, default=0,
+                        help='UDP 丢包率百分比 (默认: 0)')
+    parser.add_argument('--fallback-after', type=float, default=0,
+                        help='连接若干秒后改用 Websocket 下发音频 (默认: 不切换)')
+
+    asyncio.run(main(parser.parse_args()))
@@ -0,0 +1,42 @@
+// Counts the heap allocations of the process, include it from exactly one source file
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// The replacements below pair malloc with free, which GCC cannot see through
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+static std::atomic<size_t> g_allocation_count{0};
+static std::atomic<size_t> g_allocated_bytes{0};
+
+void* operator new(size_t size) {
+    g_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = malloc(size > 0 ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
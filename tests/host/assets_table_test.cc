@@ -0,0 +1,270 @@
+/*
+ * The chunked assets container through AssetsTable, on a partition kept in memory: the containers
+ * of make_assets_containers.py (packed by scripts/spiffs_assets/assets_container.py) are flashed
+ * and updated the way Assets::LoadTable and Assets::DownloadChanged do it.
+ *
+ * It checks that the table the script writes parses and serializes back to the same bytes, that an
+ * update downloads each changed content once, in one request when it fits, into sectors the active
+ * table does not use, that the updated partition reads back every asset of the new container, that
+ * the assets fit one by one into holes and the plan fails when they do not fit at all, that an
+ * interrupted table write leaves the old assets, and that corrupted tables are rejected.
+ *
+ * Usage: assets_table_test [directory], build/assets by default
+ */
+#include "bench_util.h"
+#include "assets_table.h"
+
+#include <mbedtls/sha256.h>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+
+// The end of the v2 assets once v1 is flashed and updated, so v3 and v4 only fit into its holes
+#define PARTITION_SIZE (21 * ASSETS_SECTOR_SIZE)
+
+static std::string g_directory = "build/assets";
+
+static std::vector<uint8_t> Load(const char* name) {
+    std::string path = g_directory + "/" + name;
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> data(std::istreambuf_iterator<char>(file), {});
+    if (data.empty()) {
+        fprintf(stderr, "%s: cannot read, make builds it with make_assets_containers.py\n", path.c_str());
+        exit(1);
+    }
+    return data;
+}
+
+static std::array<uint8_t, 32> Sha256(const uint8_t* data, size_t size) {
+    std::array<uint8_t, 32> digest;
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, 0);
+    mbedtls_sha256_update(&context, data, size);
+    mbedtls_sha256_finish(&context, digest.data());
+    mbedtls_sha256_free(&context);
+    return digest;
+}
+
+static uint32_t AlignUp(uint32_t value) {
+    return (value + ASSETS_SECTOR_SIZE - 1) / ASSETS_SECTOR_SIZE * ASSETS_SECTOR_SIZE;
+}
+
+// The name and content of every asset of a table, checking the prefix and the hash of each
+static std::map<std::string, std::vector<uint8_t>> ReadAssets(const std::vector<uint8_t>& image, const AssetsTable& table) {
+    std::map<std::string, std::vector<uint8_t>> assets;
+    for (auto& entry : table.entries) {
+        CHECK(entry.end() <= image.size());
+        CHECK(memcmp(&image[entry.offset], "ZZ", ASSETS_DATA_PREFIX_SIZE) == 0);
+        auto data = &image[entry.offset + ASSETS_DATA_PREFIX_SIZE];
+        CHECK(Sha256(data, entry.size) == entry.sha256);
+        assets[entry.name].assign(data, data + entry.size);
+    }
+    return assets;
+}
+
+static AssetsTable ParseContainer(const std::vector<uint8_t>& image) {
+    // The device reads only the first slot of the package, with a Range request
+    AssetsTable table;
+    CHECK(table.Parse(image.data(), std::min<size_t>(image.size(), ASSETS_TABLE_SLOT_SIZE)));
+    CHECK(table.image_size == image.size());
+    return table;
+}
+
+struct Partition {
+    std::vector<uint8_t> flash;
+    AssetsTable table;
+    int slot = -1;
+
+    // A full download, as Assets::DownloadAll writes it
+    void Flash(const std::vector<uint8_t>& image) {
+        CHECK(image.size() <= PARTITION_SIZE);
+        flash.assign(PARTITION_SIZE, 0xFF);
+        std::copy(image.begin(), image.end(), flash.begin());
+        CHECK(LoadTable());
+    }
+
+    // Assets::LoadTable
+    bool LoadTable() {
+        slot = -1;
+        for (int i = 0; i < ASSETS_TABLE_SLOTS; i++) {
+            AssetsTable candidate;
+            if (!candidate.Parse(&flash[i * ASSETS_TABLE_SLOT_SIZE], ASSETS_TABLE_SLOT_SIZE)
+                || candidate.image_size > flash.size()) {
+                continue;
+            }
+            if (slot < 0 || (int32_t)(candidate.sequence - table.sequence) > 0) {
+                table = std::move(candidate);
+                slot = i;
+            }
+        }
+        return slot >= 0;
+    }
+
+    // Assets::DownloadChanged up to the table write, which writes `table_bytes` of the new table
+    bool Update(const std::vector<uint8_t>& package_image, std::vector<AssetsTransfer>& transfers,
+                size_t table_bytes = SIZE_MAX) {
+        AssetsTable next;
+        if (!table.PlanUpdate(ParseContainer(package_image), flash.size(), next, transfers)) {
+            return false;
+        }
+        for (auto& transfer : transfers) {
+            CHECK(transfer.target_offset % ASSETS_SECTOR_SIZE == 0);
+            CHECK(transfer.target_offset + transfer.length <= flash.size());
+            CHECK(transfer.source_offset + transfer.length <= package_image.size());
+            // The sectors written must not hold an asset of the active table
+            uint32_t end = AlignUp(transfer.target_offset + transfer.length);
+            for (auto& entry : table.entries) {
+                CHECK(end <= entry.offset || transfer.target_offset >= AlignUp(entry.end()));
+            }
+            std::fill(flash.begin() + transfer.target_offset, flash.begin() + end, 0xFF);
+            memcpy(&flash[transfer.target_offset], &package_image[transfer.source_offset], transfer.length);
+        }
+        auto data = next.Serialize();
+        uint8_t* target = &flash[(slot == 0 ? 1 : 0) * ASSETS_TABLE_SLOT_SIZE];
+        std::fill(target, target + ASSETS_TABLE_SLOT_SIZE, 0xFF);
+        memcpy(target, data.data(), std::min(data.size(), table_bytes));
+        CHECK(LoadTable());
+        return true;
+    }
+};
+
+static size_t TransferredBytes(const std::vector<AssetsTransfer>& transfers) {
+    size_t total = 0;
+    for (auto& transfer : transfers) {
+        total += transfer.length;
+    }
+    return total;
+}
+
+static void TestParse() {
+    auto image = Load("v1.bin");
+    auto table = ParseContainer(image);
+    CHECK(table.sequence == 1 && table.entries.size() == 6);
+    auto assets = ReadAssets(image, table);
+    CHECK(assets.size() == 6 && assets["index.json"].size() == 300 && assets["font.bin"].size() == 9000);
+    auto happy = table.entries[2], neutral = table.entries[3];
+    CHECK(happy.name == "happy.gif" && happy.width == 64 && happy.height == 64);
+    // Identical contents are stored once
+    CHECK(neutral.name == "neutral.gif" && neutral.offset == happy.offset && neutral.sha256 == happy.sha256);
+    for (auto& entry : table.entries) {
+        CHECK(entry.offset >= ASSETS_DATA_OFFSET && entry.offset % ASSETS_SECTOR_SIZE == 0);
+    }
+
+    // The device writes the table byte for byte as the script does
+    auto data = table.Serialize();
+    CHECK(data.size() == ASSETS_TABLE_HEADER_SIZE + 6 * ASSETS_TABLE_ENTRY_SIZE);
+    CHECK(memcmp(data.data(), image.data(), data.size()) == 0);
+    // The second slot of a new container is empty
+    AssetsTable empty;
+    CHECK(!empty.Parse(&image[ASSETS_TABLE_SLOT_SIZE], ASSETS_TABLE_SLOT_SIZE));
+    printf("v1 container: %zu assets parsed, serialized back to the same bytes: ok\n", table.entries.size());
+}
+
+static void TestUpdate() {
+    auto v1 = Load("v1.bin"), v2 = Load("v2.bin"), v3 = Load("v3.bin"), v4 = Load("v4.bin");
+    Partition partition;
+    partition.Flash(v1);
+    CHECK(partition.slot == 0);
+    auto old_assets = ReadAssets(partition.flash, partition.table);
+
+    // index.json, sad.gif and angry.gif are new contents on consecutive sectors, cry.gif has the
+    // content of angry.gif, the rest is kept where it is
+    std::vector<AssetsTransfer> transfers;
+    auto package = ParseContainer(v2);
+    CHECK(partition.Update(v2, transfers));
+    CHECK(transfers.size() == 1);
+    size_t changed = 0;
+    uint32_t first = UINT32_MAX, last = 0;
+    for (auto& name : { "index.json", "sad.gif", "angry.gif" }) {
+        for (auto& entry : package.entries) {
+            if (entry.name == name) {
+                changed += ASSETS_DATA_PREFIX_SIZE + entry.size;
+                first = std::min(first, entry.offset);
+                last = std::max(last, entry.end());
+            }
+        }
+    }
+    CHECK(transfers[0].source_offset == first && transfers[0].length == last - first);
+    CHECK(TransferredBytes(transfers) < v2.size() / 2);
+    CHECK(partition.slot == 1 && partition.table.sequence == 2);
+    auto assets = ReadAssets(partition.flash, partition.table);
+    CHECK(assets == ReadAssets(v2, package));
+    for (auto& name : { "font.bin", "happy.gif", "neutral.gif", "wake.wav" }) {
+        CHECK(assets[name] == old_assets[name]);
+    }
+    printf("v1 -> v2: %zu of %zu bytes in %zu request (%zu bytes of changed assets), all assets match: ok\n",
+        TransferredBytes(transfers), v2.size(), transfers.size(), changed);
+
+    // v3 does not fit after the v2 assets, only one by one into the sectors v1 used
+    auto before = partition.flash;
+    CHECK(!partition.Update(v4, transfers));
+    CHECK(partition.flash == before);
+    CHECK(partition.Update(v3, transfers));
+    CHECK(transfers.size() == 3);
+    CHECK(partition.slot == 0 && partition.table.sequence == 3);
+    CHECK(ReadAssets(partition.flash, partition.table) == ReadAssets(v3, ParseContainer(v3)));
+    printf("v2 -> v3: %zu assets placed one by one into the free sectors, v4 does not fit: ok\n", transfers.size());
+}
+
+static void TestInterruptedUpdate() {
+    auto v1 = Load("v1.bin"), v2 = Load("v2.bin");
+    auto old_assets = ReadAssets(v1, ParseContainer(v1));
+    std::vector<AssetsTransfer> transfers;
+    // Power lost while the new table is written, after its assets
+    size_t table_size = ASSETS_TABLE_HEADER_SIZE + ParseContainer(v2).entries.size() * ASSETS_TABLE_ENTRY_SIZE;
+    for (size_t written : { (size_t)0, (size_t)16, table_size / 2, table_size - 1 }) {
+        Partition partition;
+        partition.Flash(v1);
+        CHECK(partition.Update(v2, transfers, written));
+        CHECK(partition.slot == 0 && partition.table.sequence == 1);
+        CHECK(ReadAssets(partition.flash, partition.table) == old_assets);
+    }
+    printf("Interrupted table writes keep the v1 assets: ok\n");
+}
+
+static void TestCorruptedTable() {
+    auto image = Load("v1.bin");
+    auto data = ParseContainer(image).Serialize();
+    AssetsTable table;
+    // Any changed byte of the magic, header or entries
+    for (size_t i = 0; i < data.size(); i++) {
+        auto corrupted = data;
+        corrupted[i] ^= 0x01;
+        CHECK(!table.Parse(corrupted.data(), corrupted.size()));
+    }
+    // Truncated before its last entry
+    CHECK(!table.Parse(data.data(), data.size() - 1));
+    CHECK(!table.Parse(data.data(), ASSETS_TABLE_HEADER_SIZE - 1));
+
+    // Entries that pass the hash but point outside the assets
+    auto valid = ParseContainer(image);
+    auto reject = [&valid](auto&& corrupt) {
+        AssetsTable corrupted = valid;
+        corrupt(corrupted);
+        auto bytes = corrupted.Serialize();
+        AssetsTable parsed;
+        CHECK(!parsed.Parse(bytes.data(), bytes.size()));
+    };
+    reject([](AssetsTable& t) { t.entries[1].offset += 1; });
+    reject([](AssetsTable& t) { t.entries[0].offset = ASSETS_TABLE_SLOT_SIZE; });
+    reject([](AssetsTable& t) { t.entries.back().size += 1; });
+    reject([](AssetsTable& t) { t.entries[0].size = UINT32_MAX - 1; });
+    reject([](AssetsTable& t) { t.image_size -= 1; });
+    reject([](AssetsTable& t) { t.entries.resize((ASSETS_TABLE_SLOT_SIZE - ASSETS_TABLE_HEADER_SIZE) / ASSETS_TABLE_ENTRY_SIZE + 1, t.entries[0]); });
+    printf("Corrupted tables rejected: ok\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        g_directory = argv[1];
+    }
+    TestParse();
+    TestUpdate();
+    TestInterruptedUpdate();
+    TestCorruptedTable();
+    return 0;
+}
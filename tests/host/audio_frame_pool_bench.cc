@@ -0,0 +1,171 @@
+/*
+ * One minute of simulated full-duplex audio through the frame path of AudioService: the input
+ * task reads 60 ms frames into the encode queue, the codec task encodes them and decodes a reply
+ * frame into the playback queue, the output task plays it.
+ *
+ * It runs once with a heap allocated AudioTask and PCM vector per stage, as before AudioFramePool,
+ * and once with the pools. It counts the heap allocations after the warm-up and measures the time
+ * from the capture of a frame to its playback, whose spread is the jitter.
+ *
+ * Usage: audio_frame_pool_bench [speedup], the frames are paced 10 times faster than real time by default
+ */
+#include "alloc_counter.h"
+#include "bench_util.h"
+#include "audio_frame_pool.h"
+#include "audio_ring.h"
+
+#include <mutex>
+#include <thread>
+
+#define FRAME_DURATION_MS 60
+#define INPUT_SAMPLES (16000 * FRAME_DURATION_MS / 1000)
+#define DECODED_SAMPLES (16000 * FRAME_DURATION_MS / 1000)
+#define OUTPUT_SAMPLES (24000 * FRAME_DURATION_MS / 1000)
+#define FRAME_COUNT (60 * 1000 / FRAME_DURATION_MS)
+#define WARMUP_FRAMES 10
+#define QUEUE_DEPTH 2
+#define POOL_HEADROOM 2
+
+struct RunResult {
+    size_t allocations;
+    size_t allocated_bytes;
+    LatencyStats latency;
+};
+
+static void FillPcm(std::vector<int16_t>& pcm, size_t samples, int seed) {
+    pcm.resize(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = static_cast<int16_t>(seed * 31 + i);
+    }
+}
+
+static RunResult Run(bool use_pool, int speedup) {
+    std::unique_ptr<AudioFramePool> encode_pool;
+    std::unique_ptr<AudioFramePool> playback_pool;
+    if (use_pool) {
+        encode_pool = std::make_unique<AudioFramePool>(QUEUE_DEPTH + POOL_HEADROOM, INPUT_SAMPLES);
+        playback_pool = std::make_unique<AudioFramePool>(QUEUE_DEPTH + POOL_HEADROOM, OUTPUT_SAMPLES);
+    }
+    auto acquire = [](AudioFramePool* pool) {
+        return pool != nullptr ? pool->Acquire() : AudioTaskPtr(new AudioTask(), AudioTaskRecycler{nullptr});
+    };
+
+    SpscRing<AudioTaskPtr, QUEUE_DEPTH> encode_queue;
+    SpscRing<AudioTaskPtr, QUEUE_DEPTH> playback_queue;
+    Notifier input_wake, codec_wake, output_wake;
+    std::vector<int64_t> capture_time(FRAME_COUNT);
+    std::vector<int64_t> latency(FRAME_COUNT);
+    std::atomic<size_t> allocations_at_warmup{0}, bytes_at_warmup{0};
+    const int64_t period_us = FRAME_DURATION_MS * 1000 / speedup;
+
+    std::thread input([&] {
+        int64_t next = NowUs();
+        for (int i = 0; i < FRAME_COUNT; i++) {
+            SleepUntilUs(next);
+            next += period_us;
+            if (i == WARMUP_FRAMES) {
+                allocations_at_warmup = g_allocation_count.load();
+                bytes_at_warmup = g_allocated_bytes.load();
+            }
+            capture_time[i] = NowUs();
+            auto task = acquire(encode_pool.get());
+            task->type = kAudioTaskTypeEncodeToSendQueue;
+            task->timestamp = i;
+            if (use_pool) {
+                // ReadAudioData fills the pooled frame in place
+                FillPcm(task->pcm, INPUT_SAMPLES, i);
+            } else {
+                // The read buffer was a new vector moved into the task
+                std::vector<int16_t> data;
+                FillPcm(data, INPUT_SAMPLES, i);
+                task->pcm = std::move(data);
+            }
+            while (!encode_queue.Push(std::move(task))) {
+                input_wake.Take();
+            }
+            codec_wake.Give();
+        }
+    });
+
+    std::thread codec([&] {
+        std::vector<int16_t> decoded;
+        int64_t checksum = 0;
+        for (int i = 0; i < FRAME_COUNT;) {
+            AudioTaskPtr task;
+            if (!encode_queue.Pop(task)) {
+                codec_wake.Take();
+                continue;
+            }
+            input_wake.Give();
+            // Encoding reads the frame
+            for (auto sample : task->pcm) {
+                checksum += sample;
+            }
+            uint32_t timestamp = task->timestamp;
+            task.reset();
+
+            // Decoding the reply and resampling it to the output rate
+            auto reply = acquire(playback_pool.get());
+            reply->type = kAudioTaskTypeDecodeToPlaybackQueue;
+            reply->timestamp = timestamp;
+            if (use_pool) {
+                FillPcm(decoded, DECODED_SAMPLES, i);
+                FillPcm(reply->pcm, OUTPUT_SAMPLES, decoded[0]);
+            } else {
+                std::vector<int16_t> pcm;
+                FillPcm(pcm, DECODED_SAMPLES, i);
+                std::vector<int16_t> resampled;
+                FillPcm(resampled, OUTPUT_SAMPLES, pcm[0]);
+                reply->pcm = std::move(resampled);
+            }
+            while (!playback_queue.Push(std::move(reply))) {
+                codec_wake.Take();
+            }
+            output_wake.Give();
+            i++;
+        }
+        DoNotOptimize(checksum);
+    });
+
+    std::thread output([&] {
+        for (int i = 0; i < FRAME_COUNT;) {
+            AudioTaskPtr task;
+            if (!playback_queue.Pop(task)) {
+                output_wake.Take();
+                continue;
+            }
+            codec_wake.Give();
+            latency[task->timestamp] = NowUs() - capture_time[task->timestamp];
+            DoNotOptimize(task->pcm.size());
+            i++;
+        }
+    });
+
+    input.join();
+    codec.join();
+    output.join();
+
+    RunResult result;
+    result.allocations = g_allocation_count.load() - allocations_at_warmup.load();
+    result.allocated_bytes = g_allocated_bytes.load() - bytes_at_warmup.load();
+    for (int i = WARMUP_FRAMES; i < FRAME_COUNT; i++) {
+        result.latency.Add(latency[i]);
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    int speedup = argc > 1 ? std::max(1, atoi(argv[1])) : 10;
+    printf("%d frames of %d ms, paced %dx faster than real time\n", FRAME_COUNT, FRAME_DURATION_MS, speedup);
+
+    for (bool use_pool : {false, true}) {
+        auto result = Run(use_pool, speedup);
+        printf("%s: %zu allocations (%.1f per frame), %zu bytes\n", use_pool ? "frame pool" : "heap frames",
+            result.allocations, double(result.allocations) / (FRAME_COUNT - WARMUP_FRAMES), result.allocated_bytes);
+        result.latency.Print("capture to playback");
+        if (use_pool) {
+            CHECK(result.allocations == 0);
+        }
+    }
+    return 0;
+}
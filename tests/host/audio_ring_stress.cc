@@ -0,0 +1,256 @@
+/*
+ * Stress test of SpscRing, and the queue hop latency of the audio pipeline with the previous
+ * shared mutex design against the SPSC rings.
+ *
+ * The stress part checks FIFO order and ownership while Clear() races with both ends. The latency
+ * part runs the input, codec, output and sender tasks of AudioService as threads: with one mutex
+ * and one condition variable notified with notify_all for all the queues, as before, and with a
+ * ring per queue and a notification of the consuming task only.
+ *
+ * Usage: audio_ring_stress [frames] [period_us]
+ */
+#include "bench_util.h"
+#include "audio_ring.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#define MAX_ENCODE_TASKS_IN_QUEUE 2
+#define MAX_PLAYBACK_TASKS_IN_QUEUE 2
+#define MAX_SEND_PACKETS_IN_QUEUE 40
+
+static std::atomic<int> g_live_items{0};
+
+struct Item {
+    uint32_t sequence;
+    explicit Item(uint32_t sequence) : sequence(sequence) { g_live_items++; }
+    ~Item() { g_live_items--; }
+};
+
+static void StressOrder() {
+    SpscRing<uint32_t, 4> ring;
+    const uint32_t count = 2000000;
+    std::thread producer([&] {
+        for (uint32_t i = 0; i < count;) {
+            if (ring.Push(uint32_t(i))) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint32_t expected = 0, value;
+    while (expected < count) {
+        if (ring.Pop(value)) {
+            CHECK(value == expected);
+            expected++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(ring.Empty());
+    printf("FIFO order of %u items: ok\n", count);
+}
+
+static void StressClear() {
+    SpscRing<std::unique_ptr<Item>, 8> ring;
+    const uint32_t count = 1000000;
+    std::atomic<bool> done{false};
+    std::thread producer([&] {
+        for (uint32_t i = 0; i < count;) {
+            if (ring.Push(std::make_unique<Item>(i))) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        done = true;
+    });
+    std::thread clearer([&] {
+        while (!done) {
+            ring.Clear();
+            CHECK(ring.Size() <= 8);
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    });
+    uint32_t popped = 0;
+    int64_t last = -1;
+    std::unique_ptr<Item> item;
+    while (!done || !ring.Empty()) {
+        if (ring.Pop(item)) {
+            // Clear() drops items, the survivors keep their order
+            CHECK(int64_t(item->sequence) > last);
+            last = item->sequence;
+            popped++;
+            item.reset();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    clearer.join();
+    while (ring.Pop(item)) {
+        item.reset();
+    }
+    CHECK(g_live_items == 0);
+    printf("Clear() racing both ends, %u items, %u popped: ok\n", count, popped);
+}
+
+struct Frame {
+    uint32_t sequence;
+    int64_t pushed_us;
+};
+
+struct HopStats {
+    LatencyStats encode, playback, send;
+};
+
+// Before: five deques behind one mutex, every push and pop wakes all the tasks
+class SharedQueues {
+public:
+    HopStats Run(uint32_t frames, int64_t period_us) {
+        HopStats stats;
+        std::thread codec([&] { CodecTask(frames); });
+        std::thread output([&] { Consume(playback_, frames, stats.playback); });
+        std::thread sender([&] { Consume(send_, frames, stats.send); });
+        int64_t next = NowUs();
+        for (uint32_t i = 0; i < frames; i++) {
+            SleepUntilUs(next += period_us);
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return encode_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
+            encode_.push_back(Frame{i, NowUs()});
+            cv_.notify_all();
+        }
+        codec.join();
+        output.join();
+        sender.join();
+        stats.encode = std::move(encode_stats_);
+        return stats;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Frame> encode_, playback_, send_;
+    LatencyStats encode_stats_;
+
+    void CodecTask(uint32_t frames) {
+        for (uint32_t i = 0; i < frames; i++) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return !encode_.empty(); });
+            Frame frame = encode_.front();
+            encode_.pop_front();
+            encode_stats_.Add(NowUs() - frame.pushed_us);
+            cv_.notify_all();
+            cv_.wait(lock, [this] {
+                return playback_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE && send_.size() < MAX_SEND_PACKETS_IN_QUEUE;
+            });
+            send_.push_back(Frame{frame.sequence, NowUs()});
+            playback_.push_back(Frame{frame.sequence, NowUs()});
+            cv_.notify_all();
+        }
+    }
+
+    void Consume(std::deque<Frame>& queue, uint32_t frames, LatencyStats& stats) {
+        for (uint32_t i = 0; i < frames; i++) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [&queue] { return !queue.empty(); });
+            Frame frame = queue.front();
+            queue.pop_front();
+            stats.Add(NowUs() - frame.pushed_us);
+            CHECK(frame.sequence == i);
+            cv_.notify_all();
+        }
+    }
+};
+
+// After: a ring per queue, a producer wakes only the consumer and a consumer only a blocked producer
+class RingQueues {
+public:
+    HopStats Run(uint32_t frames, int64_t period_us) {
+        HopStats stats;
+        std::thread codec([&] { CodecTask(frames, stats.encode); });
+        std::thread output([&] { Consume(playback_, output_wake_, frames, stats.playback); });
+        std::thread sender([&] { Consume(send_, sender_wake_, frames, stats.send); });
+        int64_t next = NowUs();
+        for (uint32_t i = 0; i < frames; i++) {
+            SleepUntilUs(next += period_us);
+            while (!encode_.Push(Frame{i, NowUs()})) {
+                input_wake_.Take();
+            }
+            codec_wake_.Give();
+        }
+        codec.join();
+        output.join();
+        sender.join();
+        return stats;
+    }
+
+private:
+    SpscRing<Frame, MAX_ENCODE_TASKS_IN_QUEUE> encode_;
+    SpscRing<Frame, MAX_PLAYBACK_TASKS_IN_QUEUE> playback_;
+    SpscRing<Frame, MAX_SEND_PACKETS_IN_QUEUE> send_;
+    Notifier input_wake_, codec_wake_, output_wake_, sender_wake_;
+
+    void CodecTask(uint32_t frames, LatencyStats& stats) {
+        for (uint32_t i = 0; i < frames;) {
+            Frame frame;
+            if (!encode_.Pop(frame)) {
+                codec_wake_.Take();
+                continue;
+            }
+            stats.Add(NowUs() - frame.pushed_us);
+            input_wake_.Give();
+            while (send_.Full() || playback_.Full()) {
+                codec_wake_.Take();
+            }
+            send_.Push(Frame{frame.sequence, NowUs()});
+            sender_wake_.Give();
+            playback_.Push(Frame{frame.sequence, NowUs()});
+            output_wake_.Give();
+            i++;
+        }
+    }
+
+    template <typename Ring>
+    void Consume(Ring& ring, Notifier& wake, uint32_t frames, LatencyStats& stats) {
+        for (uint32_t i = 0; i < frames;) {
+            Frame frame;
+            if (!ring.Pop(frame)) {
+                wake.Take();
+                continue;
+            }
+            stats.Add(NowUs() - frame.pushed_us);
+            CHECK(frame.sequence == i);
+            codec_wake_.Give();
+            i++;
+        }
+    }
+};
+
+static void PrintHops(const char* name, HopStats& stats) {
+    printf("%s\n", name);
+    for (auto [hop, hop_stats] : {std::pair<const char*, LatencyStats*>{"encode queue", &stats.encode},
+            {"playback queue", &stats.playback}, {"send queue", &stats.send}}) {
+        hop_stats->Print(hop);
+        hop_stats->PrintHistogram();
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t frames = argc > 1 ? atoi(argv[1]) : 20000;
+    int64_t period_us = argc > 2 ? atoi(argv[2]) : 250;
+
+    StressOrder();
+    StressClear();
+
+    printf("Queue hop latency, %u frames every %lld us\n", frames, (long long)period_us);
+    auto shared = SharedQueues().Run(frames, period_us);
+    PrintHops("shared mutex + notify_all", shared);
+    auto rings = RingQueues().Run(frames, period_us);
+    PrintHops("SPSC rings + task notification", rings);
+    return 0;
+}
@@ -0,0 +1,108 @@
+// Helpers shared by the host benchmarks
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+inline int64_t NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void SleepUntilUs(int64_t us) {
+    std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::microseconds(us)));
+}
+
+// Average nanoseconds per call of f, the best of `runs` runs to keep the noise of a shared host out
+template <typename F>
+double TimePerCallNs(F&& f, int iterations, int runs = 5) {
+    double best = 1e30;
+    for (int run = 0; run < runs; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            f();
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, std::chrono::duration<double, std::nano>(elapsed).count() / iterations);
+    }
+    return best;
+}
+
+// Keeps the result of a benchmarked expression alive
+inline void DoNotOptimize(size_t value) {
+    static volatile size_t sink;
+    sink = sink + value;
+}
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+        exit(1); \
+    } \
+} while (0)
+
+// Stands in for xTaskNotifyGive / ulTaskNotifyTake
+class Notifier {
+public:
+    void Give() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        count_++;
+        cv_.notify_one();
+    }
+    void Take() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return count_ > 0; });
+        count_ = 0;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int count_ = 0;
+};
+
+// Latency samples in microseconds with percentiles and a fixed-bucket histogram
+class LatencyStats {
+public:
+    void Add(int64_t us) { samples_.push_back(us); }
+    size_t count() const { return samples_.size(); }
+
+    int64_t Percentile(int percent) {
+        if (samples_.empty()) {
+            return 0;
+        }
+        std::sort(samples_.begin(), samples_.end());
+        size_t index = (samples_.size() * percent + 99) / 100;
+        return samples_[std::min(index > 0 ? index - 1 : 0, samples_.size() - 1)];
+    }
+
+    void Print(const char* name) {
+        printf("  %-24s n=%-6zu p50 %6lld us  p90 %6lld us  p99 %6lld us  max %6lld us\n", name, samples_.size(),
+            (long long)Percentile(50), (long long)Percentile(90), (long long)Percentile(99), (long long)Percentile(100));
+    }
+
+    void PrintHistogram() {
+        static const int64_t bounds_us[] = {10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000};
+        size_t begin = 0;
+        std::sort(samples_.begin(), samples_.end());
+        printf("   ");
+        for (int64_t bound : bounds_us) {
+            size_t end = std::upper_bound(samples_.begin(), samples_.end(), bound) - samples_.begin();
+            printf(" <=%lldus:%zu", (long long)bound, end - begin);
+            begin = end;
+        }
+        printf(" more:%zu\n", samples_.size() - begin);
+    }
+
+private:
+    std::vector<int64_t> samples_;
+};
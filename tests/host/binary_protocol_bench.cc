@@ -0,0 +1,194 @@
+/*
+ * Serialize and parse of the WebSocket binary audio frames for protocol versions 1, 2 and 3, with
+ * the former per-packet vector and string against the in-place framing and the payload pool.
+ *
+ * Serialize covers the encoder output buffer up to the frame handed to the websocket, parse covers
+ * the received frame up to the packet released by the decoder. Both report the time and the heap
+ * allocations per packet. The framing is first checked to round trip and to reject bad frames.
+ *
+ * Usage: binary_protocol_bench [opus_bytes]
+ */
+#include "alloc_counter.h"
+#include "bench_util.h"
+#include "protocol.h"
+#include "audio_payload_pool.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#define ITERATIONS 1000000
+// The encoder output buffer of a 16 kbps 60 ms packet, see OpusUplinkEncoder::Encode
+#define ENCODER_MAX_BYTES (16000 / 8 * 60 / 1000 * 2 + 64)
+
+static void CheckFraming(int version) {
+    std::vector<uint8_t> opus(100);
+    for (size_t i = 0; i < opus.size(); i++) {
+        opus[i] = i * 7;
+    }
+    // Packets with and without headroom, the latter get it on demand
+    for (size_t headroom : {size_t(0), size_t(AUDIO_PACKET_HEADROOM)}) {
+        AudioStreamPacket packet;
+        packet.timestamp = 123456;
+        packet.headroom = headroom;
+        packet.payload.assign(headroom, 0);
+        packet.payload.insert(packet.payload.end(), opus.begin(), opus.end());
+        auto frame = WriteBinaryHeader(version, packet);
+        size_t frame_size = GetBinaryHeaderSize(version) + packet.opus_size();
+        CHECK(packet.opus_size() == opus.size());
+
+        const uint8_t* payload;
+        size_t payload_size;
+        uint32_t timestamp;
+        CHECK(ParseBinaryFrame(version, frame, frame_size, payload, payload_size, timestamp));
+        CHECK(payload_size == opus.size() && memcmp(payload, opus.data(), opus.size()) == 0);
+        CHECK(timestamp == (version == 2 ? 123456u : 0u));
+        if (version != 1) {
+            // A truncated frame, and a header claiming more than the frame holds
+            CHECK(!ParseBinaryFrame(version, frame, GetBinaryHeaderSize(version) - 1, payload, payload_size, timestamp));
+            CHECK(!ParseBinaryFrame(version, frame, frame_size - 1, payload, payload_size, timestamp));
+        }
+    }
+}
+
+struct Result {
+    double ns;
+    double allocations;
+};
+
+template <typename F>
+static Result Measure(F&& f) {
+    f();
+    size_t allocations = g_allocation_count.load();
+    f();
+    allocations = g_allocation_count.load() - allocations;
+    return Result{TimePerCallNs(f, ITERATIONS, 3), double(allocations)};
+}
+
+// Before: the encoder returned a new vector, versions 2 and 3 copied it behind the header into a string
+static size_t SerializeBefore(int version, const std::vector<uint8_t>& encoded) {
+    auto packet = std::make_unique<AudioStreamPacket>();
+    auto& payload = packet->payload;
+    payload.resize(ENCODER_MAX_BYTES);
+    memcpy(payload.data(), encoded.data(), encoded.size());
+    payload.resize(encoded.size());
+    if (version == 2) {
+        std::string serialized;
+        serialized.resize(sizeof(BinaryProtocol2) + payload.size());
+        auto bp2 = (BinaryProtocol2*)serialized.data();
+        bp2->version = htons(version);
+        bp2->type = 0;
+        bp2->reserved = 0;
+        bp2->timestamp = htonl(1);
+        bp2->payload_size = htonl(payload.size());
+        memcpy(bp2->payload, payload.data(), payload.size());
+        return serialized.size();
+    } else if (version == 3) {
+        std::string serialized;
+        serialized.resize(sizeof(BinaryProtocol3) + payload.size());
+        auto bp3 = (BinaryProtocol3*)serialized.data();
+        bp3->type = 0;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(payload.size());
+        memcpy(bp3->payload, payload.data(), payload.size());
+        return serialized.size();
+    }
+    return payload.size();
+}
+
+// After: the encoder writes behind the headroom of a pooled buffer, the header goes in front of it
+static size_t SerializeAfter(int version, const std::vector<uint8_t>& encoded) {
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->headroom = AUDIO_PACKET_HEADROOM;
+    packet->payload = AudioPayloadPool::GetInstance().Acquire(AUDIO_PACKET_HEADROOM + ENCODER_MAX_BYTES);
+    packet->payload.resize(AUDIO_PACKET_HEADROOM + ENCODER_MAX_BYTES);
+    memcpy(packet->payload.data() + AUDIO_PACKET_HEADROOM, encoded.data(), encoded.size());
+    packet->payload.resize(AUDIO_PACKET_HEADROOM + encoded.size());
+    auto frame = WriteBinaryHeader(version, *packet);
+    size_t frame_size = GetBinaryHeaderSize(version) + packet->opus_size();
+    DoNotOptimize(reinterpret_cast<size_t>(frame));
+    AudioPayloadPool::GetInstance().Release(std::move(packet->payload));
+    return frame_size;
+}
+
+// Before: the header was decoded in place and the payload copied into a new vector
+static size_t ParseBefore(int version, std::vector<uint8_t>& frame) {
+    std::unique_ptr<AudioStreamPacket> packet;
+    if (version == 2) {
+        BinaryProtocol2* bp2 = (BinaryProtocol2*)frame.data();
+        auto payload = bp2->payload;
+        packet = std::make_unique<AudioStreamPacket>(AudioStreamPacket{
+            .timestamp = ntohl(bp2->timestamp),
+            .payload = std::vector<uint8_t>(payload, payload + ntohl(bp2->payload_size))
+        });
+    } else if (version == 3) {
+        BinaryProtocol3* bp3 = (BinaryProtocol3*)frame.data();
+        auto payload = bp3->payload;
+        packet = std::make_unique<AudioStreamPacket>(AudioStreamPacket{
+            .payload = std::vector<uint8_t>(payload, payload + ntohs(bp3->payload_size))
+        });
+    } else {
+        packet = std::make_unique<AudioStreamPacket>(AudioStreamPacket{
+            .payload = std::vector<uint8_t>(frame.begin(), frame.end())
+        });
+    }
+    return packet->payload.size();
+}
+
+// After: the frame is validated without being changed and the payload copied into a pooled buffer
+static size_t ParseAfter(int version, const std::vector<uint8_t>& frame) {
+    const uint8_t* payload;
+    size_t payload_size;
+    uint32_t timestamp;
+    if (!ParseBinaryFrame(version, frame.data(), frame.size(), payload, payload_size, timestamp)) {
+        return 0;
+    }
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->timestamp = timestamp;
+    packet->payload = AudioPayloadPool::GetInstance().Acquire(payload_size);
+    packet->payload.assign(payload, payload + payload_size);
+    size_t size = packet->payload.size();
+    // The decoder releases it
+    AudioPayloadPool::GetInstance().Release(std::move(packet->payload));
+    return size;
+}
+
+int main(int argc, char** argv) {
+    size_t opus_bytes = argc > 1 ? atoi(argv[1]) : 120;
+    if (opus_bytes == 0 || opus_bytes > ENCODER_MAX_BYTES) {
+        fprintf(stderr, "opus_bytes must be 1 to %d\n", ENCODER_MAX_BYTES);
+        return 1;
+    }
+    std::vector<uint8_t> encoded(opus_bytes, 0x5a);
+
+    for (int version = 1; version <= 3; version++) {
+        CheckFraming(version);
+    }
+    printf("Framing round trip and malformed frames: ok\n");
+
+    printf("%zu byte Opus packets, per packet:\n", opus_bytes);
+    for (int version = 1; version <= 3; version++) {
+        AudioStreamPacket packet;
+        packet.payload = encoded;
+        auto frame_start = WriteBinaryHeader(version, packet);
+        std::vector<uint8_t> frame(frame_start, frame_start + GetBinaryHeaderSize(version) + packet.opus_size());
+        std::vector<uint8_t> received = frame;
+
+        auto serialize_before = Measure([&] { DoNotOptimize(SerializeBefore(version, encoded)); });
+        auto serialize_after = Measure([&] { DoNotOptimize(SerializeAfter(version, encoded)); });
+        auto parse_before = Measure([&] {
+            // The old parser converted the header in place, so it works on a fresh copy of the frame
+            memcpy(received.data(), frame.data(), frame.size());
+            DoNotOptimize(ParseBefore(version, received));
+        });
+        auto parse_after = Measure([&] {
+            memcpy(received.data(), frame.data(), frame.size());
+            DoNotOptimize(ParseAfter(version, received));
+        });
+        printf("  v%d serialize %5.1f -> %5.1f ns, %.0f -> %.0f allocs; parse %5.1f -> %5.1f ns, %.0f -> %.0f allocs\n",
+            version, serialize_before.ns, serialize_after.ns, serialize_before.allocations, serialize_after.allocations,
+            parse_before.ns, parse_after.ns, parse_before.allocations, parse_after.allocations);
+    }
+    return 0;
+}
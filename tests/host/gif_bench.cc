@@ -0,0 +1,176 @@
+/*
+ * The GIF emoji decoding of LvglGif: the former ARGB8888 canvas, redrawn whole on every frame,
+ * against the RGB565 (or RGB565 plus A8) canvas that LVGL draws without converting, redrawn only
+ * in the area the frame changed, and against replaying the cached first loop.
+ *
+ * Every frame of the RGB565 canvas is first checked against the ARGB8888 canvas converted to
+ * RGB565, and the cached replay against decoding the second loop.
+ *
+ * Usage: gif_bench [file.gif...], the GIFs of make_emoji_gifs.py in build/gifs by default
+ */
+#include "bench_util.h"
+#include "gifdec.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#define ITERATIONS 20000
+#define CHECKED_FRAMES 100
+
+static const char* kDefaultGifs[] = {
+    "build/gifs/emoji_64_opaque.gif",
+    "build/gifs/emoji_64.gif",
+    "build/gifs/emoji_160.gif",
+    "build/gifs/emoji_240_opaque.gif",
+};
+
+struct CachedFrame {
+    std::vector<uint8_t> canvas;
+    int x, y, width, height;
+};
+
+static std::vector<char> Load(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), {});
+}
+
+static void NextFrame(gd_GIF* gif) {
+    if (gd_get_frame(gif) == 0) {
+        gd_rewind(gif);
+    }
+    gd_render_frame(gif, gif->canvas);
+}
+
+static const char* FormatName(uint8_t cf) {
+    return cf == GD_CF_ARGB8888 ? "ARGB8888" : (cf == GD_CF_RGB565 ? "RGB565" : "RGB565A8");
+}
+
+// Bytes per pixel LVGL reads to draw the canvas
+static int PixelSize(uint8_t cf) {
+    return cf == GD_CF_ARGB8888 ? 4 : (cf == GD_CF_RGB565 ? 2 : 3);
+}
+
+static void CheckCanvas(const std::vector<char>& data) {
+    gd_GIF* reference = gd_open_gif_data_cf(data.data(), GD_CF_ARGB8888);
+    gd_GIF* gif = gd_open_gif_data_cf(data.data(), GD_CF_RGB565A8);
+    CHECK(reference != nullptr && gif != nullptr);
+    int pixels = gif->width * gif->height;
+    for (int frame = 0; frame < CHECKED_FRAMES; frame++) {
+        NextFrame(reference);
+        NextFrame(gif);
+        for (int i = 0; i < pixels; i++) {
+            // B G R A
+            const uint8_t* argb = reference->canvas + i * 4;
+            uint16_t expected = ((argb[2] & 0xF8) << 8) | ((argb[1] & 0xFC) << 3) | (argb[0] >> 3);
+            uint16_t rgb565 = reinterpret_cast<uint16_t*>(gif->canvas)[i];
+            if (gif->cf == GD_CF_RGB565A8) {
+                CHECK(gif->canvas[pixels * 2 + i] == argb[3]);
+                CHECK(argb[3] == 0 || rgb565 == expected);
+            } else {
+                CHECK(argb[3] == 0xFF && rgb565 == expected);
+            }
+        }
+    }
+    gd_close_gif(reference);
+    gd_close_gif(gif);
+}
+
+// The frames of the first loop, as LvglGif caches them
+static std::vector<CachedFrame> CacheFirstLoop(gd_GIF* gif) {
+    std::vector<CachedFrame> frames;
+    gd_rewind(gif);
+    uint32_t loops = gif->loops;
+    while (true) {
+        NextFrame(gif);
+        if (gif->loops != loops) {
+            return frames;
+        }
+        frames.push_back({ std::vector<uint8_t>(gif->canvas, gif->canvas + gif->canvas_size),
+            gif->dx, gif->dy, gif->dw, gif->dh });
+    }
+}
+
+// LvglGif::NextCachedFrame into canvas, returns the bytes copied
+static size_t ReplayFrame(const gd_GIF* gif, uint8_t* canvas, const std::vector<CachedFrame>& frames, size_t index) {
+    auto& frame = frames[index];
+    if (index == 0) {
+        memcpy(canvas, frame.canvas.data(), gif->canvas_size);
+        return gif->canvas_size;
+    }
+    size_t pixel_size = gif->cf == GD_CF_ARGB8888 ? 4 : 2;
+    size_t alpha_plane = (size_t)gif->width * gif->height * 2;
+    size_t copied = 0;
+    for (int y = frame.y; y < frame.y + frame.height; y++) {
+        size_t i = (size_t)y * gif->width + frame.x;
+        memcpy(canvas + i * pixel_size, frame.canvas.data() + i * pixel_size, frame.width * pixel_size);
+        copied += frame.width * pixel_size;
+        if (gif->cf == GD_CF_RGB565A8) {
+            memcpy(canvas + alpha_plane + i, frame.canvas.data() + alpha_plane + i, frame.width);
+            copied += frame.width;
+        }
+    }
+    return copied;
+}
+
+static void Measure(const char* path, const std::vector<char>& data, uint8_t requested_cf) {
+    gd_GIF* gif = gd_open_gif_data_cf(data.data(), requested_cf);
+    CHECK(gif != nullptr);
+    size_t canvas_bytes = (size_t)gif->width * gif->height * PixelSize(gif->cf);
+
+    double decode_ns = TimePerCallNs([&] { NextFrame(gif); }, ITERATIONS);
+    // The former canvas was invalidated whole, now only the changed area is
+    double redrawn = 0;
+    gd_rewind(gif);
+    for (int i = 0; i < ITERATIONS; i++) {
+        NextFrame(gif);
+        redrawn += gif->cf == GD_CF_ARGB8888 ? canvas_bytes : (double)gif->dw * gif->dh * PixelSize(gif->cf);
+    }
+    printf("%-32s %3dx%-3d %-9s decode %9.0f frames/s, %7.0f B/frame redrawn\n", path, gif->width, gif->height,
+        FormatName(gif->cf), 1e9 / decode_ns, redrawn / ITERATIONS);
+
+    if (gif->cf != GD_CF_ARGB8888) {
+        auto frames = CacheFirstLoop(gif);
+        CHECK(!frames.empty());
+        // The canvas is now the first frame of the second loop, replaying must match decoding it
+        CHECK(memcmp(gif->canvas, frames[0].canvas.data(), gif->canvas_size) == 0);
+        std::vector<uint8_t> replayed(gif->canvas, gif->canvas + gif->canvas_size);
+        for (size_t i = 1; i < frames.size(); i++) {
+            NextFrame(gif);
+            ReplayFrame(gif, replayed.data(), frames, i);
+            CHECK(memcmp(gif->canvas, replayed.data(), gif->canvas_size) == 0);
+        }
+
+        size_t index = 0;
+        double replay_ns = TimePerCallNs([&] {
+            index = (index + 1) % frames.size();
+            ReplayFrame(gif, replayed.data(), frames, index);
+        }, ITERATIONS);
+        double copied = 0;
+        for (int i = 0; i < ITERATIONS; i++) {
+            copied += ReplayFrame(gif, replayed.data(), frames, i % frames.size());
+        }
+        printf("%-32s %3dx%-3d %-9s cached %9.0f frames/s, %7.0f B/frame copied, %zu frames in %zu B\n", path,
+            gif->width, gif->height, FormatName(gif->cf), 1e9 / replay_ns, copied / ITERATIONS,
+            frames.size(), frames.size() * (size_t)gif->canvas_size);
+    }
+    gd_close_gif(gif);
+}
+
+int main(int argc, char** argv) {
+    std::vector<const char*> paths(argv + 1, argv + argc);
+    if (paths.empty()) {
+        paths.assign(std::begin(kDefaultGifs), std::end(kDefaultGifs));
+    }
+    for (auto path : paths) {
+        auto data = Load(path);
+        if (data.empty()) {
+            fprintf(stderr, "%s: cannot read, make builds the default GIFs with make_emoji_gifs.py\n", path);
+            return 1;
+        }
+        CheckCanvas(data);
+        Measure(path, data, GD_CF_ARGB8888);
+        Measure(path, data, GD_CF_RGB565A8);
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+// The FreeRTOS task calls of stubs/freertos/task.h over std::thread
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static std::atomic<int> g_failing_task_creates{0};
+static std::atomic<int> g_running_tasks{0};
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth, void* arg, UBaseType_t priority,
+    TaskHandle_t* handle) {
+    if (g_failing_task_creates.load() > 0 && g_failing_task_creates.fetch_sub(1) > 0) {
+        return pdFAIL;
+    }
+    g_running_tasks++;
+    std::thread([function, arg] {
+        function(arg);
+        g_running_tasks--;
+    }).detach();
+    if (handle != nullptr) {
+        *handle = nullptr;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    // The task function returns right after, which ends the thread
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    return 1;
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority) {
+}
+
+void HostFailTaskCreate(int count) {
+    g_failing_task_creates = count;
+}
+
+int HostRunningTaskCount() {
+    return g_running_tasks.load();
+}
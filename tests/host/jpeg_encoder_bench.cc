@@ -0,0 +1,243 @@
+/*
+ * The camera frame encoding of image_to_jpeg_cb at quality 80, against libjpeg encoding the same
+ * pixels: time per frame, JPEG size and PSNR of the decoded frame, for 320x240 and 640x480 frames
+ * in RGB565 and YUV422.
+ *
+ * The output is first checked to decode with libjpeg to the frame size for every supported format
+ * at sizes that are not a multiple of the MCU, to stay within 1 dB of libjpeg, and unsupported
+ * formats to fail.
+ */
+#include "bench_util.h"
+#include "image_to_jpeg.h"
+
+#include <cmath>
+#include <cstring>
+#include <jpeglib.h>
+
+#define QUALITY 80
+#define ITERATIONS 20
+
+struct FrameFormat {
+    pixformat_t format;
+    const char* name;
+};
+
+static size_t Collect(void* arg, size_t index, const void* data, size_t len) {
+    auto output = static_cast<std::vector<uint8_t>*>(arg);
+    output->insert(output->end(), (const uint8_t*)data, (const uint8_t*)data + len);
+    return len;
+}
+
+static uint8_t Clamp(float value) {
+    return (uint8_t)std::fmin(255, std::fmax(0, std::lround(value)));
+}
+
+// A camera-like frame: gradients, soft shapes, fine texture and sensor noise, in 8-bit RGB
+static std::vector<uint8_t> MakeFrame(int width, int height) {
+    std::vector<uint8_t> rgb(width * height * 3);
+    uint32_t seed = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float fx = (float)x / width, fy = (float)y / height;
+            float r = 60 + 120 * fx + 40 * std::sin(fy * 9);
+            float g = 80 + 100 * fy + 30 * std::sin((fx + fy) * 14);
+            float b = 140 - 90 * fx * fy;
+            float dx = fx - 0.35f, dy = fy - 0.5f;
+            if (dx * dx + dy * dy < 0.04f) {
+                r = 220;
+                g = 180 + 20 * std::sin(x * 0.8f);
+                b = 60;
+            }
+            dx = fx - 0.75f;
+            dy = fy - 0.3f;
+            if (std::fabs(dx) < 0.12f && std::fabs(dy) < 0.15f) {
+                float t = ((x / 4 + y / 4) & 1) ? 30 : -30;
+                r = 90 + t;
+                g = 90 + t;
+                b = 200 + t;
+            }
+            seed = seed * 1664525 + 1013904223;
+            float noise = ((seed >> 24) & 15) - 7.5f;
+            uint8_t* p = &rgb[(y * width + x) * 3];
+            p[0] = Clamp(r + noise);
+            p[1] = Clamp(g + noise);
+            p[2] = Clamp(b + noise);
+        }
+    }
+    return rgb;
+}
+
+// The frame in the camera format, and the RGB that format stands for
+static void ToFormat(const std::vector<uint8_t>& rgb, int width, int height, pixformat_t format,
+                     std::vector<uint8_t>& source, std::vector<uint8_t>& reference) {
+    int pixels = width * height;
+    reference.resize(pixels * 3);
+    if (format == PIXFORMAT_RGB565) {
+        // Big-endian, as the camera sends it
+        source.resize(pixels * 2);
+        for (int i = 0; i < pixels; i++) {
+            uint16_t v = (rgb[i * 3] >> 3) << 11 | (rgb[i * 3 + 1] >> 2) << 5 | rgb[i * 3 + 2] >> 3;
+            source[i * 2] = v >> 8;
+            source[i * 2 + 1] = v & 0xFF;
+            reference[i * 3] = (v >> 11) << 3;
+            reference[i * 3 + 1] = ((v >> 5) & 63) << 2;
+            reference[i * 3 + 2] = (v & 31) << 3;
+        }
+    } else if (format == PIXFORMAT_YUV422) {
+        // BT.601 limited range, Y0 U Y1 V
+        source.resize(pixels * 2);
+        for (int i = 0; i + 1 < pixels; i += 2) {
+            float y[2], u = 0, v = 0;
+            for (int k = 0; k < 2; k++) {
+                const uint8_t* p = &rgb[(i + k) * 3];
+                y[k] = 16 + 0.257f * p[0] + 0.504f * p[1] + 0.098f * p[2];
+                u += 128 - 0.148f * p[0] - 0.291f * p[1] + 0.439f * p[2];
+                v += 128 + 0.439f * p[0] - 0.368f * p[1] - 0.071f * p[2];
+            }
+            uint8_t y0 = Clamp(y[0]), y1 = Clamp(y[1]), cb = Clamp(u / 2), cr = Clamp(v / 2);
+            source[i * 2] = y0;
+            source[i * 2 + 1] = cb;
+            source[i * 2 + 2] = y1;
+            source[i * 2 + 3] = cr;
+            for (int k = 0; k < 2; k++) {
+                float c = (k ? y1 : y0) - 16, d = cb - 128, e = cr - 128;
+                reference[(i + k) * 3] = Clamp(1.164f * c + 1.596f * e);
+                reference[(i + k) * 3 + 1] = Clamp(1.164f * c - 0.392f * d - 0.813f * e);
+                reference[(i + k) * 3 + 2] = Clamp(1.164f * c + 2.017f * d);
+            }
+        }
+    } else if (format == PIXFORMAT_RGB888) {
+        // esp32-camera RGB888 is stored B G R
+        source.resize(pixels * 3);
+        for (int i = 0; i < pixels; i++) {
+            source[i * 3] = rgb[i * 3 + 2];
+            source[i * 3 + 1] = rgb[i * 3 + 1];
+            source[i * 3 + 2] = rgb[i * 3];
+        }
+        reference = rgb;
+    } else {
+        source.resize(pixels);
+        for (int i = 0; i < pixels; i++) {
+            source[i] = Clamp(0.299f * rgb[i * 3] + 0.587f * rgb[i * 3 + 1] + 0.114f * rgb[i * 3 + 2]);
+            memset(&reference[i * 3], source[i], 3);
+        }
+    }
+}
+
+static std::vector<uint8_t> LibjpegEncode(const std::vector<uint8_t>& rgb, int width, int height) {
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    unsigned char* buffer = nullptr;
+    unsigned long size = 0;
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    // 4:2:0 like image_to_jpeg
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, QUALITY, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = const_cast<uint8_t*>(&rgb[cinfo.next_scanline * width * 3]);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    std::vector<uint8_t> jpeg(buffer, buffer + size);
+    free(buffer);
+    return jpeg;
+}
+
+static std::vector<uint8_t> Decode(const std::vector<uint8_t>& jpeg, int width, int height) {
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg.data(), jpeg.size());
+    CHECK(jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK);
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.dct_method = JDCT_FLOAT;
+    jpeg_start_decompress(&cinfo);
+    CHECK((int)cinfo.output_width == width && (int)cinfo.output_height == height);
+    std::vector<uint8_t> rgb(width * height * 3);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = &rgb[cinfo.output_scanline * width * 3];
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return rgb;
+}
+
+static double Psnr(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+    double squared_error = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        double d = (double)a[i] - b[i];
+        squared_error += d * d;
+    }
+    double mse = squared_error / a.size();
+    return mse == 0 ? 99 : 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+static std::vector<uint8_t> Encode(std::vector<uint8_t>& source, int width, int height, pixformat_t format) {
+    std::vector<uint8_t> jpeg;
+    CHECK(image_to_jpeg_cb(source.data(), source.size(), width, height, format, QUALITY, Collect, &jpeg));
+    return jpeg;
+}
+
+static void CheckFormats() {
+    FrameFormat formats[] = {
+        { PIXFORMAT_GRAYSCALE, "GRAY8" },
+        { PIXFORMAT_RGB888, "RGB888" },
+        { PIXFORMAT_RGB565, "RGB565" },
+        { PIXFORMAT_YUV422, "YUV422" },
+    };
+    // Partial MCUs at the right and bottom edges, and frames smaller than one MCU
+    int sizes[][2] = { { 320, 240 }, { 322, 237 }, { 34, 9 }, { 2, 1 } };
+    for (auto& size : sizes) {
+        auto rgb = MakeFrame(size[0], size[1]);
+        for (auto& f : formats) {
+            std::vector<uint8_t> source, reference;
+            ToFormat(rgb, size[0], size[1], f.format, source, reference);
+            auto decoded = Decode(Encode(source, size[0], size[1], f.format), size[0], size[1]);
+            if (size[0] * size[1] >= 64 * 64) {
+                double psnr = Psnr(reference, decoded);
+                double libjpeg_psnr = Psnr(reference, Decode(LibjpegEncode(reference, size[0], size[1]), size[0], size[1]));
+                CHECK(psnr > libjpeg_psnr - 1);
+            }
+        }
+    }
+
+    // Logs the unsupported format
+    std::vector<uint8_t> source(64 * 64 * 2), jpeg;
+    CHECK(!image_to_jpeg_cb(source.data(), source.size(), 64, 64, PIXFORMAT_JPEG, QUALITY, Collect, &jpeg));
+    CHECK(!image_to_jpeg_cb(source.data(), source.size(), 64, 64, PIXFORMAT_YUV420, QUALITY, Collect, &jpeg));
+}
+
+int main() {
+    CheckFormats();
+
+    int sizes[][2] = { { 320, 240 }, { 640, 480 } };
+    FrameFormat formats[] = { { PIXFORMAT_RGB565, "RGB565" }, { PIXFORMAT_YUV422, "YUV422" } };
+    printf("%-8s %-7s | %10s %10s | %10s %10s | %10s %10s\n", "frame", "format", "encoder ms", "libjpeg ms",
+        "encoder KB", "libjpeg KB", "encoder dB", "libjpeg dB");
+    for (auto& size : sizes) {
+        int width = size[0], height = size[1];
+        auto rgb = MakeFrame(width, height);
+        for (auto& f : formats) {
+            std::vector<uint8_t> source, reference;
+            ToFormat(rgb, width, height, f.format, source, reference);
+            std::vector<uint8_t> jpeg, libjpeg;
+            double encoder_ns = TimePerCallNs([&] { jpeg = Encode(source, width, height, f.format); }, ITERATIONS);
+            // libjpeg is given the RGB the camera frame stands for, the conversion is not timed
+            double libjpeg_ns = TimePerCallNs([&] { libjpeg = LibjpegEncode(reference, width, height); }, ITERATIONS);
+            printf("%dx%-4d %-7s | %10.3f %10.3f | %10.1f %10.1f | %10.2f %10.2f\n", width, height, f.name,
+                encoder_ns / 1e6, libjpeg_ns / 1e6, jpeg.size() / 1024.0, libjpeg.size() / 1024.0,
+                Psnr(reference, Decode(jpeg, width, height)), Psnr(reference, Decode(libjpeg, width, height)));
+        }
+    }
+    return 0;
+}
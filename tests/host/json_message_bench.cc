@@ -0,0 +1,204 @@
+/*
+ * Dispatch of the server control messages, with the former cJSON tree and strcmp chain against the
+ * JsonMessage scanner and the switch on the type hash, over tts/stt/llm/mcp messages like the
+ * servers send them.
+ *
+ * Each round reads the fields the Application handlers read: the state and text of tts, the text of
+ * stt, the emotion of llm, and a tree of the payload of mcp. Before timing, the fields are checked
+ * to match cJSON on every sample, including escapes and surrogate pairs, and every truncation of
+ * every sample is checked to be rejected.
+ */
+#include "alloc_counter.h"
+#include "bench_util.h"
+#include "json_message.h"
+
+#include <cstring>
+#include <string>
+
+#define ITERATIONS 100000
+
+static const char* kSamples[] = {
+    R"({"type":"tts","state":"start","sample_rate":24000,"session_id":"a1b2c3d4-e5f6"})",
+    R"({"type":"tts","state":"sentence_start","text":"今天天气不错，适合出去走走。","session_id":"a1b2c3d4-e5f6"})",
+    R"({"type":"tts","state":"sentence_start","text":"Sure! A \"quote\", a tab\t, caf\u00e9 and \ud83d\ude00 escaped, 😀 not.","session_id":"a1b2c3d4-e5f6"})",
+    R"({"type":"tts","state":"stop","session_id":"a1b2c3d4-e5f6"})",
+    R"({ "type" : "stt", "text" : "今天天气怎么样", "session_id" : "a1b2c3d4-e5f6" })",
+    R"({"type":"llm","text":"😊","emotion":"happy","session_id":"a1b2c3d4-e5f6"})",
+    R"({"session_id":"a1b2c3d4-e5f6","type":"mcp","payload":{"jsonrpc":"2.0","id":3,"method":"tools/call","params":{"name":"self.audio_speaker.set_volume","arguments":{"volume":60}}}})",
+    R"({"type":"mcp","payload":{"jsonrpc":"2.0","id":1,"method":"initialize","params":{"protocolVersion":"2024-11-05","capabilities":{"vision":{"url":"http://example.com/vision","token":"t[o]k{e}n"}},"clientInfo":{"name":"server","version":"1.0"}}},"session_id":"a1b2c3d4-e5f6"})",
+};
+
+struct Fields {
+    std::string type;
+    std::string state;
+    std::string text;
+    std::string emotion;
+    std::string payload;
+};
+
+static void PrintTree(cJSON* tree, std::string& out) {
+    char* printed = cJSON_PrintUnformatted(tree);
+    out = printed;
+    cJSON_free(printed);
+}
+
+static void GetString(const cJSON* root, const char* key, std::string& value) {
+    auto item = cJSON_GetObjectItem(root, key);
+    if (cJSON_IsString(item)) {
+        value = item->valuestring;
+    }
+}
+
+// Before: the whole message became a tree, the type was compared against each handled type in turn
+static void DispatchTree(const std::string& text, Fields* fields) {
+    cJSON* root = cJSON_Parse(text.c_str());
+    if (root == nullptr) {
+        return;
+    }
+    std::string state, message, emotion;
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (strcmp(type->valuestring, "tts") == 0) {
+        GetString(root, "state", state);
+        if (state == "sentence_start") {
+            GetString(root, "text", message);
+        }
+    } else if (strcmp(type->valuestring, "stt") == 0) {
+        GetString(root, "text", message);
+    } else if (strcmp(type->valuestring, "llm") == 0) {
+        GetString(root, "emotion", emotion);
+    } else if (strcmp(type->valuestring, "mcp") == 0) {
+        auto payload = cJSON_GetObjectItem(root, "payload");
+        if (cJSON_IsObject(payload)) {
+            DoNotOptimize(reinterpret_cast<size_t>(payload->child));
+            if (fields != nullptr) {
+                PrintTree(payload, fields->payload);
+            }
+        }
+    }
+    if (fields != nullptr) {
+        fields->type = type->valuestring;
+        fields->state = state;
+        fields->text = message;
+        fields->emotion = emotion;
+    }
+    DoNotOptimize(message.size() + emotion.size());
+    cJSON_Delete(root);
+}
+
+// After: the top level is scanned in place, only the mcp payload becomes a tree
+static void DispatchScan(const std::string& text, Fields* fields) {
+    JsonMessage message;
+    if (!message.Parse(text)) {
+        return;
+    }
+    std::string_view state;
+    std::string content, emotion;
+    switch (message.type_hash()) {
+    case JsonTypeHash("tts"):
+        if (!message.IsType("tts")) {
+            break;
+        }
+        state = message.GetStringView("state");
+        if (state == "sentence_start") {
+            message.GetString("text", content);
+        }
+        break;
+    case JsonTypeHash("stt"):
+        if (!message.IsType("stt")) {
+            break;
+        }
+        message.GetString("text", content);
+        break;
+    case JsonTypeHash("llm"):
+        if (!message.IsType("llm")) {
+            break;
+        }
+        message.GetString("emotion", emotion);
+        break;
+    case JsonTypeHash("mcp"):
+        if (!message.IsType("mcp")) {
+            break;
+        }
+        if (message.IsObject("payload")) {
+            auto payload = message.ParseMember("payload");
+            if (payload != nullptr) {
+                DoNotOptimize(reinterpret_cast<size_t>(payload->child));
+                if (fields != nullptr) {
+                    PrintTree(payload, fields->payload);
+                }
+                cJSON_Delete(payload);
+            }
+        }
+        break;
+    }
+    if (fields != nullptr) {
+        fields->type = message.type();
+        fields->state = state;
+        fields->text = content;
+        fields->emotion = emotion;
+    }
+    DoNotOptimize(content.size() + emotion.size());
+}
+
+static void CheckSample(const std::string& text) {
+    Fields tree, scan;
+    DispatchTree(text, &tree);
+    DispatchScan(text, &scan);
+    CHECK(!tree.type.empty());
+    CHECK(tree.type == scan.type && tree.state == scan.state && tree.text == scan.text);
+    CHECK(tree.emotion == scan.emotion && tree.payload == scan.payload);
+
+    JsonMessage message;
+    for (size_t size = 0; size < text.size(); size++) {
+        CHECK(!message.Parse(std::string_view(text.data(), size)));
+    }
+}
+
+// cJSON allocates with malloc, route it through the counter too
+static void* CountingMalloc(size_t size) {
+    g_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    return malloc(size);
+}
+
+template <typename F>
+static void Measure(const std::string& sample, F&& dispatch, double& ns, size_t& allocations) {
+    allocations = g_allocation_count.load();
+    dispatch(sample, nullptr);
+    allocations = g_allocation_count.load() - allocations;
+    ns = TimePerCallNs([&] { dispatch(sample, nullptr); }, ITERATIONS);
+}
+
+int main() {
+    cJSON_Hooks hooks = {CountingMalloc, free};
+    cJSON_InitHooks(&hooks);
+
+    std::vector<std::string> samples(std::begin(kSamples), std::end(kSamples));
+    for (auto& sample : samples) {
+        CheckSample(sample);
+    }
+    // An unhandled type with the hash of a handled one does not run its handler
+    static_assert(JsonTypeHash("phjrngl") == JsonTypeHash("tts"));
+    Fields collided;
+    DispatchScan(R"({"type":"phjrngl","state":"sentence_start","text":"hi"})", &collided);
+    CHECK(collided.type == "phjrngl" && collided.state.empty() && collided.text.empty());
+    printf("%zu messages: fields match cJSON, truncated messages rejected, hash collisions ignored\n", samples.size());
+
+    printf("Per message, cJSON tree parse -> JsonMessage scan:\n");
+    double tree_total = 0, scan_total = 0;
+    for (auto& sample : samples) {
+        Fields fields;
+        DispatchScan(sample, &fields);
+        double tree_ns, scan_ns;
+        size_t tree_allocations, scan_allocations;
+        Measure(sample, DispatchTree, tree_ns, tree_allocations);
+        Measure(sample, DispatchScan, scan_ns, scan_allocations);
+        tree_total += tree_ns;
+        scan_total += scan_ns;
+        std::string name = fields.type + (fields.state.empty() ? "" : " " + fields.state);
+        printf("  %-20s %4zu bytes: %6.0f -> %5.0f ns, %2zu -> %zu allocs\n", name.c_str(), sample.size(), tree_ns, scan_ns,
+            tree_allocations, scan_allocations);
+    }
+    printf("  mean: %.0f -> %.0f ns\n", tree_total / samples.size(), scan_total / samples.size());
+    return 0;
+}
@@ -0,0 +1,55 @@
+'''
+  Writes the chunked assets containers assets_table_test updates between, with pack() of
+  scripts/spiffs_assets/assets_container.py, as build.py --chunked makes them.
+
+  v1.bin  the first download, neutral.gif has the content of happy.gif
+  v2.bin  index.json and sad.gif changed, angry.gif and cry.gif added with the same content,
+          the three new contents on consecutive sectors of the package
+  v3.bin  three small assets changed on consecutive sectors, fit in the holes v2 leaves only
+          one by one
+  v4.bin  v3 and one more small asset, which does not fit
+
+  python make_assets_containers.py build/assets
+'''
+import os
+import random
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '../../scripts/spiffs_assets'))
+from assets_container import pack  # noqa: E402
+
+
+def content(seed, size):
+    return random.Random(seed).randbytes(size)
+
+
+def main():
+    directory = sys.argv[1] if len(sys.argv) > 1 else '.'
+    os.makedirs(directory, exist_ok=True)
+    index = ('index.json', content(1, 300), 0, 0)
+    font = ('font.bin', content(2, 9000), 0, 0)
+    happy = ('happy.gif', content(3, 5000), 64, 64)
+    neutral = ('neutral.gif', happy[1], 64, 64)
+    sad = ('sad.gif', content(4, 5000), 64, 64)
+    wake = ('wake.wav', content(5, 3000), 0, 0)
+    v1 = [index, font, happy, neutral, sad, wake]
+
+    index = ('index.json', content(6, 310), 0, 0)
+    sad = ('sad.gif', content(7, 5200), 64, 64)
+    angry = ('angry.gif', content(8, 4000), 64, 64)
+    cry = ('cry.gif', angry[1], 64, 64)
+    v2 = [font, happy, neutral, index, sad, angry, cry, wake]
+
+    index = ('index.json', content(9, 320), 0, 0)
+    wake = ('wake.wav', content(10, 2000), 0, 0)
+    hello = ('hello.wav', content(11, 1000), 0, 0)
+    v3 = [font, happy, neutral, sad, angry, cry, index, wake, hello]
+    v4 = v3 + [('bye.wav', content(12, 1000), 0, 0)]
+
+    for name, assets in (('v1', v1), ('v2', v2), ('v3', v3), ('v4', v4)):
+        with open(os.path.join(directory, name + '.bin'), 'wb') as f:
+            f.write(pack(assets))
+
+
+if __name__ == '__main__':
+    main()
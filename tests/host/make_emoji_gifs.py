@@ -0,0 +1,47 @@
+'''
+  Writes the emoji-like GIFs gif_bench decodes, no emoji GIFs ship in the tree.
+
+  A face whose eyes blink and mouth moves, on a transparent or an opaque background, so Pillow
+  stores most frames as small sub-rectangles like the exported emoji animations.
+
+  python make_emoji_gifs.py build/gifs
+'''
+import math
+import os
+import sys
+
+from PIL import Image, ImageDraw
+
+
+def face(path, size, frames, transparent):
+    images = []
+    for f in range(frames):
+        image = Image.new('RGBA', (size, size), (0, 0, 0, 0) if transparent else (30, 30, 60, 255))
+        draw = ImageDraw.Draw(image)
+        c = size / 2
+        r = size * 0.45
+        draw.ellipse([c - r, c - r, c + r, c + r], fill=(255, 200, 40, 255))
+        eye_height = size * 0.08 * (0.2 if f % 10 in (4, 5) else 1)
+        for x in (c - size * 0.16, c + size * 0.16):
+            draw.ellipse([x - size * 0.05, c - size * 0.12 - eye_height, x + size * 0.05, c - size * 0.12 + eye_height],
+                         fill=(60, 30, 10, 255))
+        mouth = size * (0.08 + 0.06 * math.sin(f / frames * 2 * math.pi))
+        draw.ellipse([c - size * 0.15, c + size * 0.12 - mouth / 2, c + size * 0.15, c + size * 0.12 + mouth / 2],
+                     fill=(150, 40, 40, 255))
+        images.append(image if transparent else image.convert('P', palette=Image.ADAPTIVE, colors=255))
+    # Transparent frames are restored to the background, opaque ones drawn over the previous frame
+    images[0].save(path, save_all=True, append_images=images[1:], duration=80, loop=0,
+                   disposal=2 if transparent else 1, optimize=True)
+
+
+def main():
+    directory = sys.argv[1] if len(sys.argv) > 1 else '.'
+    os.makedirs(directory, exist_ok=True)
+    face(os.path.join(directory, 'emoji_64.gif'), 64, 20, True)
+    face(os.path.join(directory, 'emoji_64_opaque.gif'), 64, 20, False)
+    face(os.path.join(directory, 'emoji_160.gif'), 160, 24, True)
+    face(os.path.join(directory, 'emoji_240_opaque.gif'), 240, 24, False)
+
+
+if __name__ == '__main__':
+    main()
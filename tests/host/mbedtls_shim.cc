@@ -0,0 +1,71 @@
+/*
+ * The mbedtls AES and SHA-256 calls used by the firmware, over OpenSSL. AES-CTR follows
+ * mbedtls_aes_crypt_ctr: the counter block is incremented as a 128 bit big endian number and the
+ * unused stream bytes carry over between calls through nc_off.
+ */
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <mbedtls/aes.h>
+#include <mbedtls/sha256.h>
+#include <openssl/aes.h>
+#include <openssl/sha.h>
+
+#include <cstring>
+
+static_assert(sizeof(AES_KEY) <= sizeof(mbedtls_aes_context::key), "mbedtls_aes_context too small");
+static_assert(sizeof(SHA256_CTX) <= sizeof(mbedtls_sha256_context::state), "mbedtls_sha256_context too small");
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_aes_free(mbedtls_aes_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits) {
+    return AES_set_encrypt_key(key, keybits, reinterpret_cast<AES_KEY*>(ctx->key)) == 0 ? 0 : -1;
+}
+
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off, unsigned char nonce_counter[16],
+    unsigned char stream_block[16], const unsigned char* input, unsigned char* output) {
+    auto key = reinterpret_cast<const AES_KEY*>(ctx->key);
+    size_t n = *nc_off;
+    if (n > 15) {
+        return -1;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (n == 0) {
+            AES_encrypt(nonce_counter, stream_block, key);
+            for (int j = 15; j >= 0; j--) {
+                if (++nonce_counter[j] != 0) {
+                    break;
+                }
+            }
+        }
+        output[i] = input[i] ^ stream_block[n];
+        n = (n + 1) & 0x0F;
+    }
+    *nc_off = n;
+    return 0;
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224) {
+    auto sha = reinterpret_cast<SHA256_CTX*>(ctx->state);
+    return (is224 ? SHA224_Init(sha) : SHA256_Init(sha)) == 1 ? 0 : -1;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t ilen) {
+    return SHA256_Update(reinterpret_cast<SHA256_CTX*>(ctx->state), input, ilen) == 1 ? 0 : -1;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char output[32]) {
+    return SHA256_Final(output, reinterpret_cast<SHA256_CTX*>(ctx->state)) == 1 ? 0 : -1;
+}
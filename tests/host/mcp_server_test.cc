@@ -0,0 +1,263 @@
+/*
+ * tools/call through McpServer::ParseMessage from several threads at once, over the inline, main
+ * loop and background executions, with the FreeRTOS tasks on std::threads and Application
+ * replaced by stubs/app.
+ *
+ * It checks that every call gets exactly one reply, that a background tool never runs twice at the
+ * same time and no more workers run than MCP_MAX_BACKGROUND_WORKERS, that progress notifications
+ * come before the result, that cancelled calls are not answered, and that a worker task which
+ * cannot be created fails its call without using up a worker slot.
+ */
+#include "bench_util.h"
+#include "mcp_server.h"
+#include "application.h"
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <unistd.h>
+
+#define THREADS 4
+#define CALLS_PER_THREAD 50
+#define REPLY_TIMEOUT_MS 5000
+
+struct Reply {
+    bool error;
+    std::string text;
+    // Position among all the messages sent, to check the order of progress and result
+    size_t order;
+};
+
+static std::map<int, Reply> g_replies;
+static std::map<std::string, size_t> g_progress;
+static size_t g_message_count;
+
+static std::atomic<int> g_slow_running{0};
+static std::atomic<int> g_slow_max{0};
+static std::atomic<int> g_tasks_max{0};
+
+static std::mutex g_gate_mutex;
+static std::condition_variable g_gate_cv;
+static bool g_gate_open = false;
+static bool g_gate_entered = false;
+
+static void UpdateMax(std::atomic<int>& max, int value) {
+    int current = max.load();
+    while (value > current && !max.compare_exchange_weak(current, value)) {
+    }
+}
+
+static void CollectMessages() {
+    auto& app = Application::GetInstance();
+    app.RunScheduled();
+    for (auto& message : app.TakeMcpMessages()) {
+        cJSON* json = cJSON_Parse(message.c_str());
+        CHECK(json != nullptr);
+        auto id = cJSON_GetObjectItem(json, "id");
+        auto method = cJSON_GetObjectItem(json, "method");
+        if (cJSON_IsNumber(id)) {
+            CHECK(g_replies.count(id->valueint) == 0);
+            Reply reply{false, "", g_message_count};
+            auto error = cJSON_GetObjectItem(json, "error");
+            if (error != nullptr) {
+                reply.error = true;
+                reply.text = cJSON_GetObjectItem(error, "message")->valuestring;
+            } else {
+                auto content = cJSON_GetObjectItem(cJSON_GetObjectItem(json, "result"), "content");
+                reply.text = cJSON_GetObjectItem(cJSON_GetArrayItem(content, 0), "text")->valuestring;
+            }
+            g_replies[id->valueint] = reply;
+        } else if (cJSON_IsString(method) && strcmp(method->valuestring, "notifications/progress") == 0) {
+            auto params = cJSON_GetObjectItem(json, "params");
+            auto token = cJSON_GetObjectItem(params, "progressToken");
+            CHECK(cJSON_IsString(token));
+            g_progress.emplace(token->valuestring, g_message_count);
+        }
+        g_message_count++;
+        cJSON_Delete(json);
+    }
+}
+
+// Runs the main loop until every id has a reply
+static void WaitForReplies(const std::vector<int>& ids) {
+    int64_t deadline = NowUs() + REPLY_TIMEOUT_MS * 1000;
+    while (true) {
+        CollectMessages();
+        bool done = std::all_of(ids.begin(), ids.end(), [](int id) { return g_replies.count(id) > 0; });
+        if (done) {
+            return;
+        }
+        if (NowUs() > deadline) {
+            for (int id : ids) {
+                if (g_replies.count(id) == 0) {
+                    fprintf(stderr, "No reply to call %d\n", id);
+                }
+            }
+            CHECK(false);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static void CallTool(int id, const std::string& tool, const std::string& arguments = "{}",
+    const std::string& progress_token = "") {
+    std::string message = "{\"jsonrpc\":\"2.0\",\"id\":" + std::to_string(id) +
+        ",\"method\":\"tools/call\",\"params\":{\"name\":\"" + tool + "\",\"arguments\":" + arguments;
+    if (!progress_token.empty()) {
+        message += ",\"_meta\":{\"progressToken\":\"" + progress_token + "\"}";
+    }
+    message += "}}";
+    McpServer::GetInstance().ParseMessage(message);
+}
+
+static void AddTestTools() {
+    auto& mcp = McpServer::GetInstance();
+    mcp.AddTool("test.slow", "Sleeps a millisecond on a worker", PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            UpdateMax(g_slow_max, ++g_slow_running);
+            UpdateMax(g_tasks_max, HostRunningTaskCount());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            g_slow_running--;
+            return std::string("slow");
+        }, kMcpToolExecutionBackground);
+    mcp.AddTool("test.other", "Another tool on a worker", PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            UpdateMax(g_tasks_max, HostRunningTaskCount());
+            return std::string("other");
+        }, kMcpToolExecutionBackground);
+    mcp.AddTool("test.gate", "Blocks its worker until the gate opens", PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            std::unique_lock<std::mutex> lock(g_gate_mutex);
+            g_gate_entered = true;
+            g_gate_cv.notify_all();
+            g_gate_cv.wait(lock, [] { return g_gate_open; });
+            return std::string("gate");
+        }, kMcpToolExecutionBackground);
+    mcp.AddTool("test.echo", "Answers inline", PropertyList({Property("text", kPropertyTypeString)}),
+        [](const PropertyList& properties) -> ReturnValue {
+            return properties["text"].value<std::string>();
+        }, kMcpToolExecutionInline);
+    mcp.AddTool("test.main", "Answers on the main loop", PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return 42;
+        });
+}
+
+// Must run first, while no worker exists
+static void TestWorkerCreateFailure() {
+    // Every worker slot fails once, then one more call
+    HostFailTaskCreate(MCP_MAX_BACKGROUND_WORKERS + 1);
+    std::vector<int> failed;
+    for (int i = 0; i <= MCP_MAX_BACKGROUND_WORKERS; i++) {
+        failed.push_back(100 + i);
+        CallTool(failed.back(), "test.slow");
+    }
+    WaitForReplies(failed);
+    for (int id : failed) {
+        CHECK(g_replies[id].error && g_replies[id].text == "Failed to start tool test.slow");
+    }
+
+    // The failures gave their slots back, so the next call gets a worker
+    HostFailTaskCreate(0);
+    CallTool(110, "test.slow");
+    WaitForReplies({110});
+    CHECK(!g_replies[110].error && g_replies[110].text == "slow");
+    printf("Worker task creation failure: ok\n");
+}
+
+static void TestConcurrentCalls() {
+    static const char* kTools[] = {"test.slow", "test.other", "test.echo", "test.main"};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([t] {
+            for (int i = 0; i < CALLS_PER_THREAD; i++) {
+                int id = 1000 + t * CALLS_PER_THREAD + i;
+                CallTool(id, kTools[(t + i) % 4], "{\"text\":\"" + std::to_string(id) + "\"}");
+                if (i % 8 == 7) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                }
+            }
+        });
+    }
+    std::vector<int> ids;
+    for (int i = 0; i < THREADS * CALLS_PER_THREAD; i++) {
+        ids.push_back(1000 + i);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    WaitForReplies(ids);
+
+    int answered = 0, rejected = 0;
+    for (int t = 0; t < THREADS; t++) {
+        for (int i = 0; i < CALLS_PER_THREAD; i++) {
+            int id = 1000 + t * CALLS_PER_THREAD + i;
+            auto& reply = g_replies[id];
+            std::string tool = kTools[(t + i) % 4];
+            if (reply.error) {
+                // Only the queued executions reject calls
+                CHECK(reply.text == "Too many tool calls" && tool != "test.echo");
+                rejected++;
+                continue;
+            }
+            answered++;
+            if (tool == "test.slow") {
+                CHECK(reply.text == "slow");
+            } else if (tool == "test.other") {
+                CHECK(reply.text == "other");
+            } else if (tool == "test.echo") {
+                CHECK(reply.text == std::to_string(id));
+            } else {
+                CHECK(reply.text == "42");
+            }
+        }
+    }
+    CHECK(g_slow_max.load() == 1);
+    CHECK(g_tasks_max.load() <= MCP_MAX_BACKGROUND_WORKERS);
+    printf("%d concurrent calls from %d threads: %d answered, %d rejected, one reply each: ok\n",
+        THREADS * CALLS_PER_THREAD, THREADS, answered, rejected);
+}
+
+static void TestProgress() {
+    CallTool(2000, "test.slow", "{}", "token-2000");
+    CallTool(2001, "test.other");
+    WaitForReplies({2000, 2001});
+    CHECK(!g_replies[2000].error);
+    CHECK(g_progress.count("token-2000") == 1 && g_progress["token-2000"] < g_replies[2000].order);
+    CHECK(g_progress.size() == 1);
+    printf("Progress before the result: ok\n");
+}
+
+static void TestCancel() {
+    CallTool(3000, "test.gate");
+    {
+        std::unique_lock<std::mutex> lock(g_gate_mutex);
+        CHECK(g_gate_cv.wait_for(lock, std::chrono::milliseconds(REPLY_TIMEOUT_MS), [] { return g_gate_entered; }));
+    }
+    // Waits for the running call of the same tool
+    CallTool(3001, "test.gate");
+    McpServer::GetInstance().CancelToolCalls();
+    {
+        std::lock_guard<std::mutex> lock(g_gate_mutex);
+        g_gate_open = true;
+    }
+    g_gate_cv.notify_all();
+
+    CallTool(3002, "test.other");
+    WaitForReplies({3002});
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CollectMessages();
+    CHECK(g_replies.count(3000) == 0 && g_replies.count(3001) == 0);
+    printf("Cancelled calls not answered: ok\n");
+}
+
+int main() {
+    AddTestTools();
+    TestWorkerCreateFailure();
+    TestConcurrentCalls();
+    TestProgress();
+    TestCancel();
+    // Idle workers wait MCP_WORKER_IDLE_SECONDS before they exit, skip the destructors under them
+    fflush(stdout);
+    _exit(0);
+}
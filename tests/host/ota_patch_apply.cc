@@ -0,0 +1,92 @@
+/*
+ * Applies a firmware delta patch with the OtaPatch of the firmware, checking it the way Ota does:
+ * the header is rejected unless the SHA-256 of the first source_size bytes of the source matches,
+ * and the rebuilt image must match the target SHA-256. Driven by scripts/ota_patch_test.py.
+ *
+ * Usage: ota_patch_apply source patch output [chunk_size]
+ *   The patch is fed in chunks of chunk_size bytes, or of random sizes up to 1500 if 0 (default).
+ *   Exits with 0 and writes output if the target was rebuilt, 1 otherwise, with the reason on stderr.
+ */
+#include "ota_patch.h"
+
+#include <mbedtls/sha256.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+static std::vector<uint8_t> Load(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+}
+
+static std::array<uint8_t, 32> Sha256(const uint8_t* data, size_t size) {
+    std::array<uint8_t, 32> digest;
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, 0);
+    mbedtls_sha256_update(&context, data, size);
+    mbedtls_sha256_finish(&context, digest.data());
+    mbedtls_sha256_free(&context);
+    return digest;
+}
+
+static int Reject(const char* reason) {
+    fprintf(stderr, "rejected: %s\n", reason);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s source patch output [chunk_size]\n", argv[0]);
+        return 2;
+    }
+    auto source = Load(argv[1]);
+    auto patch = Load(argv[2]);
+    size_t chunk_size = argc > 4 ? atoi(argv[4]) : 0;
+
+    std::vector<uint8_t> target;
+    OtaPatch ota_patch([&](size_t offset, uint8_t* data, size_t size) {
+        if (offset + size > source.size()) {
+            return false;
+        }
+        memcpy(data, source.data() + offset, size);
+        return true;
+    }, [&](const uint8_t* data, size_t size) {
+        target.insert(target.end(), data, data + size);
+        return true;
+    }, [&](const OtaPatchHeader& header) {
+        return header.source_size <= source.size() &&
+            Sha256(source.data(), header.source_size) == header.source_sha256;
+    });
+
+    if (!OtaPatch::IsPatch(patch.data(), patch.size())) {
+        return Reject("not a patch");
+    }
+    std::mt19937 rng(1234);
+    for (size_t pos = 0; pos < patch.size();) {
+        size_t n = std::min<size_t>(patch.size() - pos, chunk_size > 0 ? chunk_size : 1 + rng() % 1500);
+        if (!ota_patch.Feed(patch.data() + pos, n)) {
+            return Reject("malformed patch");
+        }
+        pos += n;
+    }
+    if (!ota_patch.IsFinished()) {
+        return Reject("patch ended early");
+    }
+    if (target.size() != ota_patch.header().target_size ||
+        Sha256(target.data(), target.size()) != ota_patch.header().target_sha256) {
+        return Reject("target SHA-256 mismatch");
+    }
+
+    FILE* output = fopen(argv[3], "wb");
+    if (output == nullptr || fwrite(target.data(), 1, target.size(), output) != target.size()) {
+        return Reject("failed to write the output");
+    }
+    fclose(output);
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * The stereo split and merge around the input resampler in ReadAudioData, with the former scalar
+ * loops against the pcm_utils kernels, for 60 ms frames at 24 kHz and 48 kHz.
+ *
+ * The kernels are first checked against the scalar loops, on word aligned buffers and on buffers
+ * offset by one sample, which take the scalar fallback.
+ */
+#include "bench_util.h"
+#include "pcm_utils.h"
+
+#define FRAME_DURATION_MS 60
+#define ITERATIONS 20000
+
+// ReadAudioData before pcm_utils: split into mic and reference, then merge them back
+static void ScalarSplitMerge(std::vector<int16_t>& data, std::vector<int16_t>& mic, std::vector<int16_t>& reference) {
+    mic.resize(data.size() / 2);
+    reference.resize(data.size() / 2);
+    for (size_t i = 0, j = 0; i < mic.size(); ++i, j += 2) {
+        mic[i] = data[j];
+        reference[i] = data[j + 1];
+    }
+    for (size_t i = 0, j = 0; i < mic.size(); ++i, j += 2) {
+        data[j] = mic[i];
+        data[j + 1] = reference[i];
+    }
+}
+
+static void KernelSplitMerge(std::vector<int16_t>& data, std::vector<int16_t>& channels) {
+    size_t frames = data.size() / 2;
+    channels.resize(frames * 2);
+    DeinterleaveStereo(data.data(), channels.data(), channels.data() + frames, frames);
+    InterleaveStereo(channels.data(), channels.data() + frames, data.data(), frames);
+}
+
+static void CheckKernels(const int16_t* input, size_t frames, size_t offset) {
+    std::vector<int16_t> left(frames + offset), right(frames + offset), mono(frames + offset), output(frames * 2 + offset);
+    DeinterleaveStereo(input, left.data() + offset, right.data() + offset, frames);
+    for (size_t i = 0; i < frames; i++) {
+        CHECK(left[offset + i] == input[2 * i] && right[offset + i] == input[2 * i + 1]);
+    }
+    InterleaveStereo(left.data() + offset, right.data() + offset, output.data() + offset, frames);
+    for (size_t i = 0; i < frames * 2; i++) {
+        CHECK(output[offset + i] == input[i]);
+    }
+    ExtractLeftChannel(input, mono.data() + offset, frames);
+    for (size_t i = 0; i < frames; i++) {
+        CHECK(mono[offset + i] == input[2 * i]);
+    }
+    std::vector<int16_t> in_place(input, input + frames * 2);
+    ExtractLeftChannel(in_place.data(), in_place.data(), frames);
+    for (size_t i = 0; i < frames; i++) {
+        CHECK(in_place[i] == input[2 * i]);
+    }
+}
+
+int main() {
+    srand(1);
+    for (int sample_rate : {24000, 48000}) {
+        // An odd frame count exercises the tail of the word-wide loops
+        size_t frames = sample_rate * FRAME_DURATION_MS / 1000 + 3;
+        std::vector<int16_t> input(frames * 2 + 1);
+        for (auto& sample : input) {
+            sample = static_cast<int16_t>(rand());
+        }
+        CheckKernels(input.data(), frames, 0);
+        CheckKernels(input.data() + 1, frames, 1);
+
+        std::vector<int16_t> data(input.begin(), input.begin() + frames * 2);
+        std::vector<int16_t> mic, reference, channels;
+        double scalar_ns = TimePerCallNs([&] { ScalarSplitMerge(data, mic, reference); }, ITERATIONS);
+        double kernel_ns = TimePerCallNs([&] { KernelSplitMerge(data, channels); }, ITERATIONS);
+        CHECK(std::equal(data.begin(), data.end(), input.begin()));
+        printf("%d Hz, %zu frames: scalar %.2f us, pcm_utils %.2f us per 60 ms frame\n", sample_rate, frames,
+            scalar_ns / 1000, kernel_ns / 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+// Host stand-in for the parts of Application that McpServer uses: the scheduled callbacks wait for
+// RunScheduled(), the MCP messages are kept for TakeMcpMessages()
+#pragma once
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Ota {
+};
+
+class AudioLatencyTracer {
+public:
+    std::string GetStatsJson() { return "{}"; }
+    void Reset() {}
+};
+
+class AudioService {
+public:
+    AudioLatencyTracer& GetLatencyTracer() { return latency_tracer_; }
+
+private:
+    AudioLatencyTracer latency_tracer_;
+};
+
+class Application {
+public:
+    static Application& GetInstance() {
+        static Application instance;
+        return instance;
+    }
+
+    void Schedule(std::function<void()> callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        main_tasks_.push_back(std::move(callback));
+    }
+
+    void SendMcpMessage(const std::string& payload) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        mcp_messages_.push_back(payload);
+    }
+
+    AudioService& GetAudioService() { return audio_service_; }
+    void Reboot() {}
+    bool UpgradeFirmware(Ota& ota, const std::string& url) { return false; }
+
+    // Runs the callbacks scheduled so far on the calling thread, returns how many ran
+    int RunScheduled() {
+        std::deque<std::function<void()>> tasks;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks.swap(main_tasks_);
+        }
+        for (auto& task : tasks) {
+            task();
+        }
+        return tasks.size();
+    }
+
+    std::vector<std::string> TakeMcpMessages() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::string> messages;
+        messages.swap(mcp_messages_);
+        return messages;
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<std::function<void()>> main_tasks_;
+    std::vector<std::string> mcp_messages_;
+    AudioService audio_service_;
+};
+
+class TaskPriorityReset {
+public:
+    TaskPriorityReset(BaseType_t priority) {}
+};
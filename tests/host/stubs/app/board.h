@@ -0,0 +1,53 @@
+// Host stand-in for the parts of Board that McpServer uses, a board without backlight or camera
+#pragma once
+#include <string>
+
+class AudioCodec {
+public:
+    void SetOutputVolume(int volume) { output_volume_ = volume; }
+    int output_volume() const { return output_volume_; }
+
+private:
+    int output_volume_ = 70;
+};
+
+class Backlight {
+public:
+    void SetBrightness(uint8_t brightness, bool permanent = false) {}
+};
+
+class Camera {
+public:
+    void SetExplainUrl(const std::string& url, const std::string& token) {}
+    bool Capture() { return false; }
+    std::string Explain(const std::string& question) { return "{}"; }
+};
+
+class Display;
+
+class Assets {
+public:
+    static Assets& GetInstance() {
+        static Assets instance;
+        return instance;
+    }
+    bool partition_valid() const { return false; }
+};
+
+class Board {
+public:
+    static Board& GetInstance() {
+        static Board instance;
+        return instance;
+    }
+
+    AudioCodec* GetAudioCodec() { return &audio_codec_; }
+    Backlight* GetBacklight() { return nullptr; }
+    Camera* GetCamera() { return nullptr; }
+    Display* GetDisplay() { return nullptr; }
+    std::string GetSystemInfoJson() { return "{}"; }
+    std::string GetDeviceStatusJson() { return "{}"; }
+
+private:
+    AudioCodec audio_codec_;
+};
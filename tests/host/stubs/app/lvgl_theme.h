@@ -0,0 +1,2 @@
+// Host build without LVGL, McpServer only uses the display classes under HAVE_LVGL
+#pragma once
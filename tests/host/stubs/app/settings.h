@@ -0,0 +1,10 @@
+// Host stand-in for Settings, nothing is stored
+#pragma once
+#include <string>
+
+class Settings {
+public:
+    Settings(const std::string& ns, bool read_write = false) {}
+    std::string GetString(const std::string& key, const std::string& default_value = "") { return default_value; }
+    void SetString(const std::string& key, const std::string& value) {}
+};
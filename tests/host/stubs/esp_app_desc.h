@@ -0,0 +1,12 @@
+// Host build of the application description
+#pragma once
+
+typedef struct {
+    char version[32];
+    char project_name[32];
+} esp_app_desc_t;
+
+inline const esp_app_desc_t* esp_app_get_description() {
+    static const esp_app_desc_t desc = {"host", "xiaozhi"};
+    return &desc;
+}
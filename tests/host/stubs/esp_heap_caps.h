@@ -0,0 +1,11 @@
+// Host build of the ESP-IDF capability allocator, every capability is plain malloc
+#pragma once
+#include <stdlib.h>
+
+#define MALLOC_CAP_DMA 0
+#define MALLOC_CAP_SPIRAM 0
+#define MALLOC_CAP_INTERNAL 0
+#define MALLOC_CAP_8BIT 0
+
+static inline void* heap_caps_malloc(size_t size, unsigned caps) { return malloc(size); }
+static inline void heap_caps_free(void* ptr) { free(ptr); }
@@ -0,0 +1,15 @@
+// Host build of the ESP-IDF logging macros for C and C++, errors and warnings go to stderr
+#pragma once
+#include <stdio.h>
+#include "sdkconfig.h"
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#ifdef HOST_LOG_VERBOSE
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) fprintf(stderr, "D %s: " format "\n", tag, ##__VA_ARGS__)
+#else
+#define ESP_LOGI(tag, format, ...) ((void)0)
+#define ESP_LOGD(tag, format, ...) ((void)0)
+#endif
+#define ESP_LOGV(tag, format, ...) ((void)0)
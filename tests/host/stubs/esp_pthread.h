@@ -0,0 +1,2 @@
+// Host build, the pthread configuration of ESP-IDF has no equivalent
+#pragma once
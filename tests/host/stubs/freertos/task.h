@@ -0,0 +1,18 @@
+// Host build of the FreeRTOS task calls, every task is a detached std::thread
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void*);
+typedef void* TaskHandle_t;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth, void* arg, UBaseType_t priority,
+    TaskHandle_t* handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority);
+
+// Host only: the next `count` xTaskCreate() calls fail as if the stack could not be allocated
+void HostFailTaskCreate(int count);
+// Host only: tasks created and not returned yet
+int HostRunningTaskCount();
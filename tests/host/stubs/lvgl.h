@@ -0,0 +1,25 @@
+// Host build of the parts of LVGL the GIF decoder uses, it only decodes from memory here
+#pragma once
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define LV_USE_DRAW_SW_ASM 0
+#define LV_DRAW_SW_ASM_HELIUM 2
+
+#define lv_malloc malloc
+#define lv_realloc realloc
+#define lv_free free
+
+typedef struct { int unused; } lv_fs_file_t;
+typedef int lv_fs_res_t;
+#define LV_FS_RES_OK 0
+#define LV_FS_MODE_RD 1
+#define LV_FS_SEEK_SET 0
+#define LV_FS_SEEK_CUR 1
+
+static inline lv_fs_res_t lv_fs_open(lv_fs_file_t* file, const char* path, int mode) { return 1; }
+static inline lv_fs_res_t lv_fs_read(lv_fs_file_t* file, void* buffer, uint32_t size, uint32_t* read) { return 1; }
+static inline lv_fs_res_t lv_fs_seek(lv_fs_file_t* file, uint32_t pos, int whence) { return 1; }
+static inline lv_fs_res_t lv_fs_tell(lv_fs_file_t* file, uint32_t* pos) { *pos = 0; return 1; }
+static inline lv_fs_res_t lv_fs_close(lv_fs_file_t* file) { return 1; }
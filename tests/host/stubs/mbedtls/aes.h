@@ -0,0 +1,14 @@
+// Host build of the mbedtls AES calls used by the firmware, implemented over OpenSSL in mbedtls_shim.cc
+#pragma once
+#include <cstddef>
+
+typedef struct {
+    // Holds an OpenSSL AES_KEY
+    alignas(16) unsigned char key[256];
+} mbedtls_aes_context;
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx);
+void mbedtls_aes_free(mbedtls_aes_context* ctx);
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits);
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off, unsigned char nonce_counter[16],
+    unsigned char stream_block[16], const unsigned char* input, unsigned char* output);
@@ -0,0 +1,5 @@
+// Host build of the mbedtls base64 call, declared only, the host targets do not encode images
+#pragma once
+#include <cstddef>
+
+int mbedtls_base64_encode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen);
@@ -0,0 +1,14 @@
+// Host build of the mbedtls SHA-256 calls used by the firmware, implemented over OpenSSL in mbedtls_shim.cc
+#pragma once
+#include <cstddef>
+
+typedef struct {
+    // Holds an OpenSSL SHA256_CTX
+    alignas(8) unsigned char state[128];
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context* ctx);
+int mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224);
+int mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t ilen);
+int mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char output[32]);
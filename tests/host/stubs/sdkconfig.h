@@ -0,0 +1,5 @@
+// The Kconfig defaults of the options used by the modules built for the host
+#pragma once
+
+#define CONFIG_OPUS_UPLINK_FRAME_DURATION_MS 60
+#define CONFIG_OPUS_UPLINK_BITRATE 16000